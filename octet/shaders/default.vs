@@ -4,8 +4,22 @@
 //
 
 // matrices
-uniform mat4 modelToProjection;
-uniform mat4 modelToCamera;
+#ifdef OCTET_INSTANCED
+  // one matrix per instance when visual_scene draws many instances at once (see param_shader)
+  attribute mat4 instance_modelToCamera;
+  uniform mat4 cameraToProjection;
+  #define modelToCamera instance_modelToCamera
+  #define modelToProjection (cameraToProjection * instance_modelToCamera)
+#else
+  uniform mat4 modelToProjection;
+  uniform mat4 modelToCamera;
+#endif
+
+// decode for quantised attributes (see mesh::quantize)
+uniform vec4 pos_scale;
+uniform vec4 pos_offset;
+uniform vec4 uv_decode;
+uniform vec4 normal_decode;
 
 // attributes from vertex buffer
 attribute vec4 pos;
@@ -20,14 +34,18 @@ varying vec4 color_;
 varying vec3 model_pos_;
 varying vec3 camera_pos_;
 
+// oct_decode() for octahedral normals is added by shader::init()
+
 void main() {
-  gl_Position = modelToProjection * pos;
-  vec3 tnormal = (modelToCamera * vec4(normal, 0.0)).xyz;
-  vec3 tpos = (modelToCamera * pos).xyz;
+  vec4 mpos = vec4(pos.xyz * pos_scale.xyz + pos_offset.xyz, pos.w);
+  vec3 mnormal = normal_decode.x != 0.0 ? oct_decode(normal.xy) : normal;
+  gl_Position = modelToProjection * mpos;
+  vec3 tnormal = (modelToCamera * vec4(mnormal, 0.0)).xyz;
+  vec3 tpos = (modelToCamera * mpos).xyz;
   normal_ = tnormal;
-  uv_ = uv;
+  uv_ = uv * uv_decode.xy + uv_decode.zw;
   color_ = color;
   camera_pos_ = tpos;
-  model_pos_ = pos.xyz;
+  model_pos_ = mpos.xyz;
 }
 
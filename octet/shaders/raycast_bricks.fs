@@ -0,0 +1,46 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// ray marching a volume with empty space skipping
+//
+// occupancy is bricked_volume::make_occupancy_texture: one texel per brick,
+// zero where the brick has voxels in range, otherwise the number of bricks that can be skipped.
+//
+
+// inputs
+varying vec3 model_pos_;
+
+uniform vec3 camera_pos;
+uniform vec3 half_extent;    // the volume fills the box [-half_extent, half_extent]
+uniform vec3 num_bricks;     // bricks along each axis
+uniform sampler3D volume;
+uniform sampler3D occupancy;
+
+const int max_steps = 512;
+
+void main() {
+  vec3 ray_direction = normalize(model_pos_ - camera_pos);
+
+  // march in texture coordinates
+  vec3 pos = model_pos_ / (half_extent * 2.0) + 0.5;
+  vec3 dir = ray_direction / (half_extent * 2.0);
+  float voxel_step = 1.0 / (num_bricks.x * 32.0); // bricked_volume::default_brick_size
+  float brick_step = 1.0 / max(num_bricks.x, max(num_bricks.y, num_bricks.z));
+
+  vec4 colour = vec4(0, 0, 0, 0);
+  for (int i = 0; i != max_steps; ++i) {
+    if (any(lessThan(pos, vec3(0, 0, 0))) || any(greaterThan(pos, vec3(1, 1, 1))) || colour.a > 0.95) break;
+
+    float skip = texture3D(occupancy, pos).r * 255.0;
+    if (skip > 0.0) {
+      // jump over empty bricks, leaving one brick of margin.
+      pos += dir * (max(skip - 1.0, 0.0) * brick_step / length(dir) + voxel_step);
+    } else {
+      float density = texture3D(volume, pos).r;
+      colour.rgb += (1.0 - colour.a) * density * vec3(1, 0.9, 0.8);
+      colour.a += (1.0 - colour.a) * density;
+      pos += dir * (voxel_step / length(dir));
+    }
+  }
+
+  gl_FragColor = vec4(colour.rgb + vec3(0.3, 0.3, 0.3) * (1.0 - colour.a), 1);
+}
@@ -0,0 +1,25 @@
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// distance field text shader (see texture_atlas::set_distance_field)
+//
+// The alpha channel is the distance to the edge of the glyph, with the edge at 0.5.
+// fwidth keeps the edge about a pixel wide at any text size.
+//
+
+// fwidth is an extension in OpenGL ES 2
+#ifdef GL_ES
+  #extension GL_OES_standard_derivatives : enable
+#endif
+
+// inputs
+varying vec2 uv_;
+varying vec4 color_;
+uniform sampler2D diffuse_sampler;
+
+void main() {
+  float dist = texture2D(diffuse_sampler, uv_).w;
+  float edge = max(fwidth(dist) * 0.7, 0.001);
+  gl_FragColor = vec4(color_.xyz, smoothstep(0.5 - edge, 0.5 + edge, dist));
+  if (gl_FragColor.w < 0.05) discard;
+}
@@ -30,11 +30,16 @@
   #include "../compiler/cpp_tokens.h"
   #include "../compiler/cpp_lexer.h"
   #include "../compiler/cpp_preprocessor.h"
+  #include "../compiler/cpp_arena.h"
+  #include "../compiler/cpp_symbols.h"
   #include "../compiler/cpp_value.h"
   #include "../compiler/cpp_expr.h"
   #include "../compiler/cpp_type.h"
   #include "../compiler/cpp_statement.h"
   #include "../compiler/cpp_scope.h"
   #include "../compiler/cpp_parser.h"
+  #include "../compiler/cpp_vm.h"
+  #include "../compiler/cpp_optimizer.h"
+  #include "../compiler/cpp_glsl_writer.h"
 
 #endif
@@ -0,0 +1,155 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Block allocator for syntax trees.
+//
+
+namespace octet
+{
+  namespace compiler
+  {
+    /// Allocate syntax tree nodes from large blocks and free them all at once.
+    ///
+    /// Objects allocated here never have their destructors called, so they
+    /// must not own heap memory (no strings, dynarrays or dictionaries).
+    ///
+    /// reset() keeps the blocks, so parsing the same size of source again
+    /// does not touch the heap.
+    ///
+    /// Example
+    ///
+    ///     cpp_arena arena;
+    ///     cpp_expr *expr = new (arena) cpp_expr(cpp_expr::kind_nop, voidType);
+    ///     arena.reset();  // expr is gone
+    ///
+    /// get_mark() and reset(mark) free only what came after the mark,
+    /// so long lived objects such as builtin types can sit at the bottom.
+    class cpp_arena
+    {
+      struct block {
+        block *next;
+        size_t size;
+      };
+
+      enum {
+        alignment = 8,
+        header_size = (sizeof(block) + alignment - 1) & ~(alignment - 1),
+      };
+
+      block *first_;
+      block *cur_;
+      uint8_t *ptr_;
+      uint8_t *end_;
+      size_t block_size_;
+      size_t bytes_used_;
+
+      // move on to the next block that will hold "size" bytes, or make a new one.
+      void next_block(size_t size) {
+        block *prev = cur_;
+        block *blk = cur_ ? cur_->next : first_;
+        while (blk && blk->size < size) {
+          prev = blk;
+          blk = blk->next;
+        }
+        if (!blk) {
+          size_t block_size = size > block_size_ ? size : block_size_;
+          blk = (block*)allocator::malloc(header_size + block_size);
+          blk->next = 0;
+          blk->size = block_size;
+          if (prev) prev->next = blk; else first_ = blk;
+        }
+        cur_ = blk;
+        ptr_ = (uint8_t*)blk + header_size;
+        end_ = ptr_ + blk->size;
+      }
+
+      // not copyable
+      cpp_arena(const cpp_arena &);
+      cpp_arena &operator=(const cpp_arena &);
+    public:
+      /// A position in the arena, see get_mark().
+      struct mark {
+        block *blk;
+        uint8_t *ptr;
+        size_t bytes_used;
+      };
+
+      cpp_arena(size_t block_size = 0x10000) {
+        first_ = cur_ = 0;
+        ptr_ = end_ = 0;
+        block_size_ = block_size;
+        bytes_used_ = 0;
+      }
+
+      ~cpp_arena() {
+        for (block *blk = first_; blk; ) {
+          block *next = blk->next;
+          allocator::free(blk, header_size + blk->size);
+          blk = next;
+        }
+      }
+
+      /// Get "size" bytes, aligned to eight bytes.
+      void *allocate(size_t size) {
+        size = (size + alignment - 1) & ~(size_t)(alignment - 1);
+        if ((size_t)(end_ - ptr_) < size) {
+          next_block(size);
+        }
+        void *result = ptr_;
+        ptr_ += size;
+        bytes_used_ += size;
+        return result;
+      }
+
+      /// Get an uninitialised array of n items.
+      template <class item_t> item_t *allocate_array(size_t n) {
+        return (item_t*)allocate(n * sizeof(item_t));
+      }
+
+      /// Free everything allocated since the last reset, keeping the blocks for reuse.
+      void reset() {
+        cur_ = 0;
+        ptr_ = end_ = 0;
+        bytes_used_ = 0;
+      }
+
+      /// Remember the current position.
+      mark get_mark() const {
+        mark result = { cur_, ptr_, bytes_used_ };
+        return result;
+      }
+
+      /// Free everything allocated since get_mark() returned "m".
+      void reset(const mark &m) {
+        cur_ = m.blk;
+        ptr_ = m.ptr;
+        end_ = m.blk ? (uint8_t*)m.blk + header_size + m.blk->size : 0;
+        bytes_used_ = m.bytes_used;
+      }
+
+      /// Bytes allocated since the last reset.
+      size_t get_bytes_used() const {
+        return bytes_used_;
+      }
+
+      /// Number of blocks taken from the heap.
+      unsigned get_num_blocks() const {
+        unsigned result = 0;
+        for (block *blk = first_; blk; blk = blk->next) ++result;
+        return result;
+      }
+    };
+  }
+}
+
+/// placement new for syntax tree nodes, eg. new (arena) cpp_expr(...)
+inline void *operator new(size_t size, octet::compiler::cpp_arena &arena) {
+  return arena.allocate(size);
+}
+
+/// called only if a constructor throws.
+inline void operator delete(void *ptr, octet::compiler::cpp_arena &arena) {
+}
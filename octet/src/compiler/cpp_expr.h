@@ -203,6 +203,11 @@ namespace octet
         return kid[ n ];
       }
 
+      void setKid( size_t n, cpp_expr *expr )
+      {
+        kid[ n ] = expr;
+      }
+
       kind_enum getKind()
       {
         return kind;
@@ -237,6 +242,29 @@ namespace octet
       {
         return swiz;
       }
+
+      // calls and constructors keep their arguments as ( ( a, b ), c )
+      // in kid( 1 ) (calls) or kid( 0 ) (constructors).
+      unsigned getNumArgs()
+      {
+        return (unsigned)int_value;
+      }
+      void setNumArgs( unsigned numArgs )
+      {
+        int_value = numArgs;
+      }
+      cpp_expr *getArg( unsigned i )
+      {
+        return getArg( kind == kind_call ? kid[ 1 ] : kid[ 0 ], getNumArgs(), i );
+      }
+      static cpp_expr *getArg( cpp_expr *args, unsigned numArgs, unsigned i )
+      {
+        for( unsigned j = numArgs - 1; j > i; --j )
+        {
+          args = args->kid[ 0 ];
+        }
+        return i == 0 ? args : args->kid[ 1 ];
+      }
     
       #if 0
       // generate an llvm pointer to this cg expression
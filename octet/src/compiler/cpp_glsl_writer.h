@@ -0,0 +1,735 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// GLSL back end: writes a syntax tree out as shader source.
+//
+
+namespace octet
+{
+  namespace compiler
+  {
+    /// Write a parsed, and usually optimised, translation unit back out as GLSL.
+    ///
+    /// Only the entry point, the functions it calls and the globals they use are
+    /// written, so uniforms that cpp_optimizer has specialised away disappear.
+    /// Constants are written with the type GLSL ES expects, eg. 2.0 and not 2 for a float.
+    ///
+    /// Example
+    ///
+    ///     cpp_glsl_writer writer(parser);
+    ///     string fs;
+    ///     if (writer.write(fs)) shader.init(vs, fs);
+    class cpp_glsl_writer {
+      enum {
+        prec_comma = 1, prec_assign, prec_question, prec_or_or, prec_xor_xor, prec_and_and,
+        prec_or, prec_xor, prec_and, prec_equality, prec_relational, prec_shift,
+        prec_additive, prec_multiplicative, prec_unary, prec_postfix,
+      };
+
+      cpp_parser &parser;
+      // structures are written to their own text as they are found.
+      dynarray<char> text;
+      dynarray<char> structs;
+      dynarray<char> *dest;
+      unsigned indent;
+
+      // globals and functions, and which of them the entry point uses.
+      hash_map<cpp_value *, unsigned> globals;
+      hash_map<cpp_value *, unsigned> used;
+      dynarray<cpp_value *> functions;
+      hash_map<cpp_scope *, unsigned> written_structs;
+
+      void out(const char *fmt, ...) {
+        char buf[256];
+        va_list list;
+        va_start(list, fmt);
+        int bytes = vsnprintf(buf, sizeof(buf), fmt, list);
+        va_end(list);
+        if (bytes < 0) return;
+        if (bytes >= (int)sizeof(buf)) bytes = sizeof(buf) - 1;
+        unsigned size = dest->size();
+        dest->resize(size + bytes);
+        memcpy(dest->data() + size, buf, bytes);
+      }
+
+      void start_line() {
+        for (unsigned i = 0; i != indent; ++i) out("  ");
+      }
+
+      static bool is_constant(cpp_expr *expr) {
+        return expr->getKind() == cpp_expr::kind_int_value || expr->getKind() == cpp_expr::kind_double_value;
+      }
+
+      static double get_double(cpp_expr *expr) {
+        return expr->getKind() == cpp_expr::kind_int_value ? (double)(long long)expr->getIntValue() : expr->getDoubleValue();
+      }
+
+      // 0 or -1 as made by the parser for unary minus and ~, maybe cast to a vector.
+      static bool is_constant(cpp_expr *expr, double value) {
+        while (expr->getKind() == cpp_expr::kind_cast) expr = expr->getKid(0);
+        return is_constant(expr) && get_double(expr) == value;
+      }
+
+      static bool is_scalar(cpp_type *type) {
+        return type->getIsScalar() && type->getKind() != cpp_type::kind_void;
+      }
+
+      static const char *scalar_name(cpp_type::kind_enum kind) {
+        switch (kind) {
+          case cpp_type::kind_float: case cpp_type::kind_half: case cpp_type::kind_cfloat: return "float";
+          case cpp_type::kind_int: case cpp_type::kind_cint: return "int";
+          case cpp_type::kind_bool: return "bool";
+          default: return "void";
+        }
+      }
+
+      // name of a type that is not an array, eg. vec3 or mat4.
+      const char *type_name(cpp_type *type, char *buf) {
+        if (type->getIsMatrix()) {
+          unsigned cols = type->getDimension(), rows = type->getSubType()->getDimension();
+          sprintf(buf, cols == rows ? "mat%d" : "mat%dx%d", cols, rows);
+        } else if (type->getIsVector()) {
+          cpp_type::kind_enum kind = type->getSubType()->getKind();
+          if (type->getDimension() == 1) return scalar_name(kind);
+          const char *prefix = kind == cpp_type::kind_int || kind == cpp_type::kind_cint ? "i" : kind == cpp_type::kind_bool ? "b" : "";
+          sprintf(buf, "%svec%d", prefix, type->getDimension());
+        } else {
+          switch (type->getKind()) {
+            case cpp_type::kind_struct: {
+              const char *name = parser.getStructName(type);
+              // anonymous structures are called __anonN, but __ is reserved in GLSL.
+              return !name ? "anon" : name[0] == '_' && name[1] == '_' ? name + 2 : name;
+            }
+            case cpp_type::kind_sampler: case cpp_type::kind_sampler2D: return "sampler2D";
+            case cpp_type::kind_sampler1D: return "sampler1D";
+            case cpp_type::kind_sampler3D: return "sampler3D";
+            case cpp_type::kind_samplerRECT: return "sampler2DRect";
+            case cpp_type::kind_samplerCUBE: return "samplerCube";
+            default: return scalar_name(type->getKind());
+          }
+        }
+        return buf;
+      }
+
+      static bool is_array(cpp_type *type) {
+        return type->getKind() == cpp_type::kind_array && !type->getIsVector() && !type->getIsMatrix();
+      }
+
+      // qualifiers such as uniform are on the elements of an array.
+      static cpp_type *get_element(cpp_type *type) {
+        while (is_array(type)) type = type->getSubType();
+        return type;
+      }
+
+      void write_type(cpp_type *type) {
+        type = get_element(type);
+        if (type->getKind() == cpp_type::kind_struct) need_struct(type);
+        char buf[16];
+        out("%s", type_name(type, buf));
+      }
+
+      // eg. vec4 light_uniforms[17]
+      void write_declaration(cpp_type *type, const char *name) {
+        write_type(type);
+        out(" %s", name);
+        for (; is_array(type); type = type->getSubType()) {
+          if (type->getDimension()) out("[%d]", type->getDimension()); else out("[]");
+        }
+      }
+
+      void write_members(cpp_scope *scope) {
+        indent++;
+        for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+          start_line();
+          write_declaration((*i)->getType(), (*i)->getName());
+          out(";\n");
+        }
+        indent--;
+      }
+
+      // write a structure definition, and the ones it uses, before the code.
+      void need_struct(cpp_type *type) {
+        cpp_scope *scope = type->getScope();
+        if (!scope || written_structs.contains(scope)) return;
+        written_structs[scope] = 1;
+        for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+          cpp_type *member = get_element((*i)->getType());
+          if (member->getKind() == cpp_type::kind_struct) need_struct(member);
+        }
+        dynarray<char> *saved = dest;
+        unsigned saved_indent = indent;
+        dest = &structs;
+        indent = 0;
+        char buf[16];
+        out("struct %s {\n", type_name(type, buf));
+        write_members(scope);
+        out("};\n\n");
+        dest = saved;
+        indent = saved_indent;
+      }
+
+      void write_float(double value, int min_prec) {
+        // the shortest text that reads back as the same float.
+        char buf[32];
+        for (int digits = 6; digits <= 9; ++digits) {
+          snprintf(buf, sizeof(buf), "%.*g", digits, value);
+          if ((float)strtod(buf, NULL) == (float)value) break;
+        }
+        if (!strpbrk(buf, ".eni")) strcat(buf, ".0");
+        out(value < 0 && min_prec > prec_unary ? "(%s)" : "%s", buf);
+      }
+
+      void write_constant(cpp_type *type, cpp_expr *value, int min_prec) {
+        if (type->getIsFloat()) {
+          write_float(get_double(value), min_prec);
+        } else if (type->getKind() == cpp_type::kind_bool) {
+          out(get_double(value) != 0 ? "true" : "false");
+        } else {
+          long long i = value->getKind() == cpp_expr::kind_int_value ? (long long)value->getIntValue() : (long long)value->getDoubleValue();
+          out(i < 0 && min_prec > prec_unary ? "(%lld)" : "%lld", i);
+        }
+      }
+
+      void write_cast(cpp_expr *expr, int min_prec) {
+        cpp_expr *src = expr->getKid(0);
+        cpp_type *type = expr->getType();
+        char buf0[16], buf1[16];
+        if (is_constant(src) && is_scalar(type)) {
+          write_constant(type, src, min_prec);
+        } else if (!strcmp(type_name(type, buf0), type_name(src->getType(), buf1)) || !(is_scalar(type) || type->getIsVector() || type->getIsMatrix())) {
+          write_expr(src, min_prec);
+        } else {
+          write_type(type);
+          out("(");
+          write_expr(src, prec_assign);
+          out(")");
+        }
+      }
+
+      // GLSL ES does not convert max(x, 0) to max(x, 0.0) so write constants with the parameter type.
+      void write_args(cpp_expr *expr) {
+        cpp_type *type = expr->getType();
+        cpp_scope::iterator param = NULL, end = NULL;
+        if (expr->getKind() == cpp_expr::kind_call) {
+          cpp_type *function_type = expr->getKid(0)->getValue()->getType();
+          param = function_type->getScope()->begin();
+          end = function_type->getScope()->end();
+          if (function_type->getIsReturnByValue()) ++param;
+        } else if (type->getIsMatrix()) {
+          type = type->getSubType()->getSubType();
+        } else if (type->getIsVector()) {
+          type = type->getSubType();
+        }
+
+        out("(");
+        for (unsigned i = 0; i != expr->getNumArgs(); ++i) {
+          cpp_expr *arg = expr->getArg(i);
+          cpp_type *arg_type = type;
+          if (expr->getKind() == cpp_expr::kind_call) {
+            arg_type = param != end ? (*param++)->getType() : arg->getType();
+          }
+          if (i) out(", ");
+          if (is_constant(arg) && is_scalar(arg_type)) {
+            write_constant(arg_type, arg, prec_assign);
+          } else {
+            write_expr(arg, prec_assign);
+          }
+        }
+        out(")");
+      }
+
+      static int get_prec(cpp_expr::kind_enum kind) {
+        switch (kind) {
+          case cpp_expr::kind_or_or: return prec_or_or;
+          case cpp_expr::kind_and_and: return prec_and_and;
+          case cpp_expr::kind_or: return prec_or;
+          case cpp_expr::kind_xor: return prec_xor;
+          case cpp_expr::kind_and: return prec_and;
+          case cpp_expr::kind_eq: case cpp_expr::kind_ne: return prec_equality;
+          case cpp_expr::kind_lt: case cpp_expr::kind_gt: case cpp_expr::kind_le: case cpp_expr::kind_ge: return prec_relational;
+          case cpp_expr::kind_shift_left: case cpp_expr::kind_shift_right: return prec_shift;
+          case cpp_expr::kind_plus: case cpp_expr::kind_minus: return prec_additive;
+          case cpp_expr::kind_star: case cpp_expr::kind_divide: case cpp_expr::kind_mod: return prec_multiplicative;
+          default: return 0;
+        }
+      }
+
+      static const char *get_op(cpp_expr::kind_enum kind) {
+        switch (kind) {
+          case cpp_expr::kind_or_or: return "||";
+          case cpp_expr::kind_and_and: return "&&";
+          case cpp_expr::kind_or: return "|";
+          case cpp_expr::kind_xor: return "^";
+          case cpp_expr::kind_and: return "&";
+          case cpp_expr::kind_eq: return "==";
+          case cpp_expr::kind_ne: return "!=";
+          case cpp_expr::kind_lt: return "<";
+          case cpp_expr::kind_gt: return ">";
+          case cpp_expr::kind_le: return "<=";
+          case cpp_expr::kind_ge: return ">=";
+          case cpp_expr::kind_shift_left: return "<<";
+          case cpp_expr::kind_shift_right: return ">>";
+          case cpp_expr::kind_plus: return "+";
+          case cpp_expr::kind_minus: return "-";
+          case cpp_expr::kind_star: return "*";
+          case cpp_expr::kind_divide: return "/";
+          case cpp_expr::kind_mod: return "%";
+          default: return "?";
+        }
+      }
+
+      void write_binary(cpp_expr *expr, int min_prec) {
+        cpp_expr::kind_enum kind = expr->getKind();
+        cpp_expr *lhs = expr->getKid(0);
+        cpp_expr *rhs = expr->getKid(1);
+        const char *op = get_op(kind);
+        int prec = get_prec(kind);
+
+        // the parser makes -x, !x and ~x from 0 - x, 1 ^ x and -1 ^ x.
+        const char *unary = NULL;
+        if (kind == cpp_expr::kind_minus && is_constant(lhs, 0)) {
+          unary = "-";
+        } else if (kind == cpp_expr::kind_plus && is_constant(lhs, 0)) {
+          unary = "";
+        } else if (kind == cpp_expr::kind_xor && expr->getType()->getKind() == cpp_type::kind_bool) {
+          if (is_constant(lhs, 1)) unary = "!"; else op = "^^", prec = prec_xor_xor;
+        } else if (kind == cpp_expr::kind_xor && is_constant(lhs, -1)) {
+          unary = "~";
+        }
+
+        if (unary) {
+          if (min_prec > prec_unary) out("(");
+          out("%s", unary);
+          write_expr(rhs, prec_unary);
+          if (min_prec > prec_unary) out(")");
+        } else {
+          if (min_prec > prec) out("(");
+          write_expr(lhs, prec);
+          out(" %s ", op);
+          write_expr(rhs, prec + 1);
+          if (min_prec > prec) out(")");
+        }
+      }
+
+      // the parser makes x++ from ( ( $tmp = x, x = x + 1 ), $tmp ).
+      static cpp_expr *get_postfix(cpp_expr *expr) {
+        if (expr->getKid(1)->getKind() != cpp_expr::kind_value || expr->getKid(0)->getKind() != cpp_expr::kind_comma) return NULL;
+        cpp_expr *save = expr->getKid(0)->getKid(0);
+        cpp_expr *inc = expr->getKid(0)->getKid(1);
+        if (
+          save->getKind() != cpp_expr::kind_equals || save->getKid(0)->getKind() != cpp_expr::kind_value ||
+          save->getKid(0)->getValue() != expr->getKid(1)->getValue() || inc->getKind() != cpp_expr::kind_equals
+        ) {
+          return NULL;
+        }
+        return inc;
+      }
+
+      void write_assign(cpp_expr *expr, int min_prec) {
+        cpp_expr *lhs = expr->getKid(0);
+        cpp_expr *rhs = expr->getKid(1);
+        if (min_prec > prec_assign) out("(");
+        write_expr(lhs, prec_unary);
+        // a += b was made as a = a + b with the same a.
+        int prec = get_prec(rhs->getKind());
+        if (prec >= prec_or && rhs->getKid(0) == lhs && get_op(rhs->getKind())[1] == 0) {
+          out(" %s= ", get_op(rhs->getKind()));
+          rhs = rhs->getKid(1);
+        } else {
+          out(" = ");
+        }
+        write_expr(rhs, prec_assign);
+        if (min_prec > prec_assign) out(")");
+      }
+
+      void write_expr(cpp_expr *expr, int min_prec) {
+        switch (expr->getKind()) {
+          case cpp_expr::kind_nop: break;
+          case cpp_expr::kind_value: out("%s", expr->getValue()->getName()); break;
+          case cpp_expr::kind_int_value:
+          case cpp_expr::kind_double_value: write_constant(expr->getType(), expr, min_prec); break;
+          case cpp_expr::kind_cast: write_cast(expr, min_prec); break;
+          case cpp_expr::kind_init: {
+            write_type(expr->getType());
+            write_args(expr);
+          } break;
+          case cpp_expr::kind_call: {
+            out("%s", expr->getKid(0)->getValue()->getName());
+            write_args(expr);
+          } break;
+          case cpp_expr::kind_index: {
+            write_expr(expr->getKid(0), prec_postfix);
+            out("[");
+            write_expr(expr->getKid(1), 0);
+            out("]");
+          } break;
+          case cpp_expr::kind_dot: {
+            write_expr(expr->getKid(0), prec_postfix);
+            out(".%s", expr->getValue()->getName());
+          } break;
+          case cpp_expr::kind_swiz: {
+            write_expr(expr->getKid(0), prec_postfix);
+            out(".");
+            cpp_type *type = expr->getType();
+            unsigned n = type->getIsVector() ? type->getDimension() : 1;
+            for (unsigned i = 0; i != n; ++i) out("%c", "xyzw"[expr->getSwiz()[i] & 3]);
+          } break;
+          case cpp_expr::kind_question: {
+            if (min_prec > prec_question) out("(");
+            write_expr(expr->getKid(0), prec_question + 1);
+            out(" ? ");
+            write_expr(expr->getKid(1), prec_assign);
+            out(" : ");
+            write_expr(expr->getKid(2), prec_question);
+            if (min_prec > prec_question) out(")");
+          } break;
+          case cpp_expr::kind_comma: {
+            if (cpp_expr *inc = get_postfix(expr)) {
+              write_expr(inc->getKid(0), prec_postfix);
+              out(inc->getKid(1)->getKind() == cpp_expr::kind_minus ? "--" : "++");
+            } else {
+              if (min_prec > prec_comma) out("(");
+              write_expr(expr->getKid(0), prec_comma);
+              out(", ");
+              write_expr(expr->getKid(1), prec_comma + 1);
+              if (min_prec > prec_comma) out(")");
+            }
+          } break;
+          case cpp_expr::kind_equals: write_assign(expr, min_prec); break;
+          default: write_binary(expr, min_prec); break;
+        }
+      }
+
+      // variables declared without a value go at the top of their block,
+      // the others where they are initialised.
+      void write_locals(cpp_scope *scope, bool all) {
+        if (!scope) return;
+        for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+          if (all || !(*i)->getInit()) {
+            start_line();
+            write_declaration((*i)->getType(), (*i)->getName());
+            out(";\n");
+          }
+        }
+      }
+
+      // int a = 1, b = 2; is ( a = 1, b = 2 )
+      void write_initialisers(cpp_expr *expr) {
+        if (expr->getKind() == cpp_expr::kind_comma && !get_postfix(expr)) {
+          write_initialisers(expr->getKid(0));
+          write_initialisers(expr->getKid(1));
+        } else if (expr->getKind() == cpp_expr::kind_equals && expr->getKid(0)->getKind() == cpp_expr::kind_value && expr->getKid(0)->getValue()->getInit()) {
+          cpp_value *value = expr->getKid(0)->getValue();
+          start_line();
+          if (get_element(value->getType())->getIsConst()) out("const ");
+          write_declaration(value->getType(), value->getName());
+          out(" = ");
+          write_expr(expr->getKid(1), prec_assign);
+          out(";\n");
+        } else if (expr->getKind() != cpp_expr::kind_nop) {
+          start_line();
+          write_expr(expr, 0);
+          out(";\n");
+        }
+      }
+
+      // { ... } without a newline at the end.
+      void write_block(cpp_statement *s) {
+        out("{\n");
+        indent++;
+        if (s->getKind() == cpp_statement::kind_compound) {
+          write_locals(s->getScope(), false);
+          for (cpp_statement *child = s->getStatements(); child; child = child->getNext()) {
+            write_statement(child);
+          }
+        } else {
+          write_statement(s);
+        }
+        indent--;
+        start_line();
+        out("}");
+      }
+
+      void write_for(cpp_statement *s) {
+        cpp_expr *init = s->getExpression()->getKid(0);
+        cpp_expr *cond = s->getExpression()->getKid(1);
+        cpp_expr *step = s->getExpression()->getKid(2);
+
+        // GLSL ES wants for( int i = 0; ... ) so declare a single loop variable in place.
+        cpp_scope *scope = s->getScope();
+        bool in_place =
+          scope && scope->size() == 1 && init && init->getKind() == cpp_expr::kind_equals &&
+          init->getKid(0)->getKind() == cpp_expr::kind_value && init->getKid(0)->getValue() == *scope->begin()
+        ;
+        bool wrap = scope && scope->size() && !in_place;
+        if (wrap) {
+          start_line();
+          out("{\n");
+          indent++;
+          write_locals(scope, true);
+        }
+        start_line();
+        out("for (");
+        if (in_place) {
+          write_declaration(init->getKid(0)->getType(), init->getKid(0)->getValue()->getName());
+          out(" = ");
+          write_expr(init->getKid(1), prec_assign);
+        } else if (init) {
+          write_expr(init, 0);
+        }
+        out("; ");
+        if (cond) write_expr(cond, 0);
+        out("; ");
+        if (step) write_expr(step, 0);
+        out(") ");
+        write_block(s->getStatements());
+        out("\n");
+        if (wrap) {
+          indent--;
+          start_line();
+          out("}\n");
+        }
+      }
+
+      void write_statement(cpp_statement *s) {
+        switch (s->getKind()) {
+          case cpp_statement::kind_compound: {
+            start_line();
+            write_block(s);
+            out("\n");
+          } break;
+          case cpp_statement::kind_expression: {
+            if (s->getExpression()) {
+              start_line();
+              write_expr(s->getExpression(), 0);
+              out(";\n");
+            }
+          } break;
+          case cpp_statement::kind_declaration: write_initialisers(s->getExpression()); break;
+          case cpp_statement::kind_return: {
+            start_line();
+            out("return");
+            if (s->getExpression()) {
+              out(" ");
+              write_expr(s->getExpression(), 0);
+            }
+            out(";\n");
+          } break;
+          case cpp_statement::kind_discard: start_line(); out("discard;\n"); break;
+          case cpp_statement::kind_break: start_line(); out("break;\n"); break;
+          case cpp_statement::kind_continue: start_line(); out("continue;\n"); break;
+          case cpp_statement::kind_if: {
+            start_line();
+            out("if (");
+            write_expr(s->getExpression(), 0);
+            out(") ");
+            write_block(s->getStatements());
+            if (s->getElse()) {
+              out(" else ");
+              write_block(s->getElse());
+            }
+            out("\n");
+          } break;
+          case cpp_statement::kind_while: {
+            start_line();
+            out("while (");
+            write_expr(s->getExpression(), 0);
+            out(") ");
+            write_block(s->getStatements());
+            out("\n");
+          } break;
+          case cpp_statement::kind_dowhile: {
+            start_line();
+            out("do ");
+            write_block(s->getStatements());
+            out(" while (");
+            write_expr(s->getExpression(), 0);
+            out(");\n");
+          } break;
+          case cpp_statement::kind_for: write_for(s); break;
+        }
+      }
+
+      void write_global(cpp_value *value) {
+        cpp_type *type = value->getType();
+        if (type->getIsBuffer()) {
+          // layout(std140, binding = 0) buffer name { ... } instance;
+          out("layout(%sbinding = %d) buffer %s {\n", type->getIsStd140() ? "std140, " : "", type->getBinding(), parser.getStructName(type));
+          write_members(type->getScope());
+          out("} %s;\n", value->getName());
+          return;
+        }
+        cpp_type *element = get_element(type);
+        if (element->getIsConst()) out("const ");
+        if (element->getIsUniform()) out("uniform ");
+        if (element->getIsAttribute()) out("attribute ");
+        if (element->getIsVarying()) out("varying ");
+        write_declaration(type, value->getName());
+        if (value->getInit()) {
+          out(" = ");
+          write_expr(value->getInit(), prec_assign);
+        }
+        out(";\n");
+      }
+
+      void write_function(cpp_value *function) {
+        cpp_type *type = function->getType();
+        cpp_scope::iterator param = type->getScope()->begin();
+        // structures are returned in a hidden first parameter.
+        write_type(type->getIsReturnByValue() ? (*param++)->getType() : type->getSubType());
+        out(" %s(", function->getName());
+        for (cpp_scope::iterator first = param; param != type->getScope()->end(); ++param) {
+          cpp_type *param_type = (*param)->getType();
+          if (param != first) out(", ");
+          if (param_type->getIsConst()) out("const ");
+          if (param_type->getIsOut()) out(param_type->getIsIn() ? "inout " : "out ");
+          write_declaration(param_type, (*param)->getName());
+        }
+        out(")");
+        if (function->getInit()) {
+          out(" ");
+          write_block(function->getInit()->getStatement());
+        } else {
+          out(";");
+        }
+        out("\n\n");
+      }
+
+      void use(cpp_expr *expr) {
+        if (!expr || expr->getKind() == cpp_expr::kind_statement) return;
+        if (expr->getKind() == cpp_expr::kind_value) use(expr->getValue());
+        use(expr->getKid(0));
+        use(expr->getKid(1));
+        use(expr->getKid(2));
+      }
+
+      void use(cpp_statement *s) {
+        for (; s; s = s->getNext()) {
+          use(s->getExpression());
+          use(s->getStatements());
+          use(s->getElse());
+        }
+      }
+
+      // functions are added after the ones they call.
+      void use(cpp_value *value) {
+        if (!globals.contains(value) || used.contains(value)) return;
+        used[value] = 1;
+        cpp_expr *init = value->getInit();
+        if (value->getType()->getKind() == cpp_type::kind_function) {
+          if (init) use(init->getStatement());
+          functions.push_back(value);
+        } else {
+          use(init);
+        }
+      }
+
+    public:
+      cpp_glsl_writer(cpp_parser &parser_) : parser(parser_) {
+      }
+
+      /// Write the function "entry" and everything it uses to result.
+      /// Returns false if there is no such function.
+      bool write(string &result, const char *entry = "main") {
+        cpp_scope *scope = parser.getGlobalScope();
+        cpp_value *main = scope->lookup(parser.getSymbols().intern(entry));
+        if (!main || main->getType()->getKind() != cpp_type::kind_function || !main->getInit()) {
+          cpp_log("error: no function called %s\n", entry);
+          return false;
+        }
+
+        globals.clear();
+        used.clear();
+        written_structs.clear();
+        functions.resize(0);
+        text.resize(0);
+        structs.resize(0);
+        dest = &text;
+        indent = 0;
+
+        for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+          for (cpp_value *value = *i; value; value = value->getNextPolymorphic()) {
+            globals[value] = 1;
+          }
+        }
+        use(main);
+
+        for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+          if ((*i)->getType()->getKind() != cpp_type::kind_function && used.contains(*i)) {
+            write_global(*i);
+          }
+        }
+        out("\n");
+        for (unsigned i = 0; i != functions.size(); ++i) {
+          write_function(functions[i]);
+        }
+
+        dynarray<char> all;
+        dest = &all;
+        if (const char *precision = parser.getFloatPrecision()) {
+          out("precision %s float;\n\n", precision);
+        }
+        all.resize(all.size() + structs.size() + text.size());
+        memcpy(all.data() + all.size() - structs.size() - text.size(), structs.data(), structs.size());
+        memcpy(all.data() + all.size() - text.size(), text.data(), text.size());
+        result.set(all.data(), all.size());
+        return true;
+      }
+    };
+
+    #if OCTET_UNIT_TEST
+      class cpp_glsl_writer_unit_test {
+      public:
+        cpp_glsl_writer_unit_test() {
+          // cut down from bump_shader
+          static const char src[] =
+            "precision mediump float;\n"
+            "struct light { vec3 dir; float spec; };\n"
+            "uniform vec4 light_uniforms[17];\n"
+            "uniform int num_lights;\n"
+            "uniform float unused;\n"
+            "uniform sampler2D diffuse_sampler;\n"
+            "varying vec3 normal_;\n"
+            "varying vec2 uv_;\n"
+            "light get_light(int i) { light l; l.dir = light_uniforms[i * 3 + 2].xyz; l.spec = -light_uniforms[i].w; return l; }\n"
+            "void main() {\n"
+            "  vec3 diffuse = vec3(0, 0, 0);\n"
+            "  for (int i = 0; i != num_lights; ++i) {\n"
+            "    light l = get_light(i);\n"
+            "    diffuse += max(dot(normal_, l.dir), 0) * 0.5 + l.spec * light_uniforms[i * 3 + 2].w;\n"
+            "  }\n"
+            "  if (num_lights == 0 || !(diffuse.x < 1.5)) diffuse = vec3(1, 1, 1);\n"
+            "  gl_FragColor = vec4(texture2D(diffuse_sampler, uv_).xyz * diffuse, 1);\n"
+            "}\n"
+          ;
+          cpp_parser parser;
+          bool ok = parser.parse(src);
+          assert(ok);
+          cpp_optimizer optimizer(parser);
+          optimizer.specialise("num_lights", 2);
+          optimizer.optimise();
+
+          string glsl;
+          ok = cpp_glsl_writer(parser).write(glsl);
+          assert(ok);
+          const char *text = glsl.c_str();
+          assert(strstr(text, "precision mediump float;"));
+          assert(strstr(text, "struct light {") && strstr(text, "uniform vec4 light_uniforms[17];"));
+          assert(strstr(text, "light_uniforms[5].w") && strstr(text, "get_light(1)") && strstr(text, "diffuse += "));
+          assert(strstr(text, "vec3(0.0, 0.0, 0.0)") && strstr(text, "!(diffuse.x < 1.5)"));
+          assert(!strstr(text, "for (") && !strstr(text, "num_lights") && !strstr(text, "unused"));
+
+          // the output is a shader in its own right.
+          cpp_parser reparse;
+          ok = reparse.parse(text);
+          assert(ok);
+        }
+      };
+
+      static cpp_glsl_writer_unit_test cpp_glsl_writer_unit_test;
+    #endif
+  }
+}
@@ -6,6 +6,20 @@
 //
 // C/C++ language subset lexer. A work in progress, needs some tests.
 //
+// Identifiers, white space and digits are scanned sixteen bytes at a time with
+// SSE2 character class masks. Loads are aligned so that they never cross a page
+// and may safely read past the terminating zero.
+//
+// Keywords are found with a perfect hash over the length and the first two and
+// last two characters of the identifier, so identifiers are not copied unless
+// the caller asks for them with id().
+//
+
+#if OCTET_SSE2 && !defined(__SANITIZE_ADDRESS__)
+  #define OCTET_LEXER_SSE2 1
+#else
+  #define OCTET_LEXER_SSE2 0
+#endif
 
 namespace octet
 {
@@ -29,6 +43,19 @@ namespace octet
 
       enum {
         max_chars = 256,
+        max_keyword_bits = 16,
+      };
+
+      enum char_class {
+        class_id_middle,
+        class_whitespace,
+        class_digit,
+      };
+
+      struct keyword {
+        unsigned offset;    // into keyword_text_
+        unsigned length;
+        int tok;
       };
     
       // small stuff    
@@ -38,16 +65,177 @@ namespace octet
       token_type type_;
       const char_type *src_;
 
-      dictionary<int> identifiers_;
+      // the last identifier, not yet copied to id_
+      const char_type *id_src_;
+      unsigned id_length_;
+
+      // keywords and their perfect hash table of keyword index + 1, 0 for none.
+      dynarray<keyword> keywords_;
+      dynarray<char_type> keyword_text_;
+      dynarray<uint16_t> keyword_table_;
+      uint32_t keyword_seed_;
+      unsigned keyword_shift_;
+      bool keywords_dirty_;
 
       char_type id_[max_chars];
 
+      // keywords must differ in length or in their first two or last two characters.
+      static uint32_t keyword_key(const char_type *id, unsigned length) {
+        const uint8_t *p = (const uint8_t *)id;
+        uint32_t key = length >= 2 ?
+          p[0] | p[1] << 8 | p[length-2] << 16 | p[length-1] << 24 :
+          p[0] * 0x01010101u
+        ;
+        return key ^ (length * 0x9e3779b9u);
+      }
+
+      unsigned keyword_hash(uint32_t key) const {
+        return (key * keyword_seed_) >> keyword_shift_;
+      }
+
+      // find a seed that puts every keyword in a different slot,
+      // doubling the table until one turns up quickly.
+      void build_keyword_table() {
+        keywords_dirty_ = false;
+        unsigned num_keywords = keywords_.size();
+        if (!num_keywords) {
+          keyword_table_.reset();
+          return;
+        }
+
+        dynarray<uint32_t> keys(num_keywords);
+        for (unsigned i = 0; i != num_keywords; ++i) {
+          keys[i] = keyword_key(&keyword_text_[keywords_[i].offset], keywords_[i].length);
+        }
+
+        unsigned bits = 4;
+        while ((1u << bits) < num_keywords * 4) ++bits;
+        uint32_t seed = 0x9e3779b1u;
+        for (; bits <= max_keyword_bits; ++bits) {
+          keyword_table_.resize(1 << bits);
+          keyword_shift_ = 32 - bits;
+          for (unsigned attempt = 0; attempt != 1000; ++attempt) {
+            keyword_seed_ = seed;
+            seed = (seed + 0x6a09e668u) | 1;
+            memset(keyword_table_.data(), 0, keyword_table_.size() * sizeof(uint16_t));
+            unsigned i = 0;
+            for (; i != num_keywords; ++i) {
+              uint16_t &slot = keyword_table_[keyword_hash(keys[i])];
+              if (slot) break;
+              slot = (uint16_t)(i + 1);
+            }
+            if (i == num_keywords) return;
+          }
+        }
+        cpp_log("error: no perfect hash for %d keywords\n", num_keywords);
+        keyword_table_.reset();
+      }
+
+      // keyword token for [id, id+length) or tok_identifier.
+      int find_keyword(const char_type *id, unsigned length) const {
+        if (keyword_table_.size()) {
+          unsigned index = keyword_table_[keyword_hash(keyword_key(id, length))];
+          if (index) {
+            const keyword &k = keywords_[index-1];
+            if (k.length == length && !memcmp(&keyword_text_[k.offset], id, length)) {
+              return k.tok;
+            }
+          }
+        }
+        return tok_identifier;
+      }
+
+      // copy the last identifier to id_ before its source goes away.
+      void copy_id() {
+        unsigned length = id_length_ < max_chars ? id_length_ : max_chars - 1;
+        memcpy(id_, id_src_, length);
+        id_[length] = 0;
+        id_src_ = 0;
+      }
+
+    #if OCTET_LEXER_SSE2
+      static unsigned first_bit(unsigned mask) {
+        #ifdef _MSC_VER
+          unsigned long index;
+          _BitScanForward(&index, mask);
+          return (unsigned)index;
+        #else
+          return (unsigned)__builtin_ctz(mask);
+        #endif
+      }
+
+      // bytes in the range [lo, hi] are set. Bytes of 128 and above are never set.
+      static __m128i in_range(__m128i v, char lo, char hi) {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+      }
+
+      // one bit for every byte of the block in the character class.
+      static unsigned class_mask(const char_type *block, char_class cls) {
+        __m128i v = _mm_load_si128((const __m128i*)block);
+        __m128i in;
+        switch (cls) {
+          case class_id_middle: {
+            // lower case letters, upper case letters with 0x20 added, digits and '_'
+            __m128i alpha = in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+            in = _mm_or_si128(_mm_or_si128(alpha, in_range(v, '0', '9')), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+          } break;
+          case class_whitespace: {
+            in = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+          } break;
+          default: {
+            in = in_range(v, '0', '9');
+          } break;
+        }
+        return (unsigned)_mm_movemask_epi8(in);
+      }
+    #endif
+
+      // skip characters of a class. Zero is in no class, so this stops at the end of the source.
+      const char_type *skip_class(const char_type *src, char_class cls) {
+        #if OCTET_LEXER_SSE2
+          const char_type *block = (const char_type *)((uintptr_t)src & ~(uintptr_t)15);
+          unsigned mask = ~class_mask(block, cls) & (0xffff << (src - block)) & 0xffff;
+          while (!mask) {
+            block += 16;
+            mask = ~class_mask(block, cls) & 0xffff;
+          }
+          return block + first_bit(mask);
+        #else
+          switch (cls) {
+            case class_id_middle: while (is_id_middle(*src)) ++src; break;
+            case class_whitespace: while (is_whitespace(*src)) ++src; break;
+            default: while (is_digit(*src)) ++src; break;
+          }
+          return src;
+        #endif
+      }
+
     public:
       cpp_lexer() {
+        src_ = 0;
+        id_src_ = 0;
+        id_length_ = 0;
+        id_[0] = 0;
+        keyword_seed_ = 0;
+        keyword_shift_ = 32;
+        keywords_dirty_ = false;
       }
 
+      /// Make an identifier lex as the token "tok", eg. add_identifier("while", tok_while).
       void add_identifier(const char *id, int tok) {
-        identifiers_[id] = tok;
+        unsigned length = (unsigned)strlen(id);
+        for (unsigned i = 0; i != keywords_.size(); ++i) {
+          if (keywords_[i].length == length && !memcmp(&keyword_text_[keywords_[i].offset], id, length)) {
+            keywords_[i].tok = tok;
+            return;
+          }
+        }
+        keyword k = { keyword_text_.size(), length, tok };
+        keywords_.push_back(k);
+        for (unsigned i = 0; i != length; ++i) {
+          keyword_text_.push_back(id[i]);
+        }
+        keywords_dirty_ = true;
       }
 
       static const char *token_name( int tok ) {
@@ -59,17 +247,11 @@ namespace octet
       }
 
       void lex_identifier() {
-        id_[ 0 ] = *src_++;
-        unsigned num_chars = 1;
-        while( is_id_middle( *src_ ) ) {
-          id_[ num_chars++ ] = *src_++;
-        }
-        id_[ num_chars ] = 0;
-        type_ = (token_type)tok_identifier;
-        int index = identifiers_.get_index(id_);
-        if (index != -1) {
-          type_ = (token_type)identifiers_.get_value(index);
-        }
+        const char_type *start = src_;
+        src_ = skip_class(src_ + 1, class_id_middle);
+        id_src_ = start;
+        id_length_ = (unsigned)(src_ - start);
+        type_ = (token_type)find_keyword(start, id_length_);
       }
 
       // 0x123 0123 12345678l 0.123e21L
@@ -93,19 +275,16 @@ namespace octet
               src++;
             }
             if( *src != '.' ) {
+              value_ = value;
               goto after_int;
             }
           }
         }
       
-        while( is_digit( *src ) ) {
-          src++;
-        }
+        src = skip_class( src, class_digit );
         if( *src == '.' ) {
           src++;
-          while( is_digit( *src ) ) {
-            src++;
-          }
+          src = skip_class( src, class_digit );
           if( *src == 'e' || *src == 'E' ) goto exponent; else goto after_float;
         } else if( *src == 'e' || *src == 'E' ) {
         exponent:
@@ -167,17 +346,20 @@ namespace octet
       // "abc"
       void lex_string() {
         char_type *dest = id_;
+        id_src_ = 0;
         ++src_;
         while( *src_ != '"' ) {
           if( *src_ == 0 ) {
             break;
           }
+          unsigned chr = 0;
           if( *src_ == '\\' ) {
-            unsigned chr = 0;
             lex_string_escape( &chr );
-            *dest++ = chr;
           } else {
-            *dest++ = *src_++;
+            chr = *src_++;
+          }
+          if( dest != id_ + max_chars - 1 ) {
+            *dest++ = chr;
           }
         }
         *dest = 0;
@@ -191,7 +373,7 @@ namespace octet
       void lex_char_constant() {
         uint64_t value = 0;
         ++src_;
-        while( *src_ != '"' ) {
+        while( *src_ != '\'' ) {
           if( *src_ == 0 ) {
             break;
           }
@@ -240,7 +422,7 @@ namespace octet
             
               is_punct('*') ? tok_dot_star :
               ( src_[0] == '.' && src_[1] == '.' ) ? ( src_ += 2, tok_ellipsis ) :
-              tok_star
+              tok_dot
             ;
             break;
           case '/': type_ = is_punct('=') ? tok_divide_equals : tok_divide; break;
@@ -285,6 +467,8 @@ namespace octet
         } else if( chr == '\'' ) {
           lex_char_constant();
         } else if( chr == 0 ) {
+          // the caller may reuse the source buffer for the next line.
+          if( id_src_ ) copy_id();
           type_ = tok_newline;
         } else {
           type_ = tok_bad_character;
@@ -295,8 +479,12 @@ namespace octet
       // small, inlinable lexer
       // ! ( ) [ ] { } etc.
       void lex_token() {
-        while( is_whitespace( *src_ ) ) {
+        if( is_whitespace( *src_ ) ) {
+          // most runs are a single space
           src_++;
+          if( is_whitespace( *src_ ) ) {
+            src_ = skip_class( src_, class_whitespace );
+          }
         }
 
         if( is_id_start( *src_ ) ) {
@@ -309,6 +497,8 @@ namespace octet
       }
     
       void start( const char_type *src ) {
+        if( id_src_ ) copy_id();
+        if( keywords_dirty_ ) build_keyword_table();
         src_ = src;
       }
     
@@ -316,9 +506,20 @@ namespace octet
         return src_;
       }
     
+      /// The last identifier or string as a zero terminated string.
       char_type *id() {
+        if( id_src_ ) copy_id();
         return id_;
       }
+
+      /// The last identifier without copying it. Not zero terminated: use id_length().
+      const char_type *id_src() {
+        return id_src_ ? id_src_ : id_;
+      }
+
+      unsigned id_length() {
+        return id_length_ < max_chars ? id_length_ : max_chars - 1;
+      }
     
       uint64_t value() {
         return value_;
@@ -336,6 +537,108 @@ namespace octet
         return type_;
       }
 
+      /// Log lexer throughput over the shaders and some of octet's own headers,
+      /// or over a zero terminated list of urls. Each file is lexed a line at a time,
+      /// as the preprocessor feeds the parser.
+      static void benchmark(const char *const *urls = 0, unsigned repeats = 50) {
+        static const char *const default_urls[] = {
+          "shaders/default.vs", "shaders/default_solid.fs", "shaders/default_textured.fs", "shaders/multitexture.fs",
+          "shaders/raycast.fs", "shaders/raycast_bricks.fs", "shaders/raycast_meta.fs", "shaders/raycast_molecule.fs",
+          "shaders/spots.fs", "shaders/cubemap.fs", "shaders/text.fs", "shaders/text_sdf.fs", "shaders/helix.cs",
+          "src/octet.h", "src/math/mat4t.h", "src/containers/dynarray.h", "src/scene/mesh.h", "src/scene/scene_node.h",
+          "src/loaders/collada_builder.h", "src/compiler/cpp_parser.h", "src/compiler/cpp_lexer.h",
+          0
+        };
+        static const char *const keywords[] = {
+          "attribute", "bool", "break", "class", "const", "continue", "else", "float", "for", "if", "in", "inline", "int",
+          "namespace", "out", "private", "public", "return", "sampler2D", "static", "struct", "template", "typedef",
+          "uniform", "unsigned", "varying", "vec2", "vec3", "vec4", "void", "while", 0
+        };
+
+        cpp_lexer lexer;
+        for (unsigned i = 0; keywords[i]; ++i) {
+          lexer.add_identifier(keywords[i], tok_last + i);
+        }
+
+        // one zero terminated line per source line
+        dynarray<char_type> text;
+        dynarray<unsigned> lines;
+        for (const char *const *url = urls ? urls : default_urls; *url; ++url) {
+          dynarray<uint8_t> buffer;
+          app_utils::get_url(buffer, *url);
+          lines.push_back(text.size());
+          for (unsigned i = 0; i != buffer.size(); ++i) {
+            char_type chr = (char_type)buffer[i];
+            if (chr == '\r') continue;
+            if (chr == '\n') {
+              text.push_back(0);
+              lines.push_back(text.size());
+            } else {
+              text.push_back(chr);
+            }
+          }
+          text.push_back(0);
+        }
+        if (text.size() == 0) return;
+
+        typedef std::chrono::steady_clock timer_clock;
+        timer_clock::time_point start = timer_clock::now();
+        unsigned num_tokens = 0, num_keywords = 0;
+        for (unsigned r = 0; r != repeats; ++r) {
+          for (unsigned i = 0; i != lines.size(); ++i) {
+            lexer.start(&text[lines[i]]);
+            for (;;) {
+              lexer.lex_token();
+              if (lexer.type() == tok_newline) break;
+              num_tokens++;
+              num_keywords += lexer.type() >= tok_last;
+            }
+          }
+        }
+        double secs = std::chrono::duration<double>(timer_clock::now() - start).count();
+        double mb = (double)text.size() * repeats / (1024 * 1024);
+        log("cpp_lexer: %d lines, %d tokens (%d keywords) %.1fMB/s %.1fM tokens/s\n",
+          lines.size(), num_tokens / repeats, num_keywords / repeats, mb / secs, num_tokens / secs * 1e-6
+        );
+      }
     };
+
+    #if OCTET_UNIT_TEST
+      class cpp_lexer_unit_test {
+      public:
+        cpp_lexer_unit_test() {
+          // the first two and last two characters of these only differ in the middle.
+          cpp_lexer lexer;
+          lexer.add_identifier("sampler1D", cpp_tokens::tok_last + 0);
+          lexer.add_identifier("sampler2D", cpp_tokens::tok_last + 1);
+          lexer.add_identifier("texture2D", cpp_tokens::tok_last + 2);
+          lexer.add_identifier("in", cpp_tokens::tok_last + 3);
+          lexer.add_identifier("int", cpp_tokens::tok_last + 4);
+
+          static const char src[] = "  in\tint inx sampler1D sampler3D a_very_long_identifier_over_sixteen_bytes 123.5f 0x1f 'A' \"str\"";
+          lexer.start(src);
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_last + 3);
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_last + 4);
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_identifier && !strcmp(lexer.id(), "inx"));
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_last + 0);
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_identifier && !strcmp(lexer.id(), "sampler3D"));
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_identifier && !strcmp(lexer.id(), "a_very_long_identifier_over_sixteen_bytes"));
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_float_constant && lexer.double_value() == 123.5);
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_int_constant && lexer.value() == 0x1f);
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_int_constant && lexer.value() == 'A');
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_string_constant && !strcmp(lexer.id(), "str"));
+          lexer.lex_token(); assert(lexer.type() == cpp_tokens::tok_newline);
+
+          // the last identifier on a line survives the line buffer being reused.
+          char line[16] = "x + name";
+          lexer.start(line);
+          do lexer.lex_token(); while (lexer.type() != cpp_tokens::tok_newline);
+          memset(line, 0, sizeof(line));
+          assert(!strcmp(lexer.id(), "name"));
+        }
+      };
+
+      static cpp_lexer_unit_test cpp_lexer_unit_test;
+    #endif
   }
 }
@@ -0,0 +1,603 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Syntax tree optimiser for shader variants.
+//
+// Shaders such as bump_shader are written for any number of lights, but each
+// variant only needs one. Fixing the uniforms that pick the variant lets us
+// fold the arithmetic that depends on them, unroll the loops they bound and
+// throw away the branches they turn off, before the driver ever sees the code.
+//
+
+namespace octet
+{
+  namespace compiler
+  {
+    /// Simplify a parsed translation unit before it is run on the VM or written out as GLSL.
+    ///
+    /// - Arithmetic, comparisons, casts, &&, || and ?: on constants are folded.
+    /// - consts and specialised uniforms are replaced by their values.
+    /// - for loops with a constant trip count are unrolled, up to get_max_unroll() times.
+    /// - if and while statements with constant conditions lose their dead side and
+    ///   statements after return, break, continue or discard are dropped.
+    ///
+    /// Names #defined with cpp_parser::predefine() have already been replaced by the
+    /// preprocessor, so they fold like any other constant.
+    ///
+    /// The new tree is built in the parser's arena and shares the parts that have not changed.
+    ///
+    /// Example
+    ///
+    ///     cpp_parser parser;
+    ///     parser.parse(fragment_shader);
+    ///     cpp_optimizer optimizer(parser);
+    ///     optimizer.specialise("num_lights", 2);
+    ///     optimizer.optimise();
+    class cpp_optimizer {
+      struct substitution {
+        cpp_value *value;
+        cpp_expr *expr;
+      };
+
+      cpp_parser &parser;
+      cpp_arena &arena;
+      // specialised uniforms first, then the variables of the loops being unrolled.
+      dynarray<substitution> substitutions;
+      unsigned max_unroll;
+      unsigned num_folded;
+      unsigned num_unrolled;
+      unsigned num_removed;
+
+      static bool is_constant(cpp_expr *expr) {
+        return expr->getKind() == cpp_expr::kind_int_value || expr->getKind() == cpp_expr::kind_double_value;
+      }
+
+      static bool is_pure(cpp_expr *expr) {
+        return is_constant(expr) || expr->getKind() == cpp_expr::kind_nop || expr->getKind() == cpp_expr::kind_value;
+      }
+
+      static double get_double(cpp_expr *expr) {
+        return expr->getKind() == cpp_expr::kind_int_value ? (double)(long long)expr->getIntValue() : expr->getDoubleValue();
+      }
+
+      static long long get_int(cpp_expr *expr) {
+        if (expr->getKind() == cpp_expr::kind_int_value) return (long long)expr->getIntValue();
+        double value = expr->getDoubleValue();
+        return value >= 2147483647.0 ? 2147483647 : value <= -2147483648.0 ? -2147483647 - 1 : (long long)value;
+      }
+
+      static bool is_true(cpp_expr *expr) {
+        return get_double(expr) != 0;
+      }
+
+      static bool is_scalar(cpp_type *type) {
+        return type && type->getIsScalar() && type->getKind() != cpp_type::kind_void;
+      }
+
+      // constants are stored as floats or 32 bit ints, as on the GPU.
+      cpp_expr *make_float(cpp_type *type, double value) {
+        num_folded++;
+        return new (arena) cpp_expr(cpp_expr::kind_double_value, type, (double)(float)value);
+      }
+
+      cpp_expr *make_int(cpp_type *type, long long value) {
+        num_folded++;
+        if (type->getKind() == cpp_type::kind_bool) value = value != 0;
+        return new (arena) cpp_expr(cpp_expr::kind_int_value, type, (long long)(int32_t)(uint32_t)value);
+      }
+
+      // convert a constant to a scalar type.
+      cpp_expr *make_constant(cpp_type *type, cpp_expr *src) {
+        if (type->getIsFloat()) return make_float(type, get_double(src));
+        if (type->getKind() == cpp_type::kind_bool) return make_int(type, is_true(src));
+        return make_int(type, get_int(src));
+      }
+
+      // copy expr with new kids, unless they are the same.
+      cpp_expr *rebuild(cpp_expr *expr, cpp_expr *kid0, cpp_expr *kid1 = NULL, cpp_expr *kid2 = NULL) {
+        if (kid0 == expr->getKid(0) && kid1 == expr->getKid(1) && kid2 == expr->getKid(2)) return expr;
+        cpp_expr *result = new (arena) cpp_expr(*expr);
+        result->setKid(0, kid0);
+        result->setKid(1, kid1);
+        result->setKid(2, kid2);
+        return result;
+      }
+
+      cpp_expr *fold_value(cpp_expr *expr) {
+        cpp_value *value = expr->getValue();
+        for (unsigned i = substitutions.size(); i-- != 0; ) {
+          if (substitutions[i].value == value) {
+            num_folded++;
+            return substitutions[i].expr;
+          }
+        }
+
+        // const int max_lights = 4;
+        cpp_type *type = value->getType();
+        if (type->getIsConst() && !type->getIsUniform() && is_scalar(type) && value->getInit()) {
+          cpp_expr *init = fold(value->getInit());
+          if (is_constant(init)) return make_constant(type, init);
+        }
+        return expr;
+      }
+
+      cpp_expr *fold_cast(cpp_expr *expr) {
+        cpp_expr *src = fold(expr->getKid(0));
+        cpp_type *type = expr->getType();
+        if (is_constant(src) && is_scalar(type)) {
+          return make_constant(type, src);
+        } else if (src->getType() && *src->getType() == *type) {
+          return src;
+        }
+        return rebuild(expr, src);
+      }
+
+      // lhs op rhs for scalar constants, or NULL.
+      cpp_expr *fold_binary(cpp_expr *expr, cpp_expr *lhs, cpp_expr *rhs) {
+        cpp_type *type = expr->getType();
+        if (!is_constant(lhs) || !is_constant(rhs) || !is_scalar(type)) return NULL;
+        cpp_expr::kind_enum kind = expr->getKind();
+        bool is_float = lhs->getKind() == cpp_expr::kind_double_value || rhs->getKind() == cpp_expr::kind_double_value;
+        if (kind >= cpp_expr::kind_lt && kind <= cpp_expr::kind_ne) {
+          double a = get_double(lhs), b = get_double(rhs);
+          long long ia = get_int(lhs), ib = get_int(rhs);
+          bool result = false;
+          switch (kind) {
+            case cpp_expr::kind_lt: result = is_float ? a < b : ia < ib; break;
+            case cpp_expr::kind_gt: result = is_float ? a > b : ia > ib; break;
+            case cpp_expr::kind_le: result = is_float ? a <= b : ia <= ib; break;
+            case cpp_expr::kind_ge: result = is_float ? a >= b : ia >= ib; break;
+            case cpp_expr::kind_eq: result = is_float ? a == b : ia == ib; break;
+            default: result = is_float ? a != b : ia != ib; break;
+          }
+          return make_int(type, result);
+        } else if (type->getIsFloat()) {
+          double a = get_double(lhs), b = get_double(rhs);
+          switch (kind) {
+            case cpp_expr::kind_plus: return make_float(type, a + b);
+            case cpp_expr::kind_minus: return make_float(type, a - b);
+            case cpp_expr::kind_star: return make_float(type, a * b);
+            case cpp_expr::kind_divide: return b != 0 ? make_float(type, a / b) : NULL;
+            default: return NULL;
+          }
+        } else {
+          int32_t a = (int32_t)get_int(lhs), b = (int32_t)get_int(rhs);
+          // wrap like 32 bit ints; division by zero is left for run time.
+          switch (kind) {
+            case cpp_expr::kind_plus: return make_int(type, (int32_t)((uint32_t)a + (uint32_t)b));
+            case cpp_expr::kind_minus: return make_int(type, (int32_t)((uint32_t)a - (uint32_t)b));
+            case cpp_expr::kind_star: return make_int(type, (int32_t)((uint32_t)a * (uint32_t)b));
+            case cpp_expr::kind_divide: return b != 0 && (b != -1 || a != INT32_MIN) ? make_int(type, a / b) : NULL;
+            case cpp_expr::kind_mod: return b != 0 && (b != -1 || a != INT32_MIN) ? make_int(type, a % b) : NULL;
+            case cpp_expr::kind_shift_left: return b >= 0 && b < 32 ? make_int(type, (int32_t)((uint32_t)a << b)) : NULL;
+            case cpp_expr::kind_shift_right: return b >= 0 && b < 32 ? make_int(type, a >> b) : NULL;
+            case cpp_expr::kind_and: return make_int(type, a & b);
+            case cpp_expr::kind_or: return make_int(type, a | b);
+            case cpp_expr::kind_xor: return make_int(type, a ^ b);
+            default: return NULL;
+          }
+        }
+      }
+
+      // the left of an assignment: indices are folded, but not the variable.
+      cpp_expr *fold_lvalue(cpp_expr *expr) {
+        switch (expr->getKind()) {
+          case cpp_expr::kind_value: return expr;
+          case cpp_expr::kind_index: return rebuild(expr, fold_lvalue(expr->getKid(0)), fold(expr->getKid(1)));
+          case cpp_expr::kind_dot:
+          case cpp_expr::kind_swiz: return rebuild(expr, fold_lvalue(expr->getKid(0)));
+          default: return fold(expr);
+        }
+      }
+
+      // x++ is ( ( $tmp = x, x = x + 1 ), $tmp ), return x = x + 1.
+      static cpp_expr *strip_postfix(cpp_expr *expr) {
+        if (
+          expr->getKind() == cpp_expr::kind_comma && expr->getKid(1)->getKind() == cpp_expr::kind_value &&
+          expr->getKid(0)->getKind() == cpp_expr::kind_comma
+        ) {
+          cpp_expr *save = expr->getKid(0)->getKid(0);
+          if (
+            save->getKind() == cpp_expr::kind_equals && save->getKid(0)->getKind() == cpp_expr::kind_value &&
+            save->getKid(0)->getValue() == expr->getKid(1)->getValue()
+          ) {
+            return expr->getKid(0)->getKid(1);
+          }
+        }
+        return expr;
+      }
+
+      // the variable that an lvalue such as a[i].x writes to.
+      static cpp_value *get_root(cpp_expr *expr) {
+        while (expr->getKind() == cpp_expr::kind_index || expr->getKind() == cpp_expr::kind_dot || expr->getKind() == cpp_expr::kind_swiz) {
+          expr = expr->getKid(0);
+        }
+        return expr->getKind() == cpp_expr::kind_value ? expr->getValue() : NULL;
+      }
+
+      // does expr assign to var, or pass it to an out parameter?
+      static bool writes(cpp_expr *expr, cpp_value *var) {
+        if (!expr || expr->getKind() == cpp_expr::kind_statement) return false;
+        if (expr->getKind() == cpp_expr::kind_equals && get_root(expr->getKid(0)) == var) return true;
+        if (expr->getKind() == cpp_expr::kind_call) {
+          cpp_type *function_type = expr->getKid(0)->getValue()->getType();
+          cpp_scope::iterator formal = function_type->getScope()->begin() + (function_type->getIsReturnByValue() ? 1 : 0);
+          for (unsigned i = 0; i != expr->getNumArgs(); ++i) {
+            if (formal[i]->getType()->getIsOut() && get_root(expr->getArg(i)) == var) return true;
+          }
+        }
+        return writes(expr->getKid(0), var) || writes(expr->getKid(1), var) || writes(expr->getKid(2), var);
+      }
+
+      static bool writes(cpp_statement *s, cpp_value *var) {
+        for (; s; s = s->getNext()) {
+          if (
+            writes(s->getExpression(), var) || writes(s->getStatements(), var) ||
+            (s->getElse() && writes(s->getElse(), var))
+          ) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      // break or continue that would leave this loop.
+      static bool jumps_out(cpp_statement *s) {
+        if (!s) return false;
+        switch (s->getKind()) {
+          case cpp_statement::kind_break:
+          case cpp_statement::kind_continue: return true;
+          case cpp_statement::kind_compound: {
+            for (cpp_statement *child = s->getStatements(); child; child = child->getNext()) {
+              if (jumps_out(child)) return true;
+            }
+            return false;
+          }
+          case cpp_statement::kind_if: return jumps_out(s->getStatements()) || jumps_out(s->getElse());
+          default: return false;
+        }
+      }
+
+      static bool is_terminator(cpp_statement *s) {
+        cpp_statement::kind_enum kind = s->getKind();
+        return kind == cpp_statement::kind_return || kind == cpp_statement::kind_break || kind == cpp_statement::kind_continue || kind == cpp_statement::kind_discard;
+      }
+
+      cpp_statement *copy(cpp_statement *s) {
+        cpp_statement *result = new (arena) cpp_statement(*s);
+        *result->getNextAddr() = NULL;
+        return result;
+      }
+
+      cpp_statement *make_compound(cpp_scope *scope, cpp_statement *statements) {
+        cpp_statement *result = new (arena) cpp_statement(cpp_statement::kind_compound);
+        result->setScope(scope);
+        *result->getStatementsAddr() = statements;
+        return result;
+      }
+
+      cpp_statement *optimise_list(cpp_statement *first) {
+        cpp_statement *result = NULL;
+        cpp_statement **prev = &result;
+        for (cpp_statement *s = first; s; s = s->getNext()) {
+          cpp_statement *new_s = optimise(s);
+          if (new_s) {
+            *prev = new_s;
+            prev = new_s->getNextAddr();
+            if (is_terminator(new_s)) {
+              for (cpp_statement *dead = s->getNext(); dead; dead = dead->getNext()) num_removed++;
+              break;
+            }
+          }
+        }
+        return result;
+      }
+
+      // for( int i = a; cond; step ) with a constant trip count becomes one block for each value of i.
+      cpp_statement *unroll(cpp_statement *s, cpp_expr *init) {
+        cpp_scope *scope = s->getScope();
+        if (!scope || scope->size() != 1 || !init || init->getKind() != cpp_expr::kind_equals) return NULL;
+        cpp_value *var = *scope->begin();
+        cpp_expr *lhs = init->getKid(0);
+        if (var->getType()->getKind() != cpp_type::kind_int || lhs->getKind() != cpp_expr::kind_value || lhs->getValue() != var || !is_constant(init->getKid(1))) {
+          return NULL;
+        }
+
+        cpp_expr *cond = s->getExpression()->getKid(1);
+        cpp_expr *step = s->getExpression()->getKid(2);
+        step = step ? strip_postfix(step) : NULL;
+        if (!cond || !step || step->getKind() != cpp_expr::kind_equals || step->getKid(0)->getKind() != cpp_expr::kind_value || step->getKid(0)->getValue() != var) {
+          return NULL;
+        }
+        cpp_statement *body = s->getStatements();
+        if (writes(body, var) || jumps_out(body)) return NULL;
+
+        // run the loop, but only the condition and the step.
+        dynarray<cpp_expr *> values;
+        cpp_expr *value = make_constant(var->getType(), init->getKid(1));
+        for (;;) {
+          substitution sub = { var, value };
+          substitutions.push_back(sub);
+          cpp_expr *test = fold(cond);
+          cpp_expr *next = fold(step->getKid(1));
+          substitutions.pop_back();
+          if (!is_constant(test) || !is_constant(next)) return NULL;
+          if (!is_true(test)) break;
+          if (values.size() == max_unroll) return NULL;
+          values.push_back(value);
+          value = make_constant(var->getType(), next);
+        }
+
+        cpp_statement *result = make_compound(NULL, NULL);
+        cpp_statement **prev = result->getStatementsAddr();
+        for (unsigned i = 0; i != values.size(); ++i) {
+          substitution sub = { var, values[i] };
+          substitutions.push_back(sub);
+          cpp_statement *copy = optimise(body);
+          substitutions.pop_back();
+          if (copy) {
+            if (copy->getKind() != cpp_statement::kind_compound) copy = make_compound(NULL, copy);
+            *prev = copy;
+            prev = copy->getNextAddr();
+          }
+        }
+        num_unrolled++;
+        return result;
+      }
+
+      cpp_statement *optimise_for(cpp_statement *s) {
+        cpp_expr *expr = s->getExpression();
+        cpp_expr *init = expr->getKid(0) ? fold(expr->getKid(0)) : NULL;
+        if (cpp_statement *result = unroll(s, init)) return result;
+
+        cpp_expr *cond = expr->getKid(1) ? fold(expr->getKid(1)) : NULL;
+        if (cond && is_constant(cond) && !is_true(cond)) {
+          num_removed++;
+          if (!init || is_pure(init)) return NULL;
+          // keep the initialiser, which may have side effects.
+          cpp_statement *decl = new (arena) cpp_statement(cpp_statement::kind_declaration);
+          decl->setExpression(init);
+          return make_compound(s->getScope(), decl);
+        }
+
+        cpp_statement *result = copy(s);
+        cpp_expr *step = expr->getKid(2) ? fold(expr->getKid(2)) : NULL;
+        result->setExpression(new (arena) cpp_expr(cpp_expr::kind_for, NULL, init, cond, step));
+        cpp_statement *body = optimise(s->getStatements());
+        *result->getStatementsAddr() = body ? body : make_compound(NULL, NULL);
+        return result;
+      }
+
+    public:
+      cpp_optimizer(cpp_parser &parser_) : parser(parser_), arena(parser_.getArena()) {
+        max_unroll = 16;
+        num_folded = num_unrolled = num_removed = 0;
+      }
+
+      /// Replace a scalar uniform or const with a value, eg. specialise("num_lights", 2).
+      /// Returns false if there is no such global.
+      bool specialise(const char *name, double value) {
+        cpp_value *var = parser.getGlobalScope()->lookup(parser.getSymbols().intern(name));
+        if (!var || !is_scalar(var->getType())) return false;
+        cpp_type *type = var->getType();
+        if (!type->getIsUniform() && !type->getIsConst()) return false;
+        cpp_expr *expr = type->getIsFloat() ?
+          new (arena) cpp_expr(cpp_expr::kind_double_value, type, (double)(float)value) :
+          new (arena) cpp_expr(cpp_expr::kind_int_value, type, (long long)(type->getKind() == cpp_type::kind_bool ? value != 0 : (int32_t)value))
+        ;
+        substitution sub = { var, expr };
+        substitutions.push_back(sub);
+        return true;
+      }
+
+      /// Loops that run more times than this are left alone.
+      void set_max_unroll(unsigned value) {
+        max_unroll = value;
+      }
+
+      unsigned get_max_unroll() const {
+        return max_unroll;
+      }
+
+      /// Fold an expression, returning a new one if anything changed.
+      cpp_expr *fold(cpp_expr *expr) {
+        switch (expr->getKind()) {
+          case cpp_expr::kind_nop:
+          case cpp_expr::kind_statement:
+          case cpp_expr::kind_value_ptr:
+          case cpp_expr::kind_int_value:
+          case cpp_expr::kind_double_value: return expr;
+          case cpp_expr::kind_value: return fold_value(expr);
+          case cpp_expr::kind_cast: return fold_cast(expr);
+          case cpp_expr::kind_equals: return rebuild(expr, fold_lvalue(expr->getKid(0)), fold(expr->getKid(1)));
+          case cpp_expr::kind_question: {
+            cpp_expr *cond = fold(expr->getKid(0));
+            if (is_constant(cond)) {
+              num_folded++;
+              return fold(expr->getKid(is_true(cond) ? 1 : 2));
+            }
+            return rebuild(expr, cond, fold(expr->getKid(1)), fold(expr->getKid(2)));
+          }
+          case cpp_expr::kind_and_and:
+          case cpp_expr::kind_or_or: {
+            bool is_and = expr->getKind() == cpp_expr::kind_and_and;
+            cpp_expr *lhs = fold(expr->getKid(0));
+            if (is_constant(lhs) && is_true(lhs) != is_and) {
+              // false && x, true || x
+              return make_int(expr->getType(), !is_and);
+            }
+            cpp_expr *rhs = fold(expr->getKid(1));
+            if (is_constant(lhs)) {
+              // true && x, false || x
+              if (is_constant(rhs)) return make_int(expr->getType(), is_true(rhs));
+              if (rhs->getType()->getKind() == cpp_type::kind_bool) {
+                num_folded++;
+                return rhs;
+              }
+            }
+            return rebuild(expr, lhs, rhs);
+          }
+          default: {
+            cpp_expr *kid0 = expr->getKid(0) ? fold(expr->getKid(0)) : NULL;
+            cpp_expr *kid1 = expr->getKid(1) ? fold(expr->getKid(1)) : NULL;
+            cpp_expr *kid2 = expr->getKid(2) ? fold(expr->getKid(2)) : NULL;
+            if (kid0 && kid1 && expr->getKind() >= cpp_expr::kind_or && expr->getKind() <= cpp_expr::kind_mod) {
+              if (cpp_expr *result = fold_binary(expr, kid0, kid1)) return result;
+            }
+            return rebuild(expr, kid0, kid1, kid2);
+          }
+        }
+      }
+
+      /// Optimise a statement, returning a new one or NULL if it does nothing.
+      cpp_statement *optimise(cpp_statement *s) {
+        switch (s->getKind()) {
+          case cpp_statement::kind_compound: {
+            cpp_statement *result = copy(s);
+            *result->getStatementsAddr() = optimise_list(s->getStatements());
+            return result;
+          }
+          case cpp_statement::kind_expression: {
+            cpp_expr *expr = s->getExpression() ? fold(s->getExpression()) : NULL;
+            if (!expr || is_pure(expr)) {
+              num_removed += expr != NULL;
+              return NULL;
+            }
+            cpp_statement *result = copy(s);
+            result->setExpression(expr);
+            return result;
+          }
+          case cpp_statement::kind_declaration:
+          case cpp_statement::kind_return: {
+            cpp_statement *result = copy(s);
+            if (s->getExpression()) result->setExpression(fold(s->getExpression()));
+            return result;
+          }
+          case cpp_statement::kind_if: {
+            cpp_expr *cond = fold(s->getExpression());
+            if (is_constant(cond)) {
+              num_removed++;
+              cpp_statement *taken = is_true(cond) ? s->getStatements() : s->getElse();
+              return taken ? optimise(taken) : NULL;
+            }
+            cpp_statement *result = copy(s);
+            cpp_statement *then_s = optimise(s->getStatements());
+            result->setExpression(cond);
+            *result->getStatementsAddr() = then_s ? then_s : make_compound(NULL, NULL);
+            result->setElse(s->getElse() ? optimise(s->getElse()) : NULL);
+            return result;
+          }
+          case cpp_statement::kind_while: {
+            cpp_expr *cond = fold(s->getExpression());
+            if (is_constant(cond) && !is_true(cond)) {
+              num_removed++;
+              return NULL;
+            }
+            cpp_statement *result = copy(s);
+            cpp_statement *body = optimise(s->getStatements());
+            result->setExpression(cond);
+            *result->getStatementsAddr() = body ? body : make_compound(NULL, NULL);
+            return result;
+          }
+          case cpp_statement::kind_dowhile: {
+            cpp_statement *result = copy(s);
+            cpp_statement *body = optimise(s->getStatements());
+            result->setExpression(fold(s->getExpression()));
+            *result->getStatementsAddr() = body ? body : make_compound(NULL, NULL);
+            return result;
+          }
+          case cpp_statement::kind_for: return optimise_for(s);
+          default: return copy(s);
+        }
+      }
+
+      /// Optimise the bodies of all the functions and the initialisers of the global variables.
+      void optimise() {
+        cpp_scope *globals = parser.getGlobalScope();
+        for (cpp_scope::iterator i = globals->begin(); i != globals->end(); ++i) {
+          for (cpp_value *value = *i; value; value = value->getNextPolymorphic()) {
+            cpp_expr *init = value->getInit();
+            if (init && init->getKind() == cpp_expr::kind_statement) {
+              cpp_statement *body = optimise(init->getStatement());
+              value->setInit(new (arena) cpp_expr(cpp_expr::kind_statement, body ? body : make_compound(NULL, NULL)));
+            } else if (init) {
+              value->setInit(fold(init));
+            }
+          }
+        }
+      }
+
+      /// Constants made by folding.
+      unsigned get_num_folded() const {
+        return num_folded;
+      }
+
+      /// Loops unrolled.
+      unsigned get_num_unrolled() const {
+        return num_unrolled;
+      }
+
+      /// Statements and branches removed.
+      unsigned get_num_removed() const {
+        return num_removed;
+      }
+    };
+
+    #if OCTET_UNIT_TEST
+      class cpp_optimizer_unit_test {
+        static void run(const char *src, bool optimise, int *result, unsigned size) {
+          cpp_parser parser;
+          bool ok = parser.parse(src);
+          assert(ok);
+          if (optimise) {
+            cpp_optimizer optimizer(parser);
+            ok = optimizer.specialise("num_lights", 3) && !optimizer.specialise("missing", 1);
+            assert(ok);
+            optimizer.optimise();
+            assert(optimizer.get_num_unrolled() == 1 && optimizer.get_num_removed() >= 3 && optimizer.get_num_folded() >= 6);
+          }
+          cpp_vm_program program;
+          ok = cpp_vm_compiler(parser, program).compile("main");
+          assert(ok);
+          cpp_vm vm(program);
+          vm.set_uniform("num_lights", 3);
+          vm.bind_buffer(0, result, size * sizeof(int));
+          vm.dispatch(1);
+        }
+
+      public:
+        cpp_optimizer_unit_test() {
+          static const char src[] =
+            "layout(binding = 0) buffer b { int data[]; } buf;\n"
+            "layout (local_size_x = 8) in;\n"
+            "uniform int num_lights = 1;\n"
+            "const int scale = 2 * 3 + 1;\n"
+            "void main() {\n"
+            "  int i = int(gl_GlobalInvocationID.x);\n"
+            "  int sum = 0;\n"
+            "  for (int j = 0; j < num_lights; j++) {\n"
+            "    sum += (i + j) * scale;\n"
+            "  }\n"
+            "  if (num_lights > 4) sum = -1; else sum += 100 / (num_lights - 1);\n"
+            "  while (scale < 0) sum = 0;\n"
+            "  buf.data[i] = num_lights == 3 && scale == 7 ? sum : -2;\n"
+            "  return;\n"
+            "  buf.data[i] = -3;\n"
+            "}\n"
+          ;
+          int expected[8], result[8];
+          run(src, false, expected, 8);
+          run(src, true, result, 8);
+          for (unsigned i = 0; i != 8; ++i) {
+            assert(expected[i] == (int)(i * 3 + 3) * 7 + 50 && result[i] == expected[i]);
+          }
+        }
+      };
+
+      static cpp_optimizer_unit_test cpp_optimizer_unit_test;
+    #endif
+  }
+}
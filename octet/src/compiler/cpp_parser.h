@@ -233,36 +233,68 @@ namespace octet
     }
     #endif
 
+    // score a function against the argument types: 0 for no match, higher is better.
+    // each argument scores 3 for an exact match (or a constant of the same kind),
+    // 2 for an int constant to float and 1 for any other scalar conversion.
     unsigned doParametersMatch( dynarray< cpp_type * > &actualTypes, cpp_value *search ) {
       cpp_type *searchType = search->getType();
       assert( searchType->getKind() == cpp_type::kind_function );
-      //cpp_log(*searchType << "\n";
-      if( searchType->getScope()->size() != actualTypes.size() ) {
+      cpp_scope *scope = searchType->getScope();
+
+      // functions that return structures have a hidden "$return" parameter first.
+      cpp_scope::iterator formal = scope->begin();
+      if( searchType->getIsReturnByValue() ) {
+        ++formal;
+      }
+      if( (size_t)( scope->end() - formal ) != actualTypes.size() ) {
         return 0;
       }
 
-      cpp_scope *scope = searchType->getScope();
-      //cpp_log("num params ok\n";
       dynarray< cpp_type * >::iterator actualType = actualTypes.begin();
-    
-      size_t numExact = 0;
-      size_t numPartial = 0;
-      for( cpp_scope::iterator formal = scope->begin(); formal != scope->end(); ++formal, ++actualType ) {
+      unsigned score = 1;
+      for( ; formal != scope->end(); ++formal, ++actualType ) {
         cpp_type *formalType = (*formal)->getType();
-        //cpp_log(*formalType << " vs " << **actualType << "\n";
+        unsigned formalKind = formalType->getKind();
+        unsigned actualKind = (*actualType)->getKind();
         if( *formalType == **actualType ) { 
-          numExact++;
-        } else if( canCastTo( formalType, *actualType ) ) {
-          numPartial++;
+          score += 3;
+        } else if( !canCastTo( formalType, *actualType ) ) {
+          return 0;
+        } else if( actualKind == cpp_type::kind_cint && ( formalKind == cpp_type::kind_int || formalKind == cpp_type::kind_bool ) ) {
+          score += 3;
+        } else if( actualKind == cpp_type::kind_cfloat && ( formalKind == cpp_type::kind_float || formalKind == cpp_type::kind_half ) ) {
+          score += 3;
+        } else if( actualKind == cpp_type::kind_cint ) {
+          score += 2;
+        } else {
+          score += 1;
         }
       }
-      //cpp_log(numExact << " exact    " << numPartial << "partial\n";
-      return numExact == actualTypes.size() ? 2 : numPartial != 0 ? 1 : 0;
+      return score;
     }
 
+    /// Parser for a C-like shader language.
+    ///
+    /// The syntax tree lives in an arena owned by the parser and identifiers
+    /// are interned, so reset() frees a whole translation unit at once and
+    /// parsing the next one reuses the same memory.
+    ///
+    /// Example
+    ///
+    ///     cpp_parser parser;
+    ///     for (unsigned i = 0; i != num_variants; ++i) {
+    ///       parser.reset();
+    ///       parser.parse(variant_source[i]);
+    ///       cpp_scope *globals = parser.getGlobalScope();
+    ///       ...
+    ///     }
     class cpp_parser : cpp_token_enum {
       cpp_preprocessor preprocessor;
       cpp_lexer lexer;
+      cpp_arena arena;
+      cpp_symbols symbols;
+      unsigned curSymbol;
+      unsigned returnSymbol;
       bool dontReadLine;
       cpp_tokens::token_type curToken;
       int line_number;
@@ -290,7 +322,27 @@ namespace octet
       cpp_type *halfTypes1D[ 4 ];
       cpp_type *halfTypes2D[ 4 ][ 4 ];
 
-      enum { debug = 1, trace_parse = 1 };
+      // GLSL layout( ... ) qualifiers of the current declaration.
+      unsigned layoutSymbol;
+      unsigned bufferSymbol;
+
+      // GLSL ES qualifiers, also not reserved in Cg.
+      unsigned attributeSymbol;
+      unsigned varyingSymbol;
+      unsigned precisionSymbol;
+      unsigned precisionSymbols[ 3 ];
+      unsigned floatPrecision;
+      bool hasLayout;
+      bool layoutStd140;
+      unsigned layoutBinding;
+      unsigned localSize[ 3 ];
+
+      // builtin types and intrinsics sit at the bottom of the arena and survive reset().
+      cpp_arena::mark builtinMark;
+      dynarray< cpp_type * > builtinTypedefs;
+      unsigned builtinNumAbstract;
+
+      enum { debug = 0, trace_parse = 0 };
 
       enum toks  { tok_asm = cpp_tokens::tok_last, tok_asm_fragment, tok_auto,tok_bool,tok_break,tok_case,tok_catch,tok_char,tok_class,tok_column,tok_major,tok_compile,tok_const,tok_const_cast,tok_continue,tok_decl,tok_default,tok_delete,tok_discard,tok_do,tok_double,tok_dword,tok_dynamic_cast,tok_else,tok_emit,tok_enum,tok_explicit,tok_extern,tok_false,tok_fixed,tok_float,tok_for,tok_friend,tok_get,tok_goto,tok_half,tok_if,tok_in,tok_inline,tok_inout,tok_int,tok_interface,tok_long,tok_matrix,tok_mutable,tok_namespace,tok_new,tok_operator,tok_out,tok_packed,tok_pass,tok_pixelfragment,tok_pixelshader,tok_private,tok_protected,tok_public,tok_register,tok_reinterpret_cast,tok_return,tok_row,tok_sampler,tok_sampler_state,tok_sampler1D,tok_sampler2D,tok_sampler3D,tok_samplerCUBE,tok_samplerRECT,tok_shared,tok_short,tok_signed,tok_sizeof,tok_static,tok_static_cast,tok_string,tok_struct,tok_switch,tok_technique,tok_template,tok_texture,tok_texture1D,tok_texture2D,tok_texture3D,tok_textureCUBE,tok_textureRECT,tok_this,tok_throw,tok_true,tok_try,tok_typedef,tok_typeid,tok_typename,tok_uniform,tok_union,tok_unsigned,tok_using,tok_vector,tok_vertexfragment,tok_vertexshader,tok_virtual,tok_void,tok_volatile,tok_while, tok_lastlast };
 
@@ -325,10 +377,16 @@ namespace octet
             }
           } else if( lexer.type() == cpp_tokens::tok_identifier ) {
             curToken = cpp_tokens::tok_identifier;
+            curSymbol = symbols.intern( lexer.id_src(), lexer.id_length() );
             if( debug ) {
               printf("# tok %s\n", lexer.id());
             }
             return;
+          } else if( (int)lexer.type() >= tok_texture && (int)lexer.type() <= tok_textureRECT ) {
+            // Cg keywords that are GLSL functions, eg. texture2D( s, uv ).
+            curToken = cpp_tokens::tok_identifier;
+            curSymbol = symbols.intern( getTokenName( lexer.type() ) );
+            return;
           } else {
             curToken = lexer.type();
             if( debug ) {
@@ -344,29 +402,54 @@ namespace octet
         const char *params;
       };
     
-      dictionary< cpp_value * > values;
-      dictionary< cpp_type * > typedefs;
-      dictionary< cpp_type * > tags;
+      // typedefs and struct tags indexed by symbol.
+      dynarray< cpp_type * > typedefs;
+      dynarray< cpp_type * > tags;
+
+      // scratch space for function call matching.
+      dynarray< cpp_type * > actualTypes;
 
-      cpp_type *findTypedef( const char *name ) {
-        int index = typedefs.get_index(name);
-        return index == -1 ? NULL : typedefs.get_value(index);
+      cpp_type *findTypedef( unsigned symbol ) {
+        return symbol < typedefs.size() ? typedefs[ symbol ] : NULL;
       }
     
-      cpp_type *makeTypedef( cpp_type *type, const char *name ) {
-        typedefs[name] = type;
+      cpp_type *makeTypedef( cpp_type *type, unsigned symbol ) {
+        setSymbolType( typedefs, symbol, type );
         return type;
       }
     
-      cpp_type *findTag( const char *name ) {
-        int index = tags.get_index(name);
-        return index == -1 ? NULL : tags.get_value(index);
+      cpp_type *makeTypedef( cpp_type *type, const char *name ) {
+        return makeTypedef( type, symbols.intern( name ) );
+      }
+    
+      cpp_type *findTag( unsigned symbol ) {
+        return symbol < tags.size() ? tags[ symbol ] : NULL;
       }
     
-      cpp_type *makeTag( cpp_type *type, const char *name ) {
-        tags[name] = type;
+      cpp_type *makeTag( cpp_type *type, unsigned symbol ) {
+        setSymbolType( tags, symbol, type );
         return type;
       }
+
+      void setSymbolType( dynarray< cpp_type * > &types, unsigned symbol, cpp_type *type ) {
+        if( symbol >= types.size() ) {
+          unsigned oldSize = types.size();
+          types.resize( symbols.size() > symbol ? symbols.size() : symbol + 1 );
+          memset( types.data() + oldSize, 0, ( types.size() - oldSize ) * sizeof( cpp_type * ) );
+        }
+        types[ symbol ] = type;
+      }
+
+      cpp_value *makeValue( cpp_type *type, unsigned symbol ) {
+        return new (arena) cpp_value( type, symbol, symbols.get_name( symbol ) );
+      }
+
+      // eg. float4 is an array of 4 packed floats.
+      cpp_type *makeVectorType( cpp_type::kind_enum kind, unsigned dim ) {
+        cpp_type *subType = new (arena) cpp_type( kind );
+        subType->setIsPacked( true );
+        return new (arena) cpp_type( cpp_type::kind_array, subType, dim );
+      }
       unsigned lineNumber() {
         return 0;
       }
@@ -385,7 +468,7 @@ namespace octet
     
       cpp_expr *makeIntType( cpp_expr *lhs ) {
         if( lhs->getType()->getKind() != cpp_type::kind_int ) {
-          return new cpp_expr( cpp_expr::kind_cast, intType, lhs );
+          return new (arena) cpp_expr( cpp_expr::kind_cast, intType, lhs );
         } else {
           return lhs;
         }
@@ -393,9 +476,9 @@ namespace octet
     
       cpp_expr *makeBoolType( cpp_expr *lhs ) {
         if( lhs->getType()->getKind() != cpp_type::kind_bool ) {
-          cpp_expr *zero = new cpp_expr( cpp_expr::kind_cast, intType, (long long)0 );
-          zero = new cpp_expr( cpp_expr::kind_cast, lhs->getType(), zero );
-          return new cpp_expr( cpp_expr::kind_ne, boolType, lhs, zero );
+          cpp_expr *zero = new (arena) cpp_expr( cpp_expr::kind_int_value, intType, (long long)0 );
+          zero = new (arena) cpp_expr( cpp_expr::kind_cast, lhs->getType(), zero );
+          return new (arena) cpp_expr( cpp_expr::kind_ne, boolType, lhs, zero );
         } else {
           return lhs;
         }
@@ -404,9 +487,9 @@ namespace octet
       cpp_expr *makeVectorBoolType( cpp_expr *lhs ) {
         if( lhs->getType()->getIsPacked() ) {
           int dim = lhs->getType()->getDimension();
-          cpp_expr *zero = new cpp_expr( cpp_expr::kind_cast, intTypes1D[ dim-1 ], (long long)0 );
-          zero = new cpp_expr( cpp_expr::kind_cast, lhs->getType(), zero );
-          return new cpp_expr( cpp_expr::kind_ne, boolTypes1D[ dim-1 ], lhs, zero );
+          cpp_expr *zero = new (arena) cpp_expr( cpp_expr::kind_int_value, intType, (long long)0 );
+          zero = new (arena) cpp_expr( cpp_expr::kind_cast, lhs->getType(), zero );
+          return new (arena) cpp_expr( cpp_expr::kind_ne, boolTypes1D[ dim-1 ], lhs, zero );
         } else {
           return makeBoolType( lhs );
         }
@@ -415,7 +498,7 @@ namespace octet
       // generate code to cast src to destType    
       cpp_expr *makeCast( cpp_expr *src, cpp_type *destType ) {
         //cpp_type *srcType = src->getType();
-        return new cpp_expr( cpp_expr::kind_cast, destType, src );
+        return new (arena) cpp_expr( cpp_expr::kind_cast, destType, src );
       }
 
       // called twice in the case of binary operators to convert the two types into a common type.
@@ -453,6 +536,139 @@ namespace octet
         }
       }
     
+      // binary operators with a matrix on one side. Only * is a matrix product,
+      // the others work on each element.
+      cpp_expr *makeMatrixOp( cpp_expr::kind_enum kind, cpp_expr *lhs, cpp_expr *rhs ) {
+        cpp_type *lhsType = lhs->getType();
+        cpp_type *rhsType = rhs->getType();
+        if( lhsType->getIsScalar() ) {
+          lhs = lhsType->getKind() == cpp_type::kind_float ? lhs : makeCast( lhs, floatType );
+          return new (arena) cpp_expr( kind, rhsType, lhs, rhs );
+        } else if( rhsType->getIsScalar() ) {
+          rhs = rhsType->getKind() == cpp_type::kind_float ? rhs : makeCast( rhs, floatType );
+          return new (arena) cpp_expr( kind, lhsType, lhs, rhs );
+        } else if( kind != cpp_expr::kind_star ) {
+          return *lhsType == *rhsType ? new (arena) cpp_expr( kind, lhsType, lhs, rhs ) : NULL;
+        } else if( lhsType->getIsVector() ) {
+          // row vector * matrix has a value for each column.
+          return new (arena) cpp_expr( kind, floatTypes1D[ rhsType->getDimension() - 1 ], lhs, rhs );
+        } else if( rhsType->getIsVector() ) {
+          // matrix * column vector has a value for each row.
+          return new (arena) cpp_expr( kind, floatTypes1D[ lhsType->getSubType()->getDimension() - 1 ], lhs, rhs );
+        } else if( lhsType->getIsMatrix() && rhsType->getIsMatrix() ) {
+          return new (arena) cpp_expr( kind, floatTypes2D[ lhsType->getSubType()->getDimension() - 1 ][ rhsType->getDimension() - 1 ], lhs, rhs );
+        }
+        return NULL;
+      }
+
+      // evaluate an array dimension such as [ 4 ] or [ N * 2 ].
+      bool getConstantInt( cpp_expr *expr, long long &result ) {
+        switch( expr->getKind() ) {
+          case cpp_expr::kind_int_value: {
+            result = (long long)expr->getIntValue();
+            return true;
+          }
+          case cpp_expr::kind_cast: {
+            return expr->getType()->getIsScalar() && !expr->getType()->getIsFloat() && getConstantInt( expr->getKid( 0 ), result );
+          }
+          case cpp_expr::kind_value: {
+            // const int max_lights = 4;
+            cpp_value *value = expr->getValue();
+            return value->getType()->getIsConst() && value->getInit() && getConstantInt( value->getInit(), result );
+          }
+          case cpp_expr::kind_plus: case cpp_expr::kind_minus: case cpp_expr::kind_star:
+          case cpp_expr::kind_divide: case cpp_expr::kind_shift_left: case cpp_expr::kind_shift_right: {
+            long long lhs = 0, rhs = 0;
+            if( !getConstantInt( expr->getKid( 0 ), lhs ) || !getConstantInt( expr->getKid( 1 ), rhs ) ) {
+              return false;
+            }
+            switch( expr->getKind() ) {
+              case cpp_expr::kind_plus: result = lhs + rhs; break;
+              case cpp_expr::kind_minus: result = lhs - rhs; break;
+              case cpp_expr::kind_star: result = lhs * rhs; break;
+              case cpp_expr::kind_divide: if( rhs == 0 ) return false; result = lhs / rhs; break;
+              case cpp_expr::kind_shift_left: result = lhs << rhs; break;
+              default: result = lhs >> rhs; break;
+            }
+            return true;
+          }
+          default: {
+            return false;
+          }
+        }
+      }
+
+      // GLSL layout( std140, binding = 0 ) or layout( local_size_x = 64 ).
+      bool parseLayout() {
+        getNext();
+        if( !expect( tok_lparen ) ) {
+          return false;
+        }
+        getNext();
+        while( (int)curToken == tok_identifier ) {
+          const char *name = symbols.get_name( curSymbol );
+          getNext();
+          unsigned value = 0;
+          if( (int)curToken == tok_equals ) {
+            getNext();
+            if( !expect( tok_int_constant ) ) {
+              return false;
+            }
+            value = (unsigned)lexer.value();
+            getNext();
+          }
+          if( !strcmp( name, "binding" ) ) {
+            layoutBinding = value;
+          } else if( !strcmp( name, "std140" ) ) {
+            layoutStd140 = true;
+          } else if( !strncmp( name, "local_size_", 11 ) && name[ 11 ] >= 'x' && name[ 11 ] <= 'z' && !name[ 12 ] ) {
+            localSize[ name[ 11 ] - 'x' ] = value ? value : 1;
+          }
+          if( (int)curToken != tok_comma ) {
+            break;
+          }
+          getNext();
+        }
+        if( !expect( tok_rparen ) ) {
+          return false;
+        }
+        getNext();
+        hasLayout = true;
+        return true;
+      }
+
+      // parse ( a, b, c ) into ( ( a, b ), c ) and leave the argument types in actualTypes.
+      bool parseArguments( cpp_expr *&args, unsigned &numArgs ) {
+        args = NULL;
+        numArgs = 0;
+        getNext();
+        if( (int)curToken != tok_rparen ) {
+          for(;;) {
+            cpp_expr *arg = parseExpression( 1 );
+            if( arg == NULL ) {
+              return false;
+            }
+            args = args ? new (arena) cpp_expr( cpp_expr::kind_comma, arg->getType(), args, arg ) : arg;
+            numArgs++;
+            if( (int)curToken != tok_comma ) {
+              break;
+            }
+            getNext();
+          }
+        }
+        if( !expect( tok_rparen ) ) {
+          return false;
+        }
+        getNext();
+
+        // arguments may contain calls, so fill this in last.
+        actualTypes.resize( 0 );
+        for( unsigned i = 0; i != numArgs; ++i ) {
+          actualTypes.push_back( cpp_expr::getArg( args, numArgs, i )->getType() );
+        }
+        return true;
+      }
+
       cpp_expr *parseDeclarators( cpp_type *type, bool allowFunctionBodies, unsigned finalToken, bool allowAbstract ) {
         cpp_expr *expr = NULL;
         for(;;) {
@@ -469,10 +685,12 @@ namespace octet
             if( isFunction && allowFunctionBodies ) {
               cpp_value *search = found;
               for(;;) {
-                string l, r;
-                cpp_log("checking %s == %s\n", search->getType()->toString(l), search->getType()->toString(r));
+                if( debug ) {
+                  string l, r;
+                  cpp_log("checking %s == %s\n", search->getType()->toString(l), search->getType()->toString(r));
+                }
                 if( *search->getType() == *value->getType() ) {
-                  cpp_log("*** same function!\n");
+                  if( debug ) cpp_log("*** same function!\n");
                   // get existing function, but update the function type (parameter names may differ)
                   search->setType( value->getType() );
                   break;
@@ -480,7 +698,7 @@ namespace octet
                 cpp_value *prev = search;
                 search = search->getNextPolymorphic();
                 if( search == NULL ) {
-                  cpp_log("*** new function!\n");
+                  if( debug ) cpp_log("*** new function!\n");
                   // insert new function at end
                   prev->setNextPolymorphic( value );
                   break;
@@ -498,26 +716,28 @@ namespace octet
               cpp_log("error: '%s' has been redefined\n", value->getName());
               return NULL;
             }
-            cpp_expr *val = new cpp_expr( cpp_expr::kind_value, value );
+            cpp_expr *val = new (arena) cpp_expr( cpp_expr::kind_value, value );
             cpp_expr *rhs = makeCast( init, value->getType() );
-            cpp_expr *assign = new cpp_expr( cpp_expr::kind_equals, value->getType(), val, rhs );
-            expr = expr ? new cpp_expr( cpp_expr::kind_comma, assign->getType(), expr, assign ) : assign;
+            cpp_expr *assign = new (arena) cpp_expr( cpp_expr::kind_equals, value->getType(), val, rhs );
+            expr = expr ? new (arena) cpp_expr( cpp_expr::kind_comma, assign->getType(), expr, assign ) : assign;
           } else if( (int)curToken == tok_lbrace && isFunction ) {
             cpp_scope *saveScope = curScope;
             curScope = value->getType()->getScope();
-            string s;
-            cpp_log("parsing body %s\n", curScope->toString(s));
+            if( debug ) {
+              string s;
+              cpp_log("parsing body %s\n", curScope->toString(s));
+            }
             cpp_statement *functionBody = parseStatement();
             curScope = saveScope;
             if( !functionBody ) {
               return NULL;
             }
 
-            cpp_log("[] done function %s\n", value->getName());
+            if( debug ) cpp_log("[] done function %s\n", value->getName());
           
             //functionBody->end()
           
-            value->setInit( new cpp_expr( cpp_expr::kind_statement, functionBody ) );
+            value->setInit( new (arena) cpp_expr( cpp_expr::kind_statement, functionBody ) );
             finalToken = 0;
             break;
           }
@@ -535,14 +755,14 @@ namespace octet
         }
 
         if( expr == NULL ) {
-          expr = new cpp_expr( cpp_expr::kind_nop, voidType );
+          expr = new (arena) cpp_expr( cpp_expr::kind_nop, voidType );
         }
         return expr;
       }
 
     
       cpp_value *parseDeclarator( cpp_type *type, bool allowAbstract ) {
-        string name;
+        unsigned name = 0;
 
         if( (int)curToken == tok_lparen ) {
           // eg. int (x[5])();
@@ -552,15 +772,15 @@ namespace octet
             return NULL;
           }
           getNext();
-          name = value->getName();
+          name = value->getSymbol();
           type = value->getType();
         } else if( allowAbstract && ( (int)curToken == tok_rparen || (int)curToken == tok_comma ) ) {
           // eg. float f( int, int, float );
           char tmp[ 32 ];
           sprintf( tmp, "__%d", numAbstract++ );
-          name = tmp;
+          name = symbols.intern( tmp );
         } else if( (int)curToken == tok_identifier ) {
-          name = lexer.id();
+          name = curSymbol;
           getNext();
         
           cpp_type *typeDef = findTypedef( name );
@@ -579,30 +799,27 @@ namespace octet
         bool first = true;
         while( (int)curToken == tok_lbracket ) {
           getNext();
-          //cpp_expr *dim = parseExpression( 0 );
+
+          // [] is an unsized array, eg. the last member of a buffer block.
+          long long dimension = 0;
+          if( (int)curToken != tok_rbracket ) {
+            cpp_expr *dim = parseExpression( 0 );
+            if( dim == NULL || !getConstantInt( dim, dimension ) || dimension <= 0 || dimension > 0xffff ) {
+              cpp_log("error: expecting constant int in []\n");
+              return NULL;
+            }
+          }
           if( !expect( tok_rbracket ) ) {
             return NULL;
           }
           getNext();
-        
-          // translate immediately.
-          /*BasicBlock *bb = NULL;
-          Value *cexpr = dim->translate_rvalue( bb, *this, true );
-          if( cexpr == NULL || !isa< ConstantInt >( cexpr ) ) {
-            cpp_log("error: expecting constant int in []\n");
-            return NULL;
-          }
-        
-          uint64_t dimension = cast< ConstantInt >( cexpr )->getValue().getLimitedValue();
-          */
-          uint64_t dimension = 0;
 
           if( first ) {
-            cpp_type *new_type = new cpp_type( cpp_type::kind_array, type, (unsigned)dimension );
+            cpp_type *new_type = new (arena) cpp_type( cpp_type::kind_array, type, (unsigned)dimension );
             returned_type = working_type = new_type;
             first = false;
           } else {
-            cpp_type *new_type = new cpp_type( cpp_type::kind_array, type, (unsigned)dimension );
+            cpp_type *new_type = new (arena) cpp_type( cpp_type::kind_array, type, (unsigned)dimension );
             working_type->setSubType( new_type );
             working_type = new_type;
           }
@@ -611,18 +828,18 @@ namespace octet
         // only one function allowed in type      
         if( (int)curToken == tok_lparen ) {
           cpp_scope *saveScope = curScope;
-          curScope = new cpp_scope( curScope );
+          curScope = new (arena) cpp_scope( arena, curScope );
         
-          cpp_type *new_type = new cpp_type( cpp_type::kind_function );
+          cpp_type *new_type = new (arena) cpp_type( cpp_type::kind_function );
           new_type->setScope( curScope );
           getNext();
         
           unsigned paramOffset = 0;
         
           if( returned_type->getIsPassByPtr() ) {
-            cpp_type *rtype = new cpp_type( *returned_type );
+            cpp_type *rtype = new (arena) cpp_type( *returned_type );
             rtype->setIsOut( true );
-            cpp_value *value = new cpp_value( rtype, "$return" );
+            cpp_value *value = makeValue( rtype, returnSymbol );
             value->setOffset( paramOffset++ );
             curScope->addValue( value );
             new_type->setSubType( voidType );
@@ -673,7 +890,7 @@ namespace octet
           return NULL;
         }
 
-        cpp_value *value = new cpp_value( returned_type, name );
+        cpp_value *value = makeValue( returned_type, name );
 
         if( (int)curToken == tok_colon ) {
           getNext();
@@ -686,14 +903,14 @@ namespace octet
             if( !expect( tok_identifier ) ) {
               return NULL;
             }
-            value->setSemantic( lexer.id() );
+            value->setSemantic( curSymbol, symbols.get_name( curSymbol ) );
             getNext();
             if( !expect( tok_rparen ) ) {
               return NULL;
             }
             getNext();
           } else if( expect( tok_identifier ) ) {
-            value->setSemantic( lexer.id() );
+            value->setSemantic( curSymbol, symbols.get_name( curSymbol ) );
             getNext();
           } else {
             return NULL;
@@ -734,12 +951,40 @@ namespace octet
         bool isUniform = false;
         bool isConst = false;
         bool isPacked = false;
+        bool isBuffer = false;
+        bool isAttribute = false;
+        bool isVarying = false;
    
         for(;;) {
           switch( (int)curToken ) {
             case tok_identifier:
             {
-              cpp_type *typeDef = findTypedef( lexer.id() );
+              // GLSL qualifiers that are not reserved in Cg.
+              if( curSymbol == layoutSymbol && !curScope->lookup( layoutSymbol ) ) {
+                if( !parseLayout() ) {
+                  return NULL;
+                }
+                break;
+              }
+              if( curSymbol == bufferSymbol && !thisType && !curScope->lookup( bufferSymbol ) ) {
+                // buffer name { members } instance; is a structure in memory.
+                isBuffer = true;
+                getNext();
+                goto structBody;
+              }
+              if( ( curSymbol == attributeSymbol || curSymbol == varyingSymbol ) && !thisType && !curScope->lookup( curSymbol ) ) {
+                isAttribute |= curSymbol == attributeSymbol;
+                isVarying |= curSymbol == varyingSymbol;
+                getNext();
+                break;
+              }
+              if( ( curSymbol == precisionSymbols[ 0 ] || curSymbol == precisionSymbols[ 1 ] || curSymbol == precisionSymbols[ 2 ] ) && !curScope->lookup( curSymbol ) ) {
+                // lowp, mediump and highp make no difference to us.
+                getNext();
+                break;
+              }
+
+              cpp_type *typeDef = findTypedef( curSymbol );
               if( typeDef == NULL ) {
                 goto finish;
               }
@@ -755,18 +1000,18 @@ namespace octet
             case tok_struct:
             {
               getNext();
-            
+            structBody:
               if( (int)curToken != tok_lbrace ) {
                 expect( tok_identifier );
-                string structId = lexer.id();
+                unsigned structId = curSymbol;
                 getNext();
               
                 if( cpp_type *tagType = findTag( structId ) ) {
-                  printf( "*** old tag %s\n", structId.c_str() );
+                  if( debug ) printf( "*** old tag %s\n", symbols.get_name( structId ) );
                   thisType = tagType;
                 } else {
-                  printf( "*** new tag %s\n", structId.c_str() );
-                  thisType = new cpp_type( cpp_type::kind_struct );
+                  if( debug ) printf( "*** new tag %s\n", symbols.get_name( structId ) );
+                  thisType = new (arena) cpp_type( cpp_type::kind_struct );
                   thisType->setScope( NULL );
                   makeTypedef( thisType, structId );
                   makeTag( thisType, structId );
@@ -774,8 +1019,8 @@ namespace octet
               } else {
                 char tmp[ 20 ];
                 sprintf( tmp, "__anon%d", structNumber++ );
-                string structId = tmp;
-                thisType = new cpp_type( cpp_type::kind_struct );
+                unsigned structId = symbols.intern( tmp );
+                thisType = new (arena) cpp_type( cpp_type::kind_struct );
                 thisType->setScope( NULL );
                 makeTypedef( thisType, structId );
                 makeTag( thisType, structId );
@@ -788,7 +1033,7 @@ namespace octet
                 }
                 getNext();
 
-                cpp_scope *scope = new cpp_scope( NULL );
+                cpp_scope *scope = new (arena) cpp_scope( arena, NULL );
                 thisType->setScope( scope );
                 unsigned structOffset = 0;
 
@@ -827,12 +1072,12 @@ namespace octet
             case tok_int: newType = intType; goto typeCommon;
             case tok_float: newType = floatType; goto typeCommon;
             case tok_half: newType = floatType; goto typeCommon;
-            case tok_sampler: newType = new cpp_type( cpp_type::kind_sampler ); goto typeCommon;
-            case tok_sampler1D: newType = new cpp_type( cpp_type::kind_sampler1D ); goto typeCommon;
-            case tok_sampler2D: newType = new cpp_type( cpp_type::kind_sampler2D ); goto typeCommon;
-            case tok_sampler3D: newType = new cpp_type( cpp_type::kind_sampler3D ); goto typeCommon;
-            case tok_samplerRECT: newType = new cpp_type( cpp_type::kind_samplerRECT ); goto typeCommon;
-            case tok_samplerCUBE: newType = new cpp_type( cpp_type::kind_samplerCUBE ); goto typeCommon;
+            case tok_sampler: newType = new (arena) cpp_type( cpp_type::kind_sampler ); goto typeCommon;
+            case tok_sampler1D: newType = new (arena) cpp_type( cpp_type::kind_sampler1D ); goto typeCommon;
+            case tok_sampler2D: newType = new (arena) cpp_type( cpp_type::kind_sampler2D ); goto typeCommon;
+            case tok_sampler3D: newType = new (arena) cpp_type( cpp_type::kind_sampler3D ); goto typeCommon;
+            case tok_samplerRECT: newType = new (arena) cpp_type( cpp_type::kind_samplerRECT ); goto typeCommon;
+            case tok_samplerCUBE: newType = new (arena) cpp_type( cpp_type::kind_samplerCUBE ); goto typeCommon;
             typeCommon:
             {
               if( thisType ) {
@@ -882,15 +1127,25 @@ namespace octet
         }
       finish:
         if( thisType == NULL ) {
-          if( isIn | isOut | isUniform| isConst| isPacked ) {
+          // layout( local_size_x = 64 ) in; has no type.
+          if( ( isIn | isOut | isUniform| isConst| isPacked| isAttribute| isVarying ) && !hasLayout ) {
             cpp_log("error: qualifier without type\n");
           }
-        } else {
+        } else if( isIn | isOut | isUniform| isConst| isPacked| isBuffer| isAttribute| isVarying ) {
+          // qualify a copy, not the shared type.
+          thisType = new (arena) cpp_type( *thisType );
           thisType->setIsConst( isConst );
           thisType->setIsUniform( isUniform );
           thisType->setIsIn( isIn );
           thisType->setIsOut( isOut );
           thisType->setIsPacked( isPacked );
+          thisType->setIsAttribute( isAttribute );
+          thisType->setIsVarying( isVarying );
+          if( isBuffer ) {
+            thisType->setIsBuffer( true );
+            thisType->setIsStd140( layoutStd140 );
+            thisType->setBinding( layoutBinding );
+          }
         }
         return thisType;
       }
@@ -899,9 +1154,9 @@ namespace octet
         cpp_statement *result = NULL;
         if( (int)curToken == tok_lbrace ) {
           cpp_scope *saveScope = curScope;
-          curScope = new cpp_scope( curScope );
+          curScope = new (arena) cpp_scope( arena, curScope );
         
-          result = new cpp_statement( cpp_statement::kind_compound );
+          result = new (arena) cpp_statement( cpp_statement::kind_compound );
           result->setScope( curScope );
           getNext();
           cpp_statement **prev = result->getStatementsAddr();
@@ -929,18 +1184,26 @@ namespace octet
             if( expr == NULL ) {
               return NULL;
             }
-            result = new cpp_statement( cpp_statement::kind_return );
+            result = new (arena) cpp_statement( cpp_statement::kind_return );
             result->setExpression( expr );
           } else {
-            result = new cpp_statement( cpp_statement::kind_return );
+            result = new (arena) cpp_statement( cpp_statement::kind_return );
           }
           if( !expect( tok_semicolon ) ) {
             return NULL;
           }
           getNext();
-        } else if( (int)curToken == tok_discard ) {
-          getNext();
-          result = new cpp_statement( cpp_statement::kind_return );
+        } else if( (int)curToken == tok_discard || (int)curToken == tok_break || (int)curToken == tok_continue || (int)curToken == tok_semicolon ) {
+          cpp_statement::kind_enum kind =
+            (int)curToken == tok_discard ? cpp_statement::kind_discard :
+            (int)curToken == tok_break ? cpp_statement::kind_break :
+            (int)curToken == tok_continue ? cpp_statement::kind_continue :
+            cpp_statement::kind_expression
+          ;
+          if( (int)curToken != tok_semicolon ) {
+            getNext();
+          }
+          result = new (arena) cpp_statement( kind );
           if( !expect( tok_semicolon ) ) {
             return NULL;
           }
@@ -957,9 +1220,9 @@ namespace octet
           getNext();
 
           cpp_scope *saveScope = curScope;
-          curScope = new cpp_scope( curScope );
+          curScope = new (arena) cpp_scope( arena, curScope );
 
-          result = new cpp_statement( isFor ? cpp_statement::kind_for : isIf ? cpp_statement::kind_if : cpp_statement::kind_while );
+          result = new (arena) cpp_statement( isFor ? cpp_statement::kind_for : isIf ? cpp_statement::kind_if : cpp_statement::kind_while );
           result->setScope( curScope );
         
           cpp_expr *expr = NULL;
@@ -976,17 +1239,30 @@ namespace octet
           }
 
           if( isFor ) {
+            // any of the three may be empty, eg. for( ;; )
             if( !expect( tok_semicolon ) ) {
               return NULL;
             }
             getNext();
-            cpp_expr *expr2 = parseExpression();
+            cpp_expr *expr2 = NULL;
+            if( (int)curToken != tok_semicolon ) {
+              expr2 = parseExpression();
+              if( !expr2 ) {
+                return NULL;
+              }
+            }
             if( !expect( tok_semicolon ) ) {
               return NULL;
             }
             getNext();
-            cpp_expr *expr3 = parseExpression();
-            expr = new cpp_expr( cpp_expr::kind_for, NULL, expr, expr2, expr3 );
+            cpp_expr *expr3 = NULL;
+            if( (int)curToken != tok_rparen ) {
+              expr3 = parseExpression();
+              if( !expr3 ) {
+                return NULL;
+              }
+            }
+            expr = new (arena) cpp_expr( cpp_expr::kind_for, NULL, expr, expr2, expr3 );
           }
         
           result->setExpression( expr );
@@ -1008,7 +1284,7 @@ namespace octet
             if( else_stmt == NULL ) {
               return NULL;
             }
-            *result->getNextAddr() = else_stmt;
+            result->setElse( else_stmt );
           }
         
           curScope = saveScope;
@@ -1016,7 +1292,7 @@ namespace octet
         } else if( (int)curToken == tok_do ) {
           getNext();
 
-          result = new cpp_statement( cpp_statement::kind_dowhile );
+          result = new (arena) cpp_statement( cpp_statement::kind_dowhile );
 
           cpp_statement *stmt = parseStatement();
           if( stmt == NULL || !expect( tok_while ) ) {
@@ -1034,20 +1310,20 @@ namespace octet
             return NULL;
           }
           result->setExpression( expr );
-          /*if( !expect( tok_semicolon ) ) {
+          if( !expect( tok_semicolon ) ) {
             return NULL;
           }
-          getNext();*/
+          getNext();
           return result;
         } else if( cpp_type *type = parseDeclspec() ) {
-          result = new cpp_statement( cpp_statement::kind_declaration );
+          result = new (arena) cpp_statement( cpp_statement::kind_declaration );
           cpp_expr *init = parseDeclarators( type, false, tok_semicolon, false );
           if( init == NULL ) {
             return NULL;
           }
           result->setExpression( init );
         } else if( cpp_expr *expr = parseExpression() ) {
-          result = new cpp_statement( cpp_statement::kind_expression );
+          result = new (arena) cpp_statement( cpp_statement::kind_expression );
           result->setExpression( expr );
           if( !expect( tok_semicolon ) ) {
             return NULL;
@@ -1060,93 +1336,135 @@ namespace octet
         return result;
       }
     
-      cpp_expr *parseExpression( unsigned minPrecidence=0 ) {
+      // ( arguments ) after a type name
+      cpp_expr *parseConstructor( cpp_type *type ) {
+        if( !expect( tok_lparen ) ) {
+          return NULL;
+        }
+        cpp_expr *args = NULL;
+        unsigned numArgs = 0;
+        if( !parseArguments( args, numArgs ) ) {
+          return NULL;
+        }
+        if( numArgs == 0 ) {
+          cpp_log("error: constructor needs arguments\n");
+          return NULL;
+        }
+        cpp_expr *result = new (arena) cpp_expr( cpp_expr::kind_init, type, args );
+        result->setNumArgs( numArgs );
+        return result;
+      }
+
+      // if "primary" is not NULL, it is the first term of the expression.
+      cpp_expr *parseExpression( unsigned minPrecidence=0, cpp_expr *primary=NULL ) {
         cpp_expr *result = 0;
         if( trace_parse ) {
           cpp_log("[+] expr\n");
         }
-        if( (int)curToken == tok_minus || (int)curToken == tok_plus ) {
-          //unsigned op = curToken;
+        if( primary ) {
+          result = primary;
+        } else if( (int)curToken == tok_minus || (int)curToken == tok_plus ) {
+          unsigned op = curToken;
           getNext();
           cpp_expr * rhs = parseExpression( 100 );
           if( rhs == NULL ) {
             return result;
           }
-          cpp_expr *zero = new cpp_expr( cpp_expr::kind_int_value, intType, (long long)0 );
-          zero = new cpp_expr( cpp_expr::kind_cast, rhs->getType(), zero );
-          result = new cpp_expr( (int)curToken == tok_minus ? cpp_expr::kind_minus : cpp_expr::kind_plus, rhs->getType(), zero, rhs );
+          cpp_expr *zero = new (arena) cpp_expr( cpp_expr::kind_int_value, intType, (long long)0 );
+          zero = new (arena) cpp_expr( cpp_expr::kind_cast, rhs->getType(), zero );
+          result = new (arena) cpp_expr( op == tok_minus ? cpp_expr::kind_minus : cpp_expr::kind_plus, rhs->getType(), zero, rhs );
         } else if( (int)curToken == tok_not ) {
-          //unsigned op = curToken;
           getNext();
           cpp_expr * rhs = parseExpression( 100 );
           if( rhs == NULL ) {
             return result;
           }
           rhs = makeBoolType( rhs );
-          cpp_expr *one = new cpp_expr( cpp_expr::kind_int_value, intType, (long long)1 );
-          one = new cpp_expr( cpp_expr::kind_cast, rhs->getType(), one );
-          result = new cpp_expr( cpp_expr::kind_xor, rhs->getType(), one, rhs );
+          cpp_expr *one = new (arena) cpp_expr( cpp_expr::kind_int_value, intType, (long long)1 );
+          one = new (arena) cpp_expr( cpp_expr::kind_cast, rhs->getType(), one );
+          result = new (arena) cpp_expr( cpp_expr::kind_xor, rhs->getType(), one, rhs );
         } else if( (int)curToken == tok_tilda ) {
-          //unsigned op = curToken;
           getNext();
           cpp_expr * rhs = parseExpression( 100 );
           if( rhs == NULL ) {
             return result;
           }
           rhs = makeIntType( rhs );
-          cpp_expr *one = new cpp_expr( cpp_expr::kind_int_value, intType, (long long)-1 );
-          one = new cpp_expr( cpp_expr::kind_cast, rhs->getType(), one );
-          result = new cpp_expr( cpp_expr::kind_xor, rhs->getType(), one, rhs );
+          cpp_expr *one = new (arena) cpp_expr( cpp_expr::kind_int_value, intType, (long long)-1 );
+          one = new (arena) cpp_expr( cpp_expr::kind_cast, rhs->getType(), one );
+          result = new (arena) cpp_expr( cpp_expr::kind_xor, rhs->getType(), one, rhs );
         } else if( (int)curToken == tok_plus_plus || (int)curToken == tok_minus_minus ) {
-          //unsigned op = curToken;
+          // ++x is x = x + 1
+          unsigned op = curToken;
           getNext();
           cpp_expr *rhs = parseExpression( 100 );
           if( rhs == NULL ) {
             return result;
           }
-          cpp_expr *inc = new cpp_expr( cpp_expr::kind_int_value, intType, (long long)1 );
-          inc = new cpp_expr( cpp_expr::kind_cast, rhs->getType(), inc );
-          result = new cpp_expr( (int)curToken == tok_plus_plus ? cpp_expr::kind_plus_equals : cpp_expr::kind_minus_equals, rhs->getType(), rhs, inc );
+          cpp_expr *inc = new (arena) cpp_expr( cpp_expr::kind_int_value, intType, (long long)1 );
+          inc = new (arena) cpp_expr( cpp_expr::kind_cast, rhs->getType(), inc );
+          inc = new (arena) cpp_expr( op == tok_plus_plus ? cpp_expr::kind_plus : cpp_expr::kind_minus, rhs->getType(), rhs, inc );
+          result = new (arena) cpp_expr( cpp_expr::kind_equals, rhs->getType(), rhs, inc );
+        } else if( (int)curToken == tok_true || (int)curToken == tok_false ) {
+          result = new (arena) cpp_expr( cpp_expr::kind_int_value, boolType, (long long)( (int)curToken == tok_true ) );
+          getNext();
+        } else if(
+          ( (int)curToken == tok_identifier && findTypedef( curSymbol ) ) ||
+          (int)curToken == tok_float || (int)curToken == tok_int || (int)curToken == tok_bool || (int)curToken == tok_half
+        ) {
+          // constructors and function style casts, eg. float4( p, 1 ) or float( i )
+          cpp_type *type =
+            (int)curToken == tok_float ? floatType :
+            (int)curToken == tok_int ? intType :
+            (int)curToken == tok_bool ? boolType :
+            (int)curToken == tok_half ? halfType :
+            findTypedef( curSymbol )
+          ;
+          getNext();
+          result = parseConstructor( type );
+          if( result == NULL ) {
+            return NULL;
+          }
         } else if( (int)curToken == tok_identifier ) {
-          string name( lexer.id() );
-          cpp_type *type = findTypedef( name );
-          if( type ) {
-            getNext();
-            if( !expect( tok_lparen ) ) {
-              return NULL;
-            }
-            cpp_expr *init = parseExpression( 100 );
-            result = new cpp_expr( cpp_expr::kind_init, type, init );
-          } else {
+          unsigned name = curSymbol;
+          {
             cpp_value *value = curScope->lookup( name );
             /*if( value == NULL && buildIntrinsic( name.c_str() ) ) {
               value = curScope->lookup( name );
             }*/
             if( value == NULL ) {
-              cpp_log("error: undefined symbol '%s'\n", name.c_str());
+              cpp_log("error: undefined symbol '%s'\n", symbols.get_name( name ));
               return NULL;
             }
             getNext();
-            result = new cpp_expr( cpp_expr::kind_value, value );
+            result = new (arena) cpp_expr( cpp_expr::kind_value, value );
           }
         } else if( (int)curToken == tok_int_constant || (int)curToken == tok_int64_constant || (int)curToken == tok_uint_constant || (int)curToken == tok_uint64_constant ) {
           //result = (int64_type)lexer_.value();
-          result = new cpp_expr( cpp_expr::kind_int_value, cintType, (long long)lexer.value() );
+          result = new (arena) cpp_expr( cpp_expr::kind_int_value, cintType, (long long)lexer.value() );
           getNext();
         } else if( (int)curToken == tok_float_constant || (int)curToken == tok_double_constant ) {
-          result = new cpp_expr( cpp_expr::kind_double_value, cfloatType, lexer.double_value() );
+          result = new (arena) cpp_expr( cpp_expr::kind_double_value, cfloatType, lexer.double_value() );
           //result = (int64_type)lexer_.value();
           getNext();  
         } else if( (int)curToken == tok_lparen ) {
           getNext();
           cpp_type *type = parseDeclspec();
-          if( type ) {
+          if( type && (int)curToken == tok_lparen ) {
+            // ( float( i ) * x ) starts with a constructor, not a cast.
+            cpp_expr *ctor = parseConstructor( type );
+            result = ctor ? parseExpression( 0, ctor ) : NULL;
+            if( result == NULL || !expect( tok_rparen ) ) {
+              return NULL;
+            }
+            getNext();
+          } else if( type ) {
             if( !expect( tok_rparen ) ) {
               return NULL;
             }
             getNext();
             cpp_expr * rhs = parseExpression( 100 );
-            result = new cpp_expr( cpp_expr::kind_cast, type, rhs );
+            result = new (arena) cpp_expr( cpp_expr::kind_cast, type, rhs );
           } else {
             result = parseExpression();
             expect( tok_rparen );
@@ -1169,8 +1487,8 @@ namespace octet
               return NULL;
             }
             if( result->getType()->getIsVector() ) {
-              cpp_type *newType = new cpp_type( *result->getType() );
-              cpp_expr *newExpr = new cpp_expr( cpp_expr::kind_swiz, newType, result );
+              cpp_type *newType = new (arena) cpp_type( *result->getType() );
+              cpp_expr *newExpr = new (arena) cpp_expr( cpp_expr::kind_swiz, newType, result );
               unsigned char *swiz = newExpr->getSwiz();
               unsigned numSwiz = 0;
               bool bad = false;
@@ -1189,84 +1507,68 @@ namespace octet
               }
             
               // single swizzles make scalars
-              string s;
-              cpp_log("%s\n", newType->toString(s));
               if( numSwiz == 1 ) {
                 *newType = *newType->getSubType();
               } else {
                 newType->setDimension( numSwiz );
               }
-              cpp_log("..%s\n", newType->toString(s));
+              if( debug ) {
+                string s;
+                cpp_log("..%s\n", newType->toString(s));
+              }
               getNext();
               result = newExpr;
             } else if( result->getType()->getKind() != cpp_type::kind_struct ) {
               cpp_log("error: left hand size of '.' should be a packed array or structure");
               return NULL;
             } else {
-              string name( lexer.id() );
+              unsigned name = curSymbol;
               getNext();
               cpp_value *value = result->getType()->getScope()->lookup( name );
               if( value == NULL ) {
-                cpp_log("error: structure does not have a member '%s'.\n", name.c_str());
+                cpp_log("error: structure does not have a member '%s'.\n", symbols.get_name( name ));
                 return NULL;
               }
-              result = new cpp_expr( cpp_expr::kind_dot, result, value );
+              result = new (arena) cpp_expr( cpp_expr::kind_dot, result, value );
             }
           } else if( (int)curToken == tok_lparen ) {
-            getNext();
-          
             if( result->getKind() == cpp_expr::kind_int_value ) {
-              //cpp_expr *rhs = parseExpression( 0 );
+              getNext();
               if( !expect( tok_rparen ) ) {
                 return NULL;
               }
               getNext();
-              result = new cpp_expr( cpp_expr::kind_int_value, cintType, (long long )0 );
+              result = new (arena) cpp_expr( cpp_expr::kind_int_value, cintType, (long long )0 );
             } else {
               if( result->getKind() != cpp_expr::kind_value || result->getType()->getKind() != cpp_type::kind_function ) {
                 cpp_log("error: calling something that is not a function.");
                 return NULL;
               }
-              cpp_expr *rhs = parseExpression( 0 );
-
-              if( !expect( tok_rparen ) ) {
+              cpp_expr *rhs = NULL;
+              unsigned numArgs = 0;
+              if( !parseArguments( rhs, numArgs ) ) {
                 return NULL;
               }
-              getNext();
-
-              dynarray< cpp_type * > actualTypes;
-              if( rhs->getKind() != cpp_expr::kind_comma ) {
-                actualTypes.push_back( rhs->getType() );
-              } else {
-                for( cpp_expr *expr = rhs; ; expr = expr->getKid( 0 ) ) {
-                  if( expr->getKind() == cpp_expr::kind_comma ) {
-                    actualTypes.push_back( expr->getKid( 1 )->getType() );
-                  } else {
-                    actualTypes.push_back( expr->getType() );
-                    break;
-                  }
-                }
-              }
 
+              // pick the best scoring overload, casts will be needed for a partial match.
               cpp_value *value = NULL;
               cpp_value *firstValue = result->getValue();
+              unsigned bestScore = 0;
+              bool ambiguous = false;
               for( cpp_value *search = firstValue; search != NULL; search = search->getNextPolymorphic() ) {
                 unsigned score = doParametersMatch( actualTypes, search );
-                if( score == 2 ) {
-                  // exact match. ignore any others.
-                  value = search;
-                  break;
-                }
-                if( score == 1 ) {
-                  // partial match, will need casts.
-                  if( value != NULL ) {
-                    cpp_log("error: more than one function matches parameters\n");
-                    result = NULL;
-                    break;
-                  }
+                if( score > bestScore ) {
                   value = search;
+                  bestScore = score;
+                  ambiguous = false;
+                } else if( score != 0 && score == bestScore ) {
+                  ambiguous = true;
                 }
               }
+              if( ambiguous ) {
+                cpp_log("error: more than one function matches parameters\n");
+                result = NULL;
+              }
 
               if( result != NULL ) {
                 if( value == NULL ) {
@@ -1284,9 +1586,13 @@ namespace octet
                   }
                   result = NULL;
                 } else {
-                  result->setType( value->getType() );
+                  // functions returning structures return them in the "$return" parameter.
+                  cpp_type *functionType = value->getType();
+                  cpp_type *returnType = functionType->getIsReturnByValue() ? (*functionType->getScope()->begin())->getType() : functionType->getSubType();
+                  result->setType( functionType );
                   result->setValue( value );
-                  result = new cpp_expr( cpp_expr::kind_call, result->getType()->getSubType(), result, rhs );
+                  result = new (arena) cpp_expr( cpp_expr::kind_call, returnType, result, rhs );
+                  result->setNumArgs( numArgs );
                 }
               }
             }
@@ -1299,18 +1605,23 @@ namespace octet
               cpp_log("error: trying to use [] on non-array");
               return NULL;
             }
-            result = new cpp_expr( cpp_expr::kind_index, result->getType()->getSubType(), result, rhs );
+            result = new (arena) cpp_expr( cpp_expr::kind_index, result->getType()->getSubType(), result, rhs );
           } else if( (int)curToken == tok_plus_plus || (int)curToken == tok_minus_minus ) {
+            // x++ is ( $tmp = x, x = x + 1 ), $tmp
+            unsigned op = curToken;
             getNext();
             char name[ 32 ];
             sprintf( name, "$tmp%d", numTmpVars++ );
-            cpp_value *tmp = new cpp_value( result->getType(), name );
-            cpp_expr *inc = new cpp_expr( cpp_expr::kind_int_value, intType, (long long)1 );
-            inc = new cpp_expr( cpp_expr::kind_cast, result->getType(), inc );
-            inc = new cpp_expr( (int)curToken == tok_plus_plus ? cpp_expr::kind_plus_equals : cpp_expr::kind_minus_equals, result->getType(), result, inc );
-            cpp_expr *tmpExpr = new cpp_expr( cpp_expr::kind_value, tmp );
-            //cpp_expr *tmpAssign = new cpp_expr( cpp_expr::kind_equals, result->getType(), tmpExpr, result );
-            result = new cpp_expr( cpp_expr::kind_comma, result->getType(), inc, tmpExpr );
+            cpp_type *type = result->getType();
+            cpp_value *tmp = makeValue( type, symbols.intern( name ) );
+            cpp_expr *tmpExpr = new (arena) cpp_expr( cpp_expr::kind_value, tmp );
+            cpp_expr *tmpAssign = new (arena) cpp_expr( cpp_expr::kind_equals, type, tmpExpr, result );
+            cpp_expr *inc = new (arena) cpp_expr( cpp_expr::kind_int_value, intType, (long long)1 );
+            inc = new (arena) cpp_expr( cpp_expr::kind_cast, type, inc );
+            inc = new (arena) cpp_expr( op == tok_plus_plus ? cpp_expr::kind_plus : cpp_expr::kind_minus, type, result, inc );
+            inc = new (arena) cpp_expr( cpp_expr::kind_equals, type, result, inc );
+            result = new (arena) cpp_expr( cpp_expr::kind_comma, type, tmpAssign, inc );
+            result = new (arena) cpp_expr( cpp_expr::kind_comma, type, result, tmpExpr );
           } else {
             break;
           }
@@ -1327,7 +1638,7 @@ namespace octet
 
           // left grouping operators will parse like ( ( a + b ) + c ) + d    so rhs will accept fewer tokens
           // right grouping operators will parse like a = ( b = ( c = d ) )   so rhs will accept more tokens
-          cpp_expr *rhs = parseExpression( tokenToPrecidence[ op ] - tokenIsRightGrouping[ curToken ] );
+          cpp_expr *rhs = parseExpression( tokenToPrecidence[ op ] - tokenIsRightGrouping[ op ] );
           if( rhs == NULL ) {
             return NULL;
           }
@@ -1336,7 +1647,7 @@ namespace octet
 
             case tok_comma:
             {
-              result = new cpp_expr( cpp_expr::kind_comma, rhs->getType(), result, rhs );
+              result = new (arena) cpp_expr( cpp_expr::kind_comma, rhs->getType(), result, rhs );
             } break;
             case tok_question:
             {
@@ -1344,7 +1655,10 @@ namespace octet
                 return NULL;
               }
                getNext();
-              cpp_expr *rhs2 = parseExpression( tokenToPrecidence[ op ] - tokenIsRightGrouping[ curToken ] );
+              cpp_expr *rhs2 = parseExpression( tokenToPrecidence[ op ] - tokenIsRightGrouping[ op ] );
+              if( rhs2 == NULL ) {
+                return NULL;
+              }
             
               rhs = makeSameType( rhs, rhs2 );
               if( result == NULL ) {
@@ -1357,7 +1671,7 @@ namespace octet
                 return NULL;
               }
 
-              result = new cpp_expr( cpp_expr::kind_question, rhs->getType(), makeVectorBoolType( result ), rhs, rhs2 );
+              result = new (arena) cpp_expr( cpp_expr::kind_question, rhs->getType(), makeVectorBoolType( result ), rhs, rhs2 );
             } break;
             case tok_or: kind = cpp_expr::kind_or; goto binop;
             case tok_and: kind = cpp_expr::kind_and; goto binop;
@@ -1373,6 +1687,14 @@ namespace octet
             case tok_and_and: kind = cpp_expr::kind_and_and; goto binop;
             binop:
             {
+              if( result->getType()->getIsMatrix() || rhs->getType()->getIsMatrix() ) {
+                result = makeMatrixOp( kind, result, rhs );
+                if( result == NULL ) {
+                  cpp_log("error: unable to convert types\n");
+                  return NULL;
+                }
+                break;
+              }
               result = makeSameType( result, rhs );
               if( result == NULL ) {
                 cpp_log("error: unable to convert types\n");
@@ -1383,7 +1705,7 @@ namespace octet
                 cpp_log("error: unable to convert types\n");
                 return NULL;
               }
-              result = new cpp_expr( kind, rhs->getType(), result, rhs );
+              result = new (arena) cpp_expr( kind, rhs->getType(), result, rhs );
             } break;
 
             case tok_lt: kind = cpp_expr::kind_lt; goto relop;
@@ -1404,28 +1726,29 @@ namespace octet
                 cpp_log("error: unable to convert types\n");
                 return NULL;
               }
-              result = new cpp_expr( kind, boolType, result, rhs );
+              result = new (arena) cpp_expr( kind, boolType, result, rhs );
             } break;
 
             case tok_equals:
             {
               rhs = makeCast( rhs, result->getType() );
-              result = new cpp_expr( cpp_expr::kind_equals, rhs->getType(), result, rhs );
+              result = new (arena) cpp_expr( cpp_expr::kind_equals, rhs->getType(), result, rhs );
             } break;
-            case tok_divide_equals: kind = cpp_expr::kind_divide_equals; goto assignop;
-            case tok_mod_equals: kind = cpp_expr::kind_mod_equals; goto assignop;
-            case tok_plus_equals: kind = cpp_expr::kind_plus_equals; goto assignop;
-            case tok_minus_equals: kind = cpp_expr::kind_minus_equals; goto assignop;
-            case tok_shift_left_equals: kind = cpp_expr::kind_shift_left_equals; goto assignop;
-            case tok_shift_right_equals: kind = cpp_expr::kind_shift_right_equals; goto assignop;
-            case tok_and_equals: kind = cpp_expr::kind_and_equals; goto assignop;
-            case tok_xor_equals: kind = cpp_expr::kind_xor_equals; goto assignop;
-            case tok_or_equals: kind = cpp_expr::kind_or_equals; goto assignop;
-            case tok_times_equals: kind = cpp_expr::kind_times_equals; goto assignop;
+            // a += b is a = a + b
+            case tok_divide_equals: kind = cpp_expr::kind_divide; goto assignop;
+            case tok_mod_equals: kind = cpp_expr::kind_mod; goto assignop;
+            case tok_plus_equals: kind = cpp_expr::kind_plus; goto assignop;
+            case tok_minus_equals: kind = cpp_expr::kind_minus; goto assignop;
+            case tok_shift_left_equals: kind = cpp_expr::kind_shift_left; goto assignop;
+            case tok_shift_right_equals: kind = cpp_expr::kind_shift_right; goto assignop;
+            case tok_and_equals: kind = cpp_expr::kind_and; goto assignop;
+            case tok_xor_equals: kind = cpp_expr::kind_xor; goto assignop;
+            case tok_or_equals: kind = cpp_expr::kind_or; goto assignop;
+            case tok_times_equals: kind = cpp_expr::kind_star; goto assignop;
             assignop:
             {
               rhs = makeCast( rhs, result->getType() );
-              result = new cpp_expr( cpp_expr::kind_equals, rhs->getType(), result, new cpp_expr( kind, rhs->getType(), result, rhs ) );
+              result = new (arena) cpp_expr( cpp_expr::kind_equals, rhs->getType(), result, new (arena) cpp_expr( kind, rhs->getType(), result, rhs ) );
             } break;
             default:
             {
@@ -1443,10 +1766,31 @@ namespace octet
       }
 
       bool parseOuter() {
+        hasLayout = false;
+        layoutStd140 = false;
+        layoutBinding = 0;
         if( (int)curToken == tok_semicolon ) {
           getNext();
           return true;
         }
+        if( (int)curToken == tok_identifier && curSymbol == precisionSymbol && !curScope->lookup( precisionSymbol ) ) {
+          // precision mediump float;
+          getNext();
+          if( !expect( tok_identifier ) ) {
+            return false;
+          }
+          unsigned qualifier = curSymbol;
+          getNext();
+          if( (int)curToken == tok_float ) {
+            floatPrecision = qualifier;
+          }
+          getNext();
+          if( !expect( tok_semicolon ) ) {
+            return false;
+          }
+          getNext();
+          return true;
+        }
         if( (int)curToken == tok_typedef ) {
           getNext();
           cpp_type *type = parseDeclspec();
@@ -1459,7 +1803,7 @@ namespace octet
             cpp_log("error: expecting declarator\n");
             return false;
           }
-          makeTypedef( value->getType(), value->getName() );
+          makeTypedef( value->getType(), value->getSymbol() );
           if( !expect( tok_semicolon ) ) {
             return false;
           }
@@ -1467,6 +1811,11 @@ namespace octet
           return true;
         }
         cpp_type *type = parseDeclspec();
+        if( !type && hasLayout && (int)curToken == tok_semicolon ) {
+          // layout( local_size_x = 64 ) in;
+          getNext();
+          return true;
+        }
         if( !type ) {
           cpp_log("error: expecting typedef or declaration\n");
           return false;
@@ -1509,43 +1858,140 @@ namespace octet
         tokenToPrecidence[ tok_lbracket ] = 13;
       
         memset( tokenIsRightGrouping, 0, sizeof( tokenIsRightGrouping ) );
-        tokenIsRightGrouping[ tok_comma ] = 1;
         tokenIsRightGrouping[ tok_equals ] = tokenIsRightGrouping[ tok_times_equals ] = tokenIsRightGrouping[ tok_divide_equals ] = tokenIsRightGrouping[ tok_mod_equals ] = tokenIsRightGrouping[ tok_plus_equals ] = 1;
         tokenIsRightGrouping[ tok_minus_equals ] = tokenIsRightGrouping[ tok_shift_left_equals ] = 1;
         tokenIsRightGrouping[ tok_shift_right_equals ] = tokenIsRightGrouping[ tok_and_equals ] = tokenIsRightGrouping[ tok_xor_equals ] = tokenIsRightGrouping[ tok_or_equals ] = 1;
         tokenIsRightGrouping[ tok_question ] = 1;
 
-        invariantScope = new cpp_scope( NULL );
-        curScope = globalScope = new cpp_scope( invariantScope );
-      
+        returnSymbol = symbols.intern( "$return" );
+        layoutSymbol = symbols.intern( "layout" );
+        bufferSymbol = symbols.intern( "buffer" );
+        attributeSymbol = symbols.intern( "attribute" );
+        varyingSymbol = symbols.intern( "varying" );
+        precisionSymbol = symbols.intern( "precision" );
+        precisionSymbols[ 0 ] = symbols.intern( "lowp" );
+        precisionSymbols[ 1 ] = symbols.intern( "mediump" );
+        precisionSymbols[ 2 ] = symbols.intern( "highp" );
+        curSymbol = 0;
+        dontReadLine = false;
+        makeBuiltins();
+
+        // everything so far is kept by reset()
+        builtinMark = arena.get_mark();
+        builtinTypedefs.resize( typedefs.size() );
+        memcpy( builtinTypedefs.data(), typedefs.data(), typedefs.size() * sizeof( cpp_type * ) );
+        builtinNumAbstract = numAbstract;
+        reset();
+      }
+
+      /// Free the syntax tree and start a new translation unit.
+      /// Memory from the last one is reused.
+      void reset() {
+        arena.reset( builtinMark );
+        if( typedefs.size() ) memset( typedefs.data(), 0, typedefs.size() * sizeof( cpp_type * ) );
+        if( tags.size() ) memset( tags.data(), 0, tags.size() * sizeof( cpp_type * ) );
+        if( builtinTypedefs.size() ) memcpy( typedefs.data(), builtinTypedefs.data(), builtinTypedefs.size() * sizeof( cpp_type * ) );
+
+        curScope = globalScope = new (arena) cpp_scope( arena, invariantScope );
+        structNumber = 0;
+        numAbstract = builtinNumAbstract;
+        numTmpVars = 0;
+        floatPrecision = 0;
+        localSize[ 0 ] = localSize[ 1 ] = localSize[ 2 ] = 1;
+      }
+
+      /// Parse a source file into the current translation unit.
+      /// Returns false on a syntax error; cpp_log() has the details.
+      bool parse(const char *src) {
+        preprocessor.begin(src);
+        lexer.start(preprocessor.cur_line());
         dontReadLine = false;
+        line_number = 1;
+        getNext();
+
+        while( (int)curToken != tok_end_of_source ) {
+          if( !parseOuter() ) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      /// Global variables and functions of the current translation unit.
+      cpp_scope *getGlobalScope() {
+        return globalScope;
+      }
+
+      /// Intrinsic functions and builtin variables such as gl_GlobalInvocationID.
+      cpp_scope *getInvariantScope() {
+        return invariantScope;
+      }
+
+      /// layout( local_size_x = x, local_size_y = y, local_size_z = z ) in;
+      unsigned getLocalSize( unsigned axis ) {
+        return localSize[ axis ];
+      }
+
+      /// "mediump" after precision mediump float; or NULL if there was none.
+      const char *getFloatPrecision() {
+        return floatPrecision ? symbols.get_name( floatPrecision ) : NULL;
+      }
+
+      /// The tag of a structure type, eg. "light" for struct light { ... }.
+      const char *getStructName( cpp_type *type ) {
+        for( unsigned i = 0; i != tags.size(); ++i ) {
+          if( tags[ i ] && tags[ i ]->getScope() == type->getScope() ) {
+            return symbols.get_name( i );
+          }
+        }
+        return NULL;
+      }
+
+      /// #define name text before every parse, eg. to make a shader variant.
+      void predefine( const char *name, const char *text ) {
+        preprocessor.predefine( name, text );
+      }
+
+      cpp_symbols &getSymbols() {
+        return symbols;
+      }
+
+      cpp_arena &getArena() {
+        return arena;
+      }
+
+    private:
+      // types, intrinsic functions and compute shader inputs shared by all translation units.
+      void makeBuiltins() {
+        invariantScope = new (arena) cpp_scope( arena, NULL );
+        curScope = invariantScope;
       
-        voidType = makeTypedef( new cpp_type( cpp_type::kind_void ), "void" );
-        intType = makeTypedef( new cpp_type( cpp_type::kind_int ), "int" );
-        floatType = makeTypedef( new cpp_type( cpp_type::kind_float ), "float" );
-        doubleType = makeTypedef( new cpp_type( cpp_type::kind_float ), "double" );
-        halfType = makeTypedef( new cpp_type( cpp_type::kind_half ), "half" );
-        boolType = makeTypedef( new cpp_type( cpp_type::kind_bool ), "bool" );
-        cintType = new cpp_type( cpp_type::kind_cint );
-        cfloatType = new cpp_type( cpp_type::kind_cfloat );
+        voidType = makeTypedef( new (arena) cpp_type( cpp_type::kind_void ), "void" );
+        intType = makeTypedef( new (arena) cpp_type( cpp_type::kind_int ), "int" );
+        floatType = makeTypedef( new (arena) cpp_type( cpp_type::kind_float ), "float" );
+        doubleType = makeTypedef( new (arena) cpp_type( cpp_type::kind_float ), "double" );
+        halfType = makeTypedef( new (arena) cpp_type( cpp_type::kind_half ), "half" );
+        boolType = makeTypedef( new (arena) cpp_type( cpp_type::kind_bool ), "bool" );
+        cintType = new (arena) cpp_type( cpp_type::kind_cint );
+        cfloatType = new (arena) cpp_type( cpp_type::kind_cfloat );
       
         for( unsigned i = 1; i <= 4; ++i ) {
           char tmp[ 10 ];
 
           sprintf( tmp, "bool%d", i );
-          cpp_type *bool_type = new cpp_type( cpp_type::kind_bool, i, true );
+          cpp_type *bool_type = makeVectorType( cpp_type::kind_bool, i );
           makeTypedef( bool_type, tmp );
 
           sprintf( tmp, "int%d", i );
-          cpp_type *int_type = new cpp_type( cpp_type::kind_int, i, true );
+          cpp_type *int_type = makeVectorType( cpp_type::kind_int, i );
           makeTypedef( int_type, tmp );
 
           sprintf( tmp, "float%d", i );
-          cpp_type *float_type = new cpp_type( cpp_type::kind_float, i, true );
+          cpp_type *float_type = makeVectorType( cpp_type::kind_float, i );
           makeTypedef( float_type, tmp );
 
           sprintf( tmp, "half%d", i );
-          cpp_type *half_type = new cpp_type( cpp_type::kind_half, i, true );
+          cpp_type *half_type = makeVectorType( cpp_type::kind_half, i );
           makeTypedef( half_type, tmp );
         
           boolTypes1D[ i-1 ] = bool_type;
@@ -1557,47 +2003,147 @@ namespace octet
             char tmp[ 10 ];
             cpp_type *type;
             sprintf( tmp, "bool%dx%d", i, j );
-            type = new cpp_type( cpp_type::kind_array, bool_type, j );
+            type = new (arena) cpp_type( cpp_type::kind_array, bool_type, j );
             makeTypedef( type, tmp );
             boolTypes2D[ i-1 ][ j-1 ] = type;
 
             sprintf( tmp, "int%dx%d", i, j );
-            type = new cpp_type( cpp_type::kind_array, int_type, j );
+            type = new (arena) cpp_type( cpp_type::kind_array, int_type, j );
             makeTypedef( type, tmp );
             intTypes2D[ i-1 ][ j-1 ] = type;
 
             sprintf( tmp, "float%dx%d", i, j );
-            type = new cpp_type( cpp_type::kind_array, float_type, j );
+            type = new (arena) cpp_type( cpp_type::kind_array, float_type, j );
+            type->setIsMatrix( true );
             makeTypedef( type, tmp );
             floatTypes2D[ i-1 ][ j-1 ] = type;
 
             sprintf( tmp, "half%dx%d", i, j );
-            type = new cpp_type( cpp_type::kind_array, half_type, j );
+            type = new (arena) cpp_type( cpp_type::kind_array, half_type, j );
+            type->setIsMatrix( true );
             makeTypedef( type, tmp );
             halfTypes2D[ i-1 ][ j-1 ] = type;
           }
         }
       
+        // GLSL names for the same types. uint is treated as int.
+        makeTypedef( intType, "uint" );
+        for( unsigned i = 2; i <= 4; ++i ) {
+          char tmp[ 10 ];
+          sprintf( tmp, "vec%d", i ); makeTypedef( floatTypes1D[ i-1 ], tmp );
+          sprintf( tmp, "ivec%d", i ); makeTypedef( intTypes1D[ i-1 ], tmp );
+          sprintf( tmp, "uvec%d", i ); makeTypedef( intTypes1D[ i-1 ], tmp );
+          sprintf( tmp, "bvec%d", i ); makeTypedef( boolTypes1D[ i-1 ], tmp );
+          sprintf( tmp, "mat%d", i ); makeTypedef( floatTypes2D[ i-1 ][ i-1 ], tmp );
+        }
+        makeTypedef( new (arena) cpp_type( cpp_type::kind_samplerCUBE ), "samplerCube" );
+      
         // initialise anaonymous structure index
         structNumber = 0;
         numAbstract = 0;
         numTmpVars = 0;
-      }
-
-      void parse(const char *src) {
-        preprocessor.begin(src);
-        lexer.start(preprocessor.cur_line());
-        dontReadLine = false;
-        line_number = 1;
-        getNext();
 
-        while( (int)curToken != tok_end_of_source ) {
-          if( !parseOuter() ) {
-            return;
+        // declare the intrinsics for every float and int vector size.
+        static const char *const floatFuncs[] = {
+          "T radians(T x); T degrees(T x); T sin(T x); T cos(T x); T tan(T x); T asin(T x); T acos(T x); T atan(T x);",
+          "T exp(T x); T log(T x); T exp2(T x); T log2(T x); T sqrt(T x); T inversesqrt(T x);",
+          "T abs(T x); T sign(T x); T floor(T x); T ceil(T x); T fract(T x); T normalize(T x);",
+          "T atan(T y, T x); T pow(T x, T y); T mod(T x, T y); T mod(T x, float y); T min(T x, T y); T min(T x, float y); T max(T x, T y); T max(T x, float y);",
+          "T clamp(T x, T a, T b); T clamp(T x, float a, float b); T mix(T x, T y, T a); T mix(T x, T y, float a);",
+          "T step(T e, T x); T step(float e, T x); T smoothstep(T a, T b, T x); T smoothstep(float a, float b, T x);",
+          "float length(T x); float distance(T x, T y); float dot(T x, T y);",
+          "T reflect(T i, T n); T refract(T i, T n, float eta); T faceforward(T n, T i, T r);",
+        };
+        static const char *const intFuncs[] = {
+          "T abs(T x); T sign(T x); T min(T x, T y); T min(T x, int y); T max(T x, T y); T max(T x, int y);",
+          "T clamp(T x, T a, T b); T clamp(T x, int a, int b);",
+        };
+        static const char *const floatNames[] = { "float", "float2", "float3", "float4" };
+        static const char *const intNames[] = { "int", "int2", "int3", "int4" };
+
+        dynarray< char > prelude;
+        for( unsigned i = 0; i != 4; ++i ) {
+          for( unsigned j = 0; j != sizeof( floatFuncs ) / sizeof( floatFuncs[ 0 ] ); ++j ) {
+            appendPrelude( prelude, floatFuncs[ j ], floatNames[ i ] );
+          }
+          for( unsigned j = 0; j != sizeof( intFuncs ) / sizeof( intFuncs[ 0 ] ); ++j ) {
+            appendPrelude( prelude, intFuncs[ j ], intNames[ i ] );
           }
         }
+        appendPrelude(
+          prelude,
+          "float3 cross(float3 x, float3 y);\n"
+          "int3 gl_GlobalInvocationID; int3 gl_LocalInvocationID; int3 gl_WorkGroupID; int3 gl_NumWorkGroups; int3 gl_WorkGroupSize;\n"
+          "int gl_LocalInvocationIndex;\n"
+          "float4 texture2D(sampler2D s, float2 uv); float4 texture2D(sampler2D s, float2 uv, float bias);\n"
+          "float4 texture2DProj(sampler2D s, float3 uv); float4 texture2DLod(sampler2D s, float2 uv, float lod);\n"
+          "float4 textureCube(samplerCube s, float3 dir); float4 textureCube(samplerCube s, float3 dir, float bias);\n"
+          "float4 gl_Position; float gl_PointSize; float4 gl_FragColor; float4 gl_FragData[4];\n"
+          "float4 gl_FragCoord; bool gl_FrontFacing; float2 gl_PointCoord;\n",
+          ""
+        );
+        prelude.push_back( 0 );
+        bool ok = parse( prelude.data() );
+        assert( ok && "builtin declarations failed to parse" );
+        (void)ok;
+        curScope = invariantScope;
       }
 
+      // copy "text" to "prelude" with T replaced by "type", one declaration per line.
+      static void appendPrelude( dynarray< char > &prelude, const char *text, const char *type ) {
+        for( const char *p = text; *p; ++p ) {
+          if( *p == 'T' && ( p == text || !isalnum( (unsigned char)p[ -1 ] ) ) && !isalnum( (unsigned char)p[ 1 ] ) ) {
+            for( const char *q = type; *q; ++q ) {
+              prelude.push_back( *q );
+            }
+          } else {
+            prelude.push_back( *p );
+            if( *p == ';' ) {
+              prelude.push_back( '\n' );
+            }
+          }
+        }
+      }
     };
+
+    #if OCTET_UNIT_TEST
+      class cpp_parser_unit_test {
+      public:
+        cpp_parser_unit_test() {
+          static const char src[] =
+            "struct light { float3 pos; float4 color; };\n"
+            "uniform float4 ambient;\n"
+            "float4 shade(light l, float3 n) {\n"
+            "  float d = 1.0;\n"
+            "  for (int i = 0; i < 4; i = i + 1) { d = d * 0.5; }\n"
+            "  return l.color * d + ambient;\n"
+            "}\n"
+          ;
+          cpp_parser parser;
+          bool ok = parser.parse(src);
+          assert(ok);
+          cpp_symbols &symbols = parser.getSymbols();
+          cpp_value *ambient = parser.getGlobalScope()->lookup(symbols.intern("ambient"));
+          assert(ambient && !strcmp(ambient->getName(), "ambient"));
+          assert(ambient->getType()->getIsUniform() && ambient->getType()->getIsVector());
+          assert(parser.getGlobalScope()->lookup(symbols.intern("shade")));
+          assert(!parser.getGlobalScope()->lookup(symbols.intern("d")));
+
+          // the second translation unit reuses the first one's memory.
+          size_t bytes = parser.getArena().get_bytes_used();
+          unsigned blocks = parser.getArena().get_num_blocks();
+          unsigned num_symbols = symbols.size();
+          parser.reset();
+          assert(parser.getGlobalScope()->size() == 0);
+          ok = parser.parse(src);
+          assert(ok);
+          assert(parser.getArena().get_bytes_used() == bytes);
+          assert(parser.getArena().get_num_blocks() == blocks);
+          assert(symbols.size() == num_symbols);
+        }
+      };
+
+      static cpp_parser_unit_test cpp_parser_unit_test;
+    #endif
   }
 }
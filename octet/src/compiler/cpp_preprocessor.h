@@ -60,10 +60,16 @@ namespace octet
         const char_type *text_;
       };
 
-      struct map_file_result {
+      // a file that has been included, kept for later includes and later runs.
+      struct cached_file {
         string filename_;
+        file_map *map_;             // memory mapped file, or 0 for add_file() sources
+        string text_;               // source text for add_file()
         const char *source_;
         const char *source_end_;
+        string guard_;              // X for a file that is all #ifndef X #define X ... #endif
+        bool pragma_once_;
+        unsigned included_run_;     // last run that included the file, for #pragma once
       };
     
       struct define_type {
@@ -78,6 +84,19 @@ namespace octet
 
       dictionary< define_type > defines_;
 
+      // #defines made by the program rather than the source, eg. shader variants.
+      struct predefine_type {
+        string name_;
+        string text_;
+      };
+
+      dynarray< predefine_type > predefines_;
+
+      dictionary<cached_file*> file_cache_;
+      dynarray<string> include_paths_;
+      unsigned run_;
+      unsigned num_skipped_includes_;
+
       const char_type *cur_line_;
       if_stack_entry_ *if_stack_ptr_;
       unsigned def_exp_stack_depth_;
@@ -122,10 +141,140 @@ namespace octet
         return include_stack_.back();
       }
 
-      bool map_file(map_file_result &result, const char *filename, const char *first_path) {
-        result.filename_.format("%s%s", first_path, filename);
-        result.source_ = result.source_end_ = 0;
-        return true;
+      // skip spaces, newlines and comments
+      static const char *skip_space(const char *src, const char *end) {
+        while (src != end) {
+          if (*src > 0 && *src <= ' ') {
+            ++src;
+          } else if (*src == '/' && src + 1 != end && src[1] == '/') {
+            while (src != end && *src != '\n') ++src;
+          } else if (*src == '/' && src + 1 != end && src[1] == '*') {
+            src += 2;
+            while (src != end && (src[0] != '*' || src + 1 == end || src[1] != '/')) ++src;
+            src += src != end ? 2 : 0;
+          } else {
+            break;
+          }
+        }
+        return src;
+      }
+
+      // read a directive name or macro name
+      static const char *read_word(string &word, const char *src, const char *end) {
+        while (src != end && (*src == ' ' || *src == '\t')) ++src;
+        const char *start = src;
+        while (src != end && ((*src >= 'a' && *src <= 'z') || (*src >= 'A' && *src <= 'Z') || (*src >= '0' && *src <= '9') || *src == '_')) ++src;
+        word.set(start, (int)(src - start));
+        return src;
+      }
+
+      // Look for #pragma once or an include guard covering the whole file.
+      // This is done once per file, so later includes of the file can be skipped without lexing it.
+      static void find_guard(cached_file &file) {
+        const char *end = file.source_end_;
+        const char *src = skip_space(file.source_, end);
+        if (src == end || *src != '#') return;
+
+        string word, guard;
+        src = read_word(word, src + 1, end);
+        if (word == "pragma") {
+          read_word(word, src, end);
+          file.pragma_once_ = word == "once";
+          return;
+        }
+        if (word != "ifndef") return;
+        src = read_word(guard, src, end);
+
+        src = skip_space(src, end);
+        if (src == end || *src != '#') return;
+        src = read_word(word, src + 1, end);
+        if (word != "define") return;
+        src = read_word(word, src, end);
+        if (word != guard.c_str()) return;
+
+        // find the matching #endif, which must be the last thing in the file.
+        unsigned depth = 1;
+        bool line_start = false;
+        while (src != end) {
+          char chr = *src;
+          if (chr == '\n') {
+            line_start = true;
+            ++src;
+          } else if (chr == '/' && src + 1 != end && (src[1] == '/' || src[1] == '*')) {
+            src = skip_space(src, end);
+          } else if (chr == '"' || chr == '\'') {
+            for (++src; src != end && *src != chr && *src != '\n'; ++src) {
+              src += *src == '\\' && src + 1 != end;
+            }
+            src += src != end && *src == chr;
+            line_start = false;
+          } else if (chr == '\\' && src + 1 != end && src[1] == '\n') {
+            src += 2;
+          } else if (chr > 0 && chr <= ' ') {
+            ++src;
+          } else if (chr == '#' && line_start) {
+            src = read_word(word, src + 1, end);
+            if (word == "if" || word == "ifdef" || word == "ifndef") {
+              depth++;
+            } else if (depth == 1 && (word == "else" || word == "elif")) {
+              return;
+            } else if (word == "endif" && --depth == 0) {
+              // skip the rest of the line, eg. "// X"
+              while (src != end && *src != '\n' && *src != '/') ++src;
+              if (skip_space(src, end) == end) {
+                file.guard_ = guard.c_str();
+              }
+              return;
+            }
+            line_start = false;
+          } else {
+            line_start = false;
+            ++src;
+          }
+        }
+      }
+
+      // dictionary does not destroy its values.
+      void clear_defines() {
+        bool any = false;
+        for (unsigned i = 0; i != defines_.get_num_indices(); ++i) {
+          if (defines_.get_key(i)) {
+            defines_.get_value(i).~define_type();
+            any = true;
+          }
+        }
+        if (any) defines_.reset();
+      }
+
+      // find a file in the cache or map it and add it to the cache.
+      cached_file *map_file(const char *filename, const char *first_path) {
+        string path;
+        for (int i = -1; i != (int)include_paths_.size(); ++i) {
+          path.format("%s%s", i == -1 ? first_path : include_paths_[i].c_str(), filename);
+
+          int index = file_cache_.get_index(path.c_str());
+          if (index != -1) {
+            return file_cache_.get_value(index);
+          }
+
+          file_map *map = new file_map(path.c_str());
+          if (map->get_error()) {
+            delete map;
+            continue;
+          }
+
+          cached_file *file = new cached_file();
+          file->filename_ = path;
+          file->map_ = map;
+          file->source_ = (const char*)map->get_data();
+          file->source_end_ = file->source_ + map->get_size();
+          file->pragma_once_ = false;
+          file->included_run_ = 0;
+          find_guard(*file);
+          file_cache_[path.c_str()] = file;
+          return file;
+        }
+        return 0;
       }
   
       unsigned line_number() {
@@ -619,7 +768,13 @@ namespace octet
           return;
         }
 
-        define_type &define = defines_[(const char*)lexer_.id()];
+        // dictionary values start as zeros, which is not a valid string.
+        const char *define_name = (const char*)lexer_.id();
+        bool is_new = defines_.get_index(define_name) == -1;
+        define_type &define = defines_[define_name];
+        if (is_new) {
+          new (&define) define_type();
+        }
 
         name_type params[ max_define_params_ ];
         unsigned num_define_params = 0;
@@ -812,17 +967,27 @@ namespace octet
                 cpp_log("error: sytnax error in #include");
               }
   
-              map_file_result file;
-              if (!map_file( file, filename, include().currentPath.c_str() )) {
+              cached_file *file = map_file( filename, include().currentPath.c_str() );
+              if (!file) {
                 cpp_log("error: include file %s not found", filename);
                 return;
               }
 
+              // already included and guarded: skip without reading it again.
+              if (
+                (file->pragma_once_ && file->included_run_ == run_) ||
+                (!file->guard_.empty() && defines_.get_index(file->guard_.c_str()) != -1)
+              ) {
+                num_skipped_includes_++;
+                return;
+              }
+              file->included_run_ = run_;
+
               output( 0x0c, line_number(), file_name(), 0 );
 
-              push_include( file.source_, file.source_end_, file.filename_, 1 );
+              push_include( file->source_, file->source_end_, file->filename_.c_str(), 1 );
 
-              output( 0x0d, 1, file.filename_, 0 );
+              output( 0x0d, 1, file->filename_.c_str(), 0 );
 
               push_if( true );
               if_.bottom_level_ = true;
@@ -952,12 +1117,62 @@ namespace octet
         //context_.debug( "[%s]\n", read_line_ );
       }
     
+      // Skip a line in a false #if without copying it, like read_some_text().
+      // Returns false if the line is a directive, which must be read.
+      bool skip_some_text() {
+        const char *current = include().current_;
+        const char *end = include().end_;
+        unsigned line_num = include().line_number_;
+
+        while( current != end && ( *current == ' ' || *current == '\t' ) ) {
+          current++;
+        }
+        if( current != end && *current == '#' ) {
+          return false;
+        }
+
+        while( current != end ) {
+          char_type chr = *current++;
+          if( chr == '\n' ) {
+            line_num++;
+            break;
+          } else if( chr == '/' && current != end && *current == '/' ) {
+            // c++ comment, stop at the newline
+            while( current != end && ( current[ 0 ] != '\n' || current[ -1 ] == '\\' ) ) {
+              line_num += current[ 0 ] == '\n';
+              current++;
+            }
+            break;
+          } else if( chr == '/' && current != end && *current == '*' ) {
+            // c comment
+            current++;
+            while( current != end && ( current[ 0 ] != '/' || current[ -1 ] != '*' ) ) {
+              line_num += current[ 0 ] == '\n';
+              current++;
+            }
+            if( current == end ) {
+              cpp_log("error: unterminated comment\n");
+              break;
+            }
+            current++;
+          } else if( chr == '\\' && current != end && *current == '\n' ) {
+            current++;
+            line_num++;
+          }
+        }
+
+        include().current_ = current;
+        include().line_number_ = line_num;
+        return true;
+      }
+
       void read_line() {
         //context_.debug( "read_line() qi=%d qo=%d\n", queue_in_, queue_out_ );
         while( queue_in_ == queue_out_ ) {
           if( include().current_ == include().end_ ) {
             //context_.debug( "read_line() qi=%d qo=%d END!\n", queue_in_, queue_out_ );
-            if( include_stack_.size() == 0 ) {
+            if( include_stack_.size() <= 1 ) {
+              // end of the main file
               cur_line_ = 0;
               return;
             } else {
@@ -980,6 +1195,12 @@ namespace octet
 
           read_line_number_ = include().line_number_;
           read_file_name_ = include().file_name_;
+
+          if( !if_.is_true_ && skip_some_text() ) {
+            num_skipped_++;
+            continue;
+          }
+
           read_some_text();
  
           char_type *src = read_line_;
@@ -1047,6 +1268,68 @@ namespace octet
       
         static short const unary_ops[] = { tok_minus, tok_plus, tok_and, tok_star, tok_not, tok_tilda, tok_plus_plus, tok_minus_minus, -1 };
         unary_op_ = unary_ops;
+
+        run_ = 0;
+        num_skipped_includes_ = 0;
+      }
+
+      ~cpp_preprocessor() {
+        clear_defines();
+        for (unsigned i = 0; i != file_cache_.get_num_indices(); ++i) {
+          if (file_cache_.get_key(i)) {
+            cached_file *file = file_cache_.get_value(i);
+            delete file->map_;
+            delete file;
+          }
+        }
+      }
+
+      /// Add a directory to search for #include files, with a trailing '/'.
+      void add_include_path(const char *path) {
+        include_paths_.push_back(string(path));
+      }
+
+      /// Add a file from memory, for example a shader header built into the program.
+      /// Files stay in the cache, mapped, for every later run.
+      void add_file(const char *filename, const char *text) {
+        int index = file_cache_.get_index(filename);
+        cached_file *file = index == -1 ? new cached_file() : file_cache_.get_value(index);
+        if (index != -1) {
+          delete file->map_;
+        }
+        file->filename_ = filename;
+        file->map_ = 0;
+        file->text_ = text;
+        file->source_ = file->text_.c_str();
+        file->source_end_ = file->source_ + strlen(file->source_);
+        file->guard_ = "";
+        file->pragma_once_ = false;
+        file->included_run_ = 0;
+        find_guard(*file);
+        file_cache_[filename] = file;
+      }
+
+      /// Define "name" as "text" at the start of every later run, like -Dname=text.
+      void predefine(const char *name, const char *text) {
+        for (unsigned i = 0; i != predefines_.size(); ++i) {
+          if (predefines_[i].name_ == name) {
+            predefines_[i].text_ = text;
+            return;
+          }
+        }
+        predefines_.resize(predefines_.size() + 1);
+        predefines_.back().name_ = name;
+        predefines_.back().text_ = text;
+      }
+
+      /// Forget all the predefine() calls.
+      void clear_predefines() {
+        predefines_.resize(0);
+      }
+
+      /// How many #includes were skipped because of #pragma once or an include guard.
+      unsigned get_num_skipped_includes() const {
+        return num_skipped_includes_;
       }
 
       void begin( const char *source ) {
@@ -1055,10 +1338,22 @@ namespace octet
           end++;
         }
 
-        include_stack_.reset();
-        include_stack_.reserve(32);
-        if_stack_.reset();
-        if_stack_.reserve(32);
+        // each run is a new translation unit, but the file cache is kept.
+        clear_defines();
+        run_++;
+
+        for (unsigned i = 0; i != predefines_.size(); ++i) {
+          define_type &define = defines_[predefines_[i].name_.c_str()];
+          new (&define) define_type();
+          define.text_ = predefines_[i].text_.c_str();
+          define.has_params_ = false;
+        }
+
+        // keep the stacks' memory from the last run.
+        include_stack_.resize(0);
+        if (include_stack_.capacity() < 32) include_stack_.reserve(32);
+        if_stack_.resize(0);
+        if (if_stack_.capacity() < 32) if_stack_.reserve(32);
 
         cur_line_ = 0;
         queue_in_ = queue_out_ = 0;
@@ -1127,7 +1422,46 @@ namespace octet
         return cur_line_;
       }
     };
-  
+
+    #if OCTET_UNIT_TEST
+      class cpp_preprocessor_unit_test {
+      public:
+        cpp_preprocessor_unit_test() {
+          cpp_preprocessor *pp = new cpp_preprocessor();
+          pp->add_file("common.h", "// shared\n#ifndef COMMON_H\n#define COMMON_H\nint common;\n#endif // COMMON_H\n");
+          pp->add_file("once.h", "#pragma once\nint once;\n");
+
+          // the second run uses the cached files, but the guards start again.
+          unsigned commons = 0, onces = 0, skipped = 0, mains = 0;
+          for (unsigned run = 0; run != 2; ++run) {
+            pp->begin(
+              "#include \"common.h\"\n#include \"once.h\"\n#include \"common.h\"\n#include \"once.h\"\n"
+              "#if 0\nint skipped; /* #endif\n */\n#endif\nint main;\n"
+            );
+            for (const char *line = pp->cur_line(); line; line = pp->next_line()) {
+              commons += strstr(line, "int common;") != 0;
+              onces += strstr(line, "int once;") != 0;
+              skipped += strstr(line, "int skipped;") != 0;
+              mains += strstr(line, "int main;") != 0;
+            }
+          }
+          assert(commons == 2 && onces == 2 && skipped == 0 && mains == 2);
+          assert(pp->get_num_skipped_includes() == 4);
+
+          // predefined values survive the next begin()
+          pp->predefine("NUM_LIGHTS", "3");
+          bool many = false;
+          pp->begin("#if NUM_LIGHTS > 2\nint many = NUM_LIGHTS;\n#endif\n");
+          for (const char *line = pp->cur_line(); line; line = pp->next_line()) {
+            many |= strstr(line, "int many = 3;") != 0;
+          }
+          assert(many);
+          delete pp;
+        }
+      };
+
+      static cpp_preprocessor_unit_test cpp_preprocessor_unit_test;
+    #endif
   }
 }
 
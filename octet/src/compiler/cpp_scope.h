@@ -11,56 +11,125 @@ namespace octet
 {
   namespace compiler
   {
+    /// Values declared in a block, structure or parameter list.
+    ///
+    /// Scopes live in the parser's arena, as do their arrays, which are
+    /// abandoned in the arena when they grow. Names are found by symbol
+    /// with an open addressed hash table.
     class cpp_scope
     {
-    public:
-    
-      typedef dynarray< cpp_value * > orderType;
-    private:
-      dynarray< cpp_value * > valuesByOrder;
-      dictionary<cpp_value *> valuesByName;
+      struct slot
+      {
+        unsigned symbol;
+        cpp_value *value;
+      };
+
+      cpp_arena *arena;
       cpp_scope *parent;
+      cpp_value **valuesByOrder;
+      unsigned numValues;
+      unsigned maxValues;
+      slot *valuesBySymbol;
+      unsigned tableBits;
+
+      static unsigned hash( unsigned symbol, unsigned bits )
+      {
+        return ( symbol * 0x9e3779b1u ) >> ( 32 - bits );
+      }
+
+      void insert( slot *table, unsigned bits, cpp_value *value )
+      {
+        unsigned mask = ( 1 << bits ) - 1;
+        unsigned i = hash( value->getSymbol(), bits );
+        while( table[ i ].symbol != 0 && table[ i ].symbol != value->getSymbol() )
+        {
+          i = ( i + 1 ) & mask;
+        }
+        table[ i ].symbol = value->getSymbol();
+        table[ i ].value = value;
+      }
+
+      cpp_value *find( unsigned symbol )
+      {
+        if( !valuesBySymbol ) return NULL;
+        unsigned mask = ( 1 << tableBits ) - 1;
+        for( unsigned i = hash( symbol, tableBits ); valuesBySymbol[ i ].symbol != 0; i = ( i + 1 ) & mask )
+        {
+          if( valuesBySymbol[ i ].symbol == symbol ) return valuesBySymbol[ i ].value;
+        }
+        return NULL;
+      }
+
     public:
-      typedef dynarray< cpp_value * >::iterator iterator;
+      typedef cpp_value **iterator;
 
-      cpp_scope( cpp_scope *parent_ ) : parent( parent_ )
+      cpp_scope( cpp_arena &arena_, cpp_scope *parent_ ) : arena( &arena_ ), parent( parent_ )
       {
+        valuesByOrder = NULL;
+        numValues = maxValues = 0;
+        valuesBySymbol = NULL;
+        tableBits = 0;
       }
     
       size_t size()
       {
-        return valuesByOrder.size();
+        return numValues;
       }
     
       iterator begin()
       {
-        return valuesByOrder.begin();
+        return valuesByOrder;
       }
     
       iterator end()
       {
-        return valuesByOrder.end();
+        return valuesByOrder + numValues;
+      }
+
+      cpp_scope *getParent()
+      {
+        return parent;
       }
     
       void addValue( cpp_value *value )
       {
-        //valuesByName.insert( valuePair( value->getName(), value ) );
-        valuesByName[value->getName()] = value;
-        valuesByOrder.push_back( value );
+        if( numValues == maxValues )
+        {
+          maxValues = maxValues ? maxValues * 2 : 4;
+          cpp_value **newValues = arena->allocate_array< cpp_value * >( maxValues );
+          if( numValues ) memcpy( newValues, valuesByOrder, numValues * sizeof( cpp_value * ) );
+          valuesByOrder = newValues;
+        }
+        valuesByOrder[ numValues++ ] = value;
+
+        // keep the table at most half full
+        if( numValues * 2 > ( 1u << tableBits ) )
+        {
+          tableBits = tableBits ? tableBits + 1 : 3;
+          slot *table = arena->allocate_array< slot >( (size_t)1 << tableBits );
+          memset( table, 0, sizeof( slot ) << tableBits );
+          for( unsigned i = 0; i != numValues; ++i )
+          {
+            insert( table, tableBits, valuesByOrder[ i ] );
+          }
+          valuesBySymbol = table;
+        } else
+        {
+          insert( valuesBySymbol, tableBits, value );
+        }
       }
     
       cpp_value *getExistingValue( cpp_value *value )
       {
-        int index = valuesByName.get_index(value->getName());
-        return index == -1 ? NULL : valuesByName.get_value(index);
+        return find( value->getSymbol() );
       }
     
-      cpp_value *lookup( const char *name )
+      /// find a symbol in this scope or the enclosing ones.
+      cpp_value *lookup( unsigned symbol )
       {
         for( cpp_scope *scope = this; scope != NULL; scope = scope->parent )
         {
-          int index = valuesByName.get_index(name);
-          if (index != -1) return valuesByName.get_value(index);
+          if( cpp_value *value = scope->find( symbol ) ) return value;
         }
         return NULL;
       }
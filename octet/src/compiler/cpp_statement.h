@@ -25,19 +25,25 @@ namespace octet
         kind_for,
         kind_while,
         kind_dowhile,
+        kind_break,
+        kind_continue,
       };
     private:
       kind_enum kind;
-      union
-      {
-        cpp_statement *statements;
-        cpp_expr *expression;
-      };
+      // if, for and while use both: the condition and the body.
+      cpp_statement *statements;
+      cpp_expr *expression;
       cpp_statement *next;
+      cpp_statement *elseStatement;
       cpp_scope *scope;
     public:
-      cpp_statement( kind_enum kind_ ) : kind( kind_ ), statements( NULL ), next( NULL )
+      cpp_statement( kind_enum kind_ ) : kind( kind_ ), statements( NULL ), expression( NULL ), next( NULL ), elseStatement( NULL ), scope( NULL )
+      {
+      }
+
+      kind_enum getKind()
       {
+        return kind;
       }
     
       cpp_statement **getStatementsAddr()
@@ -70,6 +76,17 @@ namespace octet
         return next;
       }
 
+      // the "else" part of an if statement (next is used by compound statements)
+      cpp_statement *getElse()
+      {
+        return elseStatement;
+      }
+
+      void setElse( cpp_statement *stmt )
+      {
+        elseStatement = stmt;
+      }
+
       cpp_scope *getScope()
       {
         return scope;
@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Interned identifiers.
+//
+
+namespace octet
+{
+  namespace compiler
+  {
+    /// Map identifiers to small integers so that scopes can look them up
+    /// with an integer hash and compare them with ==.
+    ///
+    /// Symbols start at 1; 0 is never a symbol.
+    /// Names are stored in blocks that never move, so get_name() pointers
+    /// stay valid for the life of the table.
+    ///
+    /// Example
+    ///
+    ///     cpp_symbols symbols;
+    ///     unsigned x = symbols.intern("x");
+    ///     assert(symbols.intern("x", 1) == x && !strcmp(symbols.get_name(x), "x"));
+    class cpp_symbols
+    {
+      struct entry {
+        const char *name;
+        unsigned length;
+        unsigned hash;
+      };
+
+      dynarray<entry> entries_;
+      dynarray<unsigned> table_;
+      cpp_arena text_;
+
+      static unsigned get_hash(const char *str, unsigned length) {
+        // FNV-1a
+        unsigned hash = 0x811c9dc5;
+        for (unsigned i = 0; i != length; ++i) {
+          hash = (hash ^ (uint8_t)str[i]) * 0x01000193;
+        }
+        return hash;
+      }
+
+      void grow_table() {
+        unsigned new_size = table_.size() ? table_.size() * 2 : 256;
+        table_.resize(new_size);
+        memset(table_.data(), 0, new_size * sizeof(unsigned));
+        unsigned mask = new_size - 1;
+        for (unsigned sym = 1; sym != entries_.size(); ++sym) {
+          unsigned i = entries_[sym].hash & mask;
+          while (table_[i]) i = (i + 1) & mask;
+          table_[i] = sym;
+        }
+      }
+
+    public:
+      cpp_symbols() : text_(0x4000) {
+        entry none = { "", 0, 0 };
+        entries_.push_back(none);
+        grow_table();
+      }
+
+      /// Find or add the symbol for [str, str+length).
+      unsigned intern(const char *str, unsigned length) {
+        unsigned hash = get_hash(str, length);
+        unsigned mask = table_.size() - 1;
+        unsigned i = hash & mask;
+        for (;;) {
+          unsigned sym = table_[i];
+          if (!sym) break;
+          const entry &e = entries_[sym];
+          if (e.hash == hash && e.length == length && !memcmp(e.name, str, length)) {
+            return sym;
+          }
+          i = (i + 1) & mask;
+        }
+
+        char *name = text_.allocate_array<char>(length + 1);
+        memcpy(name, str, length);
+        name[length] = 0;
+        entry e = { name, length, hash };
+        unsigned sym = entries_.size();
+        entries_.push_back(e);
+        if (entries_.size() * 2 > table_.size()) {
+          grow_table();
+        } else {
+          table_[i] = sym;
+        }
+        return sym;
+      }
+
+      /// Find or add the symbol for a zero terminated string.
+      unsigned intern(const char *str) {
+        return intern(str, (unsigned)strlen(str));
+      }
+
+      /// Zero terminated name of a symbol.
+      const char *get_name(unsigned sym) const {
+        return entries_[sym].name;
+      }
+
+      unsigned get_length(unsigned sym) const {
+        return entries_[sym].length;
+      }
+
+      /// One more than the largest symbol.
+      unsigned size() const {
+        return entries_.size();
+      }
+    };
+  }
+}
@@ -78,8 +78,14 @@ namespace octet
       bool isConst : 1;
       bool isPacked : 1;
       bool isReturnByValue : 1;
+      bool isBuffer : 1;
+      bool isStd140 : 1;
+      bool isAttribute : 1;
+      bool isVarying : 1;
+      bool isMatrix : 1;
     
       unsigned dimension : 16;
+      unsigned binding : 8;
     
       void clear()
       {
@@ -89,7 +95,13 @@ namespace octet
         isConst = false;
         isPacked = false;
         isReturnByValue = false;
+        isBuffer = false;
+        isStd140 = false;
+        isAttribute = false;
+        isVarying = false;
+        isMatrix = false;
         dimension = 0;
+        binding = 0;
         //llvmType = NULL;
         subType = NULL;
         scope = NULL;
@@ -102,14 +114,6 @@ namespace octet
         subType = subType_;
       }
 
-      cpp_type( cpp_type::kind_enum kind_, unsigned dim, bool isPacked_=false ) : kind( kind_array )
-      {
-        clear();
-        subType = new cpp_type( kind_ );
-        dimension = dim;
-        subType->isPacked = isPacked_;
-      }
-
       cpp_type( cpp_type::kind_enum kind_, cpp_type *subType_, unsigned dim ) : kind( kind_ )
       {
         clear();
@@ -154,6 +158,21 @@ namespace octet
       bool getIsPacked() const { return isPacked; }
       void setIsReturnByValue( bool isReturnByValue_ ) { isReturnByValue = isReturnByValue_; }
       bool getIsReturnByValue() const { return isReturnByValue; }
+      // GLSL shader storage blocks: layout(std140, binding = n) buffer name { ... } instance;
+      void setIsBuffer( bool isBuffer_ ) { isBuffer = isBuffer_; }
+      bool getIsBuffer() const { return isBuffer; }
+      void setIsStd140( bool isStd140_ ) { isStd140 = isStd140_; }
+      bool getIsStd140() const { return isStd140; }
+      void setBinding( unsigned binding_ ) { binding = binding_; }
+      unsigned getBinding() const { return binding; }
+      // GLSL ES vertex inputs and vertex to fragment values.
+      void setIsAttribute( bool isAttribute_ ) { isAttribute = isAttribute_; }
+      bool getIsAttribute() const { return isAttribute; }
+      void setIsVarying( bool isVarying_ ) { isVarying = isVarying_; }
+      bool getIsVarying() const { return isVarying; }
+      // mat2, mat3 and mat4 are arrays of column vectors with this set.
+      void setIsMatrix( bool isMatrix_ ) { isMatrix = isMatrix_; }
+      bool getIsMatrix() const { return isMatrix; }
 
       bool getIsFloat()
       {
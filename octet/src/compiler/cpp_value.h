@@ -17,11 +17,17 @@ namespace octet
     class cpp_statement;
     class cpp_value;
 
+    /// A named variable, parameter, structure member or function.
+    ///
+    /// Values live in the parser's arena. Names are interned symbols (see cpp_symbols)
+    /// and the name strings belong to the symbol table.
     class cpp_value
     {
       cpp_type *valueType;
-      string name;
-      string semantic;
+      unsigned symbol;
+      const char *name;
+      unsigned semanticSymbol;
+      const char *semantic;
       unsigned offset;
       cpp_expr *init;
       //Value *llvmValue;
@@ -30,8 +36,10 @@ namespace octet
       // if we don't find a match for the first one, we can try another.
       cpp_value *nextPolymorphicValue;
     public:
-      cpp_value( cpp_type *valueType_, const char *name_ ) : valueType( valueType_ ), name( name_ )
+      cpp_value( cpp_type *valueType_, unsigned symbol_, const char *name_ ) : valueType( valueType_ ), symbol( symbol_ ), name( name_ )
       {
+        semanticSymbol = 0;
+        semantic = "";
         init = NULL;
         offset = 0;
         //llvmValue = NULL;
@@ -50,17 +58,28 @@ namespace octet
 
       const char *getName() const
       {
-        return name.c_str();
+        return name;
+      }
+
+      unsigned getSymbol() const
+      {
+        return symbol;
       }
 
-      void setSemantic( const char *name_ )
+      void setSemantic( unsigned symbol_, const char *name_ )
       {
+        semanticSymbol = symbol_;
         semantic = name_;
       }
     
       const char *getSemantic()
       {
-        return name;
+        return semantic;
+      }
+
+      unsigned getSemanticSymbol()
+      {
+        return semanticSymbol;
       }
     
       cpp_type *getType() const
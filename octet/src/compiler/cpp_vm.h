@@ -0,0 +1,1885 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Bytecode back end and SIMD virtual machine for compute kernels.
+//
+// Every register holds one 32 bit value for each invocation of a batch of
+// 4, 8 or 16 "lanes", so each instruction runs a whole batch at once.
+// if, for and while are run with an execution mask in register 0: both sides
+// of an if are run, and variables and buffers are only written in the lanes
+// that are taking that path.
+//
+
+namespace octet
+{
+  namespace compiler
+  {
+    /// One instruction: d = a op b, with c and imm for the few that need them.
+    struct cpp_vm_instruction {
+      uint16_t op;
+      uint16_t d;
+      uint16_t a;
+      uint16_t b;
+      uint16_t c;
+      uint16_t pad;
+      int32_t imm;
+    };
+
+    /// A compiled kernel: bytecode, constants and where to find the uniforms and builtins.
+    class cpp_vm_program {
+    public:
+      enum opcode {
+        op_end,
+        // float: d = a op b, compares make ~0 or 0.
+        op_fadd, op_fsub, op_fmul, op_fdiv, op_fmin, op_fmax,
+        op_flt, op_fle, op_feq, op_fne,
+        op_fsqrt, op_ffloor, op_fceil,
+        // d = function imm of a (and b)
+        op_fcall,
+        // int: d = a op b
+        op_iadd, op_isub, op_imul, op_idiv, op_imod, op_ishl, op_ishr, op_imin, op_imax,
+        op_ilt, op_ile, op_ieq, op_ine,
+        // bits: d = a op b, andnot is a & ~b
+        op_and, op_or, op_xor, op_andnot,
+        op_i2f, op_f2i,
+        // d = a, d = c ? a : b, d = mask ? a : d
+        op_mov, op_select, op_movm,
+        // to imm always, if no lanes are active, if any lanes are active
+        op_jump, op_jump_none, op_jump_any,
+        // d = buffer b at byte a + imm, buffer b at byte a + imm = d (active lanes only)
+        op_load, op_store,
+      };
+
+      enum function {
+        fn_sin, fn_cos, fn_tan, fn_asin, fn_acos, fn_atan, fn_atan2,
+        fn_exp, fn_log, fn_exp2, fn_log2, fn_pow, fn_fmod,
+      };
+
+      // compute shader inputs, three registers each except local_index
+      enum builtin {
+        builtin_global_id, builtin_local_id, builtin_group_id,
+        builtin_num_groups, builtin_group_size, builtin_local_index,
+        num_builtins
+      };
+
+      enum {
+        mask_reg = 0,
+        max_bindings = 16,
+      };
+
+      /// A register that has the same value in every lane.
+      struct constant {
+        uint16_t reg;
+        uint32_t bits;
+      };
+
+      /// A uniform is a run of constants that set_uniform() can change.
+      struct uniform {
+        unsigned name;
+        unsigned first_constant;
+        unsigned count;
+        bool is_int;
+      };
+
+      dynarray<cpp_vm_instruction> code;
+      dynarray<constant> constants;
+      dynarray<uniform> uniforms;
+      dynarray<char> names;
+      unsigned num_regs;
+      uint16_t builtins[num_builtins];
+      unsigned local_size[3];
+
+      cpp_vm_program() {
+        reset();
+      }
+
+      void reset() {
+        code.resize(0);
+        constants.resize(0);
+        uniforms.resize(0);
+        names.resize(0);
+        num_regs = 1;
+        memset(builtins, 0, sizeof(builtins));
+        local_size[0] = local_size[1] = local_size[2] = 1;
+      }
+
+      const uniform *find_uniform(const char *name) const {
+        for (unsigned i = 0; i != uniforms.size(); ++i) {
+          if (!strcmp(&names[uniforms[i].name], name)) return &uniforms[i];
+        }
+        return 0;
+      }
+
+      const char *get_name(const uniform &u) const {
+        return &names[u.name];
+      }
+    };
+
+    /// Lower the syntax tree of a cpp_parser to cpp_vm_program bytecode.
+    ///
+    /// User functions are inlined, so recursion is not allowed (as in GLSL).
+    /// Variables live in registers; shader storage blocks
+    /// ("layout(binding = n) buffer name { ... } instance;") live in memory
+    /// with std430 or std140 layout.
+    ///
+    /// Example
+    ///
+    ///     cpp_parser parser;
+    ///     cpp_vm_program program;
+    ///     if (parser.parse(src) && cpp_vm_compiler(parser, program).compile("main")) {
+    ///       cpp_vm vm(program);
+    ///       ...
+    ///     }
+    class cpp_vm_compiler {
+      typedef cpp_vm_program prog;
+
+      enum scalar_kind { sk_float, sk_int, sk_bool, sk_none };
+
+      // a value in registers or in a buffer.
+      struct operand {
+        cpp_type *type;
+        unsigned count;
+        bool in_memory;
+        // comps[] holds the register or byte offset of each component (swizzles).
+        bool expanded;
+        // first register or byte offset
+        int base;
+        // buffers only
+        unsigned binding;
+        bool std140;
+        uint16_t offset_reg;
+        int comps[4];
+      };
+
+      struct loop_info {
+        uint16_t brk;
+        uint16_t cont;
+        dynarray<unsigned> *cont_jumps;
+      };
+
+      struct function_info {
+        cpp_value *function;
+        uint16_t ret_mask;
+        int ret_base;
+        cpp_statement *tail_return;
+        unsigned loop_base;
+        dynarray<unsigned> *exit_jumps;
+      };
+
+      cpp_parser &parser;
+      prog &program;
+      hash_map<cpp_value *, unsigned> vars;
+      dynarray<loop_info> loops;
+      dynarray<function_info> functions;
+      dynarray<unsigned> literal_constants;
+      dynarray<int> offsets;
+      // variables and constants keep their registers for the whole program.
+      // Temporaries are numbered from temp_base and freed after each statement;
+      // finish() moves them to just after the variables.
+      unsigned next_var;
+      unsigned next_reg;
+      unsigned max_reg;
+      unsigned depth;
+      uint16_t zero_reg;
+      bool ok;
+
+      enum { max_inline_depth = 32 };
+
+      bool error(const char *msg, const char *name = "") {
+        if (ok) cpp_log("error: %s%s\n", msg, name);
+        ok = false;
+        return false;
+      }
+
+      unsigned emit(unsigned op, unsigned d = 0, unsigned a = 0, unsigned b = 0, unsigned c = 0, int imm = 0) {
+        cpp_vm_instruction ins = { (uint16_t)op, (uint16_t)d, (uint16_t)a, (uint16_t)b, (uint16_t)c, 0, imm };
+        program.code.push_back(ins);
+        return program.code.size() - 1;
+      }
+
+      void patch(dynarray<unsigned> &jumps) {
+        for (unsigned i = 0; i != jumps.size(); ++i) {
+          program.code[jumps[i]].imm = program.code.size();
+        }
+        jumps.resize(0);
+      }
+
+      enum { temp_base = 0x8000 };
+
+      unsigned new_regs(unsigned n) {
+        unsigned result = next_reg;
+        next_reg += n;
+        if (next_reg > 0xffff) {
+          error("kernel needs too many registers");
+          next_reg = result = temp_base;
+        }
+        if (next_reg > max_reg) max_reg = next_reg;
+        return result;
+      }
+
+      unsigned new_vars(unsigned n) {
+        unsigned result = next_var;
+        next_var += n;
+        if (next_var > temp_base) {
+          error("kernel needs too many registers");
+          next_var = result = 1;
+        }
+        return result;
+      }
+
+      // number the temporaries after the variables.
+      void finish() {
+        unsigned offset = temp_base - next_var;
+        for (unsigned i = 0; i != program.code.size(); ++i) {
+          cpp_vm_instruction &ins = program.code[i];
+          bool is_memory = ins.op == prog::op_load || ins.op == prog::op_store;
+          if (ins.d >= temp_base) ins.d -= offset;
+          if (ins.a >= temp_base) ins.a -= offset;
+          if (ins.b >= temp_base && !is_memory) ins.b -= offset;
+          if (ins.c >= temp_base) ins.c -= offset;
+        }
+        program.num_regs = max_reg - offset;
+      }
+
+      uint16_t constant(uint32_t bits) {
+        for (unsigned i = 0; i != literal_constants.size(); ++i) {
+          const prog::constant &c = program.constants[literal_constants[i]];
+          if (c.bits == bits) return c.reg;
+        }
+        // constants live for the whole program, like variables.
+        prog::constant c = { (uint16_t)new_vars(1), bits };
+        literal_constants.push_back(program.constants.size());
+        program.constants.push_back(c);
+        return c.reg;
+      }
+
+      uint16_t fconst(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, 4);
+        return constant(bits);
+      }
+
+      uint16_t iconst(int value) {
+        return constant((uint32_t)value);
+      }
+
+      // type helpers
+      static scalar_kind get_kind(cpp_type *type) {
+        switch (type->getKind()) {
+          case cpp_type::kind_float: case cpp_type::kind_half: case cpp_type::kind_cfloat: return sk_float;
+          case cpp_type::kind_int: case cpp_type::kind_cint: return sk_int;
+          case cpp_type::kind_bool: return sk_bool;
+          case cpp_type::kind_array: return get_kind(type->getSubType());
+          default: return sk_none;
+        }
+      }
+
+      // number of 32 bit components; 0 for unsized arrays and types we can not hold.
+      static unsigned get_count(cpp_type *type) {
+        switch (type->getKind()) {
+          case cpp_type::kind_array: return type->getDimension() * get_count(type->getSubType());
+          case cpp_type::kind_struct: {
+            unsigned result = 0;
+            cpp_scope *scope = type->getScope();
+            if (!scope) return 0;
+            for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+              unsigned n = get_count((*i)->getType());
+              if (!n) return 0;
+              result += n;
+            }
+            return result;
+          }
+          default: return get_kind(type) == sk_none ? 0 : 1;
+        }
+      }
+
+      // std430 layout, with structures and array elements rounded to 16 bytes for std140.
+      static unsigned mem_align(cpp_type *type, bool std140) {
+        unsigned result = 4;
+        if (type->getIsVector()) {
+          result = type->getDimension() == 1 ? 4 : type->getDimension() == 2 ? 8 : 16;
+        } else if (type->getKind() == cpp_type::kind_array) {
+          result = mem_align(type->getSubType(), std140);
+          if (std140 && result < 16) result = 16;
+        } else if (type->getKind() == cpp_type::kind_struct && type->getScope()) {
+          cpp_scope *scope = type->getScope();
+          for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+            unsigned a = mem_align((*i)->getType(), std140);
+            if (a > result) result = a;
+          }
+          if (std140 && result < 16) result = 16;
+        }
+        return result;
+      }
+
+      static unsigned mem_stride(cpp_type *type, bool std140) {
+        unsigned align = mem_align(type, std140);
+        return (mem_size(type, std140) + align - 1) & ~(align - 1);
+      }
+
+      static unsigned mem_size(cpp_type *type, bool std140) {
+        if (type->getIsVector()) {
+          return type->getDimension() * 4;
+        } else if (type->getKind() == cpp_type::kind_array) {
+          return type->getDimension() * mem_stride(type->getSubType(), std140);
+        } else if (type->getKind() == cpp_type::kind_struct && type->getScope()) {
+          unsigned offset = 0;
+          cpp_scope *scope = type->getScope();
+          for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+            unsigned a = mem_align((*i)->getType(), std140);
+            offset = ((offset + a - 1) & ~(a - 1)) + mem_size((*i)->getType(), std140);
+          }
+          unsigned a = mem_align(type, std140);
+          return (offset + a - 1) & ~(a - 1);
+        }
+        return 4;
+      }
+
+      static unsigned member_offset(cpp_type *type, cpp_value *member, bool std140) {
+        unsigned offset = 0;
+        cpp_scope *scope = type->getScope();
+        for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+          unsigned a = mem_align((*i)->getType(), std140);
+          offset = (offset + a - 1) & ~(a - 1);
+          if (*i == member) break;
+          offset += mem_size((*i)->getType(), std140);
+        }
+        return offset;
+      }
+
+      static unsigned member_component(cpp_type *type, cpp_value *member) {
+        unsigned result = 0;
+        cpp_scope *scope = type->getScope();
+        for (cpp_scope::iterator i = scope->begin(); i != scope->end() && *i != member; ++i) {
+          result += get_count((*i)->getType());
+        }
+        return result;
+      }
+
+      // byte offsets of every component of a type in a buffer.
+      static void mem_offsets(dynarray<int> &result, cpp_type *type, bool std140, int base) {
+        if (type->getKind() == cpp_type::kind_array) {
+          cpp_type *sub = type->getSubType();
+          unsigned stride = type->getIsVector() ? 4 : mem_stride(sub, std140);
+          for (unsigned i = 0; i != type->getDimension(); ++i) {
+            mem_offsets(result, sub, std140, base + i * stride);
+          }
+        } else if (type->getKind() == cpp_type::kind_struct) {
+          cpp_scope *scope = type->getScope();
+          for (cpp_scope::iterator i = scope->begin(); i != scope->end(); ++i) {
+            mem_offsets(result, (*i)->getType(), std140, base + member_offset(type, *i, std140));
+          }
+        } else {
+          result.push_back(base);
+        }
+      }
+
+      // operands
+      void make_regs(operand &result, cpp_type *type, unsigned base) {
+        result.type = type;
+        result.count = get_count(type);
+        result.in_memory = false;
+        result.expanded = false;
+        result.base = (int)base;
+        result.binding = 0;
+        result.std140 = false;
+        result.offset_reg = 0;
+      }
+
+      void make_temp(operand &result, cpp_type *type) {
+        unsigned n = get_count(type);
+        if (!n) error("unsupported type in expression");
+        make_regs(result, type, new_regs(n ? n : 1));
+      }
+
+      unsigned comp_reg(const operand &op, unsigned i) {
+        return op.expanded ? op.comps[i] : op.base + i;
+      }
+
+      // a scalar argument is used for every component.
+      unsigned comp_reg_smear(const operand &op, unsigned i) {
+        return comp_reg(op, op.count == 1 ? 0 : i);
+      }
+
+      // component byte offsets of a memory operand
+      void get_offsets(const operand &op) {
+        offsets.resize(0);
+        if (op.expanded) {
+          for (unsigned i = 0; i != op.count; ++i) offsets.push_back(op.comps[i]);
+        } else {
+          mem_offsets(offsets, op.type, op.std140, op.base);
+        }
+      }
+
+      // make sure an operand is in registers.
+      bool load(operand &op) {
+        if (!op.in_memory) return ok;
+        if (!op.count) return error("can not load an unsized array");
+        operand result;
+        make_temp(result, op.type);
+        get_offsets(op);
+        for (unsigned i = 0; i != op.count; ++i) {
+          emit(prog::op_load, result.base + i, op.offset_reg, op.binding, 0, offsets[i]);
+        }
+        op = result;
+        return ok;
+      }
+
+      // write src to dest. Variables only change in active lanes unless we are in straight line code.
+      bool store(operand &dest, operand &src) {
+        if (!load(src)) return false;
+        if (src.count != dest.count || !dest.count) return error("assignment of different sized values");
+        if (dest.in_memory) {
+          get_offsets(dest);
+          for (unsigned i = 0; i != dest.count; ++i) {
+            emit(prog::op_store, comp_reg(src, i), dest.offset_reg, dest.binding, 0, offsets[i]);
+          }
+          return ok;
+        }
+
+        // v.xy = v.yx needs a copy first
+        bool alias = false;
+        for (unsigned i = 0; i != dest.count && !alias; ++i) {
+          for (unsigned j = i + 1; j != src.count; ++j) {
+            alias |= comp_reg(dest, i) == comp_reg(src, j);
+          }
+        }
+        if (alias) {
+          operand tmp;
+          make_temp(tmp, src.type);
+          for (unsigned i = 0; i != src.count; ++i) emit(prog::op_mov, tmp.base + i, comp_reg(src, i));
+          src = tmp;
+        }
+
+        unsigned op = depth ? prog::op_movm : prog::op_mov;
+        for (unsigned i = 0; i != dest.count; ++i) {
+          if (comp_reg(dest, i) != comp_reg(src, i)) {
+            emit(op, comp_reg(dest, i), comp_reg(src, i));
+          }
+        }
+        return ok;
+      }
+
+      // variables, uniforms and builtins
+      unsigned var_regs(cpp_value *value) {
+        unsigned &reg = vars[value];
+        if (!reg) {
+          unsigned n = get_count(value->getType());
+          if (!n) {
+            error("unsupported variable type: ", value->getName());
+            n = 1;
+          }
+          reg = new_vars(n);
+        }
+        return reg;
+      }
+
+      // evaluate a constant initialiser for a uniform's default value.
+      bool get_constant(cpp_expr *expr, double &result) {
+        switch (expr->getKind()) {
+          case cpp_expr::kind_int_value: result = (double)(long long)expr->getIntValue(); return true;
+          case cpp_expr::kind_double_value: result = expr->getDoubleValue(); return true;
+          case cpp_expr::kind_cast: return get_kind(expr->getType()) != sk_none && get_count(expr->getType()) == 1 && get_constant(expr->getKid(0), result);
+          case cpp_expr::kind_minus: {
+            double lhs = 0, rhs = 0;
+            if (!get_constant(expr->getKid(0), lhs) || !get_constant(expr->getKid(1), rhs)) return false;
+            result = lhs - rhs;
+            return true;
+          }
+          default: return false;
+        }
+      }
+
+      void add_uniform(cpp_value *value) {
+        cpp_type *type = value->getType();
+        unsigned n = get_count(type);
+        scalar_kind kind = get_kind(type);
+        if (!n || type->getKind() == cpp_type::kind_struct || kind == sk_none) {
+          error("unsupported uniform type: ", value->getName());
+          return;
+        }
+
+        prog::uniform u;
+        u.name = program.names.size();
+        for (const char *p = value->getName(); *p; ++p) program.names.push_back(*p);
+        program.names.push_back(0);
+        u.first_constant = program.constants.size();
+        u.count = n;
+        u.is_int = kind != sk_float;
+        program.uniforms.push_back(u);
+
+        // default value from the initialiser, eg. uniform float radius = 1.0;
+        double init = 0;
+        cpp_expr *expr = value->getInit();
+        if (expr && !get_constant(expr, init)) init = 0;
+
+        unsigned reg = new_vars(n);
+        vars[value] = reg;
+        for (unsigned i = 0; i != n; ++i) {
+          float f = (float)init;
+          int32_t iv = kind == sk_bool ? -(init != 0) : (int32_t)init;
+          prog::constant c = { (uint16_t)(reg + i), 0 };
+          if (kind == sk_float) memcpy(&c.bits, &f, 4); else c.bits = (uint32_t)iv;
+          program.constants.push_back(c);
+        }
+      }
+
+      unsigned builtin_regs(cpp_value *value) {
+        static const char *const names[] = {
+          "gl_GlobalInvocationID", "gl_LocalInvocationID", "gl_WorkGroupID",
+          "gl_NumWorkGroups", "gl_WorkGroupSize", "gl_LocalInvocationIndex",
+        };
+        for (unsigned i = 0; i != prog::num_builtins; ++i) {
+          if (!strcmp(value->getName(), names[i])) {
+            if (!program.builtins[i]) {
+              program.builtins[i] = (uint16_t)var_regs(value);
+            }
+            return program.builtins[i];
+          }
+        }
+        return 0;
+      }
+
+      // constant int index, eg. a[ 2 ]
+      bool get_index(cpp_expr *expr, int &result) {
+        double value = 0;
+        if (get_kind(expr->getType()) == sk_float || !get_constant(expr, value)) return false;
+        result = (int)value;
+        return true;
+      }
+
+      // conversions
+      void convert_scalar(unsigned dest, unsigned src, scalar_kind from, scalar_kind to) {
+        if (from == to) {
+          emit(prog::op_mov, dest, src);
+        } else if (to == sk_bool) {
+          emit(from == sk_float ? prog::op_fne : prog::op_ine, dest, src, zero_reg);
+        } else if (from == sk_bool) {
+          // ~0 & 1.0f is 1.0f
+          emit(prog::op_and, dest, src, to == sk_float ? fconst(1.0f) : iconst(1));
+        } else {
+          emit(to == sk_float ? prog::op_i2f : prog::op_f2i, dest, src);
+        }
+      }
+
+      // cast src to type: scalars are smeared, vectors are truncated or extended with their last component.
+      bool convert(operand &result, operand &src, cpp_type *type) {
+        if (!load(src)) return false;
+        if (*src.type == *type) {
+          result = src;
+          result.type = type;
+          return ok;
+        }
+        scalar_kind from = get_kind(src.type);
+        scalar_kind to = get_kind(type);
+        unsigned n = get_count(type);
+        if (from == sk_none || to == sk_none || !n || !src.count) {
+          if (src.count == n && n) {
+            // structures of the same shape
+            result = src;
+            result.type = type;
+            return ok;
+          }
+          return error("unsupported cast");
+        }
+        if (from == to && src.count == n) {
+          result = src;
+          result.type = type;
+          return ok;
+        }
+        make_temp(result, type);
+        for (unsigned i = 0; i != n; ++i) {
+          unsigned s = i < src.count ? i : src.count - 1;
+          convert_scalar(result.base + i, comp_reg(src, s), from, to);
+        }
+        return ok;
+      }
+
+      // scalar bool register for a condition
+      bool condition(cpp_expr *expr, unsigned &result) {
+        operand op;
+        if (!rvalue(expr, op)) return false;
+        if (get_kind(op.type) == sk_bool) {
+          result = comp_reg(op, 0);
+        } else {
+          result = new_regs(1);
+          convert_scalar(result, comp_reg(op, 0), get_kind(op.type), sk_bool);
+        }
+        return ok;
+      }
+
+      bool rvalue(cpp_expr *expr, operand &result) {
+        return eval(expr, result) && load(result);
+      }
+
+      // expressions
+      bool eval(cpp_expr *expr, operand &result) {
+        if (!ok) return false;
+        switch (expr->getKind()) {
+          case cpp_expr::kind_nop: {
+            make_regs(result, expr->getType(), zero_reg);
+            result.count = 0;
+            return ok;
+          }
+          case cpp_expr::kind_value: return eval_value(expr->getValue(), result);
+          case cpp_expr::kind_int_value: {
+            long long value = (long long)expr->getIntValue();
+            unsigned reg = get_kind(expr->getType()) == sk_bool ? iconst(value ? -1 : 0) : iconst((int)value);
+            make_regs(result, expr->getType(), reg);
+            return ok;
+          }
+          case cpp_expr::kind_double_value: {
+            make_regs(result, expr->getType(), fconst((float)expr->getDoubleValue()));
+            return ok;
+          }
+          case cpp_expr::kind_dot: {
+            if (!eval(expr->getKid(0), result)) return false;
+            cpp_type *type = result.type;
+            cpp_value *member = expr->getValue();
+            if (type->getKind() != cpp_type::kind_struct) return error("'.' on something that is not a structure");
+            if (result.in_memory) {
+              result.base += member_offset(type, member, result.std140);
+            } else {
+              result.base += member_component(type, member);
+            }
+            result.type = member->getType();
+            result.count = get_count(result.type);
+            return ok;
+          }
+          case cpp_expr::kind_index: return eval_index(expr, result);
+          case cpp_expr::kind_swiz: {
+            operand src;
+            if (!eval(expr->getKid(0), src)) return false;
+            unsigned n = get_count(expr->getType());
+            if (src.in_memory) get_offsets(src);
+            result = src;
+            result.type = expr->getType();
+            result.count = n;
+            result.expanded = true;
+            unsigned char *swiz = expr->getSwiz();
+            for (unsigned i = 0; i != n; ++i) {
+              if (swiz[i] >= src.count) return error("swizzle out of range");
+              result.comps[i] = src.in_memory ? offsets[swiz[i]] : comp_reg(src, swiz[i]);
+            }
+            return ok;
+          }
+          case cpp_expr::kind_cast: {
+            operand src;
+            return rvalue(expr->getKid(0), src) && convert(result, src, expr->getType());
+          }
+          case cpp_expr::kind_init: return eval_init(expr, result);
+          case cpp_expr::kind_comma: {
+            operand lhs;
+            return eval(expr->getKid(0), lhs) && eval(expr->getKid(1), result);
+          }
+          case cpp_expr::kind_question: {
+            unsigned cond = 0;
+            operand lhs, rhs;
+            if (!condition(expr->getKid(0), cond) || !rvalue(expr->getKid(1), lhs) || !rvalue(expr->getKid(2), rhs)) return false;
+            make_temp(result, expr->getType());
+            for (unsigned i = 0; i != result.count; ++i) {
+              emit(prog::op_select, result.base + i, comp_reg_smear(lhs, i), comp_reg_smear(rhs, i), cond);
+            }
+            return ok;
+          }
+          case cpp_expr::kind_equals: {
+            operand lhs;
+            if (!eval(expr->getKid(0), lhs) || !rvalue(expr->getKid(1), result)) return false;
+            operand src;
+            if (!convert(src, result, lhs.type)) return false;
+            result = src;
+            return store(lhs, src);
+          }
+          case cpp_expr::kind_call: return eval_call(expr, result);
+          case cpp_expr::kind_or: case cpp_expr::kind_and: case cpp_expr::kind_xor:
+          case cpp_expr::kind_lt: case cpp_expr::kind_gt: case cpp_expr::kind_le: case cpp_expr::kind_ge:
+          case cpp_expr::kind_eq: case cpp_expr::kind_ne:
+          case cpp_expr::kind_shift_left: case cpp_expr::kind_shift_right:
+          case cpp_expr::kind_plus: case cpp_expr::kind_minus: case cpp_expr::kind_star:
+          case cpp_expr::kind_divide: case cpp_expr::kind_mod:
+          case cpp_expr::kind_or_or: case cpp_expr::kind_and_and: {
+            return eval_binary(expr, result);
+          }
+          default: {
+            return error("unsupported expression: ", cpp_expr::kindName(expr->getKind()));
+          }
+        }
+      }
+
+      bool eval_value(cpp_value *value, operand &result) {
+        cpp_type *type = value->getType();
+        if (type->getIsBuffer()) {
+          make_regs(result, type, 0);
+          result.in_memory = true;
+          result.binding = type->getBinding();
+          result.std140 = type->getIsStd140();
+          result.offset_reg = zero_reg;
+          if (result.binding >= prog::max_bindings) return error("buffer binding too large: ", value->getName());
+          return ok;
+        }
+        if (type->getKind() == cpp_type::kind_function) {
+          return error("function used as a value: ", value->getName());
+        }
+        unsigned reg = vars[value];
+        if (!reg && !strncmp(value->getName(), "gl_", 3)) reg = builtin_regs(value);
+        if (!reg) reg = var_regs(value);
+        make_regs(result, type, reg);
+        return ok;
+      }
+
+      bool eval_index(cpp_expr *expr, operand &result) {
+        if (!eval(expr->getKid(0), result)) return false;
+        cpp_type *type = result.type;
+        if (type->getKind() != cpp_type::kind_array) return error("[] on something that is not an array");
+        cpp_type *sub = type->getSubType();
+        if (type->getIsVector()) {
+          sub = expr->getType();
+        }
+        unsigned n = get_count(sub);
+        int index = 0;
+        bool is_constant = get_index(expr->getKid(1), index);
+        if (is_constant && (index < 0 || (type->getDimension() && (unsigned)index >= type->getDimension()))) {
+          return error("array index out of range");
+        }
+
+        if (result.expanded) {
+          // (v.zyx)[ 1 ]
+          if (!is_constant) return error("variable index of a swizzle");
+          result.comps[0] = result.comps[index];
+        } else if (!result.in_memory) {
+          if (!is_constant) return error("variable index of an array in registers; use a buffer");
+          result.base += index * n;
+        } else {
+          unsigned stride = type->getIsVector() ? 4 : mem_stride(sub, result.std140);
+          if (is_constant) {
+            result.base += index * stride;
+          } else {
+            operand idx;
+            if (!rvalue(expr->getKid(1), idx)) return false;
+            unsigned i = comp_reg(idx, 0);
+            if (get_kind(idx.type) != sk_int) {
+              unsigned tmp = new_regs(1);
+              convert_scalar(tmp, i, get_kind(idx.type), sk_int);
+              i = tmp;
+            }
+            unsigned offset = new_regs(1);
+            emit(prog::op_imul, offset, i, iconst(stride));
+            if (result.offset_reg != zero_reg) {
+              emit(prog::op_iadd, offset, offset, result.offset_reg);
+            }
+            result.offset_reg = (uint16_t)offset;
+          }
+        }
+        result.type = sub;
+        result.count = n;
+        return ok;
+      }
+
+      // float4( xyz, 1 ), float( i ), float3( 0 )
+      bool eval_init(cpp_expr *expr, operand &result) {
+        cpp_type *type = expr->getType();
+        unsigned numArgs = expr->getNumArgs();
+        if (numArgs == 1) {
+          operand src;
+          if (!rvalue(expr->getArg(0), src)) return false;
+          bool is_matrix = type->getKind() == cpp_type::kind_array && !type->getIsVector();
+          if (is_matrix && src.count == 1) {
+            // mat4( 1.0 ) is a diagonal matrix
+            unsigned rows = type->getSubType()->getDimension();
+            make_temp(result, type);
+            operand s;
+            if (!convert(s, src, type->getSubType()->getSubType())) return false;
+            for (unsigned i = 0; i != result.count; ++i) {
+              emit(prog::op_mov, result.base + i, i % rows == i / rows ? comp_reg(s, 0) : zero_reg);
+            }
+            return ok;
+          }
+          return convert(result, src, type);
+        }
+
+        scalar_kind to = get_kind(type);
+        make_temp(result, type);
+        unsigned n = 0;
+        for (unsigned arg = 0; arg != numArgs; ++arg) {
+          operand src;
+          if (!rvalue(expr->getArg(arg), src)) return false;
+          scalar_kind from = get_kind(src.type);
+          if (from == sk_none || to == sk_none) return error("unsupported constructor");
+          for (unsigned i = 0; i != src.count && n != result.count; ++i) {
+            convert_scalar(result.base + n++, comp_reg(src, i), from, to);
+          }
+        }
+        if (n != result.count) return error("not enough values in constructor");
+        return ok;
+      }
+
+      bool eval_binary(cpp_expr *expr, operand &result) {
+        operand lhs, rhs;
+        if (!rvalue(expr->getKid(0), lhs) || !rvalue(expr->getKid(1), rhs)) return false;
+        cpp_expr::kind_enum kind = expr->getKind();
+        scalar_kind sk = get_kind(lhs.type);
+        if (sk == sk_none || get_kind(rhs.type) == sk_none) return error("unsupported operands for ", cpp_expr::kindName(kind));
+        unsigned n = lhs.count > rhs.count ? lhs.count : rhs.count;
+
+        if (kind == cpp_expr::kind_and_and || kind == cpp_expr::kind_or_or) {
+          // both sides are always evaluated
+          unsigned a = new_regs(1), b = new_regs(1);
+          convert_scalar(a, comp_reg(lhs, 0), sk, sk_bool);
+          convert_scalar(b, comp_reg(rhs, 0), get_kind(rhs.type), sk_bool);
+          emit(kind == cpp_expr::kind_and_and ? prog::op_and : prog::op_or, a, a, b);
+          make_temp(result, expr->getType());
+          convert_scalar(result.base, a, sk_bool, get_kind(expr->getType()));
+          return ok;
+        }
+
+        bool is_float = sk == sk_float;
+        bool is_compare = false;
+        bool swap = false;
+        unsigned op = 0;
+        switch (kind) {
+          case cpp_expr::kind_plus: op = is_float ? prog::op_fadd : prog::op_iadd; break;
+          case cpp_expr::kind_minus: op = is_float ? prog::op_fsub : prog::op_isub; break;
+          case cpp_expr::kind_star: op = is_float ? prog::op_fmul : prog::op_imul; break;
+          case cpp_expr::kind_divide: op = is_float ? prog::op_fdiv : prog::op_idiv; break;
+          case cpp_expr::kind_mod: op = is_float ? prog::op_fcall : prog::op_imod; break;
+          case cpp_expr::kind_shift_left: op = prog::op_ishl; break;
+          case cpp_expr::kind_shift_right: op = prog::op_ishr; break;
+          case cpp_expr::kind_and: op = prog::op_and; break;
+          case cpp_expr::kind_or: op = prog::op_or; break;
+          case cpp_expr::kind_xor: op = prog::op_xor; break;
+          case cpp_expr::kind_lt: op = is_float ? prog::op_flt : prog::op_ilt; is_compare = true; break;
+          case cpp_expr::kind_le: op = is_float ? prog::op_fle : prog::op_ile; is_compare = true; break;
+          case cpp_expr::kind_gt: op = is_float ? prog::op_flt : prog::op_ilt; is_compare = swap = true; break;
+          case cpp_expr::kind_ge: op = is_float ? prog::op_fle : prog::op_ile; is_compare = swap = true; break;
+          case cpp_expr::kind_eq: op = is_float ? prog::op_feq : prog::op_ieq; is_compare = true; break;
+          case cpp_expr::kind_ne: op = is_float ? prog::op_fne : prog::op_ine; is_compare = true; break;
+          default: return error("unsupported operator ", cpp_expr::kindName(kind));
+        }
+        if (is_float && (op == prog::op_ishl || op == prog::op_ishr || op == prog::op_and || op == prog::op_or || op == prog::op_xor)) {
+          return error("bit operations on floats");
+        }
+
+        if (is_compare) {
+          // vectors compare equal if all components are equal
+          make_temp(result, expr->getType());
+          unsigned tmp = n > 1 ? new_regs(1) : 0;
+          for (unsigned i = 0; i != n; ++i) {
+            unsigned a = comp_reg_smear(lhs, i), b = comp_reg_smear(rhs, i);
+            unsigned d = i == 0 ? result.base : tmp;
+            emit(op, d, swap ? b : a, swap ? a : b);
+            if (i) emit(kind == cpp_expr::kind_ne ? prog::op_or : prog::op_and, result.base, result.base, tmp);
+          }
+          if (get_kind(expr->getType()) != sk_bool) {
+            convert_scalar(result.base, result.base, sk_bool, get_kind(expr->getType()));
+          }
+          return ok;
+        }
+
+        make_temp(result, expr->getType());
+        if (result.count != n) return error("operands of different sizes");
+        for (unsigned i = 0; i != n; ++i) {
+          emit(op, result.base + i, comp_reg_smear(lhs, i), comp_reg_smear(rhs, i), 0, op == prog::op_fcall ? prog::fn_fmod : 0);
+        }
+        return ok;
+      }
+
+      // calls: intrinsics are expanded, user functions are inlined.
+      bool eval_call(cpp_expr *expr, operand &result) {
+        cpp_value *function = expr->getKid(0)->getValue();
+        cpp_type *functionType = function->getType();
+        cpp_scope *params = functionType->getScope();
+        cpp_expr *body = function->getInit();
+        unsigned numArgs = expr->getNumArgs();
+
+        cpp_scope::iterator formal = params->begin();
+        cpp_value *returnParam = NULL;
+        if (functionType->getIsReturnByValue()) {
+          returnParam = *formal++;
+        }
+
+        // arguments converted to the parameter types; out parameters are kept as lvalues.
+        enum { max_args = 16 };
+        if (numArgs > max_args) return error("too many arguments to ", function->getName());
+        operand args[max_args];
+        for (unsigned i = 0; i != numArgs; ++i, ++formal) {
+          cpp_type *formalType = (*formal)->getType();
+          if (formalType->getIsOut() && !formalType->getIsIn()) {
+            if (!eval(expr->getArg(i), args[i])) return false;
+          } else {
+            operand src;
+            if (!rvalue(expr->getArg(i), src) || !convert(args[i], src, formalType)) return false;
+          }
+        }
+
+        if (!body || body->getKind() != cpp_expr::kind_statement) {
+          return eval_intrinsic(function, expr->getType(), args, numArgs, result);
+        }
+
+        for (unsigned i = 0; i != functions.size(); ++i) {
+          if (functions[i].function == function) return error("recursion is not supported: ", function->getName());
+        }
+        if (functions.size() >= max_inline_depth) return error("calls nested too deeply");
+
+        // copy in
+        formal = params->begin() + (returnParam ? 1 : 0);
+        for (unsigned i = 0; i != numArgs; ++i, ++formal) {
+          operand param;
+          make_regs(param, (*formal)->getType(), var_regs(*formal));
+          cpp_type *formalType = (*formal)->getType();
+          if (formalType->getIsIn() || !formalType->getIsOut()) {
+            if (!store(param, args[i])) return false;
+          }
+        }
+
+        cpp_type *returnType = expr->getType();
+        unsigned n = returnType->getKind() == cpp_type::kind_void ? 0 : get_count(returnType);
+        int ret_base = 0;
+        if (returnParam) {
+          ret_base = var_regs(returnParam);
+        } else if (n) {
+          ret_base = new_regs(n);
+        }
+
+        dynarray<unsigned> exit_jumps;
+        cpp_statement *statement = body->getStatement();
+        function_info info = { function, 0, ret_base, tail_return(statement), loops.size(), &exit_jumps };
+        unsigned call_mask = new_regs(1);
+        emit(prog::op_mov, call_mask, prog::mask_reg);
+        if (has_return(statement, info.tail_return)) {
+          info.ret_mask = (uint16_t)new_regs(1);
+          emit(prog::op_mov, info.ret_mask, zero_reg);
+        }
+
+        functions.push_back(info);
+        depth++;
+        compile(statement);
+        depth--;
+        functions.pop_back();
+
+        patch(exit_jumps);
+        emit(prog::op_mov, prog::mask_reg, call_mask);
+
+        // copy out
+        formal = params->begin() + (returnParam ? 1 : 0);
+        for (unsigned i = 0; i != numArgs; ++i, ++formal) {
+          if ((*formal)->getType()->getIsOut()) {
+            operand param;
+            make_regs(param, (*formal)->getType(), var_regs(*formal));
+            if (!store(args[i], param)) return false;
+          }
+        }
+
+        if (returnParam) {
+          // copy, as another call could overwrite the parameter
+          make_temp(result, returnParam->getType());
+          for (unsigned i = 0; i != result.count; ++i) emit(prog::op_mov, result.base + i, ret_base + i);
+        } else {
+          make_regs(result, returnType, ret_base);
+          if (!n) result.count = 0;
+        }
+        return ok;
+      }
+
+      bool eval_intrinsic(cpp_value *function, cpp_type *type, operand *args, unsigned numArgs, operand &result) {
+        const char *name = function->getName();
+        make_temp(result, type);
+        unsigned n = result.count;
+        bool is_float = get_kind(type) == sk_float;
+        unsigned one = is_float ? fconst(1.0f) : iconst(1);
+
+        // component wise functions of one or two arguments
+        static const struct { const char *name; uint8_t op; uint8_t fn; } simple[] = {
+          { "sin", prog::op_fcall, prog::fn_sin }, { "cos", prog::op_fcall, prog::fn_cos }, { "tan", prog::op_fcall, prog::fn_tan },
+          { "asin", prog::op_fcall, prog::fn_asin }, { "acos", prog::op_fcall, prog::fn_acos },
+          { "exp", prog::op_fcall, prog::fn_exp }, { "log", prog::op_fcall, prog::fn_log },
+          { "exp2", prog::op_fcall, prog::fn_exp2 }, { "log2", prog::op_fcall, prog::fn_log2 },
+          { "pow", prog::op_fcall, prog::fn_pow },
+          { "sqrt", prog::op_fsqrt, 0 }, { "floor", prog::op_ffloor, 0 }, { "ceil", prog::op_fceil, 0 },
+        };
+        for (unsigned j = 0; j != sizeof(simple) / sizeof(simple[0]); ++j) {
+          if (!strcmp(name, simple[j].name)) {
+            for (unsigned i = 0; i != n; ++i) {
+              emit(simple[j].op, result.base + i, comp_reg_smear(args[0], i), numArgs > 1 ? comp_reg_smear(args[1], i) : 0, 0, simple[j].fn);
+            }
+            return ok;
+          }
+        }
+
+        if (!strcmp(name, "atan")) {
+          for (unsigned i = 0; i != n; ++i) {
+            if (numArgs == 2) {
+              emit(prog::op_fcall, result.base + i, comp_reg(args[0], i), comp_reg(args[1], i), 0, prog::fn_atan2);
+            } else {
+              emit(prog::op_fcall, result.base + i, comp_reg(args[0], i), 0, 0, prog::fn_atan);
+            }
+          }
+        } else if (!strcmp(name, "radians") || !strcmp(name, "degrees")) {
+          float scale = name[0] == 'r' ? 3.14159265358979f / 180 : 180 / 3.14159265358979f;
+          unsigned s = fconst(scale);
+          for (unsigned i = 0; i != n; ++i) emit(prog::op_fmul, result.base + i, comp_reg(args[0], i), s);
+        } else if (!strcmp(name, "inversesqrt")) {
+          for (unsigned i = 0; i != n; ++i) {
+            emit(prog::op_fsqrt, result.base + i, comp_reg(args[0], i));
+            emit(prog::op_fdiv, result.base + i, one, result.base + i);
+          }
+        } else if (!strcmp(name, "abs")) {
+          for (unsigned i = 0; i != n; ++i) {
+            if (is_float) {
+              emit(prog::op_and, result.base + i, comp_reg(args[0], i), iconst(0x7fffffff));
+            } else {
+              emit(prog::op_isub, result.base + i, zero_reg, comp_reg(args[0], i));
+              emit(prog::op_imax, result.base + i, result.base + i, comp_reg(args[0], i));
+            }
+          }
+        } else if (!strcmp(name, "sign")) {
+          // ( x > 0 ) - ( x < 0 )
+          unsigned tmp = new_regs(1);
+          for (unsigned i = 0; i != n; ++i) {
+            unsigned x = comp_reg(args[0], i);
+            emit(is_float ? prog::op_flt : prog::op_ilt, result.base + i, zero_reg, x);
+            emit(prog::op_and, result.base + i, result.base + i, one);
+            emit(is_float ? prog::op_flt : prog::op_ilt, tmp, x, zero_reg);
+            emit(prog::op_and, tmp, tmp, one);
+            emit(is_float ? prog::op_fsub : prog::op_isub, result.base + i, result.base + i, tmp);
+          }
+        } else if (!strcmp(name, "fract")) {
+          for (unsigned i = 0; i != n; ++i) {
+            emit(prog::op_ffloor, result.base + i, comp_reg(args[0], i));
+            emit(prog::op_fsub, result.base + i, comp_reg(args[0], i), result.base + i);
+          }
+        } else if (!strcmp(name, "mod")) {
+          // x - y * floor( x / y )
+          for (unsigned i = 0; i != n; ++i) {
+            unsigned x = comp_reg(args[0], i), y = comp_reg_smear(args[1], i), d = result.base + i;
+            emit(prog::op_fdiv, d, x, y);
+            emit(prog::op_ffloor, d, d);
+            emit(prog::op_fmul, d, d, y);
+            emit(prog::op_fsub, d, x, d);
+          }
+        } else if (!strcmp(name, "min") || !strcmp(name, "max")) {
+          bool is_min = name[1] == 'i';
+          unsigned op = is_float ? (is_min ? prog::op_fmin : prog::op_fmax) : (is_min ? prog::op_imin : prog::op_imax);
+          for (unsigned i = 0; i != n; ++i) emit(op, result.base + i, comp_reg(args[0], i), comp_reg_smear(args[1], i));
+        } else if (!strcmp(name, "clamp")) {
+          for (unsigned i = 0; i != n; ++i) {
+            emit(is_float ? prog::op_fmax : prog::op_imax, result.base + i, comp_reg(args[0], i), comp_reg_smear(args[1], i));
+            emit(is_float ? prog::op_fmin : prog::op_imin, result.base + i, result.base + i, comp_reg_smear(args[2], i));
+          }
+        } else if (!strcmp(name, "mix")) {
+          // x + ( y - x ) * a
+          for (unsigned i = 0; i != n; ++i) {
+            unsigned x = comp_reg(args[0], i), d = result.base + i;
+            emit(prog::op_fsub, d, comp_reg(args[1], i), x);
+            emit(prog::op_fmul, d, d, comp_reg_smear(args[2], i));
+            emit(prog::op_fadd, d, d, x);
+          }
+        } else if (!strcmp(name, "step")) {
+          // x < edge ? 0 : 1
+          for (unsigned i = 0; i != n; ++i) {
+            emit(prog::op_fle, result.base + i, comp_reg_smear(args[0], i), comp_reg(args[1], i));
+            emit(prog::op_and, result.base + i, result.base + i, one);
+          }
+        } else if (!strcmp(name, "smoothstep")) {
+          // t = clamp( ( x - a ) / ( b - a ), 0, 1 ); t * t * ( 3 - 2 * t )
+          unsigned tmp = new_regs(1);
+          for (unsigned i = 0; i != n; ++i) {
+            unsigned a = comp_reg_smear(args[0], i), b = comp_reg_smear(args[1], i), d = result.base + i;
+            emit(prog::op_fsub, d, comp_reg(args[2], i), a);
+            emit(prog::op_fsub, tmp, b, a);
+            emit(prog::op_fdiv, d, d, tmp);
+            emit(prog::op_fmax, d, d, zero_reg);
+            emit(prog::op_fmin, d, d, one);
+            emit(prog::op_fmul, tmp, d, fconst(-2.0f));
+            emit(prog::op_fadd, tmp, tmp, fconst(3.0f));
+            emit(prog::op_fmul, tmp, tmp, d);
+            emit(prog::op_fmul, d, tmp, d);
+          }
+        } else if (!strcmp(name, "dot") || !strcmp(name, "length") || !strcmp(name, "distance") || !strcmp(name, "normalize")) {
+          // all built from a sum of squares or products
+          operand &x = args[0];
+          unsigned m = x.count;
+          unsigned diff = 0;
+          if (name[0] == 'd' && name[1] == 'i') {
+            diff = new_regs(m);
+            for (unsigned i = 0; i != m; ++i) emit(prog::op_fsub, diff + i, comp_reg(x, i), comp_reg(args[1], i));
+          }
+          unsigned sum = new_regs(1), tmp = new_regs(1);
+          for (unsigned i = 0; i != m; ++i) {
+            unsigned a = diff ? diff + i : comp_reg(x, i);
+            unsigned b = name[0] == 'd' && name[1] == 'o' ? comp_reg(args[1], i) : a;
+            emit(prog::op_fmul, i ? tmp : sum, a, b);
+            if (i) emit(prog::op_fadd, sum, sum, tmp);
+          }
+          if (name[0] == 'd' && name[1] == 'o') {
+            emit(prog::op_mov, result.base, sum);
+          } else if (name[0] == 'n') {
+            emit(prog::op_fsqrt, sum, sum);
+            emit(prog::op_fdiv, sum, one, sum);
+            for (unsigned i = 0; i != n; ++i) emit(prog::op_fmul, result.base + i, comp_reg(x, i), sum);
+          } else {
+            emit(prog::op_fsqrt, result.base, sum);
+          }
+        } else if (!strcmp(name, "cross")) {
+          unsigned tmp = new_regs(1);
+          for (unsigned i = 0; i != 3; ++i) {
+            unsigned j = (i + 1) % 3, k = (i + 2) % 3;
+            emit(prog::op_fmul, result.base + i, comp_reg(args[0], j), comp_reg(args[1], k));
+            emit(prog::op_fmul, tmp, comp_reg(args[0], k), comp_reg(args[1], j));
+            emit(prog::op_fsub, result.base + i, result.base + i, tmp);
+          }
+        } else {
+          return error("function has no body: ", name);
+        }
+        return ok;
+      }
+
+      // statements
+      static bool is_loop(cpp_statement *s) {
+        return s->getKind() == cpp_statement::kind_for || s->getKind() == cpp_statement::kind_while || s->getKind() == cpp_statement::kind_dowhile;
+      }
+
+      // does s contain a statement of this kind (not counting nested loops for break and continue)?
+      static bool contains(cpp_statement *s, cpp_statement::kind_enum kind, cpp_statement *except) {
+        if (!s) return false;
+        if (s->getKind() == kind && s != except) return true;
+        bool into_loops = kind == cpp_statement::kind_return;
+        if (s->getKind() == cpp_statement::kind_compound) {
+          for (cpp_statement *child = s->getStatements(); child; child = child->getNext()) {
+            if (contains(child, kind, except)) return true;
+          }
+        } else if (s->getKind() == cpp_statement::kind_if) {
+          return contains(s->getStatements(), kind, except) || contains(s->getElse(), kind, except);
+        } else if (is_loop(s) && into_loops) {
+          return contains(s->getStatements(), kind, except);
+        }
+        return false;
+      }
+
+      // a return at the very end of a function does not need to change the mask.
+      static cpp_statement *tail_return(cpp_statement *body) {
+        cpp_statement *last = body;
+        if (body->getKind() == cpp_statement::kind_compound) {
+          last = NULL;
+          for (cpp_statement *s = body->getStatements(); s; s = s->getNext()) last = s;
+        }
+        return last && last->getKind() == cpp_statement::kind_return ? last : NULL;
+      }
+
+      static bool has_return(cpp_statement *body, cpp_statement *tail) {
+        return contains(body, cpp_statement::kind_return, tail);
+      }
+
+      // after both sides of an if, lanes that broke, continued or returned stay off.
+      // If that leaves no lanes, skip to the next iteration or the end of the function.
+      void exclude_finished_lanes() {
+        function_info &f = functions.back();
+        bool in_loop = loops.size() > f.loop_base;
+        bool any = false;
+        if (f.ret_mask) {
+          emit(prog::op_andnot, prog::mask_reg, prog::mask_reg, f.ret_mask);
+          any = true;
+        }
+        if (in_loop) {
+          loop_info &l = loops.back();
+          if (l.brk) emit(prog::op_andnot, prog::mask_reg, prog::mask_reg, l.brk);
+          if (l.cont) emit(prog::op_andnot, prog::mask_reg, prog::mask_reg, l.cont);
+          if (any || l.brk || l.cont) {
+            // lanes that have left the loop may still need the rest of the function.
+            l.cont_jumps->push_back(emit(prog::op_jump_none));
+          }
+        } else if (any) {
+          f.exit_jumps->push_back(emit(prog::op_jump_none));
+        }
+      }
+
+      bool compile_if(cpp_statement *s) {
+        unsigned cond = 0;
+        if (!condition(s->getExpression(), cond)) return false;
+        unsigned saved = new_regs(1);
+        emit(prog::op_mov, saved, prog::mask_reg);
+        emit(prog::op_and, prog::mask_reg, prog::mask_reg, cond);
+        unsigned skip = emit(prog::op_jump_none);
+        depth++;
+        compile(s->getStatements());
+        depth--;
+        if (s->getElse()) {
+          program.code[skip].imm = program.code.size();
+          emit(prog::op_andnot, prog::mask_reg, saved, cond);
+          skip = emit(prog::op_jump_none);
+          depth++;
+          compile(s->getElse());
+          depth--;
+        }
+        program.code[skip].imm = program.code.size();
+        emit(prog::op_mov, prog::mask_reg, saved);
+        exclude_finished_lanes();
+        return ok;
+      }
+
+      bool compile_loop(cpp_statement *s) {
+        cpp_statement::kind_enum kind = s->getKind();
+        cpp_expr *init = NULL, *cond = s->getExpression(), *step = NULL;
+        if (kind == cpp_statement::kind_for) {
+          init = cond->getKid(0);
+          step = cond->getKid(2);
+          cond = cond->getKid(1);
+        }
+        operand tmp;
+        if (init && !eval(init, tmp)) return false;
+
+        dynarray<unsigned> cont_jumps;
+        dynarray<unsigned> exit_jumps;
+        loop_info info = { 0, 0, &cont_jumps };
+        unsigned saved = new_regs(1);
+        emit(prog::op_mov, saved, prog::mask_reg);
+        if (contains(s->getStatements(), cpp_statement::kind_break, NULL)) {
+          info.brk = (uint16_t)new_regs(1);
+          emit(prog::op_mov, info.brk, zero_reg);
+        }
+        if (contains(s->getStatements(), cpp_statement::kind_continue, NULL)) {
+          info.cont = (uint16_t)new_regs(1);
+          emit(prog::op_mov, info.cont, zero_reg);
+        }
+
+        // the condition and step only change lanes that are still looping.
+        depth++;
+        unsigned top = program.code.size();
+        if (cond && kind != cpp_statement::kind_dowhile) {
+          unsigned mark = next_reg;
+          unsigned c = 0;
+          if (!condition(cond, c)) return false;
+          emit(prog::op_and, prog::mask_reg, prog::mask_reg, c);
+          next_reg = mark;
+        }
+        exit_jumps.push_back(emit(prog::op_jump_none));
+
+        loops.push_back(info);
+        compile(s->getStatements());
+        loops.pop_back();
+
+        // continued lanes join in again for the next iteration.
+        patch(cont_jumps);
+        if (info.cont) {
+          emit(prog::op_or, prog::mask_reg, prog::mask_reg, info.cont);
+          emit(prog::op_mov, info.cont, zero_reg);
+        }
+        if (kind == cpp_statement::kind_dowhile) {
+          unsigned c = 0;
+          if (!condition(cond, c)) return false;
+          emit(prog::op_and, prog::mask_reg, prog::mask_reg, c);
+          emit(prog::op_jump_any, 0, 0, 0, 0, top);
+        } else {
+          if (step && !eval(step, tmp)) return false;
+          emit(prog::op_jump, 0, 0, 0, 0, top);
+        }
+        depth--;
+
+        patch(exit_jumps);
+        emit(prog::op_mov, prog::mask_reg, saved);
+        function_info &f = functions.back();
+        if (f.ret_mask) {
+          emit(prog::op_andnot, prog::mask_reg, prog::mask_reg, f.ret_mask);
+        }
+        return ok;
+      }
+
+      bool compile_return(cpp_statement *s) {
+        function_info &f = functions.back();
+        if (cpp_expr *expr = s->getExpression()) {
+          cpp_type *functionType = f.function->getType();
+          cpp_type *type = functionType->getIsReturnByValue() ? (*functionType->getScope()->begin())->getType() : functionType->getSubType();
+          operand value, src, dest;
+          if (!rvalue(expr, value) || !convert(src, value, type)) return false;
+          make_regs(dest, type, f.ret_base);
+          if (!store(dest, src)) return false;
+        }
+        if (s != f.tail_return || loops.size() > f.loop_base) {
+          if (!f.ret_mask) return error("unexpected return");
+          emit(prog::op_or, f.ret_mask, f.ret_mask, prog::mask_reg);
+          emit(prog::op_mov, prog::mask_reg, zero_reg);
+        }
+        return ok;
+      }
+
+      bool compile(cpp_statement *s) {
+        if (!s || !ok) return ok;
+        unsigned mark = next_reg;
+        operand tmp;
+        switch (s->getKind()) {
+          case cpp_statement::kind_compound: {
+            for (cpp_statement *child = s->getStatements(); child; child = child->getNext()) {
+              if (!compile(child)) return false;
+            }
+          } break;
+          case cpp_statement::kind_expression:
+          case cpp_statement::kind_declaration: {
+            if (s->getExpression()) eval(s->getExpression(), tmp);
+          } break;
+          case cpp_statement::kind_return: compile_return(s); break;
+          case cpp_statement::kind_if: compile_if(s); break;
+          case cpp_statement::kind_for:
+          case cpp_statement::kind_while:
+          case cpp_statement::kind_dowhile: compile_loop(s); break;
+          case cpp_statement::kind_break:
+          case cpp_statement::kind_continue: {
+            function_info &f = functions.back();
+            if (loops.size() <= f.loop_base) return error("break or continue outside a loop");
+            loop_info &l = loops.back();
+            unsigned reg = s->getKind() == cpp_statement::kind_break ? l.brk : l.cont;
+            emit(prog::op_or, reg, reg, prog::mask_reg);
+            emit(prog::op_mov, prog::mask_reg, zero_reg);
+          } break;
+          default: return error("unsupported statement (discard?)");
+        }
+        next_reg = mark;
+        return ok;
+      }
+
+    public:
+      cpp_vm_compiler(cpp_parser &parser_, cpp_vm_program &program_) : parser(parser_), program(program_) {
+      }
+
+      /// Compile the function "entry" and everything it calls.
+      /// Returns false on error; cpp_log() has the details.
+      bool compile(const char *entry) {
+        program.reset();
+        vars.clear();
+        loops.resize(0);
+        functions.resize(0);
+        literal_constants.resize(0);
+        next_var = 1;
+        next_reg = max_reg = temp_base;
+        depth = 0;
+        ok = true;
+        zero_reg = iconst(0);
+
+        for (unsigned i = 0; i != 3; ++i) {
+          program.local_size[i] = parser.getLocalSize(i);
+        }
+
+        cpp_scope *globals = parser.getGlobalScope();
+        cpp_value *main = globals->lookup(parser.getSymbols().intern(entry));
+        if (!main || main->getType()->getKind() != cpp_type::kind_function || !main->getInit()) {
+          return error("no function called ", entry);
+        }
+
+        // uniforms are always there for set_uniform, even if they are not used.
+        for (cpp_scope::iterator i = globals->begin(); i != globals->end(); ++i) {
+          if ((*i)->getType()->getIsUniform()) add_uniform(*i);
+        }
+
+        dynarray<unsigned> exit_jumps;
+        cpp_statement *body = main->getInit()->getStatement();
+        function_info info = { main, 0, 0, NULL, 0, &exit_jumps };
+        if (has_return(body, NULL)) {
+          info.ret_mask = (uint16_t)new_regs(1);
+          emit(prog::op_mov, info.ret_mask, zero_reg);
+        }
+        functions.push_back(info);
+
+        // global variables are set up by each invocation.
+        for (cpp_scope::iterator i = globals->begin(); i != globals->end(); ++i) {
+          cpp_value *value = *i;
+          cpp_type *type = value->getType();
+          if (value->getInit() && !type->getIsUniform() && type->getKind() != cpp_type::kind_function) {
+            operand dest, src, converted;
+            make_regs(dest, type, var_regs(value));
+            if (!rvalue(value->getInit(), src) || !convert(converted, src, type) || !store(dest, converted)) break;
+          }
+        }
+
+        compile(body);
+        patch(exit_jumps);
+        emit(prog::op_end);
+        functions.resize(0);
+        finish();
+        return ok;
+      }
+    };
+
+    /// One lane of a register.
+    union cpp_vm_value {
+      float f;
+      int32_t i;
+      uint32_t u;
+    };
+
+    // Operations on "width" lanes at a time.
+    // The SSE2 versions do floats and ints four at a time, AVX does floats eight at a time.
+    #if OCTET_SSE2
+      struct cpp_vm_lanes4 {
+        enum { width = 4 };
+        static __m128 f(const cpp_vm_value *p) { return _mm_load_ps(&p->f); }
+        static __m128i i(const cpp_vm_value *p) { return _mm_load_si128((const __m128i*)p); }
+        static void put(cpp_vm_value *p, __m128 v) { _mm_store_ps(&p->f, v); }
+        static void put(cpp_vm_value *p, __m128i v) { _mm_store_si128((__m128i*)p, v); }
+
+        static void fadd(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_add_ps(f(a), f(b))); }
+        static void fsub(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_sub_ps(f(a), f(b))); }
+        static void fmul(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_mul_ps(f(a), f(b))); }
+        static void fdiv(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_div_ps(f(a), f(b))); }
+        static void fmin(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_min_ps(f(a), f(b))); }
+        static void fmax(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_max_ps(f(a), f(b))); }
+        static void flt(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_cmplt_ps(f(a), f(b))); }
+        static void fle(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_cmple_ps(f(a), f(b))); }
+        static void feq(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_cmpeq_ps(f(a), f(b))); }
+        static void fne(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_cmpneq_ps(f(a), f(b))); }
+        static void fsqrt(cpp_vm_value *d, const cpp_vm_value *a) { put(d, _mm_sqrt_ps(f(a))); }
+        static void and_(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_and_ps(f(a), f(b))); }
+        static void or_(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_or_ps(f(a), f(b))); }
+        static void xor_(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_xor_ps(f(a), f(b))); }
+        static void andnot(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_andnot_ps(f(b), f(a))); }
+        static void select(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b, const cpp_vm_value *c) {
+          __m128 m = f(c);
+          put(d, _mm_or_ps(_mm_and_ps(m, f(a)), _mm_andnot_ps(m, f(b))));
+        }
+        static void i2f(cpp_vm_value *d, const cpp_vm_value *a) { put(d, _mm_cvtepi32_ps(i(a))); }
+        static void f2i(cpp_vm_value *d, const cpp_vm_value *a) { put(d, _mm_cvttps_epi32(f(a))); }
+
+        static void iadd(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_add_epi32(i(a), i(b))); }
+        static void isub(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_sub_epi32(i(a), i(b))); }
+        static void ilt(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_cmplt_epi32(i(a), i(b))); }
+        static void ieq(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm_cmpeq_epi32(i(a), i(b))); }
+      };
+    #else
+      struct cpp_vm_lanes4 {
+        enum { width = 1 };
+        static void fadd(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->f = a->f + b->f; }
+        static void fsub(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->f = a->f - b->f; }
+        static void fmul(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->f = a->f * b->f; }
+        static void fdiv(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->f = a->f / b->f; }
+        static void fmin(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->f = a->f < b->f ? a->f : b->f; }
+        static void fmax(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->f = a->f > b->f ? a->f : b->f; }
+        static void flt(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->i = -(a->f < b->f); }
+        static void fle(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->i = -(a->f <= b->f); }
+        static void feq(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->i = -(a->f == b->f); }
+        static void fne(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->i = -(a->f != b->f); }
+        static void fsqrt(cpp_vm_value *d, const cpp_vm_value *a) { d->f = sqrtf(a->f); }
+        static void and_(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->u = a->u & b->u; }
+        static void or_(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->u = a->u | b->u; }
+        static void xor_(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->u = a->u ^ b->u; }
+        static void andnot(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->u = a->u & ~b->u; }
+        static void select(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b, const cpp_vm_value *c) { d->u = (c->u & a->u) | (~c->u & b->u); }
+        static void i2f(cpp_vm_value *d, const cpp_vm_value *a) { d->f = (float)a->i; }
+        static void f2i(cpp_vm_value *d, const cpp_vm_value *a) { d->i = (int32_t)a->f; }
+        static void iadd(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->u = a->u + b->u; }
+        static void isub(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->u = a->u - b->u; }
+        static void ilt(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->i = -(a->i < b->i); }
+        static void ieq(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { d->i = -(a->i == b->i); }
+      };
+    #endif
+
+    #if OCTET_AVX
+      struct cpp_vm_lanes8 {
+        enum { width = 8 };
+        static __m256 f(const cpp_vm_value *p) { return _mm256_load_ps(&p->f); }
+        static __m256i i(const cpp_vm_value *p) { return _mm256_load_si256((const __m256i*)p); }
+        static void put(cpp_vm_value *p, __m256 v) { _mm256_store_ps(&p->f, v); }
+        static void put(cpp_vm_value *p, __m256i v) { _mm256_store_si256((__m256i*)p, v); }
+
+        static void fadd(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_add_ps(f(a), f(b))); }
+        static void fsub(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_sub_ps(f(a), f(b))); }
+        static void fmul(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_mul_ps(f(a), f(b))); }
+        static void fdiv(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_div_ps(f(a), f(b))); }
+        static void fmin(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_min_ps(f(a), f(b))); }
+        static void fmax(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_max_ps(f(a), f(b))); }
+        static void flt(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_cmp_ps(f(a), f(b), _CMP_LT_OS)); }
+        static void fle(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_cmp_ps(f(a), f(b), _CMP_LE_OS)); }
+        static void feq(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_cmp_ps(f(a), f(b), _CMP_EQ_OQ)); }
+        static void fne(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_cmp_ps(f(a), f(b), _CMP_NEQ_UQ)); }
+        static void fsqrt(cpp_vm_value *d, const cpp_vm_value *a) { put(d, _mm256_sqrt_ps(f(a))); }
+        static void and_(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_and_ps(f(a), f(b))); }
+        static void or_(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_or_ps(f(a), f(b))); }
+        static void xor_(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_xor_ps(f(a), f(b))); }
+        static void andnot(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b) { put(d, _mm256_andnot_ps(f(b), f(a))); }
+        static void select(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b, const cpp_vm_value *c) { put(d, _mm256_blendv_ps(f(b), f(a), f(c))); }
+        static void i2f(cpp_vm_value *d, const cpp_vm_value *a) { put(d, _mm256_cvtepi32_ps(i(a))); }
+        static void f2i(cpp_vm_value *d, const cpp_vm_value *a) { put(d, _mm256_cvttps_epi32(f(a))); }
+      };
+
+      // AVX has no 256 bit integer ops, so batches of eight or more use it for floats only.
+      template <unsigned W> struct cpp_vm_float_lanes { typedef cpp_vm_lanes4 type; };
+      template <> struct cpp_vm_float_lanes<8> { typedef cpp_vm_lanes8 type; };
+      template <> struct cpp_vm_float_lanes<16> { typedef cpp_vm_lanes8 type; };
+    #else
+      template <unsigned W> struct cpp_vm_float_lanes { typedef cpp_vm_lanes4 type; };
+    #endif
+
+    /// Run a cpp_vm_program over a grid of work groups.
+    ///
+    /// Each batch of 4, 8 or 16 invocations from a work group runs one instruction at a time.
+    /// Work groups are shared between the threads of the job_pool.
+    ///
+    /// Example
+    ///
+    ///     cpp_vm vm(program);
+    ///     vm.set_uniform("time", 1.5f);
+    ///     vm.bind_buffer(0, vertices.data(), vertices.size() * sizeof(vertices[0]));
+    ///     vm.dispatch(num_vertices / 64);
+    class cpp_vm {
+      typedef cpp_vm_program prog;
+
+      const cpp_vm_program &program;
+      dynarray<uint32_t> constants;
+      uint8_t *buffers[prog::max_bindings];
+      size_t sizes[prog::max_bindings];
+      unsigned lanes;
+
+      // d = op(a[lane], b[lane]) for every lane
+      template <unsigned W, class fn_t> static void per_lane(cpp_vm_value *d, const cpp_vm_value *a, const cpp_vm_value *b, fn_t fn) {
+        for (unsigned l = 0; l != W; ++l) d[l] = fn(a[l], b[l]);
+      }
+
+      static float call(int fn, float a, float b) {
+        switch (fn) {
+          case prog::fn_sin: return sinf(a);
+          case prog::fn_cos: return cosf(a);
+          case prog::fn_tan: return tanf(a);
+          case prog::fn_asin: return asinf(a);
+          case prog::fn_acos: return acosf(a);
+          case prog::fn_atan: return atanf(a);
+          case prog::fn_atan2: return atan2f(a, b);
+          case prog::fn_exp: return expf(a);
+          case prog::fn_log: return logf(a);
+          case prog::fn_exp2: return powf(2.0f, a);
+          case prog::fn_log2: return logf(a) * 1.44269504f;
+          case prog::fn_pow: return powf(a, b);
+          case prog::fn_fmod: return fmodf(a, b);
+          default: return 0;
+        }
+      }
+
+      // run the program for one batch of W lanes.
+      template <unsigned W> void execute(cpp_vm_value *regs) const {
+        typedef typename cpp_vm_float_lanes<W>::type FL;
+        typedef cpp_vm_lanes4 IL;
+        const cpp_vm_instruction *code = program.code.data();
+        const cpp_vm_value *mask = regs;
+
+        // apply a lanes struct function to every group of lanes in a register.
+        #define OCTET_VM_LANES(L, fn, ...) for (unsigned l = 0; l != W; l += L::width) L::fn(__VA_ARGS__)
+
+        for (const cpp_vm_instruction *ins = code; ; ++ins) {
+          cpp_vm_value *d = regs + ins->d * W;
+          const cpp_vm_value *a = regs + ins->a * W;
+          const cpp_vm_value *b = regs + ins->b * W;
+          switch (ins->op) {
+            case prog::op_end: return;
+            case prog::op_fadd: OCTET_VM_LANES(FL, fadd, d + l, a + l, b + l); break;
+            case prog::op_fsub: OCTET_VM_LANES(FL, fsub, d + l, a + l, b + l); break;
+            case prog::op_fmul: OCTET_VM_LANES(FL, fmul, d + l, a + l, b + l); break;
+            case prog::op_fdiv: OCTET_VM_LANES(FL, fdiv, d + l, a + l, b + l); break;
+            case prog::op_fmin: OCTET_VM_LANES(FL, fmin, d + l, a + l, b + l); break;
+            case prog::op_fmax: OCTET_VM_LANES(FL, fmax, d + l, a + l, b + l); break;
+            case prog::op_flt: OCTET_VM_LANES(FL, flt, d + l, a + l, b + l); break;
+            case prog::op_fle: OCTET_VM_LANES(FL, fle, d + l, a + l, b + l); break;
+            case prog::op_feq: OCTET_VM_LANES(FL, feq, d + l, a + l, b + l); break;
+            case prog::op_fne: OCTET_VM_LANES(FL, fne, d + l, a + l, b + l); break;
+            case prog::op_fsqrt: OCTET_VM_LANES(FL, fsqrt, d + l, a + l); break;
+            case prog::op_ffloor: for (unsigned l = 0; l != W; ++l) d[l].f = floorf(a[l].f); break;
+            case prog::op_fceil: for (unsigned l = 0; l != W; ++l) d[l].f = ceilf(a[l].f); break;
+            case prog::op_fcall: for (unsigned l = 0; l != W; ++l) d[l].f = call(ins->imm, a[l].f, b[l].f); break;
+            case prog::op_iadd: OCTET_VM_LANES(IL, iadd, d + l, a + l, b + l); break;
+            case prog::op_isub: OCTET_VM_LANES(IL, isub, d + l, a + l, b + l); break;
+            case prog::op_imul: for (unsigned l = 0; l != W; ++l) d[l].u = a[l].u * b[l].u; break;
+            case prog::op_idiv: for (unsigned l = 0; l != W; ++l) d[l].i = b[l].i ? a[l].i / b[l].i : 0; break;
+            case prog::op_imod: for (unsigned l = 0; l != W; ++l) d[l].i = b[l].i ? a[l].i % b[l].i : 0; break;
+            case prog::op_ishl: for (unsigned l = 0; l != W; ++l) d[l].u = a[l].u << (b[l].u & 31); break;
+            case prog::op_ishr: for (unsigned l = 0; l != W; ++l) d[l].i = a[l].i >> (b[l].u & 31); break;
+            case prog::op_imin: for (unsigned l = 0; l != W; ++l) d[l].i = a[l].i < b[l].i ? a[l].i : b[l].i; break;
+            case prog::op_imax: for (unsigned l = 0; l != W; ++l) d[l].i = a[l].i > b[l].i ? a[l].i : b[l].i; break;
+            case prog::op_ilt: OCTET_VM_LANES(IL, ilt, d + l, a + l, b + l); break;
+            case prog::op_ile: for (unsigned l = 0; l != W; ++l) d[l].i = -(a[l].i <= b[l].i); break;
+            case prog::op_ieq: OCTET_VM_LANES(IL, ieq, d + l, a + l, b + l); break;
+            case prog::op_ine: for (unsigned l = 0; l != W; ++l) d[l].i = -(a[l].i != b[l].i); break;
+            case prog::op_and: OCTET_VM_LANES(FL, and_, d + l, a + l, b + l); break;
+            case prog::op_or: OCTET_VM_LANES(FL, or_, d + l, a + l, b + l); break;
+            case prog::op_xor: OCTET_VM_LANES(FL, xor_, d + l, a + l, b + l); break;
+            case prog::op_andnot: OCTET_VM_LANES(FL, andnot, d + l, a + l, b + l); break;
+            case prog::op_i2f: OCTET_VM_LANES(FL, i2f, d + l, a + l); break;
+            case prog::op_f2i: OCTET_VM_LANES(FL, f2i, d + l, a + l); break;
+            case prog::op_mov: memcpy(d, a, W * sizeof(cpp_vm_value)); break;
+            case prog::op_select: OCTET_VM_LANES(FL, select, d + l, a + l, b + l, regs + ins->c * W + l); break;
+            case prog::op_movm: OCTET_VM_LANES(FL, select, d + l, a + l, d + l, mask + l); break;
+            case prog::op_jump: ins = code + ins->imm - 1; break;
+            case prog::op_jump_none:
+            case prog::op_jump_any: {
+              uint32_t any = 0;
+              for (unsigned l = 0; l != W; ++l) any |= mask[l].u;
+              if ((any != 0) == (ins->op == prog::op_jump_any)) ins = code + ins->imm - 1;
+            } break;
+            case prog::op_load: {
+              // out of range reads give zero
+              const uint8_t *buffer = buffers[ins->b];
+              size_t size = sizes[ins->b];
+              for (unsigned l = 0; l != W; ++l) {
+                uint32_t offset = a[l].u + (uint32_t)ins->imm;
+                if ((size_t)offset + 4 <= size) memcpy(&d[l], buffer + offset, 4); else d[l].u = 0;
+              }
+            } break;
+            case prog::op_store: {
+              // only active lanes write, out of range writes are dropped
+              uint8_t *buffer = buffers[ins->b];
+              size_t size = sizes[ins->b];
+              for (unsigned l = 0; l != W; ++l) {
+                uint32_t offset = a[l].u + (uint32_t)ins->imm;
+                if (mask[l].u && (size_t)offset + 4 <= size) memcpy(buffer + offset, &d[l], 4);
+              }
+            } break;
+          }
+        }
+        #undef OCTET_VM_LANES
+      }
+
+      // run work groups [g0, g1) with one register file.
+      template <unsigned W> void run_groups(unsigned g0, unsigned g1, const unsigned *num_groups) const {
+        const unsigned *local_size = program.local_size;
+        unsigned group_size = local_size[0] * local_size[1] * local_size[2];
+        unsigned num_regs = program.num_regs;
+
+        // 32 byte aligned for AVX
+        dynarray<cpp_vm_value> storage(num_regs * W + 8);
+        cpp_vm_value *regs = (cpp_vm_value*)(((uintptr_t)storage.data() + 31) & ~(uintptr_t)31);
+
+        for (unsigned i = 0; i != program.constants.size(); ++i) {
+          cpp_vm_value *r = regs + program.constants[i].reg * W;
+          for (unsigned l = 0; l != W; ++l) r[l].u = constants[i];
+        }
+
+        const uint16_t *builtins = program.builtins;
+        for (unsigned axis = 0; axis != 3; ++axis) {
+          if (builtins[prog::builtin_num_groups]) {
+            cpp_vm_value *r = regs + (builtins[prog::builtin_num_groups] + axis) * W;
+            for (unsigned l = 0; l != W; ++l) r[l].u = num_groups[axis];
+          }
+          if (builtins[prog::builtin_group_size]) {
+            cpp_vm_value *r = regs + (builtins[prog::builtin_group_size] + axis) * W;
+            for (unsigned l = 0; l != W; ++l) r[l].u = local_size[axis];
+          }
+        }
+
+        for (unsigned g = g0; g != g1; ++g) {
+          unsigned group_id[3] = { g % num_groups[0], g / num_groups[0] % num_groups[1], g / (num_groups[0] * num_groups[1]) };
+          if (builtins[prog::builtin_group_id]) {
+            for (unsigned axis = 0; axis != 3; ++axis) {
+              cpp_vm_value *r = regs + (builtins[prog::builtin_group_id] + axis) * W;
+              for (unsigned l = 0; l != W; ++l) r[l].u = group_id[axis];
+            }
+          }
+
+          for (unsigned batch = 0; batch < group_size; batch += W) {
+            for (unsigned l = 0; l != W; ++l) {
+              unsigned index = batch + l;
+              unsigned local_id[3] = { index % local_size[0], index / local_size[0] % local_size[1], index / (local_size[0] * local_size[1]) };
+              regs[l].i = index < group_size ? -1 : 0;
+              if (builtins[prog::builtin_local_index]) regs[builtins[prog::builtin_local_index] * W + l].u = index;
+              for (unsigned axis = 0; axis != 3; ++axis) {
+                if (builtins[prog::builtin_local_id]) regs[(builtins[prog::builtin_local_id] + axis) * W + l].u = local_id[axis];
+                if (builtins[prog::builtin_global_id]) regs[(builtins[prog::builtin_global_id] + axis) * W + l].u = group_id[axis] * local_size[axis] + local_id[axis];
+              }
+            }
+            execute<W>(regs);
+          }
+        }
+      }
+
+      bool set(const char *name, const uint32_t *bits, unsigned n, bool is_int) {
+        const prog::uniform *u = program.find_uniform(name);
+        if (!u || n > u->count) return false;
+        for (unsigned i = 0; i != n; ++i) {
+          uint32_t value = bits[i];
+          if (u->is_int != is_int) {
+            // convert a float to an int uniform or the other way round
+            cpp_vm_value v;
+            v.u = value;
+            if (is_int) v.f = (float)v.i; else v.i = (int32_t)v.f;
+            value = v.u;
+          }
+          constants[u->first_constant + i] = value;
+        }
+        return true;
+      }
+
+      // not copyable
+      cpp_vm(const cpp_vm &);
+      cpp_vm &operator=(const cpp_vm &);
+    public:
+      /// The program must outlive the vm.
+      cpp_vm(const cpp_vm_program &program_) : program(program_) {
+        constants.resize(program.constants.size());
+        for (unsigned i = 0; i != program.constants.size(); ++i) {
+          constants[i] = program.constants[i].bits;
+        }
+        memset(buffers, 0, sizeof(buffers));
+        memset(sizes, 0, sizeof(sizes));
+
+        // a power of two at least as big as the work group, from 4 to 16.
+        unsigned group_size = program.local_size[0] * program.local_size[1] * program.local_size[2];
+        lanes = group_size <= 4 ? 4 : group_size <= 8 ? 8 : 16;
+      }
+
+      /// Set a float uniform or vector; returns false if there is no such uniform.
+      bool set_uniform(const char *name, const float *values, unsigned n) {
+        return set(name, (const uint32_t*)values, n, false);
+      }
+
+      bool set_uniform(const char *name, float value) {
+        return set_uniform(name, &value, 1);
+      }
+
+      /// Set an int or bool uniform.
+      bool set_uniform(const char *name, const int *values, unsigned n) {
+        return set(name, (const uint32_t*)values, n, true);
+      }
+
+      bool set_uniform(const char *name, int value) {
+        return set_uniform(name, &value, 1);
+      }
+
+      /// Attach memory to layout(binding = n) buffer blocks.
+      void bind_buffer(unsigned binding, void *data, size_t size) {
+        if (binding < prog::max_bindings) {
+          buffers[binding] = (uint8_t*)data;
+          sizes[binding] = data ? size : 0;
+        }
+      }
+
+      /// Choose 4, 8 or 16 invocations per instruction.
+      void set_lanes(unsigned lanes_) {
+        lanes = lanes_ <= 4 ? 4 : lanes_ <= 8 ? 8 : 16;
+      }
+
+      unsigned get_lanes() const {
+        return lanes;
+      }
+
+      /// Run x * y * z work groups, like glDispatchCompute.
+      void dispatch(unsigned x, unsigned y = 1, unsigned z = 1) {
+        unsigned num_groups[3] = { x, y, z };
+        unsigned total = x * y * z;
+        if (!total || program.code.size() == 0) return;
+
+        // a few hundred invocations per job
+        unsigned group_size = program.local_size[0] * program.local_size[1] * program.local_size[2];
+        unsigned grain = group_size >= 256 ? 1 : 256 / group_size;
+        job_pool::get().parallel_for(0, total, grain, [this, &num_groups](unsigned g0, unsigned g1) {
+          switch (lanes) {
+            case 4: run_groups<4>(g0, g1, num_groups); break;
+            case 8: run_groups<8>(g0, g1, num_groups); break;
+            default: run_groups<16>(g0, g1, num_groups); break;
+          }
+        });
+      }
+    };
+
+    #if OCTET_UNIT_TEST
+      class cpp_vm_unit_test {
+        static bool compile(cpp_vm_program &program, const char *src) {
+          cpp_parser parser;
+          return parser.parse(src) && cpp_vm_compiler(parser, program).compile("main");
+        }
+
+      public:
+        cpp_vm_unit_test() {
+          // shaders/helix.cs
+          static const char helix[] =
+            "struct my_vertex { vec4 pos; vec4 color; };\n"
+            "uniform float radius = 1.0f;\n"
+            "uniform int num_steps = 320;\n"
+            "layout(std140, binding = 0) buffer dest_buf { my_vertex data[]; } out_buf;\n"
+            "layout (local_size_x = 64) in;\n"
+            "void main() {\n"
+            "  uint i = uint(gl_GlobalInvocationID.x);\n"
+            "  float angle = float(i) * (2.0f * 3.14159265f / float(num_steps));\n"
+            "  if (i <= num_steps) {\n"
+            "    out_buf.data[i].pos = vec4(cos(angle) * radius, float(i), sin(angle) * radius, 1);\n"
+            "    out_buf.data[i].color = vec4(float(i) / float(num_steps), 0, 0, 1);\n"
+            "  }\n"
+            "}\n"
+          ;
+          cpp_vm_program program;
+          bool ok = compile(program, helix);
+          assert(ok);
+          assert(program.local_size[0] == 64 && program.uniforms.size() == 2);
+
+          for (unsigned lanes = 4; lanes <= 16; lanes *= 2) {
+            enum { num_steps = 100, size = 128 * 8 };
+            float result[size + 8];
+            for (unsigned i = 0; i != size + 8; ++i) result[i] = -1;
+            cpp_vm vm(program);
+            vm.set_lanes(lanes);
+            vm.set_uniform("num_steps", (int)num_steps);
+            vm.set_uniform("radius", 2.0f);
+            vm.bind_buffer(0, result, size * sizeof(float));
+            vm.dispatch(2);
+            for (unsigned i = 0; i <= num_steps; ++i) {
+              float angle = i * (2.0f * 3.14159265f / num_steps);
+              float *v = result + i * 8;
+              assert(fabsf(v[0] - cosf(angle) * 2) < 1e-5f && v[1] == i && fabsf(v[2] - sinf(angle) * 2) < 1e-5f && v[3] == 1);
+              assert(fabsf(v[4] - (float)i / num_steps) < 1e-6f && v[5] == 0 && v[7] == 1);
+            }
+            // predicated off, and not past the end of the buffer.
+            assert(result[(num_steps + 1) * 8] == -1 && result[size] == -1);
+          }
+
+          // masked control flow: each invocation takes a different path.
+          static const char flow[] =
+            "layout(binding = 1) buffer b { int data[]; } buf;\n"
+            "layout (local_size_x = 16) in;\n"
+            "int collatz(int n) {\n"
+            "  int steps = 0;\n"
+            "  while (n != 1) {\n"
+            "    if (steps >= 20) return -1;\n"
+            "    n = (n & 1) != 0 ? 3 * n + 1 : n / 2;\n"
+            "    steps++;\n"
+            "  }\n"
+            "  return steps;\n"
+            "}\n"
+            "void main() {\n"
+            "  int i = int(gl_GlobalInvocationID.x);\n"
+            "  int sum = 0;\n"
+            "  for (int j = 0; j < 20; ++j) {\n"
+            "    if (j == i) continue;\n"
+            "    if (j * j > i * 7) break;\n"
+            "    sum += j;\n"
+            "  }\n"
+            "  if (i % 3 == 0) sum = -sum; else if (i > 20) sum = 7;\n"
+            "  buf.data[i*2] = sum;\n"
+            "  buf.data[i*2+1] = collatz(i + 1);\n"
+            "}\n"
+          ;
+          ok = compile(program, flow);
+          assert(ok);
+          for (unsigned lanes = 4; lanes <= 16; lanes *= 2) {
+            int result[64];
+            cpp_vm vm(program);
+            vm.set_lanes(lanes);
+            vm.bind_buffer(1, result, sizeof(result));
+            vm.dispatch(2);
+            for (int i = 0; i != 32; ++i) {
+              int sum = 0;
+              for (int j = 0; j < 20; ++j) {
+                if (j == i) continue;
+                if (j * j > i * 7) break;
+                sum += j;
+              }
+              if (i % 3 == 0) sum = -sum; else if (i > 20) sum = 7;
+              int n = i + 1, steps = 0;
+              while (n != 1 && steps < 20) {
+                n = n & 1 ? 3 * n + 1 : n / 2;
+                steps++;
+              }
+              assert(result[i*2] == sum);
+              assert(result[i*2+1] == (n == 1 ? steps : -1));
+            }
+          }
+        }
+      };
+
+      static cpp_vm_unit_test cpp_vm_unit_test;
+    #endif
+  }
+}
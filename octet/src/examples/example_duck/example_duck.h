@@ -10,7 +10,7 @@ namespace octet {
     // scene for drawing duck
     ref<visual_scene> app_scene;
 
-    collada_builder loader;
+    collada_stream_loader loader;
   public:
     /// this is called when we construct the class before everything is initialised.
     example_duck(int argc, char **argv) : app(argc, argv) {
@@ -14,20 +14,33 @@ namespace octet { namespace helpers {
     ref<bitmap_font> font;
     ref<material> mat;
     ref<scene_node> node;
+    ref<texture_atlas> atlas;
   public:
     /// Create an empty text overlay.
-    text_overlay() {
+    /// With a distance_field_spread, the glyphs are converted to a distance field
+    /// that stays sharp when the text is scaled.
+    text_overlay(unsigned distance_field_spread = 0) {
       image *page = new image("assets/courier_18_0.gif");
       page->load();
       font = new bitmap_font(
         page->get_width(), page->get_height(), "assets/courier_18.fnt"
       );
 
+      const char *fragment_shader = "shaders/text.fs";
+      if (distance_field_spread) {
+        atlas = new texture_atlas(1024, 1024);
+        atlas->set_distance_field(distance_field_spread);
+        atlas->add_font("courier", font, &page);
+        atlas->pack();
+        page = atlas->get_page(0);
+        fragment_shader = "shaders/text_sdf.fs";
+      }
+
       // Make a scene for the text overlay using an ortho camera
       // that works in screen pixels.
       text_scene = new visual_scene();
 
-      param_shader *shader = new param_shader("shaders/default.vs", "shaders/text.fs");
+      param_shader *shader = new param_shader("shaders/default.vs", fragment_shader);
 
       // Make a material from the font image.
       mat = new material(page, NULL, shader);
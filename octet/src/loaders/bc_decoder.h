@@ -0,0 +1,365 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// BC1-BC5 (DXT1, DXT3, DXT5, RGTC1, RGTC2) block decoder
+//
+// Used when the GL does not support compressed textures and to sample
+// compressed images on the CPU.
+//
+// see http://www.opengl.org/registry/specs/EXT/texture_compression_s3tc.txt
+// and http://www.opengl.org/registry/specs/ARB/texture_compression_rgtc.txt
+//
+
+namespace octet { namespace loaders {
+  /// Decode blocks of BCn compressed texture data to RGBA bytes.
+  class bc_decoder {
+  public:
+    // these are here to avoid including glext.h which may be platform dependent.
+    enum {
+      COMPRESSED_RGB_S3TC_DXT1_EXT = 0x83F0,
+      COMPRESSED_RGBA_S3TC_DXT1_EXT = 0x83F1,
+      COMPRESSED_RGBA_S3TC_DXT3_EXT = 0x83F2,
+      COMPRESSED_RGBA_S3TC_DXT5_EXT = 0x83F3,
+      COMPRESSED_RED_RGTC1 = 0x8DBB,
+      COMPRESSED_RG_RGTC2 = 0x8DBD,
+    };
+
+  private:
+    // expand 5 or 6 bit colour fields to 8 bits
+    static unsigned expand565(unsigned c) {
+      unsigned r = ( c >> 11 ) & 0x1f;
+      unsigned g = ( c >> 5 ) & 0x3f;
+      unsigned b = c & 0x1f;
+      r = ( r << 3 ) | ( r >> 2 );
+      g = ( g << 2 ) | ( g >> 4 );
+      b = ( b << 3 ) | ( b >> 2 );
+      return r | ( g << 8 ) | ( b << 16 ) | 0xff000000;
+    }
+
+    // how to treat BC1 blocks with color0 <= color1
+    enum bc1_mode_t {
+      // always four colours (DXT3 and DXT5 colour blocks)
+      bc1_four_colour,
+      // three colours and black
+      bc1_black,
+      // three colours and transparent black
+      bc1_transparent,
+    };
+
+    // make the four colour palette of a BC1 block as little-endian RGBA words
+    static void bc1_palette(uint32_t *pal, const uint8_t *src, bc1_mode_t mode) {
+      unsigned c0 = src[0] + src[1] * 256;
+      unsigned c1 = src[2] + src[3] * 256;
+      uint32_t p0 = expand565(c0);
+      uint32_t p1 = expand565(c1);
+      pal[0] = p0;
+      pal[1] = p1;
+      #if OCTET_SSE2
+        // interpolate all four channels at once in 16 bit lanes
+        __m128i zero = _mm_setzero_si128();
+        __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)p0), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)p1), zero);
+        if (c0 > c1 || mode == bc1_four_colour) {
+          // (2a + b) / 3 and (a + 2b) / 3. x * 0x5556 >> 16 is x / 3 for x < 0x8000
+          __m128i third = _mm_set1_epi16(0x5556);
+          __m128i two_a_b = _mm_add_epi16(_mm_add_epi16(a, a), b);
+          __m128i a_two_b = _mm_add_epi16(_mm_add_epi16(b, b), a);
+          __m128i q = _mm_mulhi_epu16(_mm_unpacklo_epi64(two_a_b, a_two_b), third);
+          q = _mm_packus_epi16(q, q);
+          pal[2] = (uint32_t)_mm_cvtsi128_si32(q) | 0xff000000;
+          pal[3] = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(q, 4)) | 0xff000000;
+        } else {
+          __m128i half = _mm_srli_epi16(_mm_add_epi16(a, b), 1);
+          pal[2] = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(half, half)) | 0xff000000;
+          pal[3] = mode == bc1_black ? 0xff000000 : 0;
+        }
+      #else
+        uint32_t p2 = 0, p3 = 0;
+        for (unsigned i = 0; i != 24; i += 8) {
+          unsigned a = ( p0 >> i ) & 0xff, b = ( p1 >> i ) & 0xff;
+          if (c0 > c1 || mode == bc1_four_colour) {
+            p2 |= ( ( ( 2 * a + b ) * 0x5556 ) >> 16 ) << i;
+            p3 |= ( ( ( a + 2 * b ) * 0x5556 ) >> 16 ) << i;
+          } else {
+            p2 |= ( ( a + b ) >> 1 ) << i;
+          }
+        }
+        pal[2] = p2 | 0xff000000;
+        pal[3] = c0 > c1 || mode == bc1_four_colour ? p3 | 0xff000000 : mode == bc1_black ? 0xff000000 : 0;
+      #endif
+    }
+
+    // make the eight value palette of a BC3 alpha or BC4 block
+    static void bc4_palette(uint8_t *pal, const uint8_t *src) {
+      unsigned a0 = src[0], a1 = src[1];
+      pal[0] = (uint8_t)a0;
+      pal[1] = (uint8_t)a1;
+      if (a0 > a1) {
+        for (unsigned i = 1; i != 7; ++i) {
+          pal[i+1] = (uint8_t)( ( ( 7 - i ) * a0 + i * a1 + 3 ) / 7 );
+        }
+      } else {
+        for (unsigned i = 1; i != 5; ++i) {
+          pal[i+1] = (uint8_t)( ( ( 5 - i ) * a0 + i * a1 + 2 ) / 5 );
+        }
+        pal[6] = 0;
+        pal[7] = 0xff;
+      }
+    }
+
+    // write the colour of a 4x4 BC1 block to rows of RGBA texels
+    static void bc1_colour(uint8_t *dest, unsigned stride, const uint8_t *src, bc1_mode_t mode) {
+      uint32_t pal[4];
+      bc1_palette(pal, src, mode);
+      // the indices are looked up one at a time: selecting them with SSE2 compare masks measured slower.
+      for (unsigned y = 0; y != 4; ++y) {
+        unsigned bits = src[4 + y];
+        uint32_t *d = (uint32_t*)(dest + y * stride);
+        #if OCTET_SSE2
+          _mm_storeu_si128((__m128i*)d, _mm_setr_epi32((int)pal[bits & 3], (int)pal[(bits >> 2) & 3], (int)pal[(bits >> 4) & 3], (int)pal[bits >> 6]));
+        #else
+          d[0] = pal[bits & 3];
+          d[1] = pal[(bits >> 2) & 3];
+          d[2] = pal[(bits >> 4) & 3];
+          d[3] = pal[bits >> 6];
+        #endif
+      }
+    }
+
+    // write one channel of a 4x4 BC4 block
+    static void bc4_channel(uint8_t *dest, unsigned stride, const uint8_t *src) {
+      uint8_t pal[8];
+      bc4_palette(pal, src);
+      // two rows of 3-bit indices in each 24 bits
+      for (unsigned half = 0; half != 2; ++half) {
+        unsigned bits = src[2 + half * 3] | ( src[3 + half * 3] << 8 ) | ( src[4 + half * 3] << 16 );
+        for (unsigned i = 0; i != 8; ++i) {
+          dest[( half * 2 + ( i >> 2 ) ) * stride + ( i & 3 ) * 4] = pal[bits & 7];
+          bits >>= 3;
+        }
+      }
+    }
+
+    // write the alpha of a 4x4 BC2 block
+    static void bc2_alpha(uint8_t *dest, unsigned stride, const uint8_t *src) {
+      for (unsigned y = 0; y != 4; ++y) {
+        unsigned bits = src[y * 2] | ( src[y * 2 + 1] << 8 );
+        for (unsigned x = 0; x != 4; ++x) {
+          dest[y * stride + x * 4] = (uint8_t)( ( bits & 15 ) * 17 );
+          bits >>= 4;
+        }
+      }
+    }
+
+    // flip rows of 2 bit indices (4 bytes, one per row) of h valid rows
+    static void flip_bc1_indices(uint8_t *dest, const uint8_t *src, unsigned h) {
+      for (unsigned y = 0; y != 4; ++y) {
+        dest[y] = src[y < h ? h - 1 - y : y];
+      }
+    }
+
+    // flip rows of 3 bit indices (48 bits, 12 per row) of h valid rows
+    static void flip_bc4_indices(uint8_t *dest, const uint8_t *src, unsigned h) {
+      uint64_t bits = 0, out = 0;
+      for (unsigned i = 0; i != 6; ++i) bits |= (uint64_t)src[i] << ( i * 8 );
+      for (unsigned y = 0; y != 4; ++y) {
+        unsigned sy = y < h ? h - 1 - y : y;
+        out |= ( ( bits >> ( sy * 12 ) ) & 0xfff ) << ( y * 12 );
+      }
+      for (unsigned i = 0; i != 6; ++i) dest[i] = (uint8_t)( out >> ( i * 8 ) );
+    }
+
+  public:
+    /// bytes in each 4x4 block, or 0 if this is not a BCn format.
+    static unsigned get_block_size(unsigned format) {
+      switch (format) {
+        case COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case COMPRESSED_RED_RGTC1:
+          return 8;
+        case COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case COMPRESSED_RG_RGTC2:
+          return 16;
+      }
+      return 0;
+    }
+
+    /// bytes in one mip level of a compressed image.
+    static unsigned get_level_size(unsigned format, unsigned width, unsigned height) {
+      return ( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * get_block_size(format);
+    }
+
+    /// Decode one 4x4 block to RGBA texels. stride is the distance between rows of dest in bytes.
+    /// One and two channel formats decode to (r, 0, 0, 1) and (r, g, 0, 1) like the GL does.
+    static void decode_block(uint8_t *dest, unsigned stride, const uint8_t *src, unsigned format) {
+      switch (format) {
+        case COMPRESSED_RGB_S3TC_DXT1_EXT: {
+          bc1_colour(dest, stride, src, bc1_black);
+        } break;
+        case COMPRESSED_RGBA_S3TC_DXT1_EXT: {
+          bc1_colour(dest, stride, src, bc1_transparent);
+        } break;
+        case COMPRESSED_RGBA_S3TC_DXT3_EXT: {
+          bc1_colour(dest, stride, src + 8, bc1_four_colour);
+          bc2_alpha(dest + 3, stride, src);
+        } break;
+        case COMPRESSED_RGBA_S3TC_DXT5_EXT: {
+          bc1_colour(dest, stride, src + 8, bc1_four_colour);
+          bc4_channel(dest + 3, stride, src);
+        } break;
+        case COMPRESSED_RED_RGTC1:
+        case COMPRESSED_RG_RGTC2: {
+          for (unsigned y = 0; y != 4; ++y) {
+            uint32_t *d = (uint32_t*)(dest + y * stride);
+            d[0] = d[1] = d[2] = d[3] = 0xff000000;
+          }
+          bc4_channel(dest, stride, src);
+          if (format == COMPRESSED_RG_RGTC2) {
+            bc4_channel(dest + 1, stride, src + 8);
+          }
+        } break;
+      }
+    }
+
+    /// Decode one level of a compressed image to RGBA bytes (width * height * 4).
+    /// Rows of blocks are shared out on the job pool.
+    static void decode(uint8_t *dest, const uint8_t *src, unsigned format, unsigned width, unsigned height) {
+      unsigned block_size = get_block_size(format);
+      unsigned bw = ( width + 3 ) / 4;
+      unsigned bh = ( height + 3 ) / 4;
+      if (!block_size) return;
+
+      job_pool::get().parallel_for(0, bh, 8, [=](unsigned by0, unsigned by1) {
+        uint8_t tmp[4 * 4 * 4];
+        for (unsigned by = by0; by != by1; ++by) {
+          const uint8_t *block = src + by * bw * block_size;
+          unsigned rows = height - by * 4 < 4 ? height - by * 4 : 4;
+          for (unsigned bx = 0; bx != bw; ++bx, block += block_size) {
+            unsigned cols = width - bx * 4 < 4 ? width - bx * 4 : 4;
+            uint8_t *d = dest + ( by * 4 * width + bx * 4 ) * 4;
+            if (rows == 4 && cols == 4) {
+              decode_block(d, width * 4, block, format);
+            } else {
+              // partial blocks at the edges of odd sized images
+              decode_block(tmp, 16, block, format);
+              for (unsigned y = 0; y != rows; ++y) {
+                memcpy(d + y * width * 4, tmp + y * 16, cols * 4);
+              }
+            }
+          }
+        }
+      });
+    }
+
+    /// Fetch one texel of a compressed level as a little-endian RGBA word, for sampling on the CPU.
+    static uint32_t fetch(const uint8_t *src, unsigned format, unsigned width, unsigned x, unsigned y) {
+      unsigned block_size = get_block_size(format);
+      unsigned bw = ( width + 3 ) / 4;
+      uint32_t texels[16];
+      decode_block((uint8_t*)texels, 16, src + ( ( y / 4 ) * bw + x / 4 ) * block_size, format);
+      return texels[( y & 3 ) * 4 + ( x & 3 )];
+    }
+
+    /// Copy one level of blocks to dest with the rows upside down, flipping the texels inside each block.
+    /// This is used to convert DirectX (top down) images to GL (bottom up) images as they load.
+    static void copy_flipped(uint8_t *dest, const uint8_t *src, unsigned format, unsigned width, unsigned height) {
+      unsigned block_size = get_block_size(format);
+      unsigned bw = ( width + 3 ) / 4;
+      unsigned bh = ( height + 3 ) / 4;
+      // images less than four high only use the top rows of their blocks
+      unsigned h = height < 4 ? height : 4;
+      for (unsigned by = 0; by != bh; ++by) {
+        const uint8_t *s = src + by * bw * block_size;
+        uint8_t *d = dest + ( bh - 1 - by ) * bw * block_size;
+        for (unsigned bx = 0; bx != bw; ++bx, s += block_size, d += block_size) {
+          switch (format) {
+            case COMPRESSED_RGB_S3TC_DXT1_EXT:
+            case COMPRESSED_RGBA_S3TC_DXT1_EXT: {
+              memcpy(d, s, 4);
+              flip_bc1_indices(d + 4, s + 4, h);
+            } break;
+            case COMPRESSED_RGBA_S3TC_DXT3_EXT: {
+              for (unsigned y = 0; y != 4; ++y) {
+                unsigned sy = y < h ? h - 1 - y : y;
+                d[y * 2] = s[sy * 2];
+                d[y * 2 + 1] = s[sy * 2 + 1];
+              }
+              memcpy(d + 8, s + 8, 4);
+              flip_bc1_indices(d + 12, s + 12, h);
+            } break;
+            case COMPRESSED_RGBA_S3TC_DXT5_EXT: {
+              d[0] = s[0];
+              d[1] = s[1];
+              flip_bc4_indices(d + 2, s + 2, h);
+              memcpy(d + 8, s + 8, 4);
+              flip_bc1_indices(d + 12, s + 12, h);
+            } break;
+            case COMPRESSED_RED_RGTC1:
+            case COMPRESSED_RG_RGTC2: {
+              for (unsigned i = 0; i != block_size; i += 8) {
+                d[i] = s[i];
+                d[i + 1] = s[i + 1];
+                flip_bc4_indices(d + i + 2, s + i + 2, h);
+              }
+            } break;
+          }
+        }
+      }
+    }
+
+    /// Log decode throughput for each format on a size x size image.
+    /// This is wall time: decode() splits the image across the job pool.
+    static void benchmark(unsigned size = 1024) {
+      static const unsigned formats[] = {
+        COMPRESSED_RGB_S3TC_DXT1_EXT, COMPRESSED_RGBA_S3TC_DXT1_EXT, COMPRESSED_RGBA_S3TC_DXT3_EXT,
+        COMPRESSED_RGBA_S3TC_DXT5_EXT, COMPRESSED_RED_RGTC1, COMPRESSED_RG_RGTC2,
+      };
+      static const char *names[] = { "BC1", "BC1A", "BC2", "BC3", "BC4", "BC5" };
+      dynarray<uint8_t> blocks(get_level_size(COMPRESSED_RG_RGTC2, size, size));
+      dynarray<uint8_t> texels(size * size * 4);
+      unsigned seed = 0x9bac7615;
+      for (unsigned i = 0; i != blocks.size(); ++i) {
+        seed = seed * 1103515245 + 12345;
+        blocks[i] = (uint8_t)( seed >> 16 );
+      }
+
+      typedef std::chrono::steady_clock timer_clock;
+      for (unsigned f = 0; f != sizeof(formats)/sizeof(formats[0]); ++f) {
+        enum { repeats = 8 };
+        timer_clock::time_point start = timer_clock::now();
+        for (unsigned r = 0; r != repeats; ++r) {
+          decode(texels.data(), blocks.data(), formats[f], size, size);
+        }
+        double secs = std::chrono::duration<double>(timer_clock::now() - start).count();
+        double mtexels = (double)size * size * repeats / 1000000;
+        log("bc_decoder %s: %dx%d %.1f Mtexels/s\n", names[f], size, size, secs > 0 ? mtexels / secs : 0.0);
+      }
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class bc_decoder_unit_test {
+    public:
+      bc_decoder_unit_test() {
+        // BC1 block with red and blue end points, one row for each palette entry.
+        static const uint8_t bc1[8] = { 0x00, 0xf8, 0x1f, 0x00, 0x00, 0x55, 0xaa, 0xff };
+        uint32_t texels[16];
+        bc_decoder::decode_block((uint8_t*)texels, 16, bc1, bc_decoder::COMPRESSED_RGB_S3TC_DXT1_EXT);
+        assert(texels[0] == 0xff0000ff && texels[4] == 0xffff0000);
+        assert(texels[8] == 0xff5500aa && texels[12] == 0xffaa0055);
+
+        // flipping a block twice gives the original
+        uint8_t flipped[8], back[8];
+        bc_decoder::copy_flipped(flipped, bc1, bc_decoder::COMPRESSED_RGB_S3TC_DXT1_EXT, 4, 4);
+        bc_decoder::copy_flipped(back, flipped, bc_decoder::COMPRESSED_RGB_S3TC_DXT1_EXT, 4, 4);
+        assert(!memcmp(back, bc1, 8) && flipped[4] == 0xff);
+      }
+    };
+    static bc_decoder_unit_test bc_decoder_unit_test;
+  #endif
+}}
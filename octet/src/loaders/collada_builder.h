@@ -21,6 +21,34 @@ namespace octet { namespace loaders {
   /// Class for loading COLADA files.
   class collada_builder {
   public:
+    /// map a COLLADA semantic like "TEXCOORD" and set like "1" to an octet attribute.
+    static int semantic_to_attr(const char *semantic, const char *set) {
+      struct nameToValue { const char *name; int value; };
+      static const nameToValue n2v[] = {
+        { "POSITION", 0},
+        { "WEIGHT", 1},
+        { "BLENDWEIGHT", 1},
+        { "NORMAL", 2},
+        { "DIFFUSE", 3},
+        { "COLOR", 3},
+        { "SPECULAR", 4},
+        { "TESSFACTOR", 5},
+        { "FOGCOORD", 5},
+        { "PSIZE", 6},
+        { "JOINT", 7},
+        { "BLENDINDICES", 7},
+        { "TEXCOORD", 8},
+        { "TANGENT", 14},
+        { "BINORMAL", 15},
+      };
+      int int_set = set ? atoi(set) : 0;
+      for (int i = 0; i != sizeof(n2v)/sizeof(n2v[0]); ++i) {
+        if (!strcmp(semantic, n2v[i].name)) {
+          return n2v[i].value + int_set;
+        }
+      }
+      return 8;
+    }
 
   private:
     // turn this on to debug the file as it loads
@@ -29,9 +57,31 @@ namespace octet { namespace loaders {
 
     TiXmlDocument doc;
     string doc_path;
+    string doc_url;
     dictionary<TiXmlElement *, allocator> ids;
     dynarray<float> temp_floats;
 
+    // <float_array>, <int_array> and <Name_array> contents, parsed once after loading.
+    struct source_array {
+      TiXmlElement *elem;
+      dynarray<float> floats;
+      dynarray<int> ints;
+      dynarray<string> names;
+    };
+    dynarray<source_array> arrays;
+    hash_map<TiXmlElement *, unsigned> array_index;
+    dynarray<TiXmlElement *> array_elems;
+
+    // reorder the triangles and vertices of meshes for drawing, see set_optimize().
+    bool optimize_meshes;
+
+    // use compact vertex formats, see set_quantize().
+    bool quantize_meshes;
+
+    // import time for each stage, for the log
+    enum stage_t { stage_xml, stage_arrays, stage_images, stage_materials, stage_geometry, stage_controllers, stage_scenes, stage_animations, num_stages };
+    double stage_ms[num_stages];
+
     // find all the ids in an xml file
     void find_ids(TiXmlElement *parent) {
       for (TiXmlElement *elem = parent->FirstChildElement(); elem; elem = elem->NextSiblingElement()) {
@@ -39,19 +89,78 @@ namespace octet { namespace loaders {
         if (attrib) {
           //printf("%s %s\n", elem->Value(), attrib);
           ids[attrib] = elem;
+          const char *value = elem->Value();
+          if (!strcmp(value, "float_array") || !strcmp(value, "int_array") || !strcmp(value, "Name_array")) {
+            array_elems.push_back(elem);
+          }
         }
         find_ids(elem);
       }
     }
 
+    // parse all the arrays on the job pool. Geometry only reads them afterwards.
+    void parse_arrays() {
+      arrays.resize(array_elems.size());
+      array_index.clear();
+      for (unsigned i = 0; i != array_elems.size(); ++i) {
+        arrays[i].elem = array_elems[i];
+        array_index[array_elems[i]] = i + 1;
+      }
+      array_elems.reset();
+
+      job_pool::get().parallel_for(0, arrays.size(), 1, [this](unsigned a0, unsigned a1) {
+        for (unsigned i = a0; i != a1; ++i) {
+          source_array &a = arrays[i];
+          const char *value = a.elem->Value();
+          const char *count = a.elem->Attribute("count");
+          if (!strcmp(value, "float_array")) {
+            if (count) a.floats.reserve(atoi(count));
+            float_parser::parse_floats(a.floats, a.elem->GetText());
+          } else if (!strcmp(value, "int_array")) {
+            if (count) a.ints.reserve(atoi(count));
+            float_parser::parse_ints(a.ints, a.elem->GetText());
+          } else {
+            atonv(a.names, a.elem->GetText());
+          }
+        }
+      });
+    }
+
+    // the parsed contents of an array element.
+    const source_array *get_array(TiXmlElement *elem) {
+      if (!elem || !array_index.contains(elem)) return 0;
+      return &arrays[array_index[elem] - 1];
+    }
+
+    // parsed floats of a <float_array> or an empty array.
+    const dynarray<float> &get_floats(TiXmlElement *elem) {
+      static const dynarray<float> empty;
+      const source_array *a = get_array(elem);
+      return a ? a->floats : empty;
+    }
+
+    // read only: safe to call from jobs once the document is loaded.
     TiXmlElement *find_id(const char *source) {
       if (source) {
         if (source[0] == '#') source++;
-        return ids[source];
+        return ids.contains(source) ? ids[source] : 0;
       }
       return 0;
     }
 
+    // dynarray has no assignment
+    template <class item_t> static void copy_array(dynarray<item_t> &dest, const dynarray<item_t> &src) {
+      dest.resize(src.size());
+      for (unsigned i = 0; i != src.size(); ++i) {
+        dest[i] = src[i];
+      }
+    }
+
+    // milliseconds since start
+    static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
     TiXmlElement *child(TiXmlElement *parent, const char *value) {
       return parent ? parent->FirstChildElement(value) : NULL;
     }
@@ -72,82 +181,19 @@ namespace octet { namespace loaders {
       return parent ? parent->Value() : NULL;
     }
 
-    int semantic_to_attr(const char *semantic, const char *set) {
-      struct nameToValue { const char *name; int value; };
-      static const nameToValue n2v[] = {
-        { "POSITION", 0},
-        { "WEIGHT", 1},
-        { "BLENDWEIGHT", 1},
-        { "NORMAL", 2},
-        { "DIFFUSE", 3},
-        { "COLOR", 3},
-        { "SPECULAR", 4},
-        { "TESSFACTOR", 5},
-        { "FOGCOORD", 5},
-        { "PSIZE", 6},
-        { "JOINT", 7},
-        { "BLENDINDICES", 7},
-        { "TEXCOORD", 8},
-        { "TANGENT", 14},
-        { "BINORMAL", 15},
-      };
-      int int_set = set ? atoi(set) : 0;
-      for (int i = 0; i != sizeof(n2v)/sizeof(n2v[0]); ++i) {
-        if (!strcmp(semantic, n2v[i].name)) {
-          return n2v[i].value + int_set;
-        }
-      }
-      return 8;
-    }
-
     // convert a string like "1.2 3.4 43.12" into an array of float values
     void atofv(dynarray<float> &values, const char *src) {  
       values.resize(0);
-      if (!src) return;
-
-      while (*src > 0 && *src <= ' ') ++src;
-      while(*src != 0) {
-        double whole = 0, msign = 1;
-        if (*src == '-') { msign = -1; src++; }
-        if( !(*src >= '0' && *src <= '9') && *src != '.' ) break;
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        if (*src == '.') {
-          src++;
-          double frac = 0, v = 1;
-          while (*src >= '0' && *src <= '9') { frac = frac * 10 + (*src++ - '0'); v *= 10; }
-          whole += frac / v;
-        }
-        if (*src == 'e' || *src == 'E') {
-          int esign = 1;
-          src++;
-          if (*src == '-') { esign = -1; src++; }
-          else if (*src == '+') src++;
-          int exp = 0;
-          while (*src >= '0' && *src <= '9') { exp = exp * 10 + (*src++ - '0'); }
-          whole = whole * pow(10.0, exp * esign);
-        }
-        values.push_back((float)(whole * msign));
-        while (*src > 0 && *src <= ' ') ++src;
-      }
+      float_parser::parse_floats(values, src);
     }
 
     // convert an ascii sequence of integers like "1 3 9 12 34" to an array of integers
     void atoiv(dynarray<int> &values, const char *src) {  
-      //values.resize(0);
-      if (!src) return;
-
-      while (*src > 0 && *src <= ' ') ++src;
-      while(*src != 0) {
-        int whole = 0, msign = 1;
-        if (*src == '-') { msign = -1; src++; }
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        values.push_back(whole * msign);
-        while (*src > 0 && *src <= ' ') ++src;
-      }
+      float_parser::parse_ints(values, src);
     }
 
     // convert an ascii sequence of integers like "fred bert harry" into an array of strings
-    void atonv(dynarray<string> &values, const char *src) {
+    static void atonv(dynarray<string> &values, const char *src) {
       values.resize(0);
       if (!src) return;
 
@@ -175,7 +221,7 @@ namespace octet { namespace loaders {
       dynarray<int> raw_indices;         // from JOINT semantic - one per vertex - must match INV_BIND_MATRIX
       dynarray<float> inv_bind_matrices; // from INV_BIND_MATRIX semantic
       dynarray<float> bind_shape_matrix; // from BIND_SHAPE_MATRIX element
-      string joints;                     // from JOINT semantic - sids of affected nodes
+      dynarray<string> joints;           // from JOINT semantic - sids of affected nodes
 
       // OpenGL-style skin state
       enum { max_indices = 4 };
@@ -297,10 +343,7 @@ namespace octet { namespace loaders {
         state.s->add_attribute(attr, size, GL_FLOAT, state.attr_offset * 4);
         state.attr_offset += size;
       } else if (state.pass == 2) {
-        dynarray<float> accessor_floats;
-        if (!strcmp(accessor_source_elem->Value(), "float_array")) {
-          atofv(accessor_floats, accessor_source_elem->GetText());
-        }
+        const dynarray<float> &accessor_floats = get_floats(accessor_source_elem);
 
         // attribute building pass
         for (unsigned i = 0; i != num_vertices; ++i) {
@@ -337,8 +380,7 @@ namespace octet { namespace loaders {
             state.skinst->raw_indices[i] = src_idx;
           }
         } else if (!strcmp(semantic, "WEIGHT")) {
-          dynarray<float> accessor_floats;
-          atofv(accessor_floats, accessor_source_elem->GetText());
+          const dynarray<float> &accessor_floats = get_floats(accessor_source_elem);
           assert(state.skinst->raw_weights.size() >= num_vertices);
           for (unsigned i = 0; i != num_vertices; ++i) {
             unsigned index = state.p[i * state.input_stride + state.input_offset];
@@ -636,10 +678,12 @@ namespace octet { namespace loaders {
     }
 
     // add a geometry element to the list of mesh states
+    // the geometries are independent, so their vertices are built together on the job pool.
     void add_geometry(resource_dict &dict) {
       TiXmlElement *lib_geom = doc.RootElement()->FirstChildElement("library_geometries");
       if (!lib_geom) return;
 
+      dynarray<mesh_component *> components;
       for (TiXmlElement *geometry = lib_geom->FirstChildElement(); geometry != NULL; geometry = geometry->NextSiblingElement()) {
         TiXmlElement *mesh_elem = child(geometry, "mesh");
         const char *id = geometry->Attribute("id");
@@ -649,11 +693,24 @@ namespace octet { namespace loaders {
           mesh_child = mesh_child->NextSiblingElement()
         ) {
           if (is_mesh_component(mesh_child->Value())) {
-            mesh *msh = new mesh();
-            get_mesh_component(msh, id, mesh_child, NULL, dict);
+            mesh_component *mc = new mesh_component();
+            if (begin_mesh_component(*mc, new mesh(), id, mesh_child, NULL, dict)) {
+              components.push_back(mc);
+            } else {
+              delete mc;
+            }
           }
         }
       }
+
+      job_pool::get().parallel_for(0, components.size(), 1, [this, &components](unsigned c0, unsigned c1) {
+        for (unsigned i = c0; i != c1; ++i) build_mesh_component(*components[i]);
+      });
+
+      for (unsigned i = 0; i != components.size(); ++i) {
+        finish_mesh_component(*components[i]);
+        delete components[i];
+      }
     }
 
     // add a geometry element to the list of mesh states
@@ -679,13 +736,12 @@ namespace octet { namespace loaders {
             const char *semantic = attr(input, "semantic");
             const char *source_id = attr(input, "source");
             if (!strcmp(semantic, "JOINT")) {
-              TiXmlElement *name_array = child(find_id(source_id), "Name_array");
+              const source_array *name_array = get_array(child(find_id(source_id), "Name_array"));
               if (name_array) {
-                skinst.joints = text(name_array);
+                copy_array(skinst.joints, name_array->names);
               }
             } else if (!strcmp(semantic, "INV_BIND_MATRIX")) {
-              TiXmlElement *float_array = child(find_id(source_id), "float_array");
-              atofv(skinst.inv_bind_matrices, text(float_array));
+              copy_array(skinst.inv_bind_matrices, get_floats(child(find_id(source_id), "float_array")));
             }
             input = sibling(input, "input");
           }
@@ -701,9 +757,7 @@ namespace octet { namespace loaders {
 
         skin *mesh_skin = new skin(modelToBind);
 
-        dynarray<string> joints;
-        atonv(joints, skinst.joints);
-
+        dynarray<string> &joints = skinst.joints;
         for (unsigned i = 0; i != joints.size(); ++i) {
           mat4t bindToModel;
           bindToModel.init_transpose(&skinst.inv_bind_matrices[i*16]);
@@ -729,7 +783,8 @@ namespace octet { namespace loaders {
       }
     }
 
-    // add <library_images> to the scene
+    // add <library_images> to the scene.
+    // the images are decoded on the job pool while the rest of the file is built.
     void add_images(resource_dict &dict) {
       TiXmlElement *lib_anim = doc.RootElement()->FirstChildElement("library_images");
       if (!lib_anim) return;
@@ -740,6 +795,7 @@ namespace octet { namespace loaders {
           string new_path;
           new_path.format("%s%s", doc_path.c_str(), url_attr);
           image *img = new image(new_path);
+          img->start_load();
           dict.set_resource(attr(elem, "id"), img);
         }
       }
@@ -789,11 +845,9 @@ namespace octet { namespace loaders {
               const char *semantic = attr(input, "semantic");
               const char *source_id = attr(input, "source");
               if (!strcmp(semantic, "INPUT")) {
-                TiXmlElement *float_array = child(find_id(source_id), "float_array");
-                atofv(times, text(float_array));
+                copy_array(times, get_floats(child(find_id(source_id), "float_array")));
               } else if (!strcmp(semantic, "OUTPUT")) {
-                TiXmlElement *float_array = child(find_id(source_id), "float_array");
-                atofv(values, text(float_array));
+                copy_array(values, get_floats(child(find_id(source_id), "float_array")));
               } else if (!strcmp(semantic, "INTERPOLATION")) {
                 /*TiXmlElement *name_array = child(find_id(source_id), "Name_array");
                 if (name_array) {
@@ -950,13 +1004,28 @@ namespace octet { namespace loaders {
       return input_stride;
     }
 
-    // get triangles from a trilist or polylist
-    void get_mesh_component(mesh *mesh, const char *id, TiXmlElement *mesh_child, skin_state *skinst, resource_dict &dict) {
-      TiXmlElement *pelem = child(mesh_child, "p");
+    // a <triangles> or <polylist> on its way to becoming a mesh.
+    // The vertices and indices can be built on the job pool, the upload happens on the main thread.
+    struct mesh_component {
+      mesh *msh;
+      TiXmlElement *mesh_child;
+      skin_state *skinst;
+      parse_input_state state;
+      unsigned num_vertices;
+      unsigned num_indices;
+      bool ok;
+    };
 
-      if (!pelem) {
+    // name the mesh and add it to the dictionary. returns false if there are no triangles.
+    bool begin_mesh_component(mesh_component &mc, mesh *mesh, const char *id, TiXmlElement *mesh_child, skin_state *skinst, resource_dict &dict) {
+      mc.msh = mesh;
+      mc.mesh_child = mesh_child;
+      mc.skinst = skinst;
+      mc.ok = false;
+
+      if (!child(mesh_child, "p")) {
         printf("warning: no <p>\n");
-        return;
+        return false;
       }
 
       // a geometry or controller is split up into its material groups
@@ -975,9 +1044,17 @@ namespace octet { namespace loaders {
       }
 
       dict.set_resource(mesh_url, mesh);
+      return true;
+    }
 
-      parse_input_state state;
-      state.s = mesh;
+    // build the vertices and indices of a mesh component. Does not use GL or the dictionary.
+    void build_mesh_component(mesh_component &mc) {
+      TiXmlElement *mesh_child = mc.mesh_child;
+      skin_state *skinst = mc.skinst;
+      parse_input_state &state = mc.state;
+      TiXmlElement *pelem = child(mesh_child, "p");
+
+      state.s = mc.msh;
       while (pelem) {
         atoiv(state.p, pelem->GetText());
         pelem = sibling(pelem, "p");
@@ -1081,7 +1158,30 @@ namespace octet { namespace loaders {
           state.indices[i] = i;
         }
       }
-      
+
+      // the <p> array is no longer needed
+      state.p.reset();
+
+      if (optimize_meshes) {
+        // merges the vertices, which collada does not share, and reorders them.
+        mesh *msh = mc.msh;
+        unsigned pos_slot = msh->get_slot(attribute_pos);
+        unsigned pos_offset = pos_slot != ~0u && msh->get_size(pos_slot) >= 3 ? msh->get_offset(pos_slot) : ~0u;
+        num_vertices = mesh_optimizer::optimize(state.indices.data(), num_indices, (uint8_t*)state.vertices.data(), num_vertices, state.attr_stride * 4, pos_offset);
+        state.vertices.resize(num_vertices * state.attr_stride);
+      }
+
+      mc.num_vertices = num_vertices;
+      mc.num_indices = num_indices;
+      mc.ok = true;
+    }
+
+    // upload a built mesh component to GL.
+    void finish_mesh_component(mesh_component &mc) {
+      if (!mc.ok) return;
+
+      parse_input_state &state = mc.state;
+      mesh *mesh = mc.msh;
       unsigned isize = state.indices.size() * sizeof(state.indices[0]);
       unsigned vsize = state.vertices.size() * sizeof(state.vertices[0]);
 
@@ -1091,11 +1191,21 @@ namespace octet { namespace loaders {
 
       mesh->allocate(vsize, isize);
       mesh->assign(vsize, isize, (unsigned char*)&state.vertices[0], (unsigned char*)&state.indices[0]);
-      mesh->set_params(state.attr_stride * 4, num_indices, num_vertices, GL_TRIANGLES, GL_UNSIGNED_INT);
+      mesh->set_params(state.attr_stride * 4, mc.num_indices, mc.num_vertices, GL_TRIANGLES, GL_UNSIGNED_INT);
       mesh->calc_aabb();
+      if (quantize_meshes) mesh->quantize();
       if (debug > 1) mesh->dump(log("mesh\n"));
     }
 
+    // get triangles from a trilist or polylist
+    void get_mesh_component(mesh *mesh, const char *id, TiXmlElement *mesh_child, skin_state *skinst, resource_dict &dict) {
+      mesh_component mc;
+      if (begin_mesh_component(mc, mesh, id, mesh_child, skinst, dict)) {
+        build_mesh_component(mc);
+        finish_mesh_component(mc);
+      }
+    }
+
     // get blend weights and matrices from a skin
     // after this we are still not home yet as the weights need to be indexed by the POSITION of the skinned mesh.
     void get_skin(TiXmlElement *geometry, TiXmlElement *mesh_child, skin_state *skin) {
@@ -1211,15 +1321,34 @@ namespace octet { namespace loaders {
 
   public:
     collada_builder() {
+      optimize_meshes = false;
+      quantize_meshes = false;
+      for (unsigned i = 0; i != num_stages; ++i) stage_ms[i] = 0;
+    }
+
+    /// Merge duplicate vertices and reorder meshes for the vertex cache, overdraw and vertex fetch
+    /// as they are built. See mesh_optimizer. This makes loading slower and drawing faster.
+    void set_optimize(bool value) {
+      optimize_meshes = value;
+    }
+
+    /// Store positions, normals and uvs in compact encodings as meshes are built,
+    /// see mesh::quantize(). The default shaders decode them.
+    void set_quantize(bool value) {
+      quantize_meshes = value;
     }
 
     // public function to load a collada file
     bool load_xml(const char *url) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      doc_url = url;
       doc_path = url;
       doc_path.truncate(doc_path.filename_pos());
       const char *path = app_utils::get_path(url);
       char buf[256];
       getcwd(buf, sizeof(buf));
+      // the document is read only, so parse it in place.
+      doc.SetInSitu(true);
       doc.LoadFile(path);
 
       TiXmlElement *top = doc.RootElement();
@@ -1234,6 +1363,11 @@ namespace octet { namespace loaders {
       }
 
       find_ids(top);
+      stage_ms[stage_xml] = elapsed_ms(start);
+
+      start = std::chrono::steady_clock::now();
+      parse_arrays();
+      stage_ms[stage_arrays] = elapsed_ms(start);
       return true;
     }
 
@@ -1272,20 +1406,45 @@ namespace octet { namespace loaders {
     }
 
     // extract resources from the collada file into a collection.
+    // The time taken by each stage goes to the log.
     void get_resources(resource_dict &dict) {
+      typedef std::chrono::steady_clock timer_clock;
+      timer_clock::time_point start = timer_clock::now();
       add_images(dict);
+      stage_ms[stage_images] = elapsed_ms(start);
 
+      start = timer_clock::now();
       add_materials(dict);
+      stage_ms[stage_materials] = elapsed_ms(start);
 
+      start = timer_clock::now();
       add_geometry(dict);
+      stage_ms[stage_geometry] = elapsed_ms(start);
 
+      start = timer_clock::now();
       add_controllers(dict);
+      stage_ms[stage_controllers] = elapsed_ms(start);
 
       // scenes refer to all the above
+      start = timer_clock::now();
       add_scenes(dict);
+      stage_ms[stage_scenes] = elapsed_ms(start);
 
       // animations refer to all other objects
+      start = timer_clock::now();
       add_animations(dict);
+      stage_ms[stage_animations] = elapsed_ms(start);
+
+      log(
+        "collada import %s: xml %.1fms arrays %.1fms images %.1fms materials %.1fms geometry %.1fms controllers %.1fms scenes %.1fms animations %.1fms\n",
+        doc_url.c_str(), stage_ms[stage_xml], stage_ms[stage_arrays], stage_ms[stage_images], stage_ms[stage_materials],
+        stage_ms[stage_geometry], stage_ms[stage_controllers], stage_ms[stage_scenes], stage_ms[stage_animations]
+      );
+    }
+
+    /// milliseconds taken by each stage of the last import, in the order they are logged.
+    const double *get_stage_times() const {
+      return stage_ms;
     }
   };
 }}
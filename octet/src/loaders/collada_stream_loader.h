@@ -0,0 +1,944 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// load a COLLADA file without building a DOM.
+//
+
+namespace octet { namespace loaders {
+  /// Class for loading COLLADA files by streaming the mapped text.
+  ///
+  /// The first pass indexes every id to the byte offset of its element. After that
+  /// each library is streamed once with an xml_pull_parser, seeking to the elements
+  /// that it refers to. Arrays used by geometry are parsed straight from the mapped
+  /// text on the job pool and freed as soon as the meshes are built, so the peak memory
+  /// is the file mapping plus the meshes.
+  ///
+  /// Images, effects, materials, geometry and visual scenes (nodes, transforms and
+  /// instance_geometry) are loaded. Use collada_builder for skins, animations, cameras and lights.
+  ///
+  /// Example
+  ///
+  ///     collada_stream_loader loader;
+  ///     if (loader.load_xml("assets/duck_triangulate.dae")) {
+  ///       loader.get_resources(dict);
+  ///     }
+  class collada_stream_loader {
+    typedef xml_pull_parser::span span;
+
+    // turn this on to debug the file as it loads
+    enum { debug = 0 };
+
+    // ids are spans of the mapped file
+    class span_cmp {
+    public:
+      static unsigned get_hash(const span &key) {
+        unsigned hash = 2166136261u;
+        for (const char *p = key.begin; p != key.end; ++p) {
+          hash = (hash ^ (uint8_t)*p) * 16777619u;
+        }
+        return hash;
+      }
+
+      static bool is_empty(const span &key) { return key.begin == 0; }
+    };
+
+    enum library_t {
+      lib_images,
+      lib_materials,
+      lib_geometries,
+      lib_visual_scenes,
+      lib_scene,
+      num_libraries
+    };
+
+    enum stage_t {
+      stage_index,
+      stage_images,
+      stage_materials,
+      stage_geometry,
+      stage_scenes,
+      num_stages
+    };
+
+    // the parameters of an effect that become material params
+    enum effect_param_t {
+      param_emission,
+      param_ambient,
+      param_diffuse,
+      param_specular,
+      param_bump,
+      param_shininess,
+      num_effect_params
+    };
+
+    // a colour, texture or float from a <phong>, <blinn> or <lambert>
+    struct effect_param {
+      bool has_color;
+      vec4 color;
+      span texture;
+    };
+
+    // a <float_array> used by some geometry
+    struct float_source {
+      unsigned offset;
+      dynarray<float> values;
+    };
+
+    // one attribute of a mesh component
+    struct attr_input {
+      unsigned attr;
+      unsigned size;
+      unsigned p_offset;
+      unsigned accessor_offset;
+      unsigned accessor_stride;
+      unsigned array;
+    };
+
+    // a <triangles> or <polylist> on its way to becoming a mesh.
+    struct mesh_component {
+      mesh *msh;
+      dynarray<attr_input> inputs;
+      dynarray<span> ps;
+      span vcount;
+      unsigned input_stride;
+      unsigned attr_stride;
+      unsigned num_vertices;
+      dynarray<float> vertices;
+      dynarray<uint32_t> indices;
+      bool ok;
+    };
+
+    // reorder the triangles and vertices of meshes for drawing, see set_optimize().
+    bool optimize_meshes;
+
+    // use compact vertex formats, see set_quantize().
+    bool quantize_meshes;
+
+    file_map *map;
+    dynarray<uint8_t> buffer;
+    const char *src;
+    const char *src_max;
+
+    string doc_url;
+    string doc_path;
+    string default_scene;
+
+    // id to byte offset of the element
+    hash_map<span, unsigned, span_cmp> ids;
+    unsigned library_offset[num_libraries];
+
+    // arrays used by the geometry, indexed by offset + 1
+    dynarray<float_source *> arrays;
+    hash_map<unsigned, unsigned> array_index;
+
+    double stage_ms[num_stages];
+
+    static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static span trim(span s) {
+      while (s.begin != s.end && (uint8_t)s.begin[0] <= ' ') s.begin++;
+      while (s.begin != s.end && (uint8_t)s.end[-1] <= ' ') s.end--;
+      return s;
+    }
+
+    // zero terminated copy of a span, with entities decoded.
+    static const char *c_str(string &tmp, const span &s) {
+      if (!s.begin) return 0;
+      return xml_pull_parser::decode(tmp, s);
+    }
+
+    // find the offset of an element from its id or url.
+    bool find_id(unsigned &offset, const span &id) {
+      span key = id.local_url();
+      if (!key.begin || key.empty() || !ids.contains(key)) return false;
+      offset = ids[key];
+      return true;
+    }
+
+    // start parsing at an element, reading its start tag.
+    bool open_at(xml_pull_parser &xml, unsigned offset) {
+      xml.init(src, src_max);
+      xml.seek(offset, 0);
+      return xml.next() == xml_pull_parser::token_open;
+    }
+
+    // start parsing at a library, reading its start tag.
+    bool open_library(xml_pull_parser &xml, library_t lib) {
+      return library_offset[lib] != ~0u && open_at(xml, library_offset[lib]);
+    }
+
+    // after an open, get the text of the element and read its close.
+    static span get_text(xml_pull_parser &xml) {
+      span result = { 0, 0 };
+      if (xml.is_empty_element()) {
+        xml.next();
+        return result;
+      }
+      unsigned depth = xml.get_depth();
+      xml_pull_parser::token_type tok;
+      while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+        if (tok == xml_pull_parser::token_text && !result.begin) {
+          result = xml.get_text();
+        } else if (tok == xml_pull_parser::token_close && xml.get_depth() < depth) {
+          break;
+        }
+      }
+      return result;
+    }
+
+    // after an open, parse the floats in the element's text.
+    static void get_floats(dynarray<float> &values, xml_pull_parser &xml) {
+      values.resize(0);
+      span text = get_text(xml);
+      if (text.begin) float_parser::parse_floats(values, text.begin, text.end);
+    }
+
+    // first pass: find all the ids and the libraries.
+    bool index() {
+      static const char *library_names[] = {
+        "library_images", "library_materials", "library_geometries", "library_visual_scenes", "scene"
+      };
+
+      for (unsigned i = 0; i != num_libraries; ++i) {
+        library_offset[i] = ~0u;
+      }
+
+      xml_pull_parser xml(src, src_max);
+      xml_pull_parser::token_type tok = xml.next();
+      if (tok != xml_pull_parser::token_open || xml.get_name() != "COLLADA") {
+        return false;
+      }
+
+      while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+        if (tok != xml_pull_parser::token_open) continue;
+
+        span id = xml.get_attr("id");
+        if (id.begin && !id.empty()) {
+          ids[id] = xml.get_offset();
+        }
+
+        if (xml.get_depth() == 2) {
+          for (unsigned i = 0; i != num_libraries; ++i) {
+            if (xml.get_name() == library_names[i]) library_offset[i] = xml.get_offset();
+          }
+        }
+      }
+      return tok == xml_pull_parser::token_eof;
+    }
+
+    // add <library_images> to the dictionary.
+    // the images are decoded on the job pool while the rest of the file is read.
+    void add_images(resource_dict &dict) {
+      xml_pull_parser xml;
+      if (!open_library(xml, lib_images)) return;
+
+      unsigned depth = xml.get_depth();
+      span image_id = { 0, 0 };
+      string id, url, path;
+      xml_pull_parser::token_type tok;
+      while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+        if (tok == xml_pull_parser::token_close) {
+          if (xml.get_depth() < depth) break;
+        } else if (tok == xml_pull_parser::token_open) {
+          if (xml.get_name() == "image") {
+            image_id = xml.get_attr("id");
+          } else if (xml.get_name() == "init_from" && image_id.begin) {
+            span text = trim(get_text(xml));
+            if (!text.empty()) {
+              path.format("%s%s", doc_path.c_str(), c_str(url, text));
+              image *img = new image(path);
+              img->start_load();
+              dict.set_resource(c_str(id, image_id), img);
+            }
+          }
+        }
+      }
+    }
+
+    // which effect parameter is this element?
+    static int get_effect_param(const span &name) {
+      static const char *names[] = { "emission", "ambient", "diffuse", "specular", "bump", "shininess" };
+      for (int i = 0; i != num_effect_params; ++i) {
+        if (name == names[i]) return i;
+      }
+      return -1;
+    }
+
+    static bool is_shader(const span &name) {
+      return name == "phong" || name == "blinn" || name == "lambert" || name == "constant";
+    }
+
+    // follow <newparam> sids from a texture to an image id.
+    static span resolve_texture(span name, const dynarray<span> &sids, const dynarray<span> &values) {
+      for (unsigned hop = 0; hop != 4; ++hop) {
+        unsigned i = 0;
+        while (i != sids.size() && !(sids[i] == name)) ++i;
+        if (i == sids.size()) break;
+        name = values[i];
+      }
+      return name;
+    }
+
+    // get a texture or a solid colour
+    param *get_param(param_buffer_info &pbi, resource_dict &dict, const effect_param &ep, const char *value, const vec4 &deflt, const dynarray<span> &sids, const dynarray<span> &values) {
+      if (ep.has_color) {
+        return new param_color(pbi, ep.color, app_utils::get_atom(value), param::stage_fragment);
+      } else if (ep.texture.begin) {
+        string tmp;
+        image *img = dict.get_image(c_str(tmp, resolve_texture(ep.texture, sids, values)));
+        if (img) return new param_sampler(pbi, app_utils::get_atom(value), img, new sampler(), param::stage_fragment);
+      }
+      return new param_color(pbi, deflt, app_utils::get_atom(value), param::stage_fragment);
+    }
+
+    // stream an <effect> to make a material
+    material *make_material(unsigned effect_offset, resource_dict &dict) {
+      xml_pull_parser xml;
+      if (!open_at(xml, effect_offset) || xml.get_name() != "effect") return 0;
+
+      effect_param params[num_effect_params] = {};
+      dynarray<span> sids;
+      dynarray<span> values;
+      bool has_shader = false;
+
+      // names of the open elements inside the effect
+      enum { max_stack = 32 };
+      span stack[max_stack];
+      unsigned depth = xml.get_depth();
+      unsigned sp = 0;
+      span sid = { 0, 0 };
+
+      xml_pull_parser::token_type tok;
+      while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+        if (tok == xml_pull_parser::token_close) {
+          if (xml.get_depth() < depth) break;
+          sp -= sp != 0;
+        } else if (tok == xml_pull_parser::token_open) {
+          if (sp == max_stack) {
+            xml.skip();
+            continue;
+          }
+          span name = xml.get_name();
+          stack[sp++] = name;
+          if (name == "newparam") {
+            sid = xml.get_attr("sid");
+          } else if (is_shader(name)) {
+            has_shader = true;
+          } else if (name == "texture" && sp >= 3 && is_shader(stack[sp-3])) {
+            int p = get_effect_param(stack[sp-2]);
+            if (p >= 0) params[p].texture = xml.get_attr("texture");
+          }
+          if (xml.is_empty_element()) {
+            xml.next();
+            sp--;
+          }
+        } else if (tok == xml_pull_parser::token_text && sp >= 2) {
+          span top = stack[sp-1];
+          span parent = stack[sp-2];
+          span text = trim(xml.get_text());
+          if ((top == "init_from" && parent == "surface") || (top == "source" && parent == "sampler2D")) {
+            if (sid.begin) {
+              sids.push_back(sid);
+              values.push_back(text);
+            }
+          } else if ((top == "color" || top == "float") && sp >= 3 && is_shader(stack[sp-3])) {
+            int p = get_effect_param(parent);
+            if (p >= 0) {
+              float f[4] = { 0, 0, 0, 1 };
+              const uint8_t *s = (const uint8_t*)text.begin, *e = (const uint8_t*)text.end;
+              for (unsigned i = 0; i != 4; ++i) {
+                s = float_parser::skip_white(s, e);
+                if (s == e || !float_parser::parse_float(f[i], s, e)) break;
+              }
+              params[p].has_color = true;
+              params[p].color = top == "float" ? vec4(f[0], 0, 0, 0) : vec4(f[0], f[1], f[2], f[3]);
+            }
+          }
+        }
+      }
+
+      if (!has_shader) {
+        return new material(vec4(0.5, 0.5, 0.5, 0));
+      }
+
+      dynarray<uint8_t> static_buffer(256);
+      param_buffer_info pbi(static_buffer);
+      param *emission = get_param(pbi, dict, params[param_emission], "emission", vec4(0, 0, 0, 0), sids, values);
+      param *ambient = get_param(pbi, dict, params[param_ambient], "ambient", vec4(0, 0, 0, 1), sids, values);
+      param *diffuse = get_param(pbi, dict, params[param_diffuse], "diffuse", vec4(0.5f, 0.5f, 0.5f, 0), sids, values);
+      param *specular = get_param(pbi, dict, params[param_specular], "specular", vec4(0, 0, 0, 0), sids, values);
+      param *bump = get_param(pbi, dict, params[param_bump], "bump", vec4(0.5f, 0.5f, 1.0f, 0), sids, values);
+      vec4 shininess_value = params[param_shininess].has_color ? params[param_shininess].color : vec4(0, 0, 0, 0);
+      param_color *shininess = new param_color(pbi, shininess_value, app_utils::get_atom("shininess"), param::stage_fragment);
+      return new material(diffuse, ambient, emission, specular, bump, shininess);
+    }
+
+    // add <library_materials> to the dictionary
+    void add_materials(resource_dict &dict) {
+      if (!dict.has_resource("default_material")) {
+        material *defmat = new material(vec4(0.5, 0.5, 0.5, 1));
+        dict.set_resource("default_material", defmat);
+      }
+
+      xml_pull_parser xml;
+      if (!open_library(xml, lib_materials)) return;
+
+      unsigned depth = xml.get_depth();
+      span material_id = { 0, 0 };
+      string tmp;
+      xml_pull_parser::token_type tok;
+      while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+        if (tok == xml_pull_parser::token_close) {
+          if (xml.get_depth() < depth) break;
+        } else if (tok == xml_pull_parser::token_open) {
+          if (xml.get_name() == "material") {
+            material_id = xml.get_attr("id");
+          } else if (xml.get_name() == "instance_effect" && material_id.begin) {
+            unsigned effect_offset = 0;
+            material *mat = find_id(effect_offset, xml.get_attr("url")) ? make_material(effect_offset, dict) : 0;
+            dict.set_resource(c_str(tmp, material_id), mat ? mat : new material(vec4(0.5, 0.5, 0.5, 0)));
+            material_id.begin = 0;
+          }
+        }
+      }
+    }
+
+    // index of a <float_array>, parsed later on the job pool.
+    unsigned get_array(unsigned offset) {
+      unsigned &index = array_index[offset + 1];
+      if (!index) {
+        float_source *fs = new float_source();
+        fs->offset = offset;
+        arrays.push_back(fs);
+        index = arrays.size();
+      }
+      return index - 1;
+    }
+
+    // parse a <float_array> from the mapped text
+    void parse_array(float_source &fs) {
+      xml_pull_parser xml;
+      if (!open_at(xml, fs.offset)) return;
+      span count = xml.get_attr("count");
+      if (count.begin) fs.values.reserve((unsigned)atoi(count.begin));
+      span text = get_text(xml);
+      if (text.begin) float_parser::parse_floats(fs.values, text.begin, text.end);
+    }
+
+    // resolve an <input> to its <vertices> or <source>, adding attributes to the component.
+    void add_input(mesh_component &mc, const span &semantic, const span &set, unsigned p_offset, const span &source) {
+      unsigned offset = 0;
+      xml_pull_parser xml;
+      if (!find_id(offset, source) || !open_at(xml, offset)) {
+        log("warning: source not found\n");
+        return;
+      }
+
+      string semantic_str, set_str;
+      if (xml.get_name() == "vertices") {
+        // <vertices> has its own inputs that share the offset of this one.
+        unsigned depth = xml.get_depth();
+        xml_pull_parser::token_type tok;
+        while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+          if (tok == xml_pull_parser::token_close && xml.get_depth() < depth) break;
+          if (tok == xml_pull_parser::token_open && xml.get_name() == "input") {
+            span sem = xml.get_attr("semantic");
+            span src = xml.get_attr("source");
+            span inner_set = xml.get_attr("set");
+            if (sem.begin && src.begin) add_input(mc, sem, inner_set, p_offset, src);
+          }
+        }
+        return;
+      }
+
+      if (xml.get_name() != "source") {
+        log("warning: source not found\n");
+        return;
+      }
+
+      // <source><technique_common><accessor source count stride><param name type/>...
+      span accessor_source = { 0, 0 };
+      unsigned accessor_offset = 0, accessor_stride = 0, size = 0;
+      bool is_float = false;
+      unsigned depth = xml.get_depth();
+      xml_pull_parser::token_type tok;
+      while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+        if (tok == xml_pull_parser::token_close && xml.get_depth() < depth) break;
+        if (tok != xml_pull_parser::token_open) continue;
+        if (xml.get_name() == "accessor") {
+          accessor_source = xml.get_attr("source");
+          span offset_attr = xml.get_attr("offset");
+          span stride_attr = xml.get_attr("stride");
+          accessor_offset = offset_attr.begin ? (unsigned)atoi(offset_attr.begin) : 0;
+          accessor_stride = stride_attr.begin ? (unsigned)atoi(stride_attr.begin) : 0;
+        } else if (xml.get_name() == "param") {
+          if (xml.get_attr("name").begin) {
+            is_float = xml.get_attr("type") == "float";
+            size++;
+          } else {
+            accessor_offset++;
+          }
+        } else if (xml.get_name() == "float_array" || xml.get_name() == "Name_array" || xml.get_name() == "IDREF_array") {
+          xml.skip();
+        }
+      }
+
+      unsigned array_offset = 0;
+      if (!accessor_stride || !find_id(array_offset, accessor_source)) {
+        log("warning: bad or no accessor source\n");
+        return;
+      }
+
+      if (!is_float) {
+        log("warning: unsupported type\n");
+        return;
+      }
+
+      attr_input in;
+      in.attr = (unsigned)collada_builder::semantic_to_attr(c_str(semantic_str, semantic), c_str(set_str, set));
+      in.size = size;
+      in.p_offset = p_offset;
+      in.accessor_offset = accessor_offset;
+      in.accessor_stride = accessor_stride;
+      in.array = get_array(array_offset);
+      mc.inputs.push_back(in);
+    }
+
+    // stream a <triangles> or <polylist>, naming the mesh and adding it to the dictionary.
+    mesh_component *begin_component(xml_pull_parser &xml, const char *geometry_id, resource_dict &dict) {
+      mesh_component *mc = new mesh_component();
+      mc->msh = 0;
+      mc->vcount.begin = mc->vcount.end = 0;
+      mc->input_stride = 1;
+      mc->attr_stride = 0;
+      mc->num_vertices = 0;
+      mc->ok = false;
+
+      // a geometry is split up into its material groups
+      // with a name of "geometry+material"
+      string mesh_url, tmp;
+      span symbol = xml.get_attr("material");
+      if (symbol.begin) {
+        mesh_url.format("%s+%s", geometry_id, c_str(tmp, symbol));
+      } else {
+        mesh_url = geometry_id;
+      }
+
+      unsigned implicit_offset = 0;
+      unsigned depth = xml.get_depth();
+      xml_pull_parser::token_type tok;
+      while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+        if (tok == xml_pull_parser::token_close && xml.get_depth() < depth) break;
+        if (tok != xml_pull_parser::token_open) continue;
+        if (xml.get_name() == "input") {
+          span semantic = xml.get_attr("semantic");
+          span source = xml.get_attr("source");
+          span offset = xml.get_attr("offset");
+          unsigned p_offset = offset.begin ? (unsigned)atoi(offset.begin) : 0;
+          unsigned stride_offset = offset.begin ? p_offset : implicit_offset++;
+          if (stride_offset + 1 > mc->input_stride) mc->input_stride = stride_offset + 1;
+          if (semantic.begin && source.begin) {
+            add_input(*mc, semantic, xml.get_attr("set"), p_offset, source);
+          } else {
+            log("warning: bad input\n");
+          }
+        } else if (xml.get_name() == "p") {
+          span text = get_text(xml);
+          if (text.begin) mc->ps.push_back(text);
+        } else if (xml.get_name() == "vcount") {
+          mc->vcount = get_text(xml);
+        }
+      }
+
+      if (mc->ps.size() == 0) {
+        log("warning: no <p>\n");
+        delete mc;
+        return 0;
+      }
+
+      if (debug > 0) {
+        log("created mesh %s\n", mesh_url.c_str());
+      }
+
+      mc->msh = new mesh();
+      dict.set_resource(mesh_url, mc->msh);
+      return mc;
+    }
+
+    // build the vertices and indices of a mesh component. Does not use GL or the dictionary.
+    void build_component(mesh_component &mc) {
+      dynarray<int> p;
+      for (unsigned i = 0; i != mc.ps.size(); ++i) {
+        float_parser::parse_ints(p, mc.ps[i].begin, mc.ps[i].end);
+      }
+
+      unsigned stride = mc.input_stride;
+      if (p.size() % stride != 0) {
+        log("warning: expected multiple of %d indices\n", stride);
+        return;
+      }
+
+      unsigned num_vertices = p.size() / stride;
+      mc.attr_stride = 0;
+      for (unsigned i = 0; i != mc.inputs.size(); ++i) {
+        mc.attr_stride += mc.inputs[i].size;
+      }
+
+      mc.vertices.resize(mc.attr_stride * num_vertices);
+      float *dest = mc.vertices.data();
+      unsigned attr_offset = 0;
+      for (unsigned i = 0; i != mc.inputs.size(); ++i) {
+        const attr_input &in = mc.inputs[i];
+        const dynarray<float> &values = arrays[in.array]->values;
+        unsigned num_values = values.size();
+        for (unsigned v = 0; v != num_vertices; ++v) {
+          unsigned src_idx = in.accessor_offset + (unsigned)p[v * stride + in.p_offset] * in.accessor_stride;
+          float *d = dest + v * mc.attr_stride + attr_offset;
+          for (unsigned j = 0; j != in.size; ++j) {
+            d[j] = src_idx + j < num_values ? values[src_idx + j] : 0.0f;
+          }
+        }
+        attr_offset += in.size;
+      }
+
+      if (mc.vcount.begin) {
+        // polygons: make fans of triangles and hope they are convex!
+        dynarray<int> vcount;
+        float_parser::parse_ints(vcount, mc.vcount.begin, mc.vcount.end);
+        unsigned num_indices = 0;
+        for (unsigned i = 0; i != vcount.size(); ++i) {
+          num_indices += vcount[i] >= 3 ? (vcount[i] - 2) * 3 : 0;
+        }
+        mc.indices.resize(num_indices);
+        unsigned j = 0, z = 0;
+        for (unsigned i = 0; i != vcount.size(); ++i) {
+          unsigned nv = (unsigned)vcount[i];
+          for (unsigned k = 0; k + 2 < nv; ++k) {
+            mc.indices[j++] = z;
+            mc.indices[j++] = z + k + 1;
+            mc.indices[j++] = z + k + 2;
+          }
+          z += nv;
+        }
+      } else {
+        mc.indices.resize(num_vertices);
+        for (unsigned i = 0; i != num_vertices; ++i) {
+          mc.indices[i] = i;
+        }
+      }
+
+      if (optimize_meshes) {
+        // merges the vertices, which collada does not share, and reorders them.
+        unsigned pos_offset = ~0u;
+        for (unsigned i = 0, offset = 0; i != mc.inputs.size(); offset += mc.inputs[i++].size) {
+          if (pos_offset == ~0u && mc.inputs[i].attr == attribute_pos && mc.inputs[i].size >= 3) pos_offset = offset * 4;
+        }
+        num_vertices = mesh_optimizer::optimize(mc.indices.data(), mc.indices.size(), (uint8_t*)mc.vertices.data(), num_vertices, mc.attr_stride * 4, pos_offset);
+        mc.vertices.resize(num_vertices * mc.attr_stride);
+      }
+
+      mc.num_vertices = num_vertices;
+      mc.ok = true;
+    }
+
+    // upload a built mesh component to GL.
+    void finish_component(mesh_component &mc) {
+      if (!mc.ok || !mc.indices.size()) return;
+
+      mesh *msh = mc.msh;
+      unsigned attr_offset = 0;
+      for (unsigned i = 0; i != mc.inputs.size(); ++i) {
+        msh->add_attribute(mc.inputs[i].attr, mc.inputs[i].size, GL_FLOAT, attr_offset * 4);
+        attr_offset += mc.inputs[i].size;
+      }
+
+      unsigned isize = mc.indices.size() * sizeof(mc.indices[0]);
+      unsigned vsize = mc.vertices.size() * sizeof(mc.vertices[0]);
+      msh->allocate(vsize, isize);
+      msh->assign(vsize, isize, (unsigned char*)mc.vertices.data(), (unsigned char*)mc.indices.data());
+      msh->set_params(mc.attr_stride * 4, mc.indices.size(), mc.num_vertices, GL_TRIANGLES, GL_UNSIGNED_INT);
+      msh->calc_aabb();
+      if (quantize_meshes) msh->quantize();
+    }
+
+    // add <library_geometries> to the dictionary.
+    // the components are found serially, then the arrays and vertices are built on the job pool.
+    void add_geometry(resource_dict &dict) {
+      xml_pull_parser xml;
+      if (!open_library(xml, lib_geometries)) return;
+
+      dynarray<mesh_component *> components;
+      unsigned depth = xml.get_depth();
+      string geometry_id;
+      xml_pull_parser::token_type tok;
+      while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+        if (tok == xml_pull_parser::token_close) {
+          if (xml.get_depth() < depth) break;
+        } else if (tok == xml_pull_parser::token_open) {
+          span name = xml.get_name();
+          if (name == "geometry") {
+            c_str(geometry_id, xml.get_attr("id"));
+          } else if (name == "triangles" || name == "polylist") {
+            mesh_component *mc = begin_component(xml, geometry_id, dict);
+            if (mc) components.push_back(mc);
+          } else if (name == "source" || name == "vertices" || name == "extra") {
+            // the arrays are read when the inputs use them
+            xml.skip();
+          }
+        }
+      }
+
+      job_pool &pool = job_pool::get();
+      pool.parallel_for(0, arrays.size(), 1, [this](unsigned a0, unsigned a1) {
+        for (unsigned i = a0; i != a1; ++i) parse_array(*arrays[i]);
+      });
+
+      pool.parallel_for(0, components.size(), 1, [this, &components](unsigned c0, unsigned c1) {
+        for (unsigned i = c0; i != c1; ++i) build_component(*components[i]);
+      });
+
+      for (unsigned i = 0; i != components.size(); ++i) {
+        finish_component(*components[i]);
+        delete components[i];
+      }
+
+      // the arrays are no longer needed
+      for (unsigned i = 0; i != arrays.size(); ++i) {
+        delete arrays[i];
+      }
+      arrays.reset();
+      array_index.clear();
+    }
+
+    // add a scene_node/mesh/material combination to the scene
+    void add_mesh_instance(scene_node *node, const char *mesh_url, material *mat, resource_dict &dict, visual_scene *scn) {
+      if (debug > 0) {
+        log("add mesh instance %s\n", mesh_url);
+      }
+
+      mesh *msh = dict.get_mesh(mesh_url);
+      if (msh) {
+        scn->add_mesh_instance(new mesh_instance(node, msh, mat ? mat : dict.get_material("default_material")));
+      } else {
+        log("warning: missing mesh %s\n", mesh_url);
+      }
+    }
+
+    // add <library_visual_scenes> to the dictionary
+    void add_scenes(resource_dict &dict) {
+      xml_pull_parser xml;
+      if (open_library(xml, lib_scene)) {
+        unsigned depth = xml.get_depth();
+        xml_pull_parser::token_type tok;
+        while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+          if (tok == xml_pull_parser::token_close && xml.get_depth() < depth) break;
+          if (tok == xml_pull_parser::token_open && xml.get_name() == "instance_visual_scene") {
+            c_str(default_scene, xml.get_attr("url"));
+          }
+        }
+      }
+
+      if (!open_library(xml, lib_visual_scenes)) return;
+
+      visual_scene *scn = 0;
+      dynarray<scene_node *> node_stack;
+      dynarray<float> floats;
+      string tmp, url, mesh_url;
+      unsigned num_instance_materials = 0;
+      bool in_instance_geometry = false;
+
+      unsigned depth = xml.get_depth();
+      xml_pull_parser::token_type tok;
+      while ((tok = xml.next()) > xml_pull_parser::token_eof) {
+        if (tok == xml_pull_parser::token_close) {
+          if (xml.get_depth() < depth) break;
+          span name = xml.get_name();
+          if (name == "node" || name == "visual_scene") {
+            if (node_stack.size()) node_stack.pop_back();
+          } else if (name == "instance_geometry" && in_instance_geometry) {
+            // no <bind_material>: use the whole geometry
+            if (!num_instance_materials) add_mesh_instance(node_stack.back(), url, 0, dict, scn);
+            in_instance_geometry = false;
+          }
+          continue;
+        }
+
+        if (tok != xml_pull_parser::token_open) continue;
+
+        span name = xml.get_name();
+        if (name == "visual_scene") {
+          scn = new visual_scene();
+          dict.set_resource(c_str(tmp, xml.get_attr("id")), scn);
+          node_stack.resize(0);
+          node_stack.push_back(scn->get_root_node());
+          if (xml.is_empty_element()) {
+            xml.next();
+            node_stack.pop_back();
+          }
+        } else if (!scn || !node_stack.size()) {
+          xml.skip();
+        } else if (name == "node") {
+          mat4t nodeToParent;
+          nodeToParent.loadIdentity();
+          scene_node *node = new scene_node(nodeToParent, app_utils::get_atom(c_str(tmp, xml.get_attr("sid"))));
+          if (debug > 0) log("add scene_node id=%s\n", c_str(tmp, xml.get_attr("id")));
+          dict.set_resource(c_str(tmp, xml.get_attr("id")), node);
+          node_stack.back()->add_child(node);
+          node_stack.push_back(node);
+          if (xml.is_empty_element()) {
+            xml.next();
+            node_stack.pop_back();
+          }
+        } else if (name == "matrix") {
+          get_floats(floats, xml);
+          if (floats.size() >= 16) {
+            mat4t tmp(
+              vec4(floats[0], floats[4], floats[8], floats[12]),
+              vec4(floats[1], floats[5], floats[9], floats[13]),
+              vec4(floats[2], floats[6], floats[10], floats[14]),
+              vec4(floats[3], floats[7], floats[11], floats[15])
+            );
+            node_stack.back()->access_nodeToParent().multMatrix(tmp);
+          }
+        } else if (name == "rotate") {
+          get_floats(floats, xml);
+          if (floats.size() >= 4) {
+            node_stack.back()->access_nodeToParent().rotate(floats[3], floats[0], floats[1], floats[2]);
+          }
+        } else if (name == "scale") {
+          get_floats(floats, xml);
+          if (floats.size() >= 3) {
+            node_stack.back()->access_nodeToParent().scale(floats[0], floats[1], floats[2]);
+          }
+        } else if (name == "translate") {
+          get_floats(floats, xml);
+          if (floats.size() >= 3) {
+            node_stack.back()->access_nodeToParent().translate(floats[0], floats[1], floats[2]);
+          }
+        } else if (name == "instance_geometry") {
+          c_str(url, xml.get_attr("url").local_url());
+          num_instance_materials = 0;
+          in_instance_geometry = true;
+          if (xml.is_empty_element()) {
+            xml.next();
+            add_mesh_instance(node_stack.back(), url, 0, dict, scn);
+            in_instance_geometry = false;
+          }
+        } else if (name == "instance_material" && in_instance_geometry) {
+          span symbol = xml.get_attr("symbol");
+          material *mat = dict.get_material(c_str(tmp, xml.get_attr("target")));
+          if (symbol.begin) {
+            mesh_url.format("%s+%s", url.c_str(), c_str(tmp, symbol));
+          } else {
+            mesh_url = url;
+          }
+          add_mesh_instance(node_stack.back(), mesh_url, mat, dict, scn);
+          num_instance_materials++;
+        } else if (name == "instance_controller" || name == "instance_camera" || name == "instance_light" || name == "extra") {
+          // use collada_builder for these
+          xml.skip();
+        }
+      }
+    }
+
+  public:
+    collada_stream_loader() {
+      optimize_meshes = false;
+      quantize_meshes = false;
+      map = 0;
+      src = src_max = 0;
+      for (unsigned i = 0; i != num_stages; ++i) stage_ms[i] = 0;
+      for (unsigned i = 0; i != num_libraries; ++i) library_offset[i] = ~0u;
+    }
+
+    ~collada_stream_loader() {
+      delete map;
+      for (unsigned i = 0; i != arrays.size(); ++i) {
+        delete arrays[i];
+      }
+    }
+
+    /// Merge duplicate vertices and reorder meshes for the vertex cache, overdraw and vertex fetch
+    /// as they are built. See mesh_optimizer. This makes loading slower and drawing faster.
+    void set_optimize(bool value) {
+      optimize_meshes = value;
+    }
+
+    /// Store positions, normals and uvs in compact encodings as meshes are built,
+    /// see mesh::quantize(). The default shaders decode them.
+    void set_quantize(bool value) {
+      quantize_meshes = value;
+    }
+
+    /// map a collada file and index its ids.
+    bool load_xml(const char *url) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      doc_url = url;
+      doc_path = url;
+      doc_path.truncate(doc_path.filename_pos());
+
+      // map the file if we can, otherwise read it.
+      const char *path = app_utils::get_path(url);
+      delete map;
+      map = new file_map(path);
+      src = (const char*)map->get_data();
+      src_max = src + map->get_size();
+      if (map->get_error() || !src) {
+        app_utils::get_url(buffer, url);
+        src = (const char*)buffer.data();
+        src_max = src + buffer.size();
+      }
+
+      if (src == src_max) {
+        log("file %s not found\n", path);
+        return false;
+      }
+
+      if (!index()) {
+        log("warning: %s is not a collada file\n", path);
+        return false;
+      }
+
+      stage_ms[stage_index] = elapsed_ms(start);
+      return true;
+    }
+
+    /// get the url of the default visual scene (after get_resources)
+    const char *get_default_scene() {
+      return default_scene.empty() ? 0 : default_scene.c_str();
+    }
+
+    /// extract resources from the collada file into a collection.
+    /// The time taken by each stage goes to the log.
+    void get_resources(resource_dict &dict) {
+      typedef std::chrono::steady_clock timer_clock;
+      timer_clock::time_point start = timer_clock::now();
+      add_images(dict);
+      stage_ms[stage_images] = elapsed_ms(start);
+
+      start = timer_clock::now();
+      add_materials(dict);
+      stage_ms[stage_materials] = elapsed_ms(start);
+
+      start = timer_clock::now();
+      add_geometry(dict);
+      stage_ms[stage_geometry] = elapsed_ms(start);
+
+      // scenes refer to all the above
+      start = timer_clock::now();
+      add_scenes(dict);
+      stage_ms[stage_scenes] = elapsed_ms(start);
+
+      log(
+        "collada stream %s: index %.1fms images %.1fms materials %.1fms geometry %.1fms scenes %.1fms\n",
+        doc_url.c_str(), stage_ms[stage_index], stage_ms[stage_images], stage_ms[stage_materials],
+        stage_ms[stage_geometry], stage_ms[stage_scenes]
+      );
+    }
+  };
+}}
@@ -103,217 +103,86 @@ namespace octet { namespace loaders {
       return val[0] + val[1] * 0x100 + val[2] * 0x10000 + val[3] * 0x1000000;
     }
 
-    // rrrrrggggggbbbbb
-    // rrrrrggggggbbbbb
-    // 0011223344556677
-    // 8899aabbccddeeff
-    void hack_dxt1(uint8_t *dest, const uint8_t *src, unsigned stride, bool always_use_four_colours) {
-      uint16_t color0 = src[0] + src[1] * 256;
-      uint16_t color1 = src[2] + src[3] * 256;
-      src += 4;
-
-      uint8_t r0 = ( ( ( color0 >> 11 ) & 0x1f ) * (0xffff / 0x1f)) >> 8;
-      uint8_t g0 = ( ( ( color0 >> 6 ) & 0x3f ) * (0xffff / 0x3f)) >> 8;
-      uint8_t b0 = ( ( ( color0 >> 0 ) & 0x1f ) * (0xffff / 0x1f)) >> 8;
-      uint8_t r1 = ( ( ( color1 >> 11 ) & 0x1f ) * (0xffff / 0x1f)) >> 8;
-      uint8_t g1 = ( ( ( color1 >> 6 ) & 0x3f ) * (0xffff / 0x3f)) >> 8;
-      uint8_t b1 = ( ( ( color1 >> 0 ) & 0x1f ) * (0xffff / 0x1f)) >> 8;
-
-      // if it were not for the patent, some other code would go here
-      dest[0] = ( r0 + r1 ) >> 1;
-      dest[1] = ( g0 + g1 ) >> 1;
-      dest[2] = ( b0 + b1 ) >> 1;
-      dest[3] = 0xff;
-    }
-
-    // quantised alpha
-    void hack_dxt3(uint8_t *dest, const uint8_t *src, unsigned stride) {
-      dest[3] = ( src[0] + src[1] ) >> 1;
+    // GL format for a fourcc code, or 0
+    static unsigned fourcc_format(const uint8_t *fourcc) {
+      if (!memcmp(fourcc, "DXT1", 4)) return COMPRESSED_RGB_S3TC_DXT1_EXT;
+      if (!memcmp(fourcc, "DXT3", 4)) return COMPRESSED_RGBA_S3TC_DXT3_EXT;
+      if (!memcmp(fourcc, "DXT5", 4)) return COMPRESSED_RGBA_S3TC_DXT5_EXT;
+      if (!memcmp(fourcc, "ATI1", 4) || !memcmp(fourcc, "BC4U", 4)) return bc_decoder::COMPRESSED_RED_RGTC1;
+      if (!memcmp(fourcc, "ATI2", 4) || !memcmp(fourcc, "BC5U", 4)) return bc_decoder::COMPRESSED_RG_RGTC2;
+      return 0;
     }
 
-    // interpolated alpha
-    void hack_dxt5(uint8_t *dest, const uint8_t *src, unsigned stride) {
-      dest[3] = ( src[0] + src[1] ) >> 1;
-    }
-
-    // see http://www.opengl.org/registry/specs/EXT/texture_compression_s3tc.txt
-    // a s3tc dirty hack.
-    void hack_s3(uint8_t *image, unsigned dxt, unsigned width, unsigned height, const uint8_t *src, const uint8_t *src_max) {
-      unsigned max_bytes = (width) * (height) * 8;
-      if (dxt != 1) max_bytes *= 2;
-      //if (src_max - src > max_bytes) return; // oops
+  public:
+    /// Read the format, size and number of mip levels of a dds file in memory.
+    /// Returns the number of bytes needed for all the levels, or 0 if the file can't be loaded.
+    unsigned get_info(uint16_t &format, uint16_t &width, uint16_t &height, unsigned &num_levels, const uint8_t *src, const uint8_t *src_max) {
+      if (src_max - src < (int)sizeof(dds_header)) return 0;
+      dds_header *header = (dds_header*)src;
+      if (le4(header->magic) != dds_magic) return 0;
 
-      for (unsigned y = 0; y != height; ++y) {
-        uint8_t *dest = (uint8_t *)( image + y * (width * 4) );
-        for (unsigned x = 0; x != width; ++x) {
-          if (dxt == 1) {
-            hack_dxt1(dest, src+8, width * 4, false);
-            src += 8;
-          } else if (dxt <= 3) {
-            hack_dxt1(dest, src+8, width * 4, true);
-            hack_dxt3(dest, src, width * 4);
-            src += 16;
-          } else {
-            hack_dxt1(dest, src+8, width * 4, true);
-            hack_dxt5(dest, src, width * 4);
-            src += 16;
-          }
-          dest += 4;
-        }
+      unsigned pf_flags = le4(header->pf.flags);
+      format = pf_flags & ddpf_fourcc ? fourcc_format(header->pf.fourcc) : 0;
+      if (!format) {
+        printf("warning: DDS decoder only supports DXTn and ATIn\n");
+        return 0;
       }
-    }
-
-    static void swap(uint32_t &a, uint32_t &b) {
-      uint32_t t = a; a =  b; b = t;
-    }
-
-    static void swap(uint8_t &a, uint8_t &b) {
-      uint8_t t = a; a =  b; b = t;
-    }
-
-    static void swap3(uint8_t *p1, uint8_t *p2) {
-      // 00011122 23334445 55666777
-      // 44455566 67770001 11222333
-      unsigned s1 = p1[0] + p1[1] * 0x100 + p1[2] * 0x10000;
-      unsigned s2 = p2[0] + p2[1] * 0x100 + p2[2] * 0x10000;
-      s1 = ( s1 >> 12 ) | ( s1 << 12 );
-      s2 = ( s2 >> 12 ) | ( s2 << 12 );
-      p1[0] = (s2 >> 0) & 0xff;
-      p1[1] = (s2 >> 8) & 0xff;
-      p1[2] = (s2 >> 16) & 0xff;
-      p2[0] = (s1 >> 0) & 0xff;
-      p2[1] = (s1 >> 8) & 0xff;
-      p2[2] = (s1 >> 16) & 0xff;
-    }
 
-    void flip_dxt1(dynarray<uint8_t> &image, unsigned width, unsigned height) {
-      unsigned offset = 0;
-      while (width >= 4 && height >= 4) {
-        unsigned xmax = width < 4 ? 1 : width/4;
-        unsigned ymax = height < 4 ? 1 : height/4;
-        if (offset + xmax * ymax * 8 > image.size()) break; 
-        for (unsigned y = 0; y < height/8; y++) {
-          uint8_t *p1 = &image[offset + (y * xmax) * 8];
-          uint8_t *p2 = &image[offset + ((ymax - y - 1) * xmax) * 8];
-          for (unsigned x = 0; x < width/4; x++) {
-            swap((uint32_t&)p1[0], (uint32_t&)p2[0]);
-            swap(p1[4], p2[7]);
-            swap(p1[5], p2[6]);
-            swap(p1[6], p2[5]);
-            swap(p1[7], p2[4]);
-            p1 += 8;
-            p2 += 8;
-          }
-        }
-        width >>= 1;
-        height >>= 1;
-        offset += xmax * ymax * 8;
+      width = le4(header->width);
+      height = le4(header->height);
+      unsigned count = le4(header->flags) & ddsd_mipmapcount ? le4(header->mipmap_count) : 1;
+      count = count ? count : 1;
+
+      // only count the levels that are actually in the file
+      unsigned size = 0;
+      unsigned avail = (unsigned)(src_max - src - sizeof(dds_header));
+      unsigned w = width, h = height;
+      for (num_levels = 0; num_levels != count; ++num_levels) {
+        unsigned level_size = bc_decoder::get_level_size(format, w, h);
+        if (size + level_size > avail) break;
+        size += level_size;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
       }
+      return size;
     }
 
-    void flip_dxt3(dynarray<uint8_t> &image, unsigned width, unsigned height) {
-      unsigned offset = 0;
-      while (width >= 4 && height >= 4) {
-        unsigned xmax = width < 4 ? 1 : width/4;
-        unsigned ymax = height < 4 ? 1 : height/4;
-        if (offset + xmax * ymax * 16 > image.size()) break; 
-        for (unsigned y = 0; y < height/8; y++) {
-          uint8_t *p1 = &image[offset + (y * xmax) * 16];
-          uint8_t *p2 = &image[offset + ((ymax - y - 1) * xmax) * 16];
-          for (unsigned x = 0; x < width/4; x++) {
-            swap(p1[0], p2[6]);
-            swap(p1[1], p2[7]);
-            swap(p1[2], p2[4]);
-            swap(p1[3], p2[5]);
-            swap(p1[4], p2[2]);
-            swap(p1[5], p2[3]);
-            swap(p1[6], p2[0]);
-            swap(p1[7], p2[1]);
-            p1 += 8;
-            p2 += 8;
-            swap((uint32_t&)p1[0], (uint32_t&)p2[0]);
-            swap(p1[4], p2[7]);
-            swap(p1[5], p2[6]);
-            swap(p1[6], p2[5]);
-            swap(p1[7], p2[4]);
-            p1 += 8;
-            p2 += 8;
-          }
-        }
-        width >>= 1;
-        height >>= 1;
-        offset += xmax * ymax * 16;
+    /// Copy the levels of a dds file into preallocated memory of get_info() bytes.
+    /// dds textures are upside down, so rows of blocks are flipped as they go; there is no intermediate copy.
+    bool copy_levels(uint8_t *dest, unsigned dest_size, const uint8_t *src, const uint8_t *src_max) {
+      uint16_t format = 0, width = 0, height = 0;
+      unsigned num_levels = 0;
+      unsigned size = get_info(format, width, height, num_levels, src, src_max);
+      if (!size || dest_size < size) return false;
+
+      src += sizeof(dds_header);
+      unsigned w = width, h = height;
+      for (unsigned level = 0; level != num_levels; ++level) {
+        unsigned level_size = bc_decoder::get_level_size(format, w, h);
+        bc_decoder::copy_flipped(dest, src, format, w, h);
+        dest += level_size;
+        src += level_size;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
       }
+      return true;
     }
 
-    void flip_dxt5(dynarray<uint8_t> &image, unsigned width, unsigned height) {
-      unsigned offset = 0;
-      while (width >= 4 && height >= 4) {
-        unsigned xmax = width < 4 ? 1 : width/4;
-        unsigned ymax = height < 4 ? 1 : height/4;
-        if (offset + xmax * ymax * 16 > image.size()) break; 
-        for (unsigned y = 0; y < height/8; y++) {
-          uint8_t *p1 = &image[offset + (y * xmax) * 16];
-          uint8_t *p2 = &image[offset + ((ymax - y - 1) * xmax) * 16];
-          for (unsigned x = 0; x < width/4; x++) {
-            // swap alphas
-            swap(p1[0], p2[0]);
-            swap(p1[1], p2[1]);
-            // swap 3 bit indices
-            swap3(p1+2, p2+5);
-            swap3(p1+5, p2+2);
-            p1 += 8;
-            p2 += 8;
-            swap((uint32_t&)p1[0], (uint32_t&)p2[0]);
-            swap(p1[4], p2[7]);
-            swap(p1[5], p2[6]);
-            swap(p1[6], p2[5]);
-            swap(p1[7], p2[4]);
-            p1 += 8;
-            p2 += 8;
-          }
-        }
-        width >>= 1;
-        height >>= 1;
-        offset += xmax * ymax * 16;
+    /// get an opengl texture from a file in memory
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, unsigned &num_levels, const uint8_t *src, const uint8_t *src_max) {
+      unsigned size = get_info(format, width, height, num_levels, src, src_max);
+      if (!size) {
+        format = width = height = 0;
+        return;
       }
+      image.resize(size);
+      copy_levels(image.data(), size, src, src_max);
     }
-  public:
-    // get an opengl texture from a file in memory
-    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
-      // convert the data
-      dds_header *header = (dds_header*)src;
-
-      if (le4(header->magic) != dds_magic) return;
 
-      unsigned pf_flags = le4(header->pf.flags);
-
-      if (pf_flags & ddpf_fourcc) {
-        uint8_t *fourcc = header->pf.fourcc;
-        if (fourcc[0] == 'D' && fourcc[1] == 'X' && fourcc[2] == 'T') {
-          width = le4(header->width);
-          height = le4(header->height);
-
-          format =
-            fourcc[3] == '1' ? COMPRESSED_RGB_S3TC_DXT1_EXT :
-            fourcc[3] == '3' ? COMPRESSED_RGBA_S3TC_DXT3_EXT :
-            fourcc[3] == '5' ? COMPRESSED_RGBA_S3TC_DXT5_EXT :
-            0
-          ;
-          unsigned size = (unsigned)(src_max - src - 128);
-          image.resize(size);
-          memcpy(&image[0], src + 128, size);
-
-          // dds textures are upside down, flip them!
-          switch (format) {
-            case COMPRESSED_RGB_S3TC_DXT1_EXT: flip_dxt1(image, width, height); break;
-            case COMPRESSED_RGBA_S3TC_DXT3_EXT: flip_dxt3(image, width, height); break;
-            case COMPRESSED_RGBA_S3TC_DXT5_EXT: flip_dxt5(image, width, height); break;
-          }
-          return;
-        }
-      }
-      printf("warning: DDS decoder only supports DXTn\n");
+    /// get an opengl texture from a file in memory
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+      unsigned num_levels = 0;
+      get_image(image, format, width, height, num_levels, src, src_max);
     }
   };
 }}
@@ -0,0 +1,238 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Fast, correctly rounded ASCII number parsing for text mesh formats.
+//
+
+namespace octet { namespace loaders {
+  /// Parse numbers from text that is not zero terminated, such as a mapped file.
+  ///
+  /// Floats are correctly rounded: short decimals take an exact path with one
+  /// multiply or divide, everything else goes to strtof.
+  ///
+  /// Example
+  ///
+  ///     const uint8_t *src = text, *end = text + size;
+  ///     float x;
+  ///     while (float_parser::skip_space(src, end) && float_parser::parse_float(x, src, end)) {
+  ///       values.push_back(x);
+  ///     }
+  class float_parser {
+    static bool is_digit(uint8_t c) {
+      return (unsigned)(c - '0') < 10;
+    }
+
+    // slow path for numbers with too many digits or a large exponent.
+    static float parse_slow(const uint8_t *begin, const uint8_t *end) {
+      char tmp[64];
+      size_t len = (size_t)(end - begin);
+      if (len < sizeof(tmp)) {
+        memcpy(tmp, begin, len);
+        tmp[len] = 0;
+        return strtof(tmp, 0);
+      }
+      std::string str((const char*)begin, len);
+      return strtof(str.c_str(), 0);
+    }
+
+    static unsigned first_bit(unsigned mask) {
+      #ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (unsigned)index;
+      #else
+        return (unsigned)__builtin_ctz(mask);
+      #endif
+    }
+
+  public:
+    /// skip white space including new lines, sixteen bytes at a time where we can.
+    static const uint8_t *skip_white(const uint8_t *src, const uint8_t *end) {
+      #if OCTET_SSE2
+        __m128i spaces = _mm_set1_epi8(' ');
+        while (end - src >= 16) {
+          __m128i v = _mm_loadu_si128((const __m128i*)src);
+          // bytes <= ' ' are white
+          __m128i white = _mm_cmpeq_epi8(_mm_max_epu8(v, spaces), spaces);
+          unsigned mask = ~(unsigned)_mm_movemask_epi8(white) & 0xffff;
+          if (mask) return src + first_bit(mask);
+          src += 16;
+        }
+      #endif
+      while (src != end && *src <= ' ') ++src;
+      return src;
+    }
+
+    /// Append the white space separated floats in text to values, stopping at anything else.
+    /// For example the contents of a COLLADA <float_array>.
+    static void parse_floats(dynarray<float> &values, const char *text) {
+      if (text) parse_floats(values, text, text + strlen(text));
+    }
+
+    /// Append the white space separated floats in [text, text_max) to values.
+    static void parse_floats(dynarray<float> &values, const char *text, const char *text_max) {
+      const uint8_t *src = (const uint8_t*)text, *end = (const uint8_t*)text_max;
+      float value;
+      for (;;) {
+        src = skip_white(src, end);
+        if (src == end || !parse_float(value, src, end)) break;
+        values.push_back(value);
+      }
+    }
+
+    /// Append the white space separated integers in text to values, stopping at anything else.
+    static void parse_ints(dynarray<int> &values, const char *text) {
+      if (text) parse_ints(values, text, text + strlen(text));
+    }
+
+    /// Append the white space separated integers in [text, text_max) to values.
+    static void parse_ints(dynarray<int> &values, const char *text, const char *text_max) {
+      const uint8_t *src = (const uint8_t*)text, *end = (const uint8_t*)text_max;
+      int value;
+      for (;;) {
+        src = skip_white(src, end);
+        if (src == end || !parse_int(value, src, end)) break;
+        values.push_back(value);
+      }
+    }
+
+    /// skip spaces and tabs. returns false at the end of the text.
+    static bool skip_space(const uint8_t *&src, const uint8_t *end) {
+      while (src != end && (*src == ' ' || *src == '\t')) ++src;
+      return src != end;
+    }
+
+    /// Parse a float at src, moving src past it. Returns false if there is no number.
+    static bool parse_float(float &result, const uint8_t *&src, const uint8_t *end) {
+      static const float float_pow10[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+      };
+      static const double double_pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+      };
+
+      const uint8_t *begin = src;
+      const uint8_t *p = src;
+      bool negative = false;
+      if (p != end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+      // up to 19 significant digits fit in the mantissa
+      uint64_t mantissa = 0;
+      int exponent = 0;
+      unsigned num_digits = 0;
+      unsigned significant = 0;
+      bool truncated = false;
+      for (; p != end && is_digit(*p); ++p, ++num_digits) {
+        if (significant < 19) {
+          mantissa = mantissa * 10 + (*p - '0');
+          significant += mantissa != 0;
+        } else {
+          exponent++;
+          truncated |= *p != '0';
+        }
+      }
+      if (p != end && *p == '.') {
+        for (++p; p != end && is_digit(*p); ++p, ++num_digits) {
+          if (significant < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            significant += mantissa != 0;
+            exponent--;
+          } else {
+            truncated |= *p != '0';
+          }
+        }
+      }
+
+      if (num_digits == 0) {
+        // inf, nan and other oddities
+        if (p != end && (*p == 'i' || *p == 'I' || *p == 'n' || *p == 'N')) {
+          while (p != end && ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'z')) ++p;
+          result = parse_slow(begin, p);
+          src = p;
+          return true;
+        }
+        return false;
+      }
+
+      if (p != end && (*p == 'e' || *p == 'E')) {
+        const uint8_t *q = p + 1;
+        bool exp_negative = false;
+        if (q != end && (*q == '-' || *q == '+')) exp_negative = *q++ == '-';
+        if (q != end && is_digit(*q)) {
+          int exp = 0;
+          for (; q != end && is_digit(*q); ++q) {
+            if (exp < 100000) exp = exp * 10 + (*q - '0');
+          }
+          exponent += exp_negative ? -exp : exp;
+          p = q;
+        }
+      }
+      src = p;
+
+      if (mantissa == 0 && !truncated) {
+        result = negative ? -0.0f : 0.0f;
+        return true;
+      }
+
+      // exact operands and one correctly rounded operation.
+      if (!truncated && mantissa <= (1 << 24) && exponent >= -10 && exponent <= 10) {
+        float f = (float)mantissa;
+        f = exponent < 0 ? f / float_pow10[-exponent] : f * float_pow10[exponent];
+        result = negative ? -f : f;
+        return true;
+      }
+
+      // same in double, then round to float unless that could round twice.
+      if (!truncated && mantissa <= ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22) {
+        double d = (double)mantissa;
+        d = exponent < 0 ? d / double_pow10[-exponent] : d * double_pow10[exponent];
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        // float midpoints have only bit 28 set below the float mantissa.
+        if ((bits & 0x1fffffff) != 0x10000000) {
+          float f = (float)d;
+          result = negative ? -f : f;
+          return true;
+        }
+      }
+
+      result = parse_slow(begin, p);
+      return true;
+    }
+
+    /// Parse a decimal integer at src, moving src past it. Returns false if there is no number.
+    static bool parse_int(int &result, const uint8_t *&src, const uint8_t *end) {
+      const uint8_t *p = src;
+      bool negative = false;
+      if (p != end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+      if (p == end || !is_digit(*p)) return false;
+      int value = 0;
+      for (; p != end && is_digit(*p); ++p) {
+        value = value * 10 + (*p - '0');
+      }
+      result = negative ? -value : value;
+      src = p;
+      return true;
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class float_parser_unit_test {
+    public:
+      float_parser_unit_test() {
+        static const char *text[] = { "0.5", "-1.25e2", "3.14159265358979", "1e-40", "16777217", "0.1" };
+        static const float expected[] = { 0.5f, -125.0f, 3.14159265358979f, 1e-40f, 16777217.0f, 0.1f };
+        for (unsigned i = 0; i != sizeof(text)/sizeof(text[0]); ++i) {
+          const uint8_t *src = (const uint8_t*)text[i], *end = src + strlen(text[i]);
+          float f = 0;
+          assert(float_parser::parse_float(f, src, end) && src == end && f == expected[i]);
+        }
+      }
+    };
+    static float_parser_unit_test float_parser_unit_test;
+  #endif
+}}
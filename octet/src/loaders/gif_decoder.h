@@ -8,160 +8,258 @@
 // gif file decoder - only the most common variants
 // 
 namespace octet { namespace loaders {
+  /// Decoder for gif files.
+  ///
+  /// get_image() returns the first frame. For animations, begin_frames() and next_frame()
+  /// decode one frame at a time from the file in memory, without parsing it again.
   class gif_decoder {
-    uint16_t lzw_head[0x1001];
-    uint8_t lzw_tail[0x1001];
+    // lzw dictionary: each code is a prefix code followed by one byte.
+    // The length and first byte of every string are kept so that a code
+    // can be written backwards into place in a single pass.
+    uint16_t lzw_prefix[0x1000];
+    uint8_t lzw_suffix[0x1000];
+    uint8_t lzw_first[0x1000];
+    uint16_t lzw_length[0x1000];
     enum { debug_gif = 0 };
 
-    // add a lzw string for a specific code.
-    // all strings consist of a head and a single byte tail.
-    // we follow the chains to get the whole string.
-    uint8_t add_lwz_string(unsigned code, uint8_t *&bytes, uint8_t *max_bytes, unsigned reset_code) {
-      unsigned i = code;
-      unsigned num_bytes = 1;
-      for (; i > reset_code; i = lzw_head[i]) {
-        num_bytes++;
-      }
+    // frame streaming state
+    const uint8_t *file_max;
+    const uint8_t *first_frame;
+    const uint8_t *cursor;
+    const uint8_t *gct;
+    unsigned gct_size;
+    uint16_t width;
+    uint16_t height;
+    unsigned frame_index;
+
+    // rgba image that frames are drawn on top of
+    dynarray<uint8_t> canvas;
+    // copy of the canvas for frames that restore to previous
+    dynarray<uint8_t> saved_canvas;
+    // palette indices of the current frame
+    dynarray<uint8_t> indices;
+
+    // how to clean up after the last frame
+    unsigned last_disposal;
+    unsigned last_left, last_top, last_width, last_height;
 
-      uint8_t *dest = bytes += num_bytes;
-      if (bytes > max_bytes) return 0;
-      i = code;
-      for (; i > reset_code; i = lzw_head[i]) {
-        *--dest = lzw_tail[i];
+    // write the string for a code and return its length
+    unsigned add_lzw_string(unsigned code, uint8_t *bytes) {
+      unsigned num_bytes = lzw_length[code];
+      uint8_t *dest = bytes + num_bytes;
+      for (unsigned i = num_bytes; i != 0; --i) {
+        *--dest = lzw_suffix[code];
+        code = lzw_prefix[code];
       }
-      *--dest = i;
+      return num_bytes;
+    }
 
-      if (debug_gif) {
-        for (unsigned i = 0; i != num_bytes; ++i) {
-          printf("out %02x\n", dest[i]);
-        }
-      }    
-      return i;
+    // skip a chain of sub-blocks
+    static const uint8_t *skip_blocks(const uint8_t *src, const uint8_t *src_max) {
+      while (src < src_max && *src) {
+        if (debug_gif) printf("    len=%02x\n", *src);
+        src += *src + 1;
+      }
+      return src + 1;
     }
 
     // decode image data from a gif file as a lzw coding of palette values
-    bool gif_decode_bytes(uint8_t *bytes, uint8_t *max_bytes, int min_lzw_size, const uint8_t *&srcref) {
-      const uint8_t *src = srcref;
+    bool gif_decode_bytes(uint8_t *bytes, uint8_t *max_bytes, unsigned min_lzw_size, const uint8_t *&srcref, const uint8_t *src_max) {
+      if (min_lzw_size < 1 || min_lzw_size > 11) return true;
+
+      unsigned reset_code = 1 << min_lzw_size;
+      for (unsigned i = 0; i != reset_code; ++i) {
+        lzw_prefix[i] = 0;
+        lzw_suffix[i] = lzw_first[i] = (uint8_t)i;
+        lzw_length[i] = 1;
+      }
+
       unsigned lzw_size = min_lzw_size + 1;
-      unsigned reset_code = ( 1 << min_lzw_size );
       unsigned mask = reset_code * 2 - 1;
-      unsigned cur_code = reset_code + 1;
+      unsigned next_code = reset_code + 2;
+      unsigned prev_code = ~0u;
 
       unsigned acc = 0;
       unsigned bits = 0;
-      unsigned prev_code = ~0;
+      bool end = false;
+      const uint8_t *src = srcref;
 
-      while (*src) {
-        unsigned len = *src++;
-        do {
-          unsigned byte = *src++;
-          acc |= byte << bits;
+      while (!end && src < src_max && *src) {
+        const uint8_t *block_end = src + 1 + *src;
+        if (block_end > src_max) return true;
+        src++;
+        while (!end && src != block_end) {
+          acc |= *src++ << bits;
           bits += 8;
-          if (debug_gif) printf("byte %02x acc=%08x bits=%d\n", byte, acc, bits);
           while (bits >= lzw_size) {
             unsigned code = acc & mask;
             if (debug_gif) printf("code=%03x\n", code);
             bits -= lzw_size;
             acc >>= lzw_size;
-            if ((code & ~1) == reset_code) {
-              if (code == reset_code+1) {
-                // end
-                break;
-              } else {
-                // reset
-                lzw_size = min_lzw_size + 1;
-                cur_code = reset_code + 1;
-                mask = reset_code * 2 - 1;
-              }
-            } else {
-              if (
-                (prev_code == ~0 && code >= reset_code) ||
-                code > cur_code
-              ) {
-                return true;
-              }
-
-              uint8_t tail = 0;
-              if (code == cur_code) {
-                *bytes++ = tail = add_lwz_string(prev_code, bytes, max_bytes-1, reset_code);
-                if (debug_gif) printf("out %02x\n", tail);
-              } else {
-                tail = add_lwz_string(code, bytes, max_bytes, reset_code);
-              }
+            if (code == reset_code) {
+              lzw_size = min_lzw_size + 1;
+              mask = reset_code * 2 - 1;
+              next_code = reset_code + 2;
+              prev_code = ~0u;
+              continue;
+            } else if (code == reset_code + 1) {
+              end = true;
+              break;
+            }
 
-              if (bytes > max_bytes) return true;
-
-              lzw_head[cur_code] = prev_code;
-              lzw_tail[cur_code] = tail;
-              prev_code = code;
-
-              cur_code++;
-              if (cur_code > mask) {
-                if (debug_gif) printf("resize\n");
-                if (mask != 0xfff) {
-                  lzw_size++;
-                  mask = mask * 2 + 1;
-                } else {
-                  cur_code = 0x1000;
-                }
+            if (prev_code == ~0u) {
+              if (code >= reset_code) return true;
+            } else if (code <= next_code && next_code < 0x1000) {
+              // the new string is the previous one plus the first byte of this one.
+              // if this code is the one we are adding, its first byte is that of the previous string.
+              unsigned first = lzw_first[code == next_code ? prev_code : code];
+              lzw_prefix[next_code] = (uint16_t)prev_code;
+              lzw_suffix[next_code] = (uint8_t)first;
+              lzw_first[next_code] = lzw_first[prev_code];
+              lzw_length[next_code] = lzw_length[prev_code] + 1;
+              next_code++;
+              if (next_code > mask && mask != 0xfff) {
+                lzw_size++;
+                mask = mask * 2 + 1;
               }
+            } else if (code >= next_code) {
+              return true;
             }
-          } 
-        } while( --len );
+
+            if (bytes + lzw_length[code] > max_bytes) return true;
+            bytes += add_lzw_string(code, bytes);
+            prev_code = code;
+          }
+        }
       }
-      src++;
-      srcref = src;
+
+      // there may be padding after the end code.
+      srcref = skip_blocks(src, src_max);
       return false;
     }
 
+    // draw the palette indices of a frame onto the canvas. gif rows are top down, ours are bottom up.
+    void draw_frame(const uint8_t *color_table, unsigned left, unsigned top, unsigned lwidth, unsigned lheight, bool interlaced, unsigned transparency_index) {
+      const uint8_t *src = &indices[0];
+      unsigned row = 0, pass = 0;
+      static const uint8_t pass_start[] = { 0, 4, 2, 1 };
+      static const uint8_t pass_step[] = { 8, 8, 4, 2 };
+      for (unsigned j = 0; j != lheight; ++j) {
+        uint8_t *dest = &canvas[((height - 1 - row - top) * width + left) * 4];
+        for (unsigned i = 0; i != lwidth; ++i) {
+          unsigned idx = *src++;
+          // transparent pixels show what is underneath, but keep their colour
+          // where there is nothing underneath so that filtering does not darken edges.
+          if (idx != transparency_index) {
+            dest[0] = color_table[idx*3+0];
+            dest[1] = color_table[idx*3+1];
+            dest[2] = color_table[idx*3+2];
+            dest[3] = 0xff;
+          } else if (dest[3] == 0) {
+            dest[0] = color_table[idx*3+0];
+            dest[1] = color_table[idx*3+1];
+            dest[2] = color_table[idx*3+2];
+          }
+          dest += 4;
+        }
+
+        if (!interlaced) {
+          row++;
+        } else {
+          row += pass_step[pass];
+          while (row >= lheight && pass != 3) {
+            pass++;
+            row = pass_start[pass];
+          }
+        }
+      }
+    }
+
+    // clear a rectangle of the canvas to transparent
+    void clear_rect(unsigned left, unsigned top, unsigned lwidth, unsigned lheight) {
+      for (unsigned j = 0; j != lheight; ++j) {
+        memset(&canvas[((height - 1 - j - top) * width + left) * 4], 0, lwidth * 4);
+      }
+    }
+
   public:
-    // get an opengl texture from a file in memory
-    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+    gif_decoder() {
+      file_max = first_frame = cursor = gct = 0;
+      gct_size = 0;
+      width = height = 0;
+      frame_index = 0;
+      last_disposal = 0;
+      last_left = last_top = last_width = last_height = 0;
+    }
+
+    /// Start decoding the frames of a gif file in memory.
+    /// The memory must stay valid until the last call to next_frame().
+    bool begin_frames(const uint8_t *src, const uint8_t *src_max) {
+      if (src_max - src < 13 || memcmp(src, "GIF8", 4)) return false;
       width = src[6] + src[7]*256;
       height = src[8] + src[9]*256;
       unsigned flags = src[10];
-      unsigned gct_size = flags & 0x80 ? 1 << ((flags & 7)+1) : 0;
+      gct_size = flags & 0x80 ? 1 << ((flags & 7)+1) : 0;
       //unsigned background = src[11];
       //unsigned aspect = src[12];
-      unsigned transparency_index = 0x100; // disable transparency
+      gct = src + 13;
+      first_frame = cursor = gct + gct_size * 3;
+      file_max = src_max;
+      frame_index = 0;
+      last_disposal = 0;
+      canvas.resize(width * height * 4);
+      memset(&canvas[0], 0, canvas.size());
+      return true;
+    }
 
-      unsigned size = width * height * 4;
-      image.resize(size);
-      format = 0x1908; // GL_RGBA
+    /// width of the animation in pixels
+    unsigned get_width() const {
+      return width;
+    }
+
+    /// height of the animation in pixels
+    unsigned get_height() const {
+      return height;
+    }
+
+    /// number of frames decoded since begin_frames()
+    unsigned get_frame_index() const {
+      return frame_index;
+    }
 
-      memset(&image[0], 0xff, size);
-      src += 13;
-      const uint8_t *gct = src;
-      src += gct_size * 3;
+    /// Decode the next frame as RGBA, looping back to the first frame at the end of the file.
+    /// delay_ms is how long the frame should be shown for. Returns false if there are no more frames.
+    bool next_frame(dynarray<uint8_t> &image, unsigned &delay_ms) {
+      if (!cursor) return false;
+
+      unsigned transparency_index = 0x100; // disable transparency
+      unsigned disposal = 0;
+      delay_ms = 0;
+      bool looped = false;
+
+      const uint8_t *src = cursor;
+      const uint8_t *src_max = file_max;
       while (src < src_max) {
         unsigned code = *src++;
-        if (code == 0x3b) {
-          // end
-          break;
+        if (code == 0x3b || src == src_max) {
+          // end: start again unless there were no frames at all.
+          if (looped || frame_index == 0) break;
+          looped = true;
+          src = first_frame;
+          last_disposal = 0;
+          memset(&canvas[0], 0, canvas.size());
         } else if (code == 0x21) {
-          if (*src == 0xf9) {
+          if (*src == 0xf9 && src + 6 < src_max) {
             // graphics control extension
             //unsigned block_size = src[1];
             unsigned flags = src[2];
-            //unsigned delay = src[3] + src[4] * 256;
+            delay_ms = (src[3] + src[4] * 256) * 10;
             transparency_index = flags & 1 ? src[5] : 0x100;
-
-            src++;
-            while (*src) {
-              if (debug_gif) printf("    len=%02x\n", *src);
-              src += *src + 1;
-            }
-            src++;
-          } else {
-            // unknown extension
-            src++;
-            while (*src) {
-              if (debug_gif) printf("    len=%02x\n", *src);
-              src += *src + 1;
-            }
-            src++;
+            disposal = (flags >> 2) & 7;
           }
-        } else if (code == 0x2c) {
+          // skip the extension
+          src = skip_blocks(src + 1, src_max);
+        } else if (code == 0x2c && src + 9 < src_max) {
           // image descriptor
           unsigned left = src[0] + src[1]*256;
           unsigned top = src[2] + src[3]*256;
@@ -169,42 +267,73 @@ namespace octet { namespace loaders {
           unsigned lheight = src[6] + src[7]*256;
           unsigned flags = src[8];
           unsigned lct_size = ( flags & 0x80 ) ? 1 << ((flags & 7)+1) : 0;
+          bool interlaced = ( flags & 0x40 ) != 0;
           src += 9;
           const uint8_t *color_table = ( flags & 0x80 ) ? src : gct;
           src += lct_size * 3;
+          if (src >= src_max) break;
           unsigned min_lzw_size = *src++;
 
-          dynarray<uint8_t> bytes(lwidth*lheight);
-          bool error = 
+          indices.resize(lwidth*lheight);
+          bool error =
             left + lwidth > width ||
             top + lheight > height ||
-            gif_decode_bytes(&bytes[0], &bytes[lwidth*lheight], min_lzw_size, src)
+            gif_decode_bytes(indices.data(), indices.data() + lwidth*lheight, min_lzw_size, src, src_max)
           ;
           if (error) {
             printf("warning: gif_decode_bytes - broken gif file\n");
-            goto fail;
-          } else {
-            uint8_t *src = &bytes[0];
-            for (unsigned j = 0; j != lheight; ++j) {
-              uint8_t *dest = &image[((height - 1 - j - top) * width + left) * 4];
-              for (unsigned i = 0; i != lwidth; ++i) {
-                unsigned idx = *src++;
-                dest[0] = color_table[idx*3+0];
-                dest[1] = color_table[idx*3+1];
-                dest[2] = color_table[idx*3+2];
-                dest[3] = idx == transparency_index ? 0x00 : 0xff;
-                //printf("%02x %02x %02x\n", dest[0], dest[1], dest[2]);
-                dest += 4;
-              }
-            }
+            cursor = 0;
+            return false;
+          }
+
+          // clean up after the last frame
+          if (last_disposal == 2) {
+            clear_rect(last_left, last_top, last_width, last_height);
+          } else if (last_disposal == 3 && saved_canvas.size() == canvas.size()) {
+            memcpy(&canvas[0], &saved_canvas[0], canvas.size());
           }
+          if (disposal == 3) {
+            saved_canvas.resize(canvas.size());
+            memcpy(&saved_canvas[0], &canvas[0], canvas.size());
+          }
+
+          draw_frame(color_table, left, top, lwidth, lheight, interlaced, transparency_index);
+
+          last_disposal = disposal;
+          last_left = left;
+          last_top = top;
+          last_width = lwidth;
+          last_height = lheight;
+
+          cursor = src;
+          frame_index++;
+          image.resize(canvas.size());
+          memcpy(&image[0], &canvas[0], canvas.size());
+          return true;
         } else {
           printf("warning: unknown gif file section type\n");
+          break;
         }
       }
-    fail:;
-      //num_components = transparency_index == 0x100 ? 3 : 4;
+      cursor = 0;
+      return false;
+    }
+
+    /// get the first frame of a gif file in memory as an RGBA image.
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+      format = 0x1908; // GL_RGBA
+      if (!begin_frames(src, src_max)) {
+        width = height = 0;
+        return;
+      }
+      width = this->width;
+      height = this->height;
+
+      unsigned delay_ms = 0;
+      if (!next_frame(image, delay_ms)) {
+        image.resize(width * height * 4);
+        memset(&image[0], 0xff, image.size());
+      }
     }
   };
 }}
-
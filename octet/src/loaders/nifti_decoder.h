@@ -68,6 +68,97 @@ namespace octet { namespace loaders {
     };
 
   public:
+    /// NIFTI voxel types.
+    enum datatype_t {
+      dt_uint8 = 2,
+      dt_int16 = 4,
+      dt_int32 = 8,
+      dt_float32 = 16,
+      dt_rgb24 = 128,
+      dt_uint16 = 512,
+      dt_rgba32 = 2304,
+    };
+
+    /// Layout of the voxels of a NIFTI file.
+    struct volume_info {
+      unsigned width;
+      unsigned height;
+      unsigned depth;
+      unsigned datatype;
+      unsigned bytes_per_voxel;
+      uint64_t vox_offset;
+    };
+
+    /// size of a NIFTI-1 header and its padding before the voxels.
+    static unsigned get_header_size() {
+      return 352;
+    }
+
+    /// Read the voxel layout from the header without touching the voxels.
+    /// Suitable for mapped files that are too big to decode in one go.
+    static bool get_info(volume_info &info, const uint8_t *src, const uint8_t *src_max) {
+      if (src_max - src < (int)sizeof(nifti_header)) {
+        log("warning: NIFTI file too small\n");
+        return false;
+      }
+
+      nifti_header header;
+      memcpy(&header, src, sizeof(header));
+      if (header.sizeof_hdr != 348 || header.dim[0] < 3 || header.dim[0] > 4 || (header.bitpix & 7) || !header.bitpix) {
+        log("warning: NIFTI image type not supported (dim[0] = %d)\n", header.dim[0]);
+        return false;
+      }
+
+      info.width = (unsigned)header.dim[1];
+      info.height = (unsigned)header.dim[2];
+      info.depth = (unsigned)header.dim[3];
+      info.datatype = (unsigned)header.datatype;
+      info.bytes_per_voxel = (unsigned)header.bitpix / 8;
+      info.vox_offset = (uint64_t)header.vox_offset;
+
+      uint64_t size = (uint64_t)info.width * info.height * info.depth * info.bytes_per_voxel;
+      if (info.vox_offset + size > (uint64_t)(src_max - src)) {
+        log("warning: NIFTI image too small\n");
+        return false;
+      }
+      return true;
+    }
+
+    /// Scalar value of a voxel. Colour voxels use their largest channel, RGBA uses alpha.
+    static float get_value(const uint8_t *voxel, unsigned datatype) {
+      switch (datatype) {
+        case dt_uint8: return voxel[0];
+        case dt_int16: { int16_t v; memcpy(&v, voxel, 2); return v; }
+        case dt_uint16: { uint16_t v; memcpy(&v, voxel, 2); return v; }
+        case dt_int32: { int32_t v; memcpy(&v, voxel, 4); return (float)v; }
+        case dt_float32: { float v; memcpy(&v, voxel, 4); return v; }
+        case dt_rgb24: return (float)std::max(voxel[0], std::max(voxel[1], voxel[2]));
+        case dt_rgba32: return voxel[3];
+        default: return voxel[0];
+      }
+    }
+
+    /// Write a header for a single frame volume, eg. for synthetic test data.
+    /// dest must have get_header_size() bytes.
+    static void init_header(uint8_t *dest, unsigned width, unsigned height, unsigned depth, unsigned datatype, unsigned bits_per_voxel) {
+      memset(dest, 0, get_header_size());
+      nifti_header header;
+      memset(&header, 0, sizeof(header));
+      header.sizeof_hdr = 348;
+      header.dim[0] = 3;
+      header.dim[1] = (short)width;
+      header.dim[2] = (short)height;
+      header.dim[3] = (short)depth;
+      header.dim[4] = 1;
+      header.datatype = (short)datatype;
+      header.bitpix = (short)bits_per_voxel;
+      header.pixdim[1] = header.pixdim[2] = header.pixdim[3] = 1;
+      header.vox_offset = (float)get_header_size();
+      header.scl_slope = 1;
+      memcpy(header.magic, "n+1", 4);
+      memcpy(dest, &header, sizeof(header));
+    }
+
     /// get data for a texture in memory.
     void get_image(dynarray<uint8_t> &bytes, uint16_t &format, uint16_t &width, uint16_t &height, uint16_t &depth, uint32_t &frames, const uint8_t *src, const uint8_t *src_max) {
       // convert the data
@@ -8,245 +8,524 @@
 //
 namespace octet { namespace loaders {
   /// Class for loading OBJ files.
+  ///
+  /// The file is mapped and split into line-aligned chunks that are parsed in parallel.
+  /// Each chunk has its own positions, uvs, normals and triangles, which are merged afterwards.
+  /// Vertices are indexed on their (position, uv, normal) indices, making one mesh for each
+  /// object and material. Position indices are split into ranges which are indexed in parallel.
+  ///
+  /// Example
+  ///
+  ///     obj_loader loader;
+  ///     loader.load("assets/bunny.obj", dict, app_scene);
   class obj_loader {
   public:
     obj_loader() {
+      optimize_meshes = false;
+      quantize_meshes = false;
+    }
+
+    /// Reorder meshes for the vertex cache, overdraw and vertex fetch as they are built.
+    /// See mesh_optimizer. This makes loading slower and drawing faster.
+    void set_optimize(bool value) {
+      optimize_meshes = value;
+    }
+
+    /// Store positions, normals and uvs in compact encodings as meshes are built,
+    /// see mesh::quantize(). The default shaders decode them.
+    void set_quantize(bool value) {
+      quantize_meshes = value;
     }
 
     /// Load an OBJ file
     /// http://en.wikipedia.org/wiki/Wavefront_.obj_file
     bool load(const char *url, resource_dict &dict, visual_scene *scene) {
-      dynarray<uint8_t> file;
-      app_utils::get_url(file, url);
-      if (file.size() == 0) return false;
-
-      const uint8_t *eof = file.data() + file.size();
-      this->dict = &dict;
-      material_index = 0;
-      
-      for (const uint8_t *src = file.data(); src != eof; ) {
-        while (*src == ' ' && src != eof) ++src;
-        const uint8_t *begin = src;
-        while (*src != '\n' && *src != '\r' && src != eof) ++src;
-        const uint8_t *end = src;
-        src += src != eof && *src == '\r';
-        src += src != eof && *src == '\n';
-        if (begin != end ) switch (begin[0]) {
-          case '#': {
-            fwrite(begin, 1, end-begin, stdout);
-          } break;
-          case 'o': {
-            flush();
-            fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') obj_name.assign((const char*)begin + 2, (const char*)end);
-            node = new scene_node(mat4t(), atom_);
-          } break;
-          case 'g': {
-            fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') group_name.assign((const char*)begin + 2, (const char*)end);
-          } break;
-          case 'v': {
-            //fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') {
-              atofv(values, begin+2, end);
-              if (values.size() == 3) {
-                src_vertices.push_back(vec3p(values[0], values[1], values[2]));
-              }
-            } else if (begin[1] == 't' && begin[2] == ' ') {
-              atofv(values, begin+3, end);
-              if (values.size() == 2) {
-                src_uvs.push_back(vec2p(values[0], values[1]));
-              }
-            } else if (begin[1] == 'n' && begin[2] == ' ') {
-              atofv(values, begin+3, end);
-              if (values.size() == 3) {
-                src_normals.push_back(vec3p(values[0], values[1], values[2]));
-              }
-            }
-          } break;
-          case 'f': {
-            //fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') {
-              unsigned slashes = 0;
-              mesh::vertex v[6];
-              atoiv(ivalues, slashes, begin + 2, end);
-              size_t num_values = ivalues.size() - slashes;
-              size_t num_comps = ivalues.size() / num_values;
-              size_t num_idx = ivalues.size() / num_comps;
-              if (num_idx > 4 || num_comps > 3) {
-                printf("warning: bad obj file face\n");
-                return false;
-              }
-              mesh::vertex vtx[4];
-              memset(vtx, 0, sizeof(vtx));
-              if (num_comps >= 1) {
-                size_t d = 0;
-                for (size_t i = 0; i < ivalues.size(); i += num_comps) {
-                  int iv = ivalues[i];
-                  vtx[d++].pos = src_vertices[iv < 0 ? src_vertices.size() + iv : iv];
-                }
-              }
-              if (num_comps >= 2) {
-                size_t d = 0;
-                for (size_t i = 1; i < ivalues.size(); i += num_comps) {
-                  int iv = ivalues[i];
-                  vtx[d++].uv = src_uvs[iv < 0 ? src_uvs.size() + iv : iv];
-                }
-              }
-              if (num_comps >= 3) {
-                size_t d = 0;
-                for (size_t i = 2; i < ivalues.size(); i += num_comps) {
-                  int iv = ivalues[i];
-                  vtx[d++].normal = src_normals[iv < 0 ? src_normals.size() + iv : iv];
-                }
-              }
+      // map the file if we can, otherwise read it.
+      file_map map(app_utils::get_path(url));
+      dynarray<uint8_t> buffer;
+      const uint8_t *src = map.get_data();
+      const uint8_t *src_max = src + map.get_size();
+      if (map.get_error() || !src) {
+        app_utils::get_url(buffer, url);
+        src = buffer.data();
+        src_max = src + buffer.size();
+      }
+      if (src == src_max) return false;
 
-              face f;
-              f.vtx[0] = vtx[0];
-              f.vtx[1] = vtx[1];
-              f.vtx[2] = vtx[2];
-              f.material_index = material_index;
-              faces.push_back(f);
-              if (num_idx == 4) {
-                f.vtx[0] = vtx[0];
-                f.vtx[1] = vtx[2];
-                f.vtx[2] = vtx[3];
-                f.material_index = material_index;
-                faces.push_back(f);
-              }
-            }
-          } break;
-          default: {
-            fwrite(begin, 1, end-begin, stdout);
-            printf("unknown\n");
-            return false;
-          } break;
-          case 'u': {
-            fwrite(begin, 1, end-begin, stdout);
-            if (begin+7 < end && !memcmp(begin, "usemtl ", 7)) {
-              size_t len = end - (begin+7);
-              size_t i = 0;
-              for (; i != materials.size(); ++i) {
-                if (
-                  materials[i].size() == len &&
-                  !memcmp(materials[i].c_str(), begin+7, len)
-                ) {
-                  break;
-                }
-              }
+      split(src, src_max);
 
-              if (i == materials.size()) {
-                materials.push_back(string((const char*)begin+7, (unsigned)len));
-              }
+      job_pool &pool = job_pool::get();
+      pool.parallel_for(0, chunks.size(), 1, [this](unsigned c0, unsigned c1) {
+        for (unsigned c = c0; c != c1; ++c) parse_chunk(chunks[c]);
+      });
 
-              material_index = (uint32_t)i;
-            }
-          } break;
-        }
+      merge();
+      make_groups();
+
+      for (unsigned g = 0; g != groups.size(); ++g) {
+        build_group(groups[g]);
+      }
+
+      if (optimize_meshes) {
+        pool.parallel_for(0, groups.size(), 1, [this](unsigned g0, unsigned g1) {
+          for (unsigned g = g0; g != g1; ++g) {
+            group &grp = groups[g];
+            unsigned num_vertices = mesh_optimizer::optimize(grp.indices.data(), grp.indices.size(), (uint8_t*)grp.vertices.data(), grp.vertices.size(), sizeof(mesh::vertex), 0);
+            grp.vertices.resize(num_vertices);
+          }
+        });
       }
-      flush();
 
+      make_scene(url, dict, scene);
+
+      chunks.reset();
+      groups.reset();
+      spans.reset();
+      positions.reset();
+      uvs.reset();
+      normals.reset();
       return true;
     }
+
   private:
-    dynarray<vec3p> src_vertices;
-    dynarray<vec3p> src_normals;
-    dynarray<vec2p> src_uvs;
-    dynarray<uint32_t> src_material;
-    dynarray<string> materials;
+    // one corner of a face: position, uv and normal indices.
+    // flags say which are present and which count back from the end of the chunk.
+    struct corner {
+      int32_t idx[3];
+      uint32_t flags;
+    };
 
-    string obj_name;
-    string group_name;
-    resource_dict *dict;
-    scene_node *node;
+    enum {
+      present_bit = 1,
+      relative_bit = 8,
+    };
 
-    struct face {
-      mesh::vertex vtx[3];
-      int material_index;
+    // object and material changes, in order with the triangles.
+    enum event_kind { ev_object, ev_material };
 
-      bool operator <(const face &rhs) {
-        return material_index < rhs.material_index;
-      }
+    struct event {
+      unsigned first_tri;
+      event_kind kind;
+      const uint8_t *name;
+      const uint8_t *name_end;
+    };
+
+    // part of the file and what we found in it.
+    struct chunk {
+      const uint8_t *begin;
+      const uint8_t *end;
+      dynarray<vec3p> positions;
+      dynarray<vec2p> uvs;
+      dynarray<vec3p> normals;
+      dynarray<corner> corners;
+      dynarray<event> events;
+      unsigned offset[3];
+      unsigned num_bad_lines;
+      unsigned num_bad_indices;
+    };
+
+    // triangles from one chunk that belong to a group.
+    struct span {
+      unsigned chunk;
+      unsigned first_tri;
+      unsigned end_tri;
+    };
+
+    // a mesh: all the triangles of one object with one material.
+    struct group {
+      unsigned object;
+      unsigned material;
+      dynarray<unsigned> spans;
+      dynarray<mesh::vertex> vertices;
+      dynarray<uint32_t> indices;
+      vec3 bb_min;
+      vec3 bb_max;
+    };
+
+    // position, uv and normal indices plus one, zero if absent.
+    struct corner_key {
+      uint32_t idx[3];
+    };
+
+    // vertices made from one range of position indices.
+    struct partition {
+      dynarray<mesh::vertex> vertices;
+      unsigned offset;
     };
 
-    dynarray<face> faces;
-    dynarray<uint32_t> indices;
-    dynarray<float> values;
-    dynarray<int> ivalues;
-    uint32_t material_index;
-
-    // convert an ascii sequence of integers like "1 3 9 12 34" to an array of integers
-    void atoiv(dynarray<int> &values, unsigned &slashes, const uint8_t *src, const uint8_t *end) {
-      values.resize(0);
-      slashes = 0;
-
-      while (src != end && *src > 0 && *src <= ' ') ++src;
-      while(src != end) {
-        int whole = 0, msign = 1;
-        if (src != end && *src == '-') { msign = -1; src++; }
-        while (src != end && *src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        values.push_back(whole * msign);
-        while (src != end && *src > 0 && *src <= ' ') ++src;
-        if (src != end && *src == '/') { slashes++; src++; }
+    // reorder the triangles and vertices of meshes for drawing, see set_optimize().
+    bool optimize_meshes;
+
+    // use compact vertex formats, see set_quantize().
+    bool quantize_meshes;
+
+    dynarray<chunk> chunks;
+    dynarray<group> groups;
+    dynarray<span> spans;
+
+    dynarray<vec3p> positions;
+    dynarray<vec2p> uvs;
+    dynarray<vec3p> normals;
+
+    dynarray<string> objects;
+    dynarray<string> materials;
+
+    // split the file into line-aligned chunks, a few for each thread.
+    void split(const uint8_t *src, const uint8_t *src_max) {
+      size_t size = src_max - src;
+      size_t min_chunk = 1024 * 1024;
+      size_t chunk_size = size / (job_pool::get().get_num_threads() * 4) + 1;
+      chunk_size = chunk_size < min_chunk ? min_chunk : chunk_size;
+
+      chunks.resize(0);
+      while (src != src_max) {
+        const uint8_t *end = (size_t)(src_max - src) <= chunk_size ? src_max : src + chunk_size;
+        if (end != src_max) {
+          const uint8_t *nl = (const uint8_t*)memchr(end, '\n', src_max - end);
+          end = nl ? nl + 1 : src_max;
+        }
+        chunks.resize(chunks.size() + 1);
+        chunk &c = chunks.back();
+        c.begin = src;
+        c.end = end;
+        c.num_bad_lines = 0;
+        c.num_bad_indices = 0;
+        src = end;
       }
     }
 
-    void atofv(dynarray<float> &values, const uint8_t *src, const uint8_t *end) {
-      values.resize(0);
+    static bool is_keyword(const uint8_t *src, const uint8_t *end, const char *keyword, unsigned len) {
+      return (size_t)(end - src) > len && !memcmp(src, keyword, len) && (src[len] == ' ' || src[len] == '\t');
+    }
 
-      while (*src > 0 && *src <= ' ') ++src;
-      while(src != end) {
-        double whole = 0, msign = 1;
-        if (*src == '-') { msign = -1; src++; }
-        if( !(*src >= '0' && *src <= '9') && *src != '.' ) break;
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        if (*src == '.') {
-          src++;
-          double frac = 0, v = 1;
-          while (*src >= '0' && *src <= '9') { frac = frac * 10 + (*src++ - '0'); v *= 10; }
-          whole += frac / v;
+    // parse up to n floats, zero filling the rest.
+    static unsigned parse_floats(float *values, unsigned n, const uint8_t *src, const uint8_t *end) {
+      unsigned i = 0;
+      for (; i != n && float_parser::skip_space(src, end) && float_parser::parse_float(values[i], src, end); ++i) {
+      }
+      for (unsigned j = i; j != n; ++j) values[j] = 0;
+      return i;
+    }
+
+    // parse one corner of a face such as 1/2/3, 1//3 or -1
+    static bool parse_corner(corner &result, chunk &c, const uint8_t *&src, const uint8_t *end) {
+      result.flags = 0;
+      unsigned counts[3] = { c.positions.size(), c.uvs.size(), c.normals.size() };
+      for (unsigned a = 0; a != 3; ++a) {
+        int value = 0;
+        if (float_parser::parse_int(value, src, end) && value != 0) {
+          result.flags |= present_bit << a;
+          if (value < 0) {
+            result.flags |= relative_bit << a;
+            result.idx[a] = (int32_t)counts[a] + value;
+          } else {
+            result.idx[a] = value - 1;
+          }
+        } else {
+          result.idx[a] = 0;
+          if (a == 0) return false;
         }
-        if (*src == 'e' || *src == 'E') {
-          int esign = 1;
+        if (a == 2 || src == end || *src != '/') break;
+        ++src;
+      }
+      return true;
+    }
+
+    void parse_line(chunk &c, const uint8_t *src, const uint8_t *end) {
+      float values[3];
+      switch (src[0]) {
+        case 'v': {
+          if (src + 1 == end) {
+            c.num_bad_lines++;
+          } else if (src[1] == ' ' || src[1] == '\t') {
+            if (parse_floats(values, 3, src + 2, end) != 3) c.num_bad_lines++;
+            c.positions.push_back(vec3p(values[0], values[1], values[2]));
+          } else if (src[1] == 't') {
+            parse_floats(values, 2, src + 2, end);
+            c.uvs.push_back(vec2p(values[0], values[1]));
+          } else if (src[1] == 'n') {
+            parse_floats(values, 3, src + 2, end);
+            c.normals.push_back(vec3p(values[0], values[1], values[2]));
+          }
+        } break;
+        case 'f': {
+          if (!is_keyword(src, end, "f", 1)) break;
           src++;
-          if (*src == '-') { esign = -1; src++; }
-          else if (*src == '+') src++;
-          int exp = 0;
-          while (*src >= '0' && *src <= '9') { exp = exp * 10 + (*src++ - '0'); }
-          whole = whole * pow(10.0, exp * esign);
+          corner first, prev, cur;
+          unsigned n = 0;
+          while (float_parser::skip_space(src, end)) {
+            if (!parse_corner(cur, c, src, end)) {
+              c.num_bad_lines++;
+              break;
+            }
+            // triangle fan
+            if (n == 0) {
+              first = cur;
+            } else if (n >= 2) {
+              c.corners.push_back(first);
+              c.corners.push_back(prev);
+              c.corners.push_back(cur);
+            }
+            prev = cur;
+            n++;
+          }
+        } break;
+        case 'o': case 'u': {
+          unsigned len = src[0] == 'o' ? 1 : 6;
+          if (!is_keyword(src, end, src[0] == 'o' ? "o" : "usemtl", len)) break;
+          src += len;
+          float_parser::skip_space(src, end);
+          while (end != src && (end[-1] == ' ' || end[-1] == '\t')) --end;
+          event e = { c.corners.size() / 3, len == 1 ? ev_object : ev_material, src, end };
+          c.events.push_back(e);
+        } break;
+        // comments, groups, smoothing groups and material libraries are ignored.
+        default: break;
+      }
+    }
+
+    void parse_chunk(chunk &c) {
+      const uint8_t *src = c.begin;
+      while (src != c.end) {
+        const uint8_t *nl = (const uint8_t*)memchr(src, '\n', c.end - src);
+        const uint8_t *next = nl ? nl + 1 : c.end;
+        const uint8_t *end = nl ? nl : c.end;
+        if (end != src && end[-1] == '\r') --end;
+        float_parser::skip_space(src, end);
+        if (src != end) parse_line(c, src, end);
+        src = next;
+      }
+    }
+
+    // gather the vertex attributes and make indices absolute.
+    void merge() {
+      unsigned totals[3] = { 0, 0, 0 };
+      for (unsigned i = 0; i != chunks.size(); ++i) {
+        chunk &c = chunks[i];
+        c.offset[0] = totals[0];
+        c.offset[1] = totals[1];
+        c.offset[2] = totals[2];
+        totals[0] += c.positions.size();
+        totals[1] += c.uvs.size();
+        totals[2] += c.normals.size();
+      }
+
+      positions.resize(totals[0]);
+      uvs.resize(totals[1]);
+      normals.resize(totals[2]);
+      job_pool::get().parallel_for(0, chunks.size(), 1, [this, totals](unsigned c0, unsigned c1) {
+        for (unsigned ci = c0; ci != c1; ++ci) {
+          chunk &c = chunks[ci];
+          std::copy(c.positions.data(), c.positions.data() + c.positions.size(), positions.data() + c.offset[0]);
+          std::copy(c.uvs.data(), c.uvs.data() + c.uvs.size(), uvs.data() + c.offset[1]);
+          std::copy(c.normals.data(), c.normals.data() + c.normals.size(), normals.data() + c.offset[2]);
+          c.positions.reset();
+          c.uvs.reset();
+          c.normals.reset();
+
+          for (unsigned i = 0; i != c.corners.size(); ++i) {
+            corner &cr = c.corners[i];
+            for (unsigned a = 0; a != 3; ++a) {
+              if (!(cr.flags & (present_bit << a))) continue;
+              int64_t idx = (int64_t)cr.idx[a] + (cr.flags & (relative_bit << a) ? c.offset[a] : 0);
+              if (idx < 0 || (uint64_t)idx >= totals[a]) {
+                c.num_bad_indices++;
+                cr.flags &= ~(present_bit << a);
+                cr.idx[a] = 0;
+              } else {
+                cr.idx[a] = (int32_t)idx;
+              }
+            }
+          }
+        }
+      });
+
+      unsigned bad_lines = 0, bad_indices = 0;
+      for (unsigned i = 0; i != chunks.size(); ++i) {
+        bad_lines += chunks[i].num_bad_lines;
+        bad_indices += chunks[i].num_bad_indices;
+      }
+      if (bad_lines || bad_indices) {
+        log("warning: obj file has %d bad lines and %d bad indices\n", bad_lines, bad_indices);
+      }
+    }
+
+    static unsigned find_name(dynarray<string> &names, const uint8_t *name, const uint8_t *name_end) {
+      unsigned len = (unsigned)(name_end - name);
+      for (unsigned i = 0; i != names.size(); ++i) {
+        if ((unsigned)names[i].size() == len && !memcmp(names[i].c_str(), name, len)) {
+          return i;
+        }
+      }
+      names.push_back(string((const char*)name, len));
+      return names.size() - 1;
+    }
+
+    // walk the object and material changes in file order to sort triangles into groups.
+    void make_groups() {
+      objects.resize(0);
+      materials.resize(0);
+      hash_map<uint64_t, unsigned> group_index;
+      unsigned object = ~0u, material = ~0u;
+
+      for (unsigned ci = 0; ci != chunks.size(); ++ci) {
+        chunk &c = chunks[ci];
+        unsigned num_tris = c.corners.size() / 3;
+        unsigned tri = 0;
+        for (unsigned ei = 0; ei <= c.events.size(); ++ei) {
+          unsigned end_tri = ei == c.events.size() ? num_tris : c.events[ei].first_tri;
+          if (end_tri != tri) {
+            if (object == ~0u) object = find_name(objects, 0, 0);
+            if (material == ~0u) material = find_name(materials, 0, 0);
+            unsigned &g = group_index[((uint64_t)(object + 1) << 32) | (material + 1)];
+            if (g == 0) {
+              groups.resize(groups.size() + 1);
+              g = groups.size();
+              groups.back().object = object;
+              groups.back().material = material;
+            }
+            span s = { ci, tri, end_tri };
+            groups[g - 1].spans.push_back(spans.size());
+            spans.push_back(s);
+            tri = end_tri;
+          }
+          if (ei != c.events.size()) {
+            const event &e = c.events[ei];
+            if (e.kind == ev_object) {
+              object = find_name(objects, e.name, e.name_end);
+            } else {
+              material = find_name(materials, e.name, e.name_end);
+            }
+          }
         }
-        values.push_back((float)(whole * msign));
-        while (*src > 0 && *src <= ' ') ++src;
       }
     }
 
-    void flush() {
-      std::sort(faces.begin(), faces.end());
-      face *f = 0;
-      gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, faces.size() * sizeof(f->vtx));
+    // Index the vertices of a group and build its vertex and index arrays.
+    // Each partition owns a range of positions and chains the vertices that share a position,
+    // so the partitions can be indexed in parallel and always agree.
+    void build_group(group &grp) {
+      unsigned num_keys = 0;
+      for (unsigned si = 0; si != grp.spans.size(); ++si) {
+        num_keys += (spans[grp.spans[si]].end_tri - spans[grp.spans[si]].first_tri) * 3;
+      }
+      if (num_keys == 0) return;
 
-      {
-        gl_resource::wolock vl(vertices);
-        for (size_t i = 0; i != faces.size(); ++i) {
-          memcpy(vl.u8() + i * sizeof(f->vtx), faces[i].vtx, sizeof(f->vtx));
+      dynarray<corner_key> keys;
+      keys.reserve(num_keys);
+      uint32_t lo = ~0u, hi = 0;
+      for (unsigned si = 0; si != grp.spans.size(); ++si) {
+        const span &s = spans[grp.spans[si]];
+        const chunk &c = chunks[s.chunk];
+        for (unsigned i = s.first_tri * 3; i != s.end_tri * 3; ++i) {
+          const corner &cr = c.corners[i];
+          corner_key key;
+          for (unsigned a = 0; a != 3; ++a) {
+            key.idx[a] = cr.flags & (present_bit << a) ? (uint32_t)cr.idx[a] + 1 : 0;
+          }
+          // triangles with a bad position index collapse onto the first vertex.
+          key.idx[0] += key.idx[0] == 0;
+          lo = std::min(lo, key.idx[0]);
+          hi = std::max(hi, key.idx[0]);
+          keys.push_back(key);
         }
       }
 
-      int prev_mi = -1;
-      for (size_t i = 0; i != faces.size(); ++i) {
-        if (faces[i].material_index != prev_mi) {
-          mesh *msh = new mesh();
-          msh->set_default_attributes();
-          msh->set_vertices(vertices);
-          material *mat = new material(vec4(0.5f, 0.5f, 0.5f, 1));
-          mesh_instance *mi = new mesh_instance(node, msh, mat);
+      enum { min_partition = 65536 };
+      job_pool &pool = job_pool::get();
+      unsigned num_parts = std::min(pool.get_num_threads(), (num_keys + min_partition - 1) / min_partition);
+      num_parts = std::max(num_parts, 1u);
+      unsigned range = (hi - lo + num_parts) / num_parts;
+      dynarray<partition> parts(num_parts);
+      grp.indices.resize(num_keys);
+
+      pool.parallel_for(0, num_parts, 1, [&](unsigned p0, unsigned p1) {
+        for (unsigned p = p0; p != p1; ++p) {
+          uint32_t first = std::min(lo + p * range, hi + 1);
+          uint32_t last = std::min(first + range, hi + 1);
+          dynarray<unsigned> head(last - first);
+          memset(head.data(), 0, head.size() * sizeof(unsigned));
+          dynarray<unsigned> next;
+          dynarray<uint64_t> attrs;
+          dynarray<mesh::vertex> &vertices = parts[p].vertices;
+
+          for (unsigned i = 0; i != num_keys; ++i) {
+            const corner_key &key = keys[i];
+            if (key.idx[0] < first || key.idx[0] >= last) continue;
+
+            uint64_t attr = ((uint64_t)key.idx[1] << 32) | key.idx[2];
+            unsigned &h = head[key.idx[0] - first];
+            unsigned v = h;
+            while (v && attrs[v - 1] != attr) v = next[v - 1];
+            if (!v) {
+              mesh::vertex vtx;
+              vtx.pos = positions.size() ? positions[key.idx[0] - 1] : vec3p(0, 0, 0);
+              vtx.uv = key.idx[1] ? uvs[key.idx[1] - 1] : vec2p(0, 0);
+              vtx.normal = key.idx[2] ? normals[key.idx[2] - 1] : vec3p(0, 0, 0);
+              vertices.push_back(vtx);
+              attrs.push_back(attr);
+              next.push_back(h);
+              h = v = vertices.size();
+            }
+            grp.indices[i] = v - 1;
+          }
         }
+      });
+
+      unsigned num_vertices = 0;
+      for (unsigned p = 0; p != num_parts; ++p) {
+        parts[p].offset = num_vertices;
+        num_vertices += parts[p].vertices.size();
       }
 
-      faces.resize(0);
-      src_vertices.resize(0);
-      src_uvs.resize(0);
-      src_normals.resize(0);
+      grp.vertices.resize(num_vertices);
+      for (unsigned p = 0; p != num_parts; ++p) {
+        std::copy(parts[p].vertices.data(), parts[p].vertices.data() + parts[p].vertices.size(), grp.vertices.data() + parts[p].offset);
+      }
+
+      if (num_parts > 1) {
+        pool.parallel_for(0, num_keys, 65536, [&](unsigned i0, unsigned i1) {
+          for (unsigned i = i0; i != i1; ++i) {
+            grp.indices[i] += parts[(keys[i].idx[0] - lo) / range].offset;
+          }
+        });
+      }
+
+      grp.bb_min = vec3(1e37f);
+      grp.bb_max = vec3(-1e37f);
+      for (unsigned i = 0; i != num_vertices; ++i) {
+        grp.bb_min = min(grp.bb_min, vec3(grp.vertices[i].pos));
+        grp.bb_max = max(grp.bb_max, vec3(grp.vertices[i].pos));
+      }
+    }
+
+    // make nodes, meshes and materials.
+    void make_scene(const char *url, resource_dict &dict, visual_scene *scene) {
+      dynarray<scene_node*> nodes(objects.size());
+      for (unsigned i = 0; i != objects.size(); ++i) {
+        nodes[i] = new scene_node(mat4t(), app_utils::get_atom(objects[i].size() ? objects[i].c_str() : url));
+        if (scene) scene->add_child(nodes[i]);
+      }
+
+      dynarray<material*> mats(materials.size());
+      for (unsigned i = 0; i != materials.size(); ++i) {
+        mats[i] = new material(vec4(0.5f, 0.5f, 0.5f, 1));
+        if (materials[i].size()) dict.set_resource(materials[i].c_str(), mats[i]);
+      }
+
+      for (unsigned i = 0; i != groups.size(); ++i) {
+        group &grp = groups[i];
+        mesh *msh = new mesh();
+        msh->set_default_attributes();
+        msh->set_vertices(grp.vertices);
+        msh->set_indices(grp.indices);
+        msh->set_aabb(aabb((grp.bb_min + grp.bb_max) * 0.5f, (grp.bb_max - grp.bb_min) * 0.5f));
+        if (quantize_meshes) msh->quantize();
+
+        string &name = objects[grp.object];
+        dict.set_resource(name.size() ? name.c_str() : url, msh);
+        if (scene) scene->add_mesh_instance(new mesh_instance(nodes[grp.object], msh, mats[grp.material]));
+      }
     }
   };
 }}
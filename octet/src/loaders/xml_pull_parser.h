@@ -0,0 +1,364 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// In-situ XML pull parser.
+//
+
+namespace octet { namespace loaders {
+  /// Pull parser for XML text in memory, such as a mapped file.
+  ///
+  /// Nothing is allocated or copied: names, attribute values and text are spans of the
+  /// original buffer, which does not need to be zero terminated. Attributes are only
+  /// scanned when asked for. Comments, processing instructions and DOCTYPE are skipped,
+  /// as is text that is only white space. Entities are left alone; use decode() on
+  /// spans that might contain them.
+  ///
+  /// Example
+  ///
+  ///     xml_pull_parser xml(text, text + size);
+  ///     for (xml_pull_parser::token_type tok = xml.next(); tok > xml_pull_parser::token_eof; tok = xml.next()) {
+  ///       if (tok == xml_pull_parser::token_open && xml.get_name() == "float_array") {
+  ///         xml_pull_parser::span id = xml.get_attr("id");
+  ///       }
+  ///     }
+  class xml_pull_parser {
+  public:
+    /// A range of characters in the buffer.
+    struct span {
+      const char *begin;
+      const char *end;
+
+      unsigned size() const { return (unsigned)(end - begin); }
+      bool empty() const { return begin == end; }
+
+      bool operator==(const span &rhs) const {
+        return size() == rhs.size() && !memcmp(begin, rhs.begin, size());
+      }
+
+      bool operator==(const char *rhs) const {
+        size_t len = strlen(rhs);
+        return size() == len && !memcmp(begin, rhs, len);
+      }
+
+      bool operator!=(const char *rhs) const { return !(*this == rhs); }
+
+      /// remove a leading '#' from a url
+      span local_url() const {
+        span result = *this;
+        if (result.begin != result.end && *result.begin == '#') result.begin++;
+        return result;
+      }
+    };
+
+    enum token_type {
+      token_error = -1,
+      token_eof = 0,
+      token_open,
+      token_close,
+      token_text,
+    };
+
+  private:
+    const char *src;
+    const char *src_max;
+    const char *pos;
+
+    // the current token
+    const char *token_start;
+    span name;
+    span attrs;
+    span text;
+    unsigned depth;
+    bool pending_close;
+
+    static bool is_space(char c) {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    static bool is_name_end(char c) {
+      return is_space(c) || c == '/' || c == '>';
+    }
+
+    // find a terminator like "-->" at or after p. returns src_max if missing.
+    const char *find(const char *p, const char *str) const {
+      size_t len = strlen(str);
+      while (p < src_max) {
+        p = (const char*)memchr(p, str[0], (size_t)(src_max - p));
+        if (!p || (size_t)(src_max - p) < len) return src_max;
+        if (!memcmp(p, str, len)) return p;
+        ++p;
+      }
+      return src_max;
+    }
+
+    bool starts_with(const char *p, const char *str) const {
+      size_t len = strlen(str);
+      return (size_t)(src_max - p) >= len && !memcmp(p, str, len);
+    }
+
+    token_type error() {
+      pos = src_max;
+      return token_error;
+    }
+
+  public:
+    xml_pull_parser(const char *src_ = 0, const char *src_max_ = 0) {
+      init(src_, src_max_);
+    }
+
+    xml_pull_parser(const uint8_t *src_, const uint8_t *src_max_) {
+      init((const char*)src_, (const char*)src_max_);
+    }
+
+    /// start parsing a new buffer.
+    void init(const char *src_, const char *src_max_) {
+      src = src_;
+      src_max = src_max_;
+      seek(0, 0);
+    }
+
+    /// continue parsing from a byte offset previously returned by get_offset().
+    /// depth is the depth that should be reported for the element there.
+    void seek(unsigned offset, unsigned depth_) {
+      pos = src + offset;
+      token_start = pos;
+      depth = depth_;
+      pending_close = false;
+      name.begin = name.end = attrs.begin = attrs.end = text.begin = text.end = pos;
+    }
+
+    /// move to the next element start, element end or piece of text.
+    token_type next() {
+      if (pending_close) {
+        // <name/> gives an open and a close
+        pending_close = false;
+        depth--;
+        return token_close;
+      }
+
+      while (pos < src_max) {
+        token_start = pos;
+        if (*pos != '<') {
+          const char *lt = (const char*)memchr(pos, '<', (size_t)(src_max - pos));
+          const char *text_end = lt ? lt : src_max;
+          const char *p = pos;
+          while (p != text_end && is_space(*p)) ++p;
+          text.begin = pos;
+          text.end = text_end;
+          pos = text_end;
+          if (p != text_end) return token_text;
+          continue;
+        }
+
+        const char *p = pos + 1;
+        if (p == src_max) return error();
+
+        if (*p == '!') {
+          if (starts_with(p, "!--")) {
+            const char *e = find(p + 3, "-->");
+            if (e == src_max) return error();
+            pos = e + 3;
+          } else if (starts_with(p, "![CDATA[")) {
+            const char *e = find(p + 8, "]]>");
+            if (e == src_max) return error();
+            text.begin = p + 8;
+            text.end = e;
+            pos = e + 3;
+            return token_text;
+          } else {
+            // <!DOCTYPE ... [ ... ]>
+            unsigned nest = 0;
+            for (; p != src_max && (*p != '>' || nest); ++p) {
+              nest += *p == '[';
+              nest -= *p == ']' && nest;
+            }
+            if (p == src_max) return error();
+            pos = p + 1;
+          }
+          continue;
+        }
+
+        if (*p == '?') {
+          const char *e = find(p + 1, "?>");
+          if (e == src_max) return error();
+          pos = e + 2;
+          continue;
+        }
+
+        if (*p == '/') {
+          name.begin = ++p;
+          while (p != src_max && !is_name_end(*p)) ++p;
+          name.end = p;
+          p = (const char*)memchr(p, '>', (size_t)(src_max - p));
+          if (!p || !depth) return error();
+          pos = p + 1;
+          depth--;
+          return token_close;
+        }
+
+        name.begin = p;
+        while (p != src_max && !is_name_end(*p)) ++p;
+        name.end = p;
+        if (name.empty()) return error();
+
+        // find the end of the tag, skipping quoted values
+        attrs.begin = p;
+        char quote = 0;
+        for (; p != src_max; ++p) {
+          char c = *p;
+          if (quote) {
+            if (c == quote) quote = 0;
+          } else if (c == '"' || c == '\'') {
+            quote = c;
+          } else if (c == '>') {
+            break;
+          }
+        }
+        if (p == src_max) return error();
+        pending_close = p[-1] == '/';
+        attrs.end = pending_close ? p - 1 : p;
+        pos = p + 1;
+        depth++;
+        return token_open;
+      }
+      return token_eof;
+    }
+
+    /// skip the children and end of the element just opened.
+    token_type skip() {
+      unsigned d = depth;
+      token_type tok;
+      while ((tok = next()) > token_eof) {
+        if (tok == token_close && depth < d) return tok;
+      }
+      return tok;
+    }
+
+    /// Element name of token_open or token_close
+    span get_name() const {
+      return name;
+    }
+
+    /// Raw text of token_text
+    span get_text() const {
+      return text;
+    }
+
+    /// Nesting depth: the document element is at depth 1 while open.
+    unsigned get_depth() const {
+      return depth;
+    }
+
+    /// Byte offset of the current token, for seek()
+    unsigned get_offset() const {
+      return (unsigned)(token_start - src);
+    }
+
+    /// true if the element just opened has no content, ie. <name/>
+    bool is_empty_element() const {
+      return pending_close;
+    }
+
+    /// Get an attribute of the element just opened. Returns an empty span with a null begin if missing.
+    span get_attr(const char *attr_name) const {
+      size_t len = strlen(attr_name);
+      const char *p = attrs.begin, *e = attrs.end;
+      for (;;) {
+        while (p != e && is_space(*p)) ++p;
+        if (p == e) break;
+        const char *n = p;
+        while (p != e && *p != '=' && !is_space(*p)) ++p;
+        const char *n_end = p;
+        while (p != e && is_space(*p)) ++p;
+        if (p == e || *p != '=') break;
+        ++p;
+        while (p != e && is_space(*p)) ++p;
+        if (p == e || (*p != '"' && *p != '\'')) break;
+        char quote = *p++;
+        const char *v = p;
+        while (p != e && *p != quote) ++p;
+        if (p == e) break;
+        if ((size_t)(n_end - n) == len && !memcmp(n, attr_name, len)) {
+          span result = { v, p };
+          return result;
+        }
+        ++p;
+      }
+      span result = { 0, 0 };
+      return result;
+    }
+
+    /// Copy a span to a string, decoding the five standard entities and numeric character references.
+    static string &decode(string &result, const span &s) {
+      dynarray<char> tmp;
+      tmp.reserve(s.size() + 1);
+      for (const char *p = s.begin; p != s.end; ++p) {
+        char c = *p;
+        if (c == '&') {
+          const char *semi = (const char*)memchr(p, ';', (size_t)(s.end - p));
+          if (semi) {
+            span ent = { p + 1, semi };
+            unsigned code = 0;
+            if (ent == "amp") code = '&';
+            else if (ent == "lt") code = '<';
+            else if (ent == "gt") code = '>';
+            else if (ent == "quot") code = '"';
+            else if (ent == "apos") code = '\'';
+            else if (ent.size() > 1 && ent.begin[0] == '#') {
+              bool hex = ent.begin[1] == 'x';
+              code = (unsigned)strtoul(ent.begin + 1 + hex, 0, hex ? 16 : 10);
+            }
+            if (code) {
+              // utf-8 encode
+              if (code < 0x80) {
+                tmp.push_back((char)code);
+              } else if (code < 0x800) {
+                tmp.push_back((char)(0xc0 | (code >> 6)));
+                tmp.push_back((char)(0x80 | (code & 0x3f)));
+              } else if (code < 0x10000) {
+                tmp.push_back((char)(0xe0 | (code >> 12)));
+                tmp.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+                tmp.push_back((char)(0x80 | (code & 0x3f)));
+              } else {
+                tmp.push_back((char)(0xf0 | (code >> 18)));
+                tmp.push_back((char)(0x80 | ((code >> 12) & 0x3f)));
+                tmp.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+                tmp.push_back((char)(0x80 | (code & 0x3f)));
+              }
+              p = semi;
+              continue;
+            }
+          }
+        }
+        tmp.push_back(c);
+      }
+      result.set(tmp.data(), tmp.size());
+      return result;
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class xml_pull_parser_unit_test {
+    public:
+      xml_pull_parser_unit_test() {
+        static const char text[] =
+          "<?xml version=\"1.0\"?><!-- c --><a x='1' y=\"a&amp;b\"><b/>hello<![CDATA[<raw>]]></a>";
+        xml_pull_parser xml(text, text + sizeof(text) - 1);
+        assert(xml.next() == xml_pull_parser::token_open && xml.get_name() == "a" && xml.get_depth() == 1);
+        assert(xml.get_attr("x") == "1" && xml.get_attr("z").begin == 0);
+        string y;
+        assert(!strcmp(xml_pull_parser::decode(y, xml.get_attr("y")), "a&b"));
+        assert(xml.next() == xml_pull_parser::token_open && xml.get_name() == "b" && xml.is_empty_element());
+        assert(xml.next() == xml_pull_parser::token_close && xml.get_depth() == 1);
+        assert(xml.next() == xml_pull_parser::token_text && xml.get_text() == "hello");
+        assert(xml.next() == xml_pull_parser::token_text && xml.get_text() == "<raw>");
+        assert(xml.next() == xml_pull_parser::token_close && xml.get_name() == "a");
+        assert(xml.next() == xml_pull_parser::token_eof);
+      }
+    };
+    static xml_pull_parser_unit_test xml_pull_parser_unit_test;
+  #endif
+}}
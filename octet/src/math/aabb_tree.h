@@ -0,0 +1,454 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Dynamic bounding volume tree
+//
+
+namespace octet { namespace math {
+  /// Dynamic tree of axis aligned bounding boxes, used to find the objects inside a camera frustum.
+  ///
+  /// Each object is a leaf with a slightly larger ("fat") box, so small moves do not change the tree.
+  /// When an object leaves its fat box, the boxes above it are refitted and the tree is rotated
+  /// locally to keep the boxes small. An object that jumps a long way is removed and inserted again.
+  ///
+  /// Example
+  ///
+  ///     aabb_tree tree;
+  ///     int proxy = tree.add(bounds, object_index);
+  ///     tree.move(proxy, new_bounds);
+  ///     dynarray<unsigned> visible;
+  ///     tree.cull(aabb_tree::frustum(planes), visible);
+  class aabb_tree {
+  public:
+    /// results of frustum::classify()
+    enum { outside = 0, intersecting = 1, inside = 2 };
+
+    /// Up to eight planes laid out for testing four at a time.
+    /// The planes are as from mat4t::get_frustum_planes(): dot(normal, p) + w >= 0 inside.
+    class frustum {
+      float nx[8], ny[8], nz[8], nw[8];
+    public:
+      frustum(const vec4 *planes, unsigned num_planes = 6) {
+        assert(num_planes <= 8);
+        for (unsigned i = 0; i != 8; ++i) {
+          // spare planes let everything through.
+          vec4 p = i < num_planes ? planes[i] : vec4(0, 0, 0, 1);
+          nx[i] = p.x(); ny[i] = p.y(); nz[i] = p.z(); nw[i] = p.w();
+        }
+      }
+
+      /// Is the box outside, inside or crossing the planes?
+      int classify(const aabb &bb) const {
+        vec3 c = bb.get_center();
+        vec3 h = bb.get_half_extent();
+        #if OCTET_SSE2
+          __m128 cx = _mm_set1_ps(c.x()), cy = _mm_set1_ps(c.y()), cz = _mm_set1_ps(c.z());
+          __m128 hx = _mm_set1_ps(h.x()), hy = _mm_set1_ps(h.y()), hz = _mm_set1_ps(h.z());
+          __m128 sign = _mm_set1_ps(-0.0f);
+          int out = 0, in = 0;
+          for (unsigned i = 0; i != 8; i += 4) {
+            __m128 px = _mm_loadu_ps(nx + i), py = _mm_loadu_ps(ny + i), pz = _mm_loadu_ps(nz + i);
+            // distance of the center and the box's extent along each normal.
+            __m128 d = _mm_add_ps(
+              _mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+              _mm_add_ps(_mm_mul_ps(pz, cz), _mm_loadu_ps(nw + i))
+            );
+            __m128 r = _mm_add_ps(
+              _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, px), hx), _mm_mul_ps(_mm_andnot_ps(sign, py), hy)),
+              _mm_mul_ps(_mm_andnot_ps(sign, pz), hz)
+            );
+            out |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+            in |= _mm_movemask_ps(_mm_cmpge_ps(_mm_sub_ps(d, r), _mm_setzero_ps())) << i;
+          }
+          if (out) return outside;
+          return in == 0xff ? inside : intersecting;
+        #else
+          bool all_in = true;
+          for (unsigned i = 0; i != 8; ++i) {
+            float d = nx[i] * c.x() + ny[i] * c.y() + nz[i] * c.z() + nw[i];
+            float r = fabsf(nx[i]) * h.x() + fabsf(ny[i]) * h.y() + fabsf(nz[i]) * h.z();
+            if (d + r < 0) return outside;
+            if (d - r < 0) all_in = false;
+          }
+          return all_in ? inside : intersecting;
+        #endif
+      }
+    };
+
+  private:
+    struct node {
+      aabb bounds;        // fat box for leaves, union of the children otherwise
+      int parent;         // next free node when on the free list
+      int child[2];       // -1 for leaves
+      unsigned user_data;
+    };
+
+    dynarray<node> nodes_;
+    int root_;
+    int free_list_;
+    unsigned num_leaves_;
+    float margin_;
+
+    // scratch for cull(): node index * 2 + 1 if the node is known to be inside.
+    dynarray<unsigned> stack_;
+
+    bool is_leaf(int index) const {
+      return nodes_[index].child[0] < 0;
+    }
+
+    // proportional to surface area, the chance of a random ray or frustum touching the box.
+    static float area(const aabb &bb) {
+      vec3 h = bb.get_half_extent();
+      return h.x() * h.y() + h.y() * h.z() + h.z() * h.x();
+    }
+
+    static aabb merge(aabb a, const aabb &b) {
+      return a.get_union(b);
+    }
+
+    static bool contains(const aabb &outer, const aabb &inner) {
+      return all(abs(inner.get_center() - outer.get_center()) + inner.get_half_extent() <= outer.get_half_extent());
+    }
+
+    aabb fatten(const aabb &bb) const {
+      vec3 h = bb.get_half_extent();
+      float largest = h.x() > h.y() ? h.x() : h.y();
+      largest = largest > h.z() ? largest : h.z();
+      float m = largest * margin_;
+      return aabb(bb.get_center(), h + vec3(m, m, m));
+    }
+
+    int alloc_node() {
+      if (free_list_ >= 0) {
+        int index = free_list_;
+        free_list_ = nodes_[index].parent;
+        return index;
+      }
+      nodes_.push_back(node());
+      return (int)nodes_.size() - 1;
+    }
+
+    void free_node(int index) {
+      nodes_[index].child[0] = nodes_[index].child[1] = -1;
+      nodes_[index].parent = free_list_;
+      free_list_ = index;
+    }
+
+    // swap a child of "index" with a grandchild on the other side if that shrinks the other child.
+    void rotate(int index) {
+      int l = nodes_[index].child[0], r = nodes_[index].child[1];
+      float best = 0;
+      int best_side = -1, best_k = 0;
+      for (int side = 0; side != 2; ++side) {
+        int near = side ? r : l, far = side ? l : r;
+        if (is_leaf(far)) continue;
+        float far_area = area(nodes_[far].bounds);
+        for (int k = 0; k != 2; ++k) {
+          // "near" swaps with far's child k, leaving far = near + far's other child.
+          const aabb &other = nodes_[nodes_[far].child[1-k]].bounds;
+          float saving = far_area - area(merge(nodes_[near].bounds, other));
+          if (saving > best) {
+            best = saving;
+            best_side = side;
+            best_k = k;
+          }
+        }
+      }
+      if (best_side < 0) return;
+
+      int near = best_side ? r : l, far = best_side ? l : r;
+      int grandchild = nodes_[far].child[best_k];
+      nodes_[index].child[best_side ? 1 : 0] = grandchild;
+      nodes_[grandchild].parent = index;
+      nodes_[far].child[best_k] = near;
+      nodes_[near].parent = far;
+      nodes_[far].bounds = merge(nodes_[nodes_[far].child[0]].bounds, nodes_[nodes_[far].child[1]].bounds);
+    }
+
+    // recompute the boxes from "index" up to the root, rotating on the way.
+    void refit(int index) {
+      while (index >= 0) {
+        node &n = nodes_[index];
+        n.bounds = merge(nodes_[n.child[0]].bounds, nodes_[n.child[1]].bounds);
+        rotate(index);
+        index = nodes_[index].parent;
+      }
+    }
+
+    void insert_leaf(int leaf) {
+      if (root_ < 0) {
+        root_ = leaf;
+        nodes_[leaf].parent = -1;
+        return;
+      }
+
+      // walk down to the cheapest sibling by surface area.
+      aabb bb = nodes_[leaf].bounds;
+      int sibling = root_;
+      while (!is_leaf(sibling)) {
+        const node &n = nodes_[sibling];
+        float combined = area(merge(n.bounds, bb));
+        float cost_here = 2 * combined;
+        float inherited = 2 * (combined - area(n.bounds));
+        float cost[2];
+        for (int k = 0; k != 2; ++k) {
+          int c = n.child[k];
+          float grown = area(merge(nodes_[c].bounds, bb));
+          cost[k] = inherited + (is_leaf(c) ? grown : grown - area(nodes_[c].bounds));
+        }
+        if (cost_here < cost[0] && cost_here < cost[1]) break;
+        sibling = cost[0] <= cost[1] ? n.child[0] : n.child[1];
+      }
+
+      int old_parent = nodes_[sibling].parent;
+      int new_parent = alloc_node();
+      node &p = nodes_[new_parent];
+      p.parent = old_parent;
+      p.child[0] = sibling;
+      p.child[1] = leaf;
+      p.user_data = 0;
+      p.bounds = merge(nodes_[sibling].bounds, bb);
+      nodes_[sibling].parent = new_parent;
+      nodes_[leaf].parent = new_parent;
+
+      if (old_parent < 0) {
+        root_ = new_parent;
+      } else {
+        node &op = nodes_[old_parent];
+        op.child[op.child[0] == sibling ? 0 : 1] = new_parent;
+        refit(old_parent);
+      }
+    }
+
+    void remove_leaf(int leaf) {
+      if (leaf == root_) {
+        root_ = -1;
+        return;
+      }
+      int parent = nodes_[leaf].parent;
+      int grandparent = nodes_[parent].parent;
+      int sibling = nodes_[parent].child[nodes_[parent].child[0] == leaf ? 1 : 0];
+      nodes_[sibling].parent = grandparent;
+      free_node(parent);
+      if (grandparent < 0) {
+        root_ = sibling;
+      } else {
+        node &gp = nodes_[grandparent];
+        gp.child[gp.child[0] == parent ? 0 : 1] = sibling;
+        refit(grandparent);
+      }
+    }
+
+    int get_height(int index) const {
+      if (is_leaf(index)) return 1;
+      int h0 = get_height(nodes_[index].child[0]), h1 = get_height(nodes_[index].child[1]);
+      return 1 + (h0 > h1 ? h0 : h1);
+    }
+
+  public:
+    /// "margin" is how much bigger than the object a leaf's box is, as a fraction of the object's size.
+    aabb_tree(float margin = 0.125f) {
+      root_ = -1;
+      free_list_ = -1;
+      num_leaves_ = 0;
+      margin_ = margin;
+    }
+
+    /// Remove all the objects.
+    void reset() {
+      nodes_.resize(0);
+      root_ = -1;
+      free_list_ = -1;
+      num_leaves_ = 0;
+    }
+
+    /// Add an object; returns a proxy for move() and remove().
+    int add(const aabb &bounds, unsigned user_data) {
+      int leaf = alloc_node();
+      node &n = nodes_[leaf];
+      n.bounds = fatten(bounds);
+      n.child[0] = n.child[1] = -1;
+      n.user_data = user_data;
+      insert_leaf(leaf);
+      num_leaves_++;
+      return leaf;
+    }
+
+    /// Remove an object.
+    void remove(int proxy) {
+      remove_leaf(proxy);
+      free_node(proxy);
+      num_leaves_--;
+    }
+
+    /// Tell the tree an object has moved. Returns true if the tree changed.
+    bool move(int proxy, const aabb &bounds) {
+      node &n = nodes_[proxy];
+      if (contains(n.bounds, bounds)) return false;
+
+      aabb fat = fatten(bounds);
+      if (n.parent >= 0 && n.bounds.intersects(bounds)) {
+        // a short move: grow or shrink the boxes above and rotate.
+        n.bounds = fat;
+        refit(n.parent);
+      } else {
+        remove_leaf(proxy);
+        nodes_[proxy].bounds = fat;
+        insert_leaf(proxy);
+      }
+      return true;
+    }
+
+    /// The user_data passed to add().
+    unsigned get_user_data(int proxy) const {
+      return nodes_[proxy].user_data;
+    }
+
+    /// The box the tree keeps for an object; a little bigger than the object.
+    const aabb &get_fat_bounds(int proxy) const {
+      return nodes_[proxy].bounds;
+    }
+
+    /// Number of objects.
+    unsigned size() const {
+      return num_leaves_;
+    }
+
+    /// Number of levels, 0 for an empty tree.
+    int get_height() const {
+      return root_ < 0 ? 0 : get_height(root_);
+    }
+
+    /// Add the user_data of every object whose box is not outside the frustum to "result".
+    /// Subtrees outside are skipped and subtrees inside are added without more tests.
+    void cull(const frustum &planes, dynarray<unsigned> &result) {
+      if (root_ < 0) return;
+      stack_.resize(0);
+      stack_.push_back((unsigned)root_ * 2);
+      while (!stack_.empty()) {
+        unsigned entry = stack_.back();
+        stack_.pop_back();
+        int index = (int)(entry >> 1);
+        unsigned is_inside = entry & 1;
+        const node &n = nodes_[index];
+        if (!is_inside) {
+          int side = planes.classify(n.bounds);
+          if (side == outside) continue;
+          is_inside = side == inside;
+        }
+        if (n.child[0] < 0) {
+          result.push_back(n.user_data);
+        } else {
+          stack_.push_back((unsigned)n.child[0] * 2 + is_inside);
+          stack_.push_back((unsigned)n.child[1] * 2 + is_inside);
+        }
+      }
+    }
+
+    /// Check that the parents and boxes are consistent. For testing.
+    bool is_valid() const {
+      if (root_ < 0) return num_leaves_ == 0;
+      if (nodes_[root_].parent != -1) return false;
+      dynarray<int> stack;
+      stack.push_back(root_);
+      unsigned num_leaves = 0;
+      while (!stack.empty()) {
+        int index = stack.back();
+        stack.pop_back();
+        const node &n = nodes_[index];
+        if (n.child[0] < 0) {
+          num_leaves++;
+          continue;
+        }
+        for (int k = 0; k != 2; ++k) {
+          const node &c = nodes_[n.child[k]];
+          if (c.parent != index || !contains(fatten(n.bounds), c.bounds)) return false;
+          stack.push_back(n.child[k]);
+        }
+      }
+      return num_leaves == num_leaves_;
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class aabb_tree_unit_test {
+      static aabb random_box(random &rand, float range) {
+        vec3 center(rand.get(-range, range), rand.get(-range, range), rand.get(-range, range));
+        vec3 half(rand.get(0.1f, 2.0f), rand.get(0.1f, 2.0f), rand.get(0.1f, 2.0f));
+        return aabb(center, half);
+      }
+
+      // one plane at a time, without SIMD.
+      static bool brute_force(const vec4 *planes, const aabb &bb) {
+        vec3 c = bb.get_center(), h = bb.get_half_extent();
+        for (int i = 0; i != 6; ++i) {
+          vec3 n = planes[i].xyz();
+          if (dot(n, c) + planes[i].w() < -dot(abs(n), h)) return false;
+        }
+        return true;
+      }
+
+      static bool check_cull(aabb_tree &tree, const dynarray<int> &proxies, const vec4 *planes) {
+        dynarray<unsigned> visible;
+        tree.cull(aabb_tree::frustum(planes), visible);
+        dynarray<uint8_t> seen(proxies.size());
+        memset(seen.data(), 0, seen.size());
+        for (unsigned i = 0; i != visible.size(); ++i) {
+          if (seen[visible[i]]++) return false;
+        }
+        for (unsigned i = 0; i != proxies.size(); ++i) {
+          bool expected = proxies[i] >= 0 && brute_force(planes, tree.get_fat_bounds(proxies[i]));
+          if (expected != (seen[i] != 0)) return false;
+        }
+        return true;
+      }
+
+    public:
+      aabb_tree_unit_test() {
+        random rand(0x5678);
+        aabb_tree tree;
+        dynarray<int> proxies;
+        for (unsigned i = 0; i != 2000; ++i) {
+          proxies.push_back(tree.add(random_box(rand, 100), i));
+        }
+        assert(tree.size() == 2000 && tree.is_valid());
+        assert(tree.get_height() < 40);
+
+        // a camera at the origin looking down -z.
+        mat4t cameraToProjection;
+        cameraToProjection.loadIdentity();
+        cameraToProjection.frustum(-0.1f, 0.1f, -0.1f, 0.1f, 0.1f, 60);
+        vec4 planes[6];
+        cameraToProjection.get_frustum_planes(planes);
+        assert(check_cull(tree, proxies, planes));
+
+        // small moves refit, big ones reinsert.
+        for (unsigned i = 0; i < 2000; i += 3) {
+          aabb bb = tree.get_fat_bounds(proxies[i]);
+          float step = i % 2 ? 0.5f : 50.0f;
+          bb = aabb(bb.get_center() + vec3(rand.get(-step, step), 0, rand.get(-step, step)), bb.get_half_extent() * 0.8f);
+          tree.move(proxies[i], bb);
+        }
+        assert(tree.is_valid() && tree.get_height() < 40);
+
+        for (unsigned i = 0; i < 2000; i += 7) {
+          tree.remove(proxies[i]);
+          proxies[i] = -1;
+        }
+        assert(tree.is_valid());
+
+        // looking somewhere else.
+        mat4t worldToCamera;
+        worldToCamera.loadIdentity();
+        worldToCamera.rotateY(70);
+        worldToCamera.translate(10, -5, 20);
+        (worldToCamera * cameraToProjection).get_frustum_planes(planes);
+        assert(check_cull(tree, proxies, planes));
+      }
+    };
+    static aabb_tree_unit_test aabb_tree_unit_test;
+  #endif
+}}
@@ -378,6 +378,23 @@ namespace octet { namespace math {
   
     /// Get the absolute value of a matrix; useful for extents.
     mat4t abs() const { return mat4t(v[0].abs(), v[1].abs(), v[2].abs(), v[3].abs()); }
+
+    /// Get the left, right, bottom, top, near and far planes of a projection matrix
+    /// in the space it transforms from. eg. model space for modelToProjection.
+    /// A point is inside a plane if dot(plane.xyz(), pos) + plane.w() >= 0, which is its distance.
+    void get_frustum_planes(vec4 *planes) const {
+      vec4 cx = colx(), cy = coly(), cz = colz(), cw = colw();
+      planes[0] = cw + cx;
+      planes[1] = cw - cx;
+      planes[2] = cw + cy;
+      planes[3] = cw - cy;
+      planes[4] = cw + cz;
+      planes[5] = cw - cz;
+      for (unsigned i = 0; i != 6; ++i) {
+        float len = length(planes[i].xyz());
+        if (len != 0) planes[i] = planes[i] * (1.0f / len);
+      }
+    }
   
     // In place matrix multiply, as in glMultMatrix
     mat4t &multMatrix(const mat4t &r)
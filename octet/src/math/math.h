@@ -86,5 +86,6 @@ namespace octet {
 #include "polygon.h"
 #include "zcylinder.h"
 #include "voxel_grid.h"
+#include "aabb_tree.h"
 
 #endif
@@ -199,6 +199,55 @@ namespace octet { namespace math {
     return (a | a >> 8) & 0x0000ffff;
   }
 
+  /// convert a float to IEEE half precision, rounding to nearest even. Used for half float vertex attributes.
+  inline uint16_t float_to_half(float value) {
+    union { float f; uint32_t u; } fu;
+    fu.f = value;
+    uint32_t sign = (fu.u >> 16) & 0x8000;
+    uint32_t abs = fu.u & 0x7fffffff;
+    if (abs >= 0x7f800000) {
+      // inf and nan
+      return (uint16_t)(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0));
+    }
+    if (abs >= 0x477ff000) {
+      // too big: infinity
+      return (uint16_t)(sign | 0x7c00);
+    }
+    if (abs < 0x38800000) {
+      // denormal or zero: shift the mantissa, with its hidden bit, into place.
+      if (abs < 0x33000000) return (uint16_t)sign;
+      unsigned shift = 126 - (abs >> 23);
+      uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+      uint32_t result = mantissa >> shift;
+      uint32_t rest = mantissa & ((1u << shift) - 1);
+      uint32_t halfway = 1u << (shift - 1);
+      result += rest > halfway || (rest == halfway && (result & 1));
+      return (uint16_t)(sign | result);
+    }
+    uint32_t result = (abs - 0x38000000) >> 13;
+    uint32_t rest = abs & 0x1fff;
+    result += rest > 0x1000 || (rest == 0x1000 && (result & 1));
+    return (uint16_t)(sign | result);
+  }
+
+  /// convert IEEE half precision to a float.
+  inline float half_to_float(uint16_t value) {
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+    union { float f; uint32_t u; } fu;
+    if (exponent == 0) {
+      // zero or denormal
+      fu.f = mantissa * (1.0f / 16777216);
+      fu.u |= sign;
+    } else if (exponent == 31) {
+      fu.u = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+      fu.u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    return fu.f;
+  }
+
   /// a pair of objects, like std::pair
   template <typename first_t, typename second_t> class pair {
   public:
@@ -219,6 +268,9 @@ namespace octet { namespace math {
         assert(ilog2(1<<7) == 7);
         assert(ilog2((1<<7)+1) == 7);
         assert(ilog2((1<<7)-1) == 6);
+        assert(float_to_half(1.0f) == 0x3c00 && float_to_half(-2.5f) == 0xc100 && float_to_half(65504.0f) == 0x7bff);
+        assert(half_to_float(0x3555) == 0.333251953125f && half_to_float(0x0001) == 5.9604644775390625e-8f);
+        assert(float_to_half(half_to_float(0x0123)) == 0x0123 && float_to_half(1e6f) == 0x7c00);
       }
     };
     static scalar_unit_test scalar_unit_test;
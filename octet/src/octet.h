@@ -106,8 +106,8 @@
   // math library
   #include "math/math.h"
 
-  // CG, GLSL, C++ compiler
-  #include "compiler/compiler.h"
+  // worker threads
+  #include "resources/job.h"
 
   // loaders (low dependency, so you can use them in other projects)
   #include "loaders/loaders.h"
@@ -121,6 +121,9 @@
   // resource management
   #include "resources/resources.h"
 
+  // CG, GLSL, C++ compiler
+  #include "compiler/compiler.h"
+
   // shaders
   #include "shaders/shaders.h"
 
@@ -149,6 +152,8 @@
 
   // asset loaders
   #include "loaders/collada_builder.h"
+  #include "loaders/collada_stream_loader.h"
+  #include "loaders/obj_loader.h"
 
   // forward references
   #include "resources/resources.inl"
@@ -22,6 +22,7 @@ namespace octet {
     attribute_blendindices = 7,
     attribute_texcoord = 8,
     attribute_uv = 8,
+    attribute_instance = 9,   // mat4 per instance, uses 9 to 12. See instance_buffer.
     attribute_tangent = 14,
     attribute_bitangent = 15,
     attribute_binormal = 15,
@@ -36,6 +36,43 @@
   #define GL_UNIFORM_BUFFER 0
 #endif
 
+// SSE2 integer and float intrinsics for image and mesh processing.
+// Unlike OCTET_SSE, this does not change the layout of the math classes.
+#ifndef OCTET_SSE2
+  #if OCTET_SSE || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define OCTET_SSE2 1
+  #else
+    #define OCTET_SSE2 0
+  #endif
+#endif
+
+#ifndef OCTET_AVX
+  #if defined(__AVX__)
+    #define OCTET_AVX 1
+  #else
+    #define OCTET_AVX 0
+  #endif
+#endif
+
+// hardware instancing (glDrawElementsInstanced, glVertexAttribDivisor) needs OpenGL 3.3 or ES3.
+// GLES2 builds and the legacy OSX headers draw each instance on its own.
+#ifndef OCTET_INSTANCING
+  #if defined(OCTET_GLES2) || defined(__APPLE__)
+    #define OCTET_INSTANCING 0
+  #else
+    #define OCTET_INSTANCING 1
+  #endif
+#endif
+
+// worker threads for the job pool. Set to 0 to run all jobs on the calling thread.
+#ifndef OCTET_THREADS
+  #if defined(OCTET_VITA) || defined(__GENERIC__)
+    #define OCTET_THREADS 0
+  #else
+    #define OCTET_THREADS 1
+  #endif
+#endif
+
 // use <> to include from standard directories
 // use "" to include from our own project
 #include <stdio.h>
@@ -56,6 +93,23 @@
 #include <fstream>
 #include <cmath>
 
+#if OCTET_SSE2
+  #include <emmintrin.h>
+#endif
+
+#if OCTET_AVX
+  #include <immintrin.h>
+#endif
+
+#if OCTET_THREADS
+  #include <thread>
+  #include <mutex>
+  #include <condition_variable>
+  #include <atomic>
+#endif
+#include <functional>
+#include <chrono>
+
 #if defined(WIN32)
   #include <direct.h>
 #endif
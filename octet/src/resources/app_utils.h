@@ -193,9 +193,26 @@ namespace octet { namespace resources {
       glActiveTexture(GL_TEXTURE0);
       glBindTexture(GL_TEXTURE_2D, handle);
 
-      glTexImage2D(GL_TEXTURE_2D, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)image);
-
-      glGenerateMipmap(GL_TEXTURE_2D);
+      if (in_format == GL_RGB || in_format == GL_RGBA) {
+        // build the mip chain ourselves: this is faster and more predictable than the driver.
+        unsigned num_comps = in_format == GL_RGBA ? 4 : 3;
+        dynarray<uint8_t> chain((unsigned)mipmap_builder::chain_size(width, height, num_comps));
+        memcpy(chain.data(), image, width * height * num_comps);
+        unsigned levels = mipmap_builder(num_comps).build(chain.data(), width, height);
+        uint8_t *src = chain.data();
+        // the levels are tightly packed; RGB rows of the small levels are not multiples of 4 bytes.
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (unsigned level = 0; level != levels; ++level) {
+          glTexImage2D(GL_TEXTURE_2D, level, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)src);
+          src += width * height * num_comps;
+          width = width > 1 ? width / 2 : 1;
+          height = height > 1 ? height / 2 : 1;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)image);
+        glGenerateMipmap(GL_TEXTURE_2D);
+      }
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
       return handle;
@@ -144,3 +144,16 @@ OCTET_ATOM(npos)
 OCTET_ATOM(diffuse_light)
 OCTET_ATOM(specular_light)
 OCTET_ATOM(first_index)
+OCTET_ATOM(attribute_decode)
+OCTET_ATOM(pos_scale)
+OCTET_ATOM(pos_offset)
+OCTET_ATOM(uv_decode)
+OCTET_ATOM(normal_decode)
+OCTET_ATOM(clusters)
+OCTET_ATOM(page)
+OCTET_ATOM(page_index)
+OCTET_ATOM(uv_rect)
+OCTET_ATOM(x)
+OCTET_ATOM(y)
+OCTET_ATOM(pages)
+OCTET_ATOM(regions)
@@ -237,6 +237,17 @@ private:
       return num_quads;
     }
 
+    // find the metrics for a character
+    const char_info *find_char(unsigned chr) {
+      int index = char_map.get_index(chr);
+      return index >= 0 ? char_map.get_value(index) : 0;
+    }
+
+    static void set_u2(uint8_t *dest, unsigned value) {
+      dest[0] = (uint8_t)value;
+      dest[1] = (uint8_t)(value >> 8);
+    }
+
 
   public:
     RESOURCE_META(bitmap_font)
@@ -263,6 +274,53 @@ private:
       if (v.is_reader()) update();
     }
 
+    /// Set the size of the page textures, which is used to make uvs.
+    void set_page_size(unsigned page_width, unsigned page_height) {
+      uscale = 1.0f / page_width;
+      vscale = 1.0f / page_height;
+    }
+
+    /// Get the codes of all the characters in the font.
+    void get_chars(dynarray<unsigned> &result) {
+      for (unsigned i = 0; i != char_map.size(); ++i) {
+        if (char_map.get_value(i)) {
+          result.push_back(char_map.get_key(i));
+        }
+      }
+    }
+
+    /// Get where a character is on its page, in pixels from the top left as in the .fnt file.
+    bool get_char_rect(unsigned chr, unsigned &page, unsigned &x, unsigned &y, unsigned &width, unsigned &height) {
+      const char_info *ci = find_char(chr);
+      if (!ci) return false;
+      page = ci->page;
+      x = u2(ci->x);
+      y = u2(ci->y);
+      width = u2(ci->width);
+      height = u2(ci->height);
+      return true;
+    }
+
+    /// Add a border around a character, for example the spread of a distance field.
+    void grow_char(unsigned chr, unsigned border) {
+      char_info *ci = (char_info *)find_char(chr);
+      if (!ci) return;
+      set_u2(ci->width, u2(ci->width) + border * 2);
+      set_u2(ci->height, u2(ci->height) + border * 2);
+      set_u2(ci->xoffset, s2(ci->xoffset) - (int)border);
+      set_u2(ci->yoffset, s2(ci->yoffset) - (int)border);
+    }
+
+    /// Move a character to a new place, for example when the glyphs are packed into a texture_atlas.
+    void set_char_rect(unsigned chr, unsigned page, unsigned x, unsigned y) {
+      // the metrics point into font_info, so this is saved with the font.
+      char_info *ci = (char_info *)find_char(chr);
+      if (!ci) return;
+      ci->page = (uint8_t)page;
+      set_u2(ci->x, x);
+      set_u2(ci->y, y);
+    }
+
     /// Build a mesh by combining the string with the bitmap font info.
     unsigned build_mesh(const aabb &bb, vertex *vtx, uint32_t *idx, unsigned max_quads, const char *text, const char *max_text) {
       // defensive coding
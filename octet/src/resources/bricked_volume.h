@@ -0,0 +1,418 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Bricked volume: large NIFTI volumes streamed from a mapped file in 3D tiles.
+//
+
+namespace octet { namespace resources {
+  /// A 3D volume split into cubic bricks which are copied out of a mapped file on demand.
+  ///
+  /// Opening the volume maps the file and scans it once for the range of values in each brick.
+  /// Only the bricks that are asked for are resident, in a fixed size cache.
+  /// The brick ranges give an occupancy map for skipping empty space when ray marching.
+  ///
+  /// Example
+  ///
+  ///     bricked_volume vol;
+  ///     if (vol.open("assets/volumes/head.nii")) {
+  ///       // bricks with values in [40, 255] are occupied
+  ///       GLuint occupancy = vol.make_occupancy_texture(40, 255);
+  ///       const uint8_t *voxels = vol.get_brick(0, 0, 0);
+  ///     }
+  class bricked_volume {
+  public:
+    enum { default_brick_size = 32 };
+
+    /// range of voxel values in a brick.
+    struct brick_range {
+      float min;
+      float max;
+    };
+
+  private:
+    // the mapped file, if we opened one
+    file_map *map;
+
+    // voxel layout and the first voxel
+    loaders::nifti_decoder::volume_info info;
+    const uint8_t *voxels;
+
+    unsigned brick_size;
+    unsigned bricks_x;
+    unsigned bricks_y;
+    unsigned bricks_z;
+    unsigned brick_bytes;
+    dynarray<brick_range> ranges;
+
+    // brick cache: each slot holds one brick, least recently used bricks are replaced.
+    dynarray<uint8_t> cache;
+    dynarray<int> slot_of_brick;
+    dynarray<unsigned> brick_of_slot;
+    dynarray<unsigned> slot_time;
+    unsigned num_slots;
+    unsigned num_resident;
+    unsigned time;
+
+    bricked_volume(const bricked_volume &rhs);
+    void operator=(const bricked_volume &rhs);
+
+    // the part of init after the voxels have been found
+    bool init_bricks(const uint8_t *src, const uint8_t *src_max, unsigned brick_size, unsigned cache_bytes) {
+      if (!loaders::nifti_decoder::get_info(info, src, src_max)) {
+        return false;
+      }
+
+      voxels = src + info.vox_offset;
+      this->brick_size = brick_size ? brick_size : (unsigned)default_brick_size;
+      bricks_x = (info.width + this->brick_size - 1) / this->brick_size;
+      bricks_y = (info.height + this->brick_size - 1) / this->brick_size;
+      bricks_z = (info.depth + this->brick_size - 1) / this->brick_size;
+      brick_bytes = this->brick_size * this->brick_size * this->brick_size * info.bytes_per_voxel;
+
+      unsigned num_bricks = get_num_bricks();
+      ranges.resize(num_bricks);
+      job_pool::get().parallel_for(0, bricks_z, 1, [this](unsigned z0, unsigned z1) {
+        for (unsigned bz = z0; bz != z1; ++bz) scan_layer(bz);
+      });
+
+      num_slots = std::max(1u, std::min(num_bricks, cache_bytes / brick_bytes));
+      slot_of_brick.resize(num_bricks);
+      for (unsigned i = 0; i != num_bricks; ++i) slot_of_brick[i] = -1;
+      brick_of_slot.resize(num_slots);
+      slot_time.resize(num_slots);
+      return true;
+    }
+
+    void reset() {
+      delete map;
+      map = 0;
+      voxels = 0;
+      ranges.reset();
+      cache.reset();
+      slot_of_brick.reset();
+      brick_of_slot.reset();
+      slot_time.reset();
+      bricks_x = bricks_y = bricks_z = 0;
+      num_resident = 0;
+      time = 0;
+    }
+
+    const uint8_t *row(unsigned y, unsigned z) const {
+      return voxels + ((uint64_t)z * info.height + y) * info.width * info.bytes_per_voxel;
+    }
+
+    // range of a run of n voxels, merged into r.
+    void run_range(brick_range &r, const uint8_t *src, unsigned n) const {
+      if (info.datatype == loaders::nifti_decoder::dt_uint8) {
+        unsigned mn = (unsigned)r.min, mx = (unsigned)r.max;
+        unsigned i = 0;
+        #if OCTET_SSE2
+          if (n >= 16) {
+            __m128i vmin = _mm_set1_epi8((char)mn), vmax = _mm_set1_epi8((char)mx);
+            for (; i + 16 <= n; i += 16) {
+              __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+              vmin = _mm_min_epu8(vmin, v);
+              vmax = _mm_max_epu8(vmax, v);
+            }
+            uint8_t lo[16], hi[16];
+            _mm_storeu_si128((__m128i*)lo, vmin);
+            _mm_storeu_si128((__m128i*)hi, vmax);
+            for (unsigned j = 0; j != 16; ++j) {
+              mn = std::min(mn, (unsigned)lo[j]);
+              mx = std::max(mx, (unsigned)hi[j]);
+            }
+          }
+        #endif
+        for (; i != n; ++i) {
+          mn = std::min(mn, (unsigned)src[i]);
+          mx = std::max(mx, (unsigned)src[i]);
+        }
+        r.min = (float)mn;
+        r.max = (float)mx;
+      } else {
+        for (unsigned i = 0; i != n; ++i) {
+          float v = loaders::nifti_decoder::get_value(src + i * info.bytes_per_voxel, info.datatype);
+          r.min = std::min(r.min, v);
+          r.max = std::max(r.max, v);
+        }
+      }
+    }
+
+    // find the ranges of a layer of bricks, reading the file in order.
+    void scan_layer(unsigned bz) {
+      unsigned z0 = bz * brick_size, z1 = std::min(z0 + brick_size, info.depth);
+      brick_range *layer = &ranges[bz * bricks_y * bricks_x];
+      for (unsigned i = 0; i != bricks_x * bricks_y; ++i) {
+        layer[i].min = 1e37f;
+        layer[i].max = -1e37f;
+      }
+      for (unsigned z = z0; z != z1; ++z) {
+        for (unsigned y = 0; y != info.height; ++y) {
+          const uint8_t *src = row(y, z);
+          brick_range *r = layer + (y / brick_size) * bricks_x;
+          for (unsigned bx = 0; bx != bricks_x; ++bx) {
+            unsigned x0 = bx * brick_size;
+            unsigned n = std::min(brick_size, info.width - x0);
+            run_range(r[bx], src + x0 * info.bytes_per_voxel, n);
+          }
+        }
+      }
+    }
+
+    // copy a brick out of the volume, padding the edges with zeros.
+    void copy_brick(uint8_t *dest, unsigned bx, unsigned by, unsigned bz) const {
+      unsigned bpv = info.bytes_per_voxel;
+      unsigned x0 = bx * brick_size, y0 = by * brick_size, z0 = bz * brick_size;
+      unsigned nx = std::min(brick_size, info.width - x0);
+      unsigned ny = std::min(brick_size, info.height - y0);
+      unsigned nz = std::min(brick_size, info.depth - z0);
+      unsigned row_bytes = brick_size * bpv;
+      if (nx != brick_size || ny != brick_size || nz != brick_size) {
+        memset(dest, 0, brick_bytes);
+      }
+      for (unsigned z = 0; z != nz; ++z) {
+        for (unsigned y = 0; y != ny; ++y) {
+          memcpy(dest + (z * brick_size + y) * row_bytes, row(y0 + y, z0 + z) + x0 * bpv, nx * bpv);
+        }
+      }
+    }
+
+  public:
+    bricked_volume() {
+      map = 0;
+      brick_size = default_brick_size;
+      brick_bytes = 0;
+      num_slots = 0;
+      reset();
+    }
+
+    ~bricked_volume() {
+      reset();
+    }
+
+    /// Map a NIFTI file and find the range of each brick.
+    /// cache_bytes limits the memory used by resident bricks.
+    bool open(const char *url, unsigned brick_size = default_brick_size, unsigned cache_bytes = 64 * 1024 * 1024) {
+      reset();
+      map = new file_map(app_utils::get_path(url));
+      if (map->get_error() || !map->get_data()) {
+        log("bricked_volume: %s: %s\n", url, map->get_error() ? map->get_error() : "empty file");
+        reset();
+        return false;
+      }
+
+      if (!init_bricks(map->get_data(), map->get_data() + map->get_size(), brick_size, cache_bytes)) {
+        reset();
+        return false;
+      }
+      return true;
+    }
+
+    /// Use a NIFTI file that is already in memory. The memory must outlive the volume.
+    bool init(const uint8_t *src, const uint8_t *src_max, unsigned brick_size = default_brick_size, unsigned cache_bytes = 64 * 1024 * 1024) {
+      reset();
+      if (!init_bricks(src, src_max, brick_size, cache_bytes)) {
+        reset();
+        return false;
+      }
+      return true;
+    }
+
+    /// width, height and depth in voxels.
+    unsigned get_width() const { return info.width; }
+    unsigned get_height() const { return info.height; }
+    unsigned get_depth() const { return info.depth; }
+
+    /// NIFTI datatype and size of the voxels.
+    unsigned get_datatype() const { return info.datatype; }
+    unsigned get_bytes_per_voxel() const { return info.bytes_per_voxel; }
+
+    /// edge of a brick in voxels.
+    unsigned get_brick_size() const { return brick_size; }
+
+    /// bytes in one brick.
+    unsigned get_brick_bytes() const { return brick_bytes; }
+
+    /// number of bricks along each axis.
+    unsigned get_bricks_x() const { return bricks_x; }
+    unsigned get_bricks_y() const { return bricks_y; }
+    unsigned get_bricks_z() const { return bricks_z; }
+    unsigned get_num_bricks() const { return bricks_x * bricks_y * bricks_z; }
+
+    /// index of a brick.
+    unsigned get_brick_index(unsigned bx, unsigned by, unsigned bz) const {
+      return (bz * bricks_y + by) * bricks_x + bx;
+    }
+
+    /// range of values in a brick.
+    const brick_range &get_range(unsigned index) const {
+      return ranges[index];
+    }
+
+    /// true if no voxel in the brick is in [lo, hi].
+    bool is_empty(unsigned index, float lo, float hi) const {
+      return ranges[index].max < lo || ranges[index].min > hi;
+    }
+
+    /// true if the brick is in the cache.
+    bool is_resident(unsigned index) const {
+      return slot_of_brick[index] >= 0;
+    }
+
+    /// bytes of memory used by the cache and the brick table.
+    size_t get_memory_used() const {
+      return (size_t)num_slots * brick_bytes + ranges.size() * sizeof(brick_range) + slot_of_brick.size() * sizeof(int) + num_slots * sizeof(unsigned) * 2;
+    }
+
+    /// Voxels of a brick, x fastest, brick_size voxels on a side.
+    /// Bricks past the edge of the volume are padded with zeros.
+    /// The pointer is valid until get_num_slots() other bricks have been fetched.
+    /// Not thread safe.
+    const uint8_t *get_brick(unsigned bx, unsigned by, unsigned bz) {
+      unsigned index = get_brick_index(bx, by, bz);
+      int slot = slot_of_brick[index];
+      if (slot < 0) {
+        if (num_resident < num_slots) {
+          slot = (int)num_resident++;
+        } else {
+          // replace the least recently used brick
+          slot = 0;
+          for (unsigned i = 1; i != num_slots; ++i) {
+            if (slot_time[i] < slot_time[slot]) slot = (int)i;
+          }
+          slot_of_brick[brick_of_slot[slot]] = -1;
+        }
+        if (cache.size() == 0) cache.resize(num_slots * brick_bytes);
+        copy_brick(&cache[slot * brick_bytes], bx, by, bz);
+        slot_of_brick[index] = slot;
+        brick_of_slot[slot] = index;
+      }
+      slot_time[slot] = ++time;
+      return &cache[slot * brick_bytes];
+    }
+
+    /// number of bricks that can be resident at once.
+    unsigned get_num_slots() const {
+      return num_slots;
+    }
+
+    /// Occupancy map with one byte per brick for skipping empty space.
+    /// Zero means the brick has values in [lo, hi].
+    /// Otherwise it is the number of bricks that can be skipped in any direction
+    /// before reaching an occupied one (chessboard distance, at most 255).
+    void get_occupancy(dynarray<uint8_t> &result, float lo, float hi) const {
+      unsigned num_bricks = get_num_bricks();
+      result.resize(num_bricks);
+      for (unsigned i = 0; i != num_bricks; ++i) {
+        result[i] = is_empty(i, lo, hi) ? 255 : 0;
+      }
+
+      // the chessboard distance transform is separable: one 1D pass per axis.
+      unsigned dims[3] = { bricks_x, bricks_y, bricks_z };
+      unsigned strides[3] = { 1, bricks_x, bricks_x * bricks_y };
+      dynarray<uint8_t> line(std::max(bricks_x, std::max(bricks_y, bricks_z)));
+      for (unsigned axis = 0; axis != 3; ++axis) {
+        unsigned n = dims[axis], stride = strides[axis];
+        for (unsigned start = 0; start != num_bricks; ++start) {
+          // visit each line once, from the brick with coordinate 0 on this axis.
+          if ((start / stride) % n != 0) continue;
+          for (unsigned i = 0; i != n; ++i) line[i] = result[start + i * stride];
+          for (unsigned i = 0; i != n; ++i) {
+            unsigned best = 255;
+            for (unsigned j = 0; j != n; ++j) {
+              unsigned dist = i > j ? i - j : j - i;
+              best = std::min(best, std::max(dist, (unsigned)line[j]));
+            }
+            result[start + i * stride] = (uint8_t)best;
+          }
+        }
+      }
+    }
+
+    /// Make a GL_TEXTURE_3D of the occupancy map, one texel per brick.
+    /// Sample it with nearest filtering; see shaders/raycast_bricks.fs.
+    GLuint make_occupancy_texture(float lo, float hi) const {
+      dynarray<uint8_t> occupancy;
+      get_occupancy(occupancy, lo, hi);
+
+      GLuint texture = 0;
+      glGenTextures(1, &texture);
+      glBindTexture(GL_TEXTURE_3D, texture);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexImage3D(GL_TEXTURE_3D, 0, GL_LUMINANCE, bricks_x, bricks_y, bricks_z, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, (void*)occupancy.data());
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+      return texture;
+    }
+
+    /// Write a synthetic size^3 8 bit volume to a file and log the time to open it,
+    /// the time to fetch bricks and the memory used compared with decoding the whole volume.
+    /// The volume is a thick spherical shell, so most bricks are empty.
+    static void benchmark(unsigned size = 1024, const char *url = "bricked_volume_benchmark.nii") {
+      string path = app_utils::get_path(url);
+      FILE *file = fopen(path, "wb");
+      if (!file) {
+        log("bricked_volume: could not write %s\n", path.c_str());
+        return;
+      }
+
+      uint8_t header[352];
+      loaders::nifti_decoder::init_header(header, size, size, size, loaders::nifti_decoder::dt_uint8, 8);
+      fwrite(header, 1, loaders::nifti_decoder::get_header_size(), file);
+      dynarray<uint8_t> slice(size * size);
+      float r = size * 0.5f, r_in = r * 0.8f, r_out = r * 0.9f;
+      for (unsigned z = 0; z != size; ++z) {
+        for (unsigned y = 0; y != size; ++y) {
+          for (unsigned x = 0; x != size; ++x) {
+            float dx = x - r, dy = y - r, dz = z - r;
+            float d2 = dx*dx + dy*dy + dz*dz;
+            slice[y * size + x] = d2 >= r_in*r_in && d2 <= r_out*r_out ? (uint8_t)(128 + ((x ^ y ^ z) & 127)) : 0;
+          }
+        }
+        fwrite(slice.data(), 1, slice.size(), file);
+      }
+      fclose(file);
+
+      typedef std::chrono::steady_clock timer_clock;
+      timer_clock::time_point start = timer_clock::now();
+      bricked_volume vol;
+      if (!vol.open(url)) return;
+      double open_ms = std::chrono::duration<double, std::milli>(timer_clock::now() - start).count();
+
+      start = timer_clock::now();
+      dynarray<uint8_t> occupancy;
+      vol.get_occupancy(occupancy, 1, 255);
+      double occ_ms = std::chrono::duration<double, std::milli>(timer_clock::now() - start).count();
+      unsigned num_empty = 0;
+      for (unsigned i = 0; i != occupancy.size(); ++i) num_empty += occupancy[i] != 0;
+
+      // fetch every occupied brick, as a ray marcher with empty space skipping would.
+      start = timer_clock::now();
+      unsigned fetched = 0;
+      for (unsigned bz = 0; bz != vol.get_bricks_z(); ++bz) {
+        for (unsigned by = 0; by != vol.get_bricks_y(); ++by) {
+          for (unsigned bx = 0; bx != vol.get_bricks_x(); ++bx) {
+            if (occupancy[vol.get_brick_index(bx, by, bz)] == 0) {
+              vol.get_brick(bx, by, bz);
+              fetched++;
+            }
+          }
+        }
+      }
+      double fetch_ms = std::chrono::duration<double, std::milli>(timer_clock::now() - start).count();
+
+      double mb = 1.0 / (1024 * 1024);
+      log("bricked_volume %d^3: open %.1fms occupancy %.1fms, %d/%d bricks empty\n", size, open_ms, occ_ms, num_empty, vol.get_num_bricks());
+      log("bricked_volume %d^3: fetched %d bricks in %.1fms\n", size, fetched, fetch_ms);
+      log("bricked_volume %d^3: %.1fMB resident vs %.1fMB for the whole volume\n", size, vol.get_memory_used() * mb, (double)size * size * size * mb);
+      remove(path);
+    }
+  };
+}}
@@ -36,4 +36,7 @@ OCTET_CLASS(scene, mesh_voxel_grid)
 #endif
 OCTET_CLASS(scene, mesh_points)
 OCTET_CLASS(scene, mesh_cylinder)
+OCTET_CLASS(scene, animated_image)
+OCTET_CLASS(scene, atlas_region)
+OCTET_CLASS(scene, texture_atlas)
 //OCTET_CLASS(scene, value)
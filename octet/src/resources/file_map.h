@@ -21,6 +21,9 @@ public:
     error = 0;
     data = 0;
     size = 0;
+    #ifndef WIN32
+      file_handle = -1;
+    #endif
 
     if (file_name == NULL) {
       error = "no file name";
@@ -51,8 +54,29 @@ public:
 
       data = (const uint8_t *)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
     #else
-      //file_handle = open(file_name, O_RDONLY);
-      //mmap
+      file_handle = open(file_name, O_RDONLY);
+
+      if (file_handle < 0) {
+        error = "could not open file";
+        return;
+      }
+
+      struct stat st;
+      if (fstat(file_handle, &st) != 0) {
+        error = "could not get file size";
+        return;
+      }
+
+      size = (uint64_t)st.st_size;
+      if (size == 0) return;
+
+      void *ptr = mmap(0, (size_t)size, PROT_READ, MAP_SHARED, file_handle, 0);
+      if (ptr == MAP_FAILED) {
+        error = "could not map file";
+        size = 0;
+        return;
+      }
+      data = (const uint8_t *)ptr;
     #endif
   }
 
@@ -62,6 +86,8 @@ public:
       CloseHandle(file_handle);
       CloseHandle(mapping_handle);
     #else
+      if (data) munmap((void*)data, (size_t)size);
+      if (file_handle >= 0) close(file_handle);
     #endif
   }
 
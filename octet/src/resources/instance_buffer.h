@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Per-instance matrices for hardware instancing
+//
+
+namespace octet { namespace resources {
+  /// A stream of matrices, one per instance, for glDrawElementsInstanced().
+  ///
+  /// The matrices are gathered on the CPU each frame and sent to GL with one glBufferData(),
+  /// which gives the driver a fresh store so it does not have to wait for last frame's draws.
+  /// enable_attributes() points attribute_instance (a mat4 in slots 9 to 12) at a run of them,
+  /// advancing one matrix per instance.
+  ///
+  /// Example
+  ///
+  ///     instances.clear();
+  ///     unsigned first = instances.add(modelToCamera[0]);
+  ///     instances.add(modelToCamera[1]);
+  ///     instances.upload();
+  ///     instances.enable_attributes(first);
+  ///     msh->draw_instanced(2);
+  ///     instances.disable_attributes();
+  class instance_buffer : public resource {
+    dynarray<mat4t> matrices;
+    GLuint buffer;
+
+  public:
+    instance_buffer() {
+      buffer = 0;
+    }
+
+    ~instance_buffer() {
+      reset();
+    }
+
+    /// Free the GL buffer.
+    void reset() {
+      if (buffer) glDeleteBuffers(1, &buffer);
+      buffer = 0;
+      matrices.reset();
+    }
+
+    /// Start a new set of instances.
+    void clear() {
+      matrices.resize(0);
+    }
+
+    /// Add an instance and return its index.
+    unsigned add(const mat4t &matrix) {
+      matrices.push_back(matrix);
+      return matrices.size() - 1;
+    }
+
+    /// Number of instances added since clear().
+    unsigned size() const {
+      return matrices.size();
+    }
+
+    /// Copy the instances to GL.
+    void upload() {
+      #if OCTET_INSTANCING
+        if (matrices.empty()) return;
+        if (!buffer) glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(mat4t), matrices.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+      #endif
+    }
+
+    /// Feed the instances from "first" on to attribute_instance, one matrix per instance.
+    void enable_attributes(unsigned first) const {
+      #if OCTET_INSTANCING
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (unsigned i = 0; i != 4; ++i) {
+          size_t offset = first * sizeof(mat4t) + i * sizeof(vec4);
+          glVertexAttribPointer(attribute_instance + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4t), (void*)offset);
+          glEnableVertexAttribArray(attribute_instance + i);
+          glVertexAttribDivisor(attribute_instance + i, 1);
+        }
+      #endif
+    }
+
+    /// Return attribute_instance to normal per-vertex use.
+    static void disable_attributes() {
+      #if OCTET_INSTANCING
+        for (unsigned i = 0; i != 4; ++i) {
+          glVertexAttribDivisor(attribute_instance + i, 0);
+          glDisableVertexAttribArray(attribute_instance + i);
+        }
+      #endif
+    }
+  };
+}}
@@ -4,52 +4,200 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
-// work in progress
+// Job pool: a small set of worker threads for loaders and mesh processing.
+//
 
 namespace octet { namespace resources {
-  class job : public resource {
-    ref<job> next;
+  class job_pool;
+
+  /// A batch of jobs. Wait on the group to join all the jobs added to it.
+  class job_group {
+    friend class job_pool;
+    #if OCTET_THREADS
+      std::atomic<int> pending;
+    #else
+      int pending;
+    #endif
+
+    job_group(const job_group &rhs);
+    void operator=(const job_group &rhs);
+  public:
+    job_group() {
+      pending = 0;
+    }
+
+    /// wait for any outstanding jobs before we go away.
+    ~job_group() {
+      wait();
+    }
 
-    enum state_t {
-      state_waiting,
-      state_running,
+    /// true if all the jobs in this group have finished.
+    bool is_done() const {
+      return pending == 0;
+    }
+
+    /// run jobs on this thread until the group is done.
+    inline void wait();
+  };
+
+  /// A pool of worker threads shared by the whole framework.
+  ///
+  /// Example
+  ///
+  ///     // process the rows of an image in bands of 16
+  ///     job_pool::get().parallel_for(0, height, 16, [&](unsigned y0, unsigned y1) {
+  ///       for (unsigned y = y0; y != y1; ++y) do_row(y);
+  ///     });
+  class job_pool {
+    struct task_t {
+      std::function<void()> fn;
+      job_group *group;
     };
 
-    state_t state;
+    #if OCTET_THREADS
+      std::mutex mutex;
+      std::condition_variable wake;
+      std::condition_variable done;
+      std::deque<task_t> tasks;
+      std::vector<std::thread> workers;
+      bool stopping;
 
-    class scheduler {
-      job *waiting;
-      job *running;
-    public:
-      scheduler() {
-        waiting = 0;
-        running = 0;
+      void worker_loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+          wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+          if (stopping && tasks.empty()) return;
+          task_t task = tasks.front();
+          tasks.pop_front();
+          lock.unlock();
+          execute(task);
+          lock.lock();
+        }
       }
 
-      void add_to_waiting(job *jb) {
-        jb->next = waiting;
-        waiting = this;
+      void execute(task_t &task) {
+        task.fn();
+        if (--task.group->pending == 0) {
+          std::lock_guard<std::mutex> lock(mutex);
+          done.notify_all();
+        }
       }
-    };
+    #endif
 
-    scheduler *get_scheduler() {
-      static scheduler sch;
-      return &sch;
-    }
+    job_pool(const job_pool &rhs);
+    void operator=(const job_pool &rhs);
   public:
-    job() {
-      scheduler *sch = get_scheduler();
-      sch->add_to_waiting(this);
+    /// create a pool. By default use one worker per hardware thread, less the caller.
+    job_pool(unsigned num_workers = ~0u) {
+      #if OCTET_THREADS
+        stopping = false;
+        if (num_workers == ~0u) {
+          unsigned hw = std::thread::hardware_concurrency();
+          num_workers = hw > 1 ? hw - 1 : 0;
+        }
+        for (unsigned i = 0; i != num_workers; ++i) {
+          workers.push_back(std::thread([this]() { worker_loop(); }));
+        }
+      #endif
     }
 
-    virtual ~job() {
+    /// finish all the work and join the threads.
+    ~job_pool() {
+      #if OCTET_THREADS
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i != workers.size(); ++i) {
+          workers[i].join();
+        }
+      #endif
     }
 
-    virtual void kernel() = 0;
-    virtual bool is_ready() = 0;
+    /// the shared pool.
+    static job_pool &get() {
+      static job_pool instance;
+      return instance;
+    }
+
+    /// number of threads that can run jobs, including the caller.
+    unsigned get_num_threads() const {
+      #if OCTET_THREADS
+        return (unsigned)workers.size() + 1;
+      #else
+        return 1;
+      #endif
+    }
+
+    /// add a job to a group. The job may run at any time before group.wait() returns.
+    void add(job_group &group, const std::function<void()> &fn) {
+      #if OCTET_THREADS
+        if (!workers.empty()) {
+          task_t task = { fn, &group };
+          ++group.pending;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(task);
+          }
+          wake.notify_one();
+          return;
+        }
+      #endif
+      fn();
+    }
+
+    /// run one waiting job on this thread. Returns false if there was nothing to do.
+    bool run_one() {
+      #if OCTET_THREADS
+        std::unique_lock<std::mutex> lock(mutex);
+        if (tasks.empty()) return false;
+        task_t task = tasks.front();
+        tasks.pop_front();
+        lock.unlock();
+        execute(task);
+        return true;
+      #else
+        return false;
+      #endif
+    }
 
-    state_t get_state() {
-      return state;
+    /// help out with jobs until every job in the group is done.
+    void wait(job_group &group) {
+      #if OCTET_THREADS
+        while (group.pending != 0) {
+          if (!run_one()) {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this, &group]() { return group.pending == 0 || !tasks.empty(); });
+          }
+        }
+      #endif
+    }
+
+    /// split [begin, end) into chunks of at least grain items and call fn(chunk_begin, chunk_end) on each.
+    /// Returns when all the chunks are done.
+    template <class fn_t> void parallel_for(unsigned begin, unsigned end, unsigned grain, const fn_t &fn) {
+      if (end <= begin) return;
+      unsigned count = end - begin;
+      unsigned max_chunks = get_num_threads() * 4;
+      if (grain == 0) grain = 1;
+      unsigned chunk = (count + max_chunks - 1) / max_chunks;
+      chunk = chunk < grain ? grain : chunk;
+      if (chunk >= count) {
+        fn(begin, end);
+        return;
+      }
+
+      job_group group;
+      for (unsigned i = begin; i < end; i += chunk) {
+        unsigned i1 = end - i < chunk ? end : i + chunk;
+        add(group, [&fn, i, i1]() { fn(i, i1); });
+      }
+      wait(group);
     }
   };
+
+  inline void job_group::wait() {
+    job_pool::get().wait(*this);
+  }
 } }
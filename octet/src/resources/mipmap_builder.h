@@ -0,0 +1,462 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Mip chain generation for 8-bit and float images.
+//
+// Levels are built with a separable filter in linear space, so sRGB images
+// are converted to linear through a table, filtered and converted back.
+// Any size works: each level is max(1, size/2) of the previous one.
+//
+
+namespace octet { namespace resources {
+  /// Build mip chains for images with one to four components per pixel.
+  ///
+  /// The chain is stored level by level, with all the faces of a level together:
+  ///
+  ///     level 0 face 0, level 0 face 1, ... level 1 face 0, level 1 face 1, ...
+  ///
+  /// Example
+  ///
+  ///     mipmap_builder builder(4, mipmap_builder::filter_box, true);
+  ///     bytes.resize(mipmap_builder::chain_size(width, height, 4));
+  ///     builder.build(bytes.data(), width, height);
+  class mipmap_builder {
+  public:
+    enum filter_t {
+      /// area average. Fast and exact for power of two sizes.
+      filter_box,
+      /// Kaiser-windowed sinc. Sharper than box, less ringing than lanczos.
+      filter_kaiser,
+      /// Lanczos 3. Sharpest, may ring on hard edges.
+      filter_lanczos,
+    };
+
+  private:
+    enum {
+      // rows of the destination image processed by one job
+      band_rows = 64,
+      // resolution of the linear to 8-bit table
+      linear_steps = 4096,
+    };
+
+    // filter weights for one axis. Every destination pixel has the same number of taps.
+    struct axis_t {
+      dynarray<int> index;
+      dynarray<float> weight;
+      unsigned taps;
+    };
+
+    filter_t filter;
+    bool srgb;
+    unsigned num_comps;
+
+    // conversion tables, one for colour, one for alpha
+    struct tables_t {
+      float srgb_to_linear[256];
+      float unorm_to_linear[256];
+      uint8_t linear_to_srgb[linear_steps+1];
+      uint8_t linear_to_unorm[linear_steps+1];
+
+      tables_t() {
+        for (unsigned i = 0; i != 256; ++i) {
+          float c = i * (1.0f/255);
+          srgb_to_linear[i] = c <= 0.04045f ? c * (1.0f/12.92f) : powf((c + 0.055f) * (1.0f/1.055f), 2.4f);
+          unorm_to_linear[i] = c;
+        }
+        for (unsigned i = 0; i <= linear_steps; ++i) {
+          float l = (float)i / linear_steps;
+          float s = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f/2.4f) - 0.055f;
+          linear_to_srgb[i] = (uint8_t)(s * 255 + 0.5f);
+          linear_to_unorm[i] = (uint8_t)(l * 255 + 0.5f);
+        }
+      }
+    };
+
+    static const tables_t &get_tables() {
+      static tables_t tables;
+      return tables;
+    }
+
+    // zero order modified bessel function of the first kind for the kaiser window
+    static float bessel_i0(float x) {
+      float sum = 1, term = 1, x2 = x * x * 0.25f;
+      for (int k = 1; k != 20; ++k) {
+        term *= x2 / (float)(k * k);
+        sum += term;
+      }
+      return sum;
+    }
+
+    static float sinc(float x) {
+      if (fabsf(x) < 1e-5f) return 1;
+      x *= 3.14159265f;
+      return sinf(x) / x;
+    }
+
+    float radius() const {
+      return filter == filter_box ? 0.5f : 3.0f;
+    }
+
+    float kernel(float t) const {
+      float at = fabsf(t);
+      if (at >= radius()) return 0;
+      if (filter == filter_lanczos) {
+        return sinc(t) * sinc(t * (1.0f/3));
+      } else {
+        const float alpha = 4.0f;
+        float r = t * (1.0f/3);
+        return sinc(t) * bessel_i0(alpha * sqrtf(1 - r * r)) / bessel_i0(alpha);
+      }
+    }
+
+    // work out the weights to shrink src pixels to dest pixels along one axis
+    void make_axis(axis_t &axis, unsigned src, unsigned dest) const {
+      float scale = (float)src / dest;
+      float support = radius() * scale;
+      axis.taps = (unsigned)ceilf(support * 2) + 1;
+      axis.index.resize(dest * axis.taps);
+      axis.weight.resize(dest * axis.taps);
+      for (unsigned d = 0; d != dest; ++d) {
+        float centre = (d + 0.5f) * scale;
+        int first = (int)floorf(centre - support);
+        float total = 0;
+        for (unsigned k = 0; k != axis.taps; ++k) {
+          int s = first + (int)k;
+          float w;
+          if (filter == filter_box) {
+            // fraction of source pixel s covered by the destination pixel
+            float lo = centre - support, hi = centre + support;
+            float a = s < lo ? lo : (float)s;
+            float b = s + 1 > hi ? hi : (float)(s + 1);
+            w = b > a ? b - a : 0;
+          } else {
+            w = kernel((s + 0.5f - centre) / scale);
+          }
+          axis.index[d * axis.taps + k] = s < 0 ? 0 : s >= (int)src ? src - 1 : s;
+          axis.weight[d * axis.taps + k] = w;
+          total += w;
+        }
+        float rcp = total != 0 ? 1.0f / total : 0;
+        for (unsigned k = 0; k != axis.taps; ++k) {
+          axis.weight[d * axis.taps + k] *= rcp;
+        }
+      }
+    }
+
+    // convert one source row to linear floats
+    void load_row(float *dest, const uint8_t *src, unsigned n) const {
+      const tables_t &t = get_tables();
+      const float *colour = srgb ? t.srgb_to_linear : t.unorm_to_linear;
+      // the last component of RGBA and LUMINANCE_ALPHA is alpha, which is always linear.
+      unsigned alpha = num_comps == 4 || num_comps == 2 ? num_comps - 1 : ~0u;
+      for (unsigned i = 0, c = 0; i != n; ++i) {
+        dest[i] = c == alpha ? t.unorm_to_linear[src[i]] : colour[src[i]];
+        c = c + 1 == num_comps ? 0 : c + 1;
+      }
+    }
+
+    void load_row(float *dest, const float *src, unsigned n) const {
+      memcpy(dest, src, n * sizeof(float));
+    }
+
+    // convert linear floats to a destination row
+    void store_row(uint8_t *dest, const float *src, unsigned n) const {
+      const tables_t &t = get_tables();
+      const uint8_t *colour = srgb ? t.linear_to_srgb : t.linear_to_unorm;
+      unsigned alpha = num_comps == 4 || num_comps == 2 ? num_comps - 1 : ~0u;
+      for (unsigned i = 0, c = 0; i != n; ++i) {
+        float v = src[i];
+        v = v < 0 ? 0 : v > 1 ? 1 : v;
+        unsigned q = (unsigned)(v * linear_steps + 0.5f);
+        dest[i] = c == alpha ? t.linear_to_unorm[q] : colour[q];
+        c = c + 1 == num_comps ? 0 : c + 1;
+      }
+    }
+
+    void store_row(float *dest, const float *src, unsigned n) const {
+      memcpy(dest, src, n * sizeof(float));
+    }
+
+    // horizontal pass over one linear row
+    void filter_row(float *dest, const float *src, const axis_t &axis, unsigned dw) const {
+      const int *index = axis.index.data();
+      const float *weight = axis.weight.data();
+      unsigned taps = axis.taps;
+      #if OCTET_SSE2
+        if (num_comps == 4) {
+          for (unsigned x = 0; x != dw; ++x) {
+            __m128 sum = _mm_setzero_ps();
+            for (unsigned k = 0; k != taps; ++k) {
+              __m128 w = _mm_set1_ps(weight[k]);
+              sum = _mm_add_ps(sum, _mm_mul_ps(w, _mm_loadu_ps(src + index[k] * 4)));
+            }
+            _mm_storeu_ps(dest + x * 4, sum);
+            index += taps;
+            weight += taps;
+          }
+          return;
+        }
+      #endif
+      unsigned nc = num_comps;
+      for (unsigned x = 0; x != dw; ++x) {
+        for (unsigned c = 0; c != nc; ++c) {
+          float sum = 0;
+          for (unsigned k = 0; k != taps; ++k) {
+            sum += weight[k] * src[index[k] * nc + c];
+          }
+          dest[x * nc + c] = sum;
+        }
+        index += taps;
+        weight += taps;
+      }
+    }
+
+    // dest += src * w over a whole row
+    static void accumulate(float *dest, const float *src, float w, unsigned n) {
+      unsigned i = 0;
+      #if OCTET_AVX
+        __m256 w8 = _mm256_set1_ps(w);
+        for (; i + 8 <= n; i += 8) {
+          _mm256_storeu_ps(dest + i, _mm256_add_ps(_mm256_loadu_ps(dest + i), _mm256_mul_ps(w8, _mm256_loadu_ps(src + i))));
+        }
+      #endif
+      #if OCTET_SSE2
+        __m128 w4 = _mm_set1_ps(w);
+        for (; i + 4 <= n; i += 4) {
+          _mm_storeu_ps(dest + i, _mm_add_ps(_mm_loadu_ps(dest + i), _mm_mul_ps(w4, _mm_loadu_ps(src + i))));
+        }
+      #endif
+      for (; i != n; ++i) {
+        dest[i] += src[i] * w;
+      }
+    }
+
+    // shrink rows [y0, y1) of one face with the separable filter
+    template <class pixel_t> void resample_band(
+      pixel_t *dest, unsigned dw, const pixel_t *src, unsigned sw,
+      const axis_t &xaxis, const axis_t &yaxis, unsigned y0, unsigned y1
+    ) const {
+      unsigned nc = num_comps;
+      const int *yindex = yaxis.index.data();
+      int rmin = yindex[y0 * yaxis.taps];
+      int rmax = yindex[y1 * yaxis.taps - 1];
+      for (unsigned i = y0 * yaxis.taps; i != y1 * yaxis.taps; ++i) {
+        rmin = yindex[i] < rmin ? yindex[i] : rmin;
+        rmax = yindex[i] > rmax ? yindex[i] : rmax;
+      }
+
+      // horizontally filter every source row the band needs
+      dynarray<float> line(sw * nc);
+      dynarray<float> rows((rmax - rmin + 1) * dw * nc);
+      for (int r = rmin; r <= rmax; ++r) {
+        load_row(line.data(), src + (size_t)r * sw * nc, sw * nc);
+        filter_row(rows.data() + (r - rmin) * dw * nc, line.data(), xaxis, dw);
+      }
+
+      // then vertically combine them
+      dynarray<float> out(dw * nc);
+      for (unsigned y = y0; y != y1; ++y) {
+        memset(out.data(), 0, dw * nc * sizeof(float));
+        for (unsigned k = 0; k != yaxis.taps; ++k) {
+          float w = yaxis.weight[y * yaxis.taps + k];
+          if (w != 0) {
+            accumulate(out.data(), rows.data() + (yaxis.index[y * yaxis.taps + k] - rmin) * dw * nc, w, dw * nc);
+          }
+        }
+        store_row(dest + (size_t)y * dw * nc, out.data(), dw * nc);
+      }
+    }
+
+    // 2x2 average of linear 8-bit data, rows [y0, y1)
+    void box_band(uint8_t *dest, unsigned dw, const uint8_t *src, unsigned sw, unsigned y0, unsigned y1) const {
+      unsigned nc = num_comps;
+      unsigned stride = sw * nc;
+      for (unsigned y = y0; y != y1; ++y) {
+        const uint8_t *s0 = src + (size_t)y * 2 * stride;
+        const uint8_t *s1 = s0 + stride;
+        uint8_t *d = dest + (size_t)y * dw * nc;
+        unsigned x = 0;
+        #if OCTET_SSE2
+          if (nc == 4) {
+            // four destination pixels (32 source bytes per row) at a time
+            const __m128i two = _mm_set1_epi16(2);
+            const __m128i zero = _mm_setzero_si128();
+            for (; x + 4 <= dw; x += 4) {
+              __m128i a0 = _mm_loadu_si128((const __m128i*)(s0 + x * 8));
+              __m128i a1 = _mm_loadu_si128((const __m128i*)(s0 + x * 8 + 16));
+              __m128i b0 = _mm_loadu_si128((const __m128i*)(s1 + x * 8));
+              __m128i b1 = _mm_loadu_si128((const __m128i*)(s1 + x * 8 + 16));
+              // vertical sums as 16 bit values, one pixel per 64 bits
+              __m128i v0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+              __m128i v1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+              __m128i v2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+              __m128i v3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+              // horizontal pairs
+              __m128i h0 = _mm_add_epi16(_mm_unpacklo_epi64(v0, v1), _mm_unpackhi_epi64(v0, v1));
+              __m128i h1 = _mm_add_epi16(_mm_unpacklo_epi64(v2, v3), _mm_unpackhi_epi64(v2, v3));
+              h0 = _mm_srli_epi16(_mm_add_epi16(h0, two), 2);
+              h1 = _mm_srli_epi16(_mm_add_epi16(h1, two), 2);
+              _mm_storeu_si128((__m128i*)(d + x * 4), _mm_packus_epi16(h0, h1));
+            }
+          }
+        #endif
+        for (; x != dw; ++x) {
+          for (unsigned c = 0; c != nc; ++c) {
+            unsigned i = x * 2 * nc + c;
+            d[x * nc + c] = (uint8_t)((s0[i] + s0[i + nc] + s1[i] + s1[i + nc] + 2) >> 2);
+          }
+        }
+      }
+    }
+
+    // 2x2 average of sRGB 8-bit data through the tables, rows [y0, y1)
+    void srgb_box_band(uint8_t *dest, unsigned dw, const uint8_t *src, unsigned sw, unsigned y0, unsigned y1) const {
+      const tables_t &t = get_tables();
+      unsigned nc = num_comps;
+      unsigned stride = sw * nc;
+      unsigned alpha = nc == 4 || nc == 2 ? nc - 1 : ~0u;
+      for (unsigned y = y0; y != y1; ++y) {
+        const uint8_t *s0 = src + (size_t)y * 2 * stride;
+        const uint8_t *s1 = s0 + stride;
+        uint8_t *d = dest + (size_t)y * dw * nc;
+        for (unsigned x = 0; x != dw; ++x) {
+          for (unsigned c = 0; c != nc; ++c) {
+            unsigned i = x * 2 * nc + c;
+            if (c == alpha) {
+              d[x * nc + c] = (uint8_t)((s0[i] + s0[i + nc] + s1[i] + s1[i + nc] + 2) >> 2);
+            } else {
+              const float *lin = t.srgb_to_linear;
+              float sum = lin[s0[i]] + lin[s0[i + nc]] + lin[s1[i]] + lin[s1[i + nc]];
+              d[x * nc + c] = t.linear_to_srgb[(unsigned)(sum * (linear_steps * 0.25f) + 0.5f)];
+            }
+          }
+        }
+      }
+    }
+
+    void shrink_band(uint8_t *dest, unsigned dw, unsigned dh, const uint8_t *src, unsigned sw, unsigned sh, const axis_t &xaxis, const axis_t &yaxis, unsigned y0, unsigned y1) const {
+      if (filter == filter_box && sw == dw * 2 && sh == dh * 2) {
+        if (srgb) {
+          srgb_box_band(dest, dw, src, sw, y0, y1);
+        } else {
+          box_band(dest, dw, src, sw, y0, y1);
+        }
+      } else {
+        resample_band(dest, dw, src, sw, xaxis, yaxis, y0, y1);
+      }
+    }
+
+    void shrink_band(float *dest, unsigned dw, unsigned dh, const float *src, unsigned sw, unsigned sh, const axis_t &xaxis, const axis_t &yaxis, unsigned y0, unsigned y1) const {
+      resample_band(dest, dw, src, sw, xaxis, yaxis, y0, y1);
+    }
+
+    template <class pixel_t> unsigned build_chain(pixel_t *chain, unsigned width, unsigned height, unsigned num_faces, unsigned max_levels) const {
+      unsigned levels = get_num_levels(width, height);
+      levels = levels < max_levels ? levels : max_levels;
+      unsigned nc = num_comps;
+      unsigned sw = width, sh = height;
+      pixel_t *src = chain;
+      for (unsigned level = 1; level < levels; ++level) {
+        unsigned dw = sw > 1 ? sw / 2 : 1;
+        unsigned dh = sh > 1 ? sh / 2 : 1;
+        pixel_t *dest = src + (size_t)sw * sh * nc * num_faces;
+
+        axis_t xaxis, yaxis;
+        make_axis(xaxis, sw, dw);
+        make_axis(yaxis, sh, dh);
+
+        // split the level into bands of rows for each face
+        unsigned bands = (dh + band_rows - 1) / band_rows;
+        job_pool::get().parallel_for(0, bands * num_faces, 1, [&](unsigned i0, unsigned i1) {
+          for (unsigned i = i0; i != i1; ++i) {
+            unsigned face = i / bands;
+            unsigned y0 = (i % bands) * band_rows;
+            unsigned y1 = y0 + band_rows < dh ? y0 + band_rows : dh;
+            shrink_band(
+              dest + (size_t)dw * dh * nc * face, dw, dh,
+              src + (size_t)sw * sh * nc * face, sw, sh,
+              xaxis, yaxis, y0, y1
+            );
+          }
+        });
+
+        src = dest;
+        sw = dw;
+        sh = dh;
+      }
+      return levels;
+    }
+
+  public:
+    /// make a builder for pixels with num_comps components. If srgb is set, colour components are
+    /// filtered in linear space. Alpha (the last of two or four components) is always linear.
+    mipmap_builder(unsigned num_comps = 4, filter_t filter = filter_box, bool srgb = false) {
+      this->num_comps = num_comps;
+      this->filter = filter;
+      this->srgb = srgb;
+    }
+
+    /// number of levels in a full chain down to 1x1.
+    static unsigned get_num_levels(unsigned width, unsigned height) {
+      unsigned size = width > height ? width : height;
+      unsigned levels = 1;
+      while (size > 1) {
+        size >>= 1;
+        levels++;
+      }
+      return levels;
+    }
+
+    /// number of pixels in a chain of num_levels levels.
+    static size_t get_chain_pixels(unsigned width, unsigned height, unsigned num_levels) {
+      size_t total = 0;
+      for (unsigned level = 0; level != num_levels; ++level) {
+        total += (size_t)width * height;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+      }
+      return total;
+    }
+
+    /// number of components needed for a full chain of one or more faces.
+    static size_t chain_size(unsigned width, unsigned height, unsigned num_comps, unsigned num_faces = 1) {
+      return get_chain_pixels(width, height, get_num_levels(width, height)) * num_comps * num_faces;
+    }
+
+    /// Given level 0 of each face at the start of the chain, fill in the smaller levels.
+    /// The chain must have room for chain_size() values. Returns the number of levels.
+    unsigned build(uint8_t *chain, unsigned width, unsigned height, unsigned num_faces = 1, unsigned max_levels = ~0u) const {
+      return build_chain(chain, width, height, num_faces, max_levels);
+    }
+
+    /// Float version of build. Values are treated as linear.
+    unsigned build(float *chain, unsigned width, unsigned height, unsigned num_faces = 1, unsigned max_levels = ~0u) const {
+      return build_chain(chain, width, height, num_faces, max_levels);
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class mipmap_builder_unit_test {
+    public:
+      mipmap_builder_unit_test() {
+        // a 2x2 box filter of a power of two image matches the simple average
+        uint8_t chain[16 + 4 + 1];
+        for (unsigned i = 0; i != 16; ++i) chain[i] = (uint8_t)(i * 16);
+        mipmap_builder box(1);
+        assert(box.build(chain, 4, 4) == 3);
+        assert(chain[16] == (0 + 16 + 64 + 80 + 2) / 4);
+
+        // odd sizes are resampled, not truncated
+        dynarray<uint8_t> odd(mipmap_builder::chain_size(5, 3, 4));
+        memset(odd.data(), 0x80, 5 * 3 * 4);
+        mipmap_builder kaiser(4, mipmap_builder::filter_kaiser, true);
+        assert(kaiser.build(odd.data(), 5, 3) == 3);
+        assert(odd[5 * 3 * 4] == 0x80 && odd[odd.size() - 1] == 0x80);
+      }
+    };
+    static mipmap_builder_unit_test mipmap_builder_unit_test;
+  #endif
+} }
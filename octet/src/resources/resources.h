@@ -17,9 +17,12 @@
   }
 
   // resources
+  #include "../resources/mipmap_builder.h"
+  #include "../resources/sdf_builder.h"
   #include "../resources/file_map.h"
   #include "../resources/zip_file.h"
   #include "../resources/app_utils.h"
+  #include "../resources/bricked_volume.h"
   #include "../resources/visitor.h"
   #include "../resources/binary_writer.h"
   #include "../resources/binary_reader.h"
@@ -28,6 +31,7 @@
   #include "../resources/resource.h"
   #include "../resources/resource_dict.h"
   #include "../resources/gl_resource.h"
+  #include "../resources/instance_buffer.h"
   #include "../resources/bitmap_font.h"
   #include "../resources/mesh_builder.h"
 
@@ -0,0 +1,130 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Signed distance fields from coverage bitmaps.
+//
+// Distances are exact Euclidean distances to the nearest pixel on the other
+// side of the edge, found with the separable squared distance transform of
+// Felzenszwalb and Huttenlocher: one pass down the columns, one along the rows.
+//
+
+namespace octet { namespace resources {
+  /// Convert coverage bitmaps, such as font glyphs, into signed distance fields.
+  ///
+  /// A distance field can be drawn at any size with a sharp edge by thresholding
+  /// at 0.5 in the shader (see shaders/text_sdf.fs), so one small field serves every text size.
+  ///
+  /// Distances are stored as 8 bits: 128 is the edge, 255 is "spread" pixels inside
+  /// and 0 is "spread" pixels outside.
+  ///
+  /// Example
+  ///
+  ///     // glyph is w x h alpha values with a "spread" pixel border of zeros
+  ///     sdf_builder::build(field, glyph, w, h, 1, 4);
+  class sdf_builder {
+    enum { infinity = 0x3fffffff };
+
+    // 1D squared distance transform of f (n values, stride apart) into d.
+    static void transform_1d(float *d, const float *f, unsigned n, unsigned stride, int *v, float *z) {
+      unsigned k = 0;
+      v[0] = 0;
+      z[0] = -(float)infinity;
+      z[1] = (float)infinity;
+      for (unsigned q = 1; q != n; ++q) {
+        // find where the parabola from q crosses the lower envelope
+        float fq = f[q * stride] + (float)(q * q);
+        float s;
+        for (;;) {
+          int p = v[k];
+          s = (fq - (f[p * stride] + (float)(p * p))) / (2.0f * (q - p));
+          if (s > z[k]) break;
+          --k;
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k+1] = (float)infinity;
+      }
+
+      k = 0;
+      for (unsigned q = 0; q != n; ++q) {
+        while (z[k+1] < (float)q) ++k;
+        float dq = (float)q - v[k];
+        d[q * stride] = dq * dq + f[v[k] * stride];
+      }
+    }
+
+    // squared distance from every pixel to the nearest pixel marked zero in "grid".
+    static void transform_2d(float *grid, unsigned width, unsigned height, float *tmp, int *v, float *z) {
+      for (unsigned x = 0; x != width; ++x) {
+        transform_1d(tmp + x, grid + x, height, width, v, z);
+      }
+      for (unsigned y = 0; y != height; ++y) {
+        transform_1d(grid + y * width, tmp + y * width, width, 1, v, z);
+      }
+    }
+
+  public:
+    /// Build a distance field from 8-bit coverage values, "stride" bytes apart (eg. 4 for the alpha of RGBA).
+    /// The result is written to dest with the same stride, so it can build in place.
+    /// Pixels with coverage of 128 or more are inside.
+    static void build(uint8_t *dest, const uint8_t *src, unsigned width, unsigned height, unsigned stride, unsigned spread) {
+      unsigned size = width * height;
+      if (!size) return;
+
+      dynarray<float> outside(size);
+      dynarray<float> inside(size);
+      dynarray<float> tmp(size);
+      unsigned max_dim = width > height ? width : height;
+      dynarray<int> v(max_dim);
+      dynarray<float> z(max_dim + 1);
+
+      for (unsigned i = 0; i != size; ++i) {
+        bool in = src[i * stride] >= 128;
+        outside[i] = in ? 0.0f : (float)infinity;
+        inside[i] = in ? (float)infinity : 0.0f;
+      }
+
+      transform_2d(outside.data(), width, height, tmp.data(), v.data(), z.data());
+      transform_2d(inside.data(), width, height, tmp.data(), v.data(), z.data());
+
+      // the edge is half way between an inside and an outside pixel.
+      float scale = 127.0f / (spread ? spread : 1);
+      for (unsigned i = 0; i != size; ++i) {
+        float dist = outside[i] != 0 ? 0.5f - sqrtf(outside[i]) : sqrtf(inside[i]) - 0.5f;
+        float value = 128.0f + dist * scale;
+        dest[i * stride] = (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value + 0.5f);
+      }
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class sdf_builder_unit_test {
+    public:
+      sdf_builder_unit_test() {
+        // a 4x4 square in the middle of a 12x12 bitmap
+        uint8_t src[12*12];
+        uint8_t dest[12*12];
+        for (unsigned y = 0; y != 12; ++y) {
+          for (unsigned x = 0; x != 12; ++x) {
+            src[y*12+x] = x >= 4 && x < 8 && y >= 4 && y < 8 ? 255 : 0;
+          }
+        }
+        sdf_builder::build(dest, src, 12, 12, 1, 4);
+
+        // inside is above the edge, outside below and symmetrical about it.
+        assert(dest[5*12+5] > 128 && dest[5*12+3] < 128);
+        assert(dest[5*12+4] + dest[5*12+3] == 256);
+        // three pixels out from the left edge is 2.5 pixels away
+        assert(dest[5*12+1] == (uint8_t)(128.5f - 2.5f * 127 / 4));
+        // diagonal distance from the corner
+        assert(dest[2*12+2] == (uint8_t)(128.5f + (0.5f - sqrtf(8)) * 127 / 4));
+      }
+    };
+
+    static sdf_builder_unit_test sdf_builder_unit_test;
+  #endif
+} }
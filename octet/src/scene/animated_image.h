@@ -0,0 +1,123 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Animated image: frames of a gif streamed into a ring of images.
+//
+
+namespace octet { namespace scene {
+  /// Frames of an animated gif, decoded one at a time into a small ring of images.
+  ///
+  /// The file is parsed once; each frame continues from where the last one stopped.
+  /// A frame's image stays valid until the ring comes round again.
+  ///
+  /// Example
+  ///
+  ///     ref<animated_image> anim = new animated_image("assets/invaderers/ball.gif");
+  ///     ...
+  ///     // every frame of the game
+  ///     image *img = anim->update(16);
+  ///     GLuint texture = img->get_gl_texture();
+  class animated_image : public resource {
+    // source of the animation
+    string url;
+
+    // the whole gif file, which the decoder reads from
+    dynarray<uint8_t> file;
+    gif_decoder decoder;
+
+    // images that frames are decoded into
+    dynarray<ref<image> > ring;
+    unsigned ring_pos;
+
+    // current frame and how long it stays on screen
+    image *current;
+    unsigned frame_ms;
+    unsigned time_ms;
+
+    dynarray<uint8_t> pixels;
+
+    void init(const char *url, unsigned ring_size) {
+      this->url = url;
+      ring_pos = 0;
+      current = 0;
+      frame_ms = 0;
+      time_ms = 0;
+      ring.resize(ring_size ? ring_size : 1);
+      for (unsigned i = 0; i != ring.size(); ++i) {
+        ring[i] = new image();
+      }
+    }
+
+  public:
+    RESOURCE_META(animated_image)
+
+    /// make an empty animation.
+    animated_image() {
+      init("", 2);
+    }
+
+    /// Animation from a gif file. ring_size is the number of frames that can be used at once.
+    animated_image(const char *url, unsigned ring_size = 2) {
+      init(url, ring_size);
+    }
+
+    /// access attributes by name
+    void visit(visitor &v) {
+      v.visit(url, atom_url);
+    }
+
+    /// load the file and decode the first frame.
+    bool load() {
+      file.resize(0);
+      app_utils::get_url(file, url.c_str());
+      if (file.size() == 0 || !decoder.begin_frames(file.data(), file.data() + file.size())) {
+        return false;
+      }
+      time_ms = 0;
+      return next_frame() != 0;
+    }
+
+    /// Decode the next frame into the next image of the ring.
+    image *next_frame() {
+      if (file.size() == 0) {
+        // load() decodes the first frame
+        return load() ? current : 0;
+      }
+
+      if (!decoder.next_frame(pixels, frame_ms)) return 0;
+      image *img = ring[ring_pos];
+      ring_pos = ring_pos + 1 == ring.size() ? 0 : ring_pos + 1;
+      img->set_pixels(GL_RGBA, (uint16_t)decoder.get_width(), (uint16_t)decoder.get_height(), pixels.data());
+      current = img;
+      return img;
+    }
+
+    /// Advance time by delta_ms and return the image for the current frame.
+    image *update(unsigned delta_ms) {
+      if (!current && !next_frame()) return 0;
+
+      time_ms += delta_ms;
+      // frames with no delay are shown for 100ms, as browsers do.
+      unsigned ms = frame_ms ? frame_ms : 100;
+      while (time_ms >= ms) {
+        time_ms -= ms;
+        if (!next_frame()) break;
+        ms = frame_ms ? frame_ms : 100;
+      }
+      return current;
+    }
+
+    /// the image for the current frame.
+    image *get_image() const {
+      return current;
+    }
+
+    /// number of frames decoded so far.
+    unsigned get_frame_index() const {
+      return decoder.get_frame_index();
+    }
+  };
+}}
@@ -36,6 +36,9 @@ namespace octet { namespace scene {
     float xscale;
     float yscale;
 
+    // world space frustum planes, dot(plane.xyz(), pos) + plane.w() >= 0 inside.
+    vec4 frustum_planes[6];
+
   public:
     RESOURCE_META(camera_instance)
 
@@ -126,6 +129,8 @@ namespace octet { namespace scene {
         }
         cameraToProjection.frustum(-near_plane * xscale, near_plane * xscale, -near_plane * yscale, near_plane * yscale, near_plane, far_plane);
       }
+
+      (worldToCamera * cameraToProjection).get_frustum_planes(frustum_planes);
     }
 
     /// call this many times to build matrices for uniforms.
@@ -144,6 +149,12 @@ namespace octet { namespace scene {
       return cameraToProjection;
     }
 
+    /// The six world space planes of the view frustum from the last set_cameraToWorld():
+    /// left, right, bottom, top, near and far, with normals pointing inwards.
+    const vec4 *get_frustum_planes() const {
+      return frustum_planes;
+    }
+
     /// return a ray from screen (x, y) to the far plane; used for picking.
     ray get_ray(float x, float y) {
       vec4 ray_start, ray_end;
@@ -31,12 +31,22 @@ namespace octet { namespace scene {
     uint8_t mip_levels;
     uint8_t cube_faces;
 
+    // mip chain options
+    uint8_t mip_filter;
+    bool srgb;
+
     // derived attributes (not for saving)
     // todo: use gl_resource
     GLuint gl_texture;
 
     GLuint gl_target;
 
+    // decoding and mip chain being done on the job pool
+    job_group mip_jobs;
+
+    // files read by start_load() for the job pool to decode
+    dynarray<dynarray<uint8_t> > files;
+
     void init(const char *name) {
       bool is_cubemap = strstr(name, "%s") != 0;
       this->url = name;
@@ -47,6 +57,9 @@ namespace octet { namespace scene {
       mip_levels = 1;
       cube_faces = is_cubemap ? 6 : 1;
       format = 0;
+      frames = 1;
+      mip_filter = mipmap_builder::filter_box;
+      srgb = false;
     }
 
     // these are here to avoid including glext.h which may be platform dependent.
@@ -62,41 +75,133 @@ namespace octet { namespace scene {
       COMPRESSED_RGBA_S3TC_DXT1_EXT = 0x83F1,
       COMPRESSED_RGBA_S3TC_DXT3_EXT = 0x83F2,
       COMPRESSED_RGBA_S3TC_DXT5_EXT = 0x83F3,
+      COMPRESSED_RED_RGTC1 = 0x8DBB,
+      COMPRESSED_RG_RGTC2 = 0x8DBD,
     };
 
-    /// Make mipmaps for this image.
+    /// true if the GL can use this compressed format.
+    static bool is_compression_supported(unsigned format) {
+      const char *ext = (const char*)glGetString(GL_EXTENSIONS);
+      // core profiles do not list extensions here, but they all have these formats.
+      if (!ext) return true;
+      if (format == COMPRESSED_RED_RGTC1 || format == COMPRESSED_RG_RGTC2) {
+        return strstr(ext, "texture_compression_rgtc") != 0;
+      }
+      return strstr(ext, "texture_compression_s3tc") != 0 || (format == COMPRESSED_RGB_S3TC_DXT1_EXT && strstr(ext, "texture_compression_dxt1") != 0);
+    }
+
+    /// Decode compressed levels to RGBA for GLs that can't use them.
+    void decompress() {
+      unsigned block_size = bc_decoder::get_block_size(format);
+      if (!block_size) return;
+
+      dynarray<uint8_t> blocks(bytes);
+      unsigned full_levels = mipmap_builder::get_num_levels(width, height);
+      unsigned levels = mip_levels == full_levels ? full_levels : 1;
+      bytes.resize((unsigned)mipmap_builder::get_chain_pixels(width, height, full_levels) * 4);
+
+      const uint8_t *src = blocks.data();
+      uint8_t *dest = bytes.data();
+      unsigned w = width, h = height;
+      for (unsigned level = 0; level != levels; ++level) {
+        bc_decoder::decode(dest, src, format, w, h);
+        src += bc_decoder::get_level_size(format, w, h);
+        dest += w * h * 4;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+      }
+
+      format = RGBA;
+      mip_levels = (uint8_t)levels;
+      if (levels != full_levels) {
+        make_mipmaps();
+      }
+    }
+
+    unsigned get_num_comps() const {
+      return format == RGBA ? 4 : format == RGB ? 3 : format == LUMINANCE_ALPHA ? 2 : 1;
+    }
+
+    /// Make mipmaps for this image. Level 0 of each face must already be in bytes.
     void make_mipmaps() {
       if (format != RGB && format != RGBA) return;
+      if (gl_target != GL_TEXTURE_2D && gl_target != GL_TEXTURE_CUBE_MAP) return;
 
-      bytes.resize(bytes.size() * 4 / 3);
+      unsigned num_comps = get_num_comps();
+      bytes.resize((unsigned)mipmap_builder::chain_size(width, height, num_comps, cube_faces));
 
-      unsigned num_comps = format == RGB ? 3 : 4;
-      uint8_t *src = &bytes[0];
-      uint8_t *dest = &bytes[width * height * num_comps];
-      unsigned w = width;
-      unsigned h = height;
-      unsigned stride = w * num_comps;
-      mip_levels = 0;
-      while (w > 1 && h > 1) {
-        for (unsigned y = 0; y < h/2; ++y) {
-          for (unsigned x = 0; x < w/2; ++x) {
-            // this is a rather dreadful box filter, it is simple to make, but introduces
-            // artifacts. We can do better than this.
-            for (unsigned i = 0; i != num_comps; ++i) {
-              *dest++ = ( src[0] + src[num_comps] + src[stride] + src[stride+num_comps] + 3 ) >> 2;
-              src++;
-            }
-            src += num_comps;
-          }
-          src += stride;
+      mipmap_builder builder(num_comps, (mipmap_builder::filter_t)mip_filter, srgb);
+      mip_levels = (uint8_t)builder.build(bytes.data(), width, height, cube_faces);
+    }
+
+    /// Build the mip chain on the job pool so that loading can carry on.
+    void start_mipmaps() {
+      job_pool::get().add(mip_jobs, [this]() { make_mipmaps(); });
+    }
+
+    /// Read the file, or the six faces of a cube map, into files.
+    /// This stays on the calling thread as app_utils::get_path is not thread safe.
+    void read_files() {
+      if (cube_faces == 6) {
+        static const char *face_names[] = { "left", "right", "top", "bottom", "front", "back" };
+        string x;
+        files.resize(6);
+        for (unsigned i = 0; i != 6; ++i) {
+          x.format(url, face_names[i]);
+          app_utils::get_url(files[i], x.c_str());
         }
-        w >>= 1;
-        h >>= 1;
-        stride >>= 1;
-        mip_levels++;
+      } else {
+        files.resize(1);
+        app_utils::get_url(files[0], url.c_str());
+      }
+    }
+
+    /// Decode the files from read_files() into level 0.
+    void decode_files() {
+      bytes.resize(0);
+      for (unsigned i = 0; i != files.size(); ++i) {
+        decode_part(files[i]);
+      }
+      files.reset();
+    }
+
+    /// decode one file and add it to the end of level 0.
+    void decode_part(const dynarray<uint8_t> &buffer) {
+      const unsigned char *src = buffer.data();
+      const unsigned char *src_max = src + buffer.size();
+
+      // decoders replace their output, so decode faces after the first separately.
+      dynarray<uint8_t> part;
+      dynarray<uint8_t> &dest = bytes.size() ? part : bytes;
+
+      if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF89a", 6)) {
+        gif_decoder dec;
+        dec.get_image(dest, format, width, height, src, src_max);
+      } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
+        jpeg_decoder dec;
+        dec.get_image(dest, format, width, height, src, src_max);
+      } else if (buffer.size() >= 6 && buffer[0] == 0 && buffer[1] == 0 && buffer[2] == 2) {
+        tga_decoder dec;
+        dec.get_image(dest, format, width, height, src, src_max);
+      } else if (buffer.size() >= 4 && buffer[0] == 'D' && buffer[1] == 'D' && buffer[2] == 'S' && buffer[3] == ' ') {
+        dds_decoder dec;
+        unsigned num_levels = 1;
+        dec.get_image(dest, format, width, height, num_levels, src, src_max);
+        mip_levels = (uint8_t)num_levels;
+      } else if (buffer.size() >= 348 && (!memcmp(&buffer[344], "ni1", 4) || !memcmp(&buffer[344], "n+1", 4))) {
+        nifti_decoder dec;
+        gl_target = GL_TEXTURE_3D;
+        dec.get_image(dest, format, width, height, depth, frames, src, src_max);
+      } else {
+        printf("warning: unknown texture format\n");
+        return;
+      }
+
+      if (&dest == &part) {
+        unsigned old_size = bytes.size();
+        bytes.resize(old_size + part.size());
+        memcpy(&bytes[old_size], &part[0], part.size());
       }
-      assert(dest - &bytes[0] < (int)bytes.size());
-      //printf("%d %d\n", dest - &bytes[0], bytes.size());
     }
 
     /// DXT encode the image, making it smaller and grainier.
@@ -216,37 +321,59 @@ namespace octet { namespace scene {
     void add_texture() {
       glBindTexture(gl_target, gl_texture);
 
-      if (mip_levels == 1 || gl_target != GL_TEXTURE_2D) {
+      // rows are tightly packed: RGB rows and the small levels of a chain are not 4 byte aligned.
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      unsigned num_comps = get_num_comps();
+      if (gl_target == GL_TEXTURE_3D) {
+        glTexImage3D(gl_target, 0, format, width, height, depth, 0, format, GL_UNSIGNED_BYTE, (void*)&bytes[0]);
+      } else if (mip_levels == 1) {
         if (gl_target == GL_TEXTURE_2D) {
           glTexImage2D(gl_target, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, (void*)&bytes[0]);
-          // this may not work on very old systems, comment it out.
-          glGenerateMipmap(gl_target);
-        } else if (gl_target == GL_TEXTURE_3D) {
-          glTexImage3D(gl_target, 0, format, width, height, 1, 0, format, GL_UNSIGNED_BYTE, (void*)&bytes[0]);
-          printf("err=%08x\n", glGetError());
         } else if (gl_target == GL_TEXTURE_CUBE_MAP) {
-          unsigned num_comps = format == RGBA ? 4 : 3;
           for (int i = 0; i != 6; ++i) {
             size_t offset = width * height * num_comps * i;
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, (void*)&bytes[offset]);
-            //static const unsigned cols[6] = { 0xff0000ff, 0xffff00ff, 0xffffffff, 0xff00ffff, 0x0000ffff, 0x00ffffff };
-            //glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, 1, 1, 0, format, GL_UNSIGNED_BYTE, (void*)&cols[i]);
           }
-          glGenerateMipmap(gl_target);
         }
-      } else if (gl_target == GL_TEXTURE_2D) {
-        unsigned num_comps = format == RGBA ? 4 : 3;
+        // this may not work on very old systems, comment it out.
+        glGenerateMipmap(gl_target);
+      } else {
+        // upload our own mip chain, all the faces of each level together.
         unsigned w = width;
         unsigned h = height;
         uint8_t *src = &bytes[0];
-        unsigned level = 0;
-        while (w != 0 && h != 0) {
-          glTexImage2D(gl_target, level++, format, w, h, 0, format, GL_UNSIGNED_BYTE, (void*)src);
-          src += w * h * num_comps;
-          w >>= 1;
-          h >>= 1;
+        for (unsigned level = 0; level != mip_levels; ++level) {
+          for (unsigned i = 0; i != cube_faces; ++i) {
+            GLuint face_target = gl_target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : gl_target;
+            glTexImage2D(face_target, level, format, w, h, 0, format, GL_UNSIGNED_BYTE, (void*)src);
+            src += w * h * num_comps;
+          }
+          w = w > 1 ? w / 2 : 1;
+          h = h > 1 ? h / 2 : 1;
         }
       }
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    // replace the pixels of a 2D texture made by add_texture() with the same size, format and levels.
+    // this keeps the storage, so the driver does not have to allocate it again.
+    void update_texture() {
+      glBindTexture(gl_target, gl_texture);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      unsigned num_comps = get_num_comps();
+      unsigned w = width;
+      unsigned h = height;
+      uint8_t *src = &bytes[0];
+      for (unsigned level = 0; level != mip_levels; ++level) {
+        glTexSubImage2D(gl_target, level, 0, 0, w, h, format, GL_UNSIGNED_BYTE, (void*)src);
+        src += w * h * num_comps;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+      }
+      if (mip_levels == 1) {
+        glGenerateMipmap(gl_target);
+      }
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     }
 
   public:
@@ -269,10 +396,17 @@ namespace octet { namespace scene {
       width = _width;
       height = _height;
       depth = _depth; // for 3D textures
+      frames = 1;
+      format = 0;
+      mip_levels = 1;
+      cube_faces = _target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+      mip_filter = mipmap_builder::filter_box;
+      srgb = false;
     }
 
     /// release resources.
     ~image() {
+      wait_for_mipmaps();
     }
 
     /// width in pixels
@@ -295,13 +429,69 @@ namespace octet { namespace scene {
       return gl_target;
     }
 
+    /// GL_RGB, GL_RGBA, GL_ALPHA etc. or a compressed format.
+    unsigned get_format() const {
+      return format;
+    }
+
+    /// Get the top mip level of the image, loading it if necessary.
+    /// Compressed images are decoded to RGBA first. Returns NULL if there are no pixels.
+    const uint8_t *get_pixels() {
+      wait_for_mipmaps();
+      if (bytes.size() == 0 || width == 0 || height == 0) {
+        load();
+        wait_for_mipmaps();
+      }
+      decompress();
+      return bytes.size() ? &bytes[0] : 0;
+    }
+
     /// animated textures have multiple frames. eg. MPEG file. return ~0 for infinite.
     unsigned get_frames() const {
       return frames;
     }
 
+    /// Choose the filter used to build the mip chain. Call before the image is loaded.
+    void set_mip_filter(mipmap_builder::filter_t filter) {
+      mip_filter = (uint8_t)filter;
+    }
+
+    /// Set if the colour components are sRGB encoded (most photos and painted textures are).
+    /// The mip chain is then filtered in linear space. Call before the image is loaded.
+    void set_srgb(bool value) {
+      srgb = value;
+    }
+
+    /// Replace the pixels with a new 8-bit RGB or RGBA image, for example the next frame of an animation.
+    /// If there is a GL texture already, it is updated; in place if the size and format are the same.
+    void set_pixels(uint16_t new_format, uint16_t new_width, uint16_t new_height, const uint8_t *pixels) {
+      wait_for_mipmaps();
+      bool same_size = format == new_format && width == new_width && height == new_height;
+      unsigned old_mip_levels = mip_levels;
+      format = new_format;
+      width = new_width;
+      height = new_height;
+      mip_levels = 1;
+      bytes.resize(width * height * get_num_comps());
+      memcpy(&bytes[0], pixels, bytes.size());
+      make_mipmaps();
+      if (gl_texture) {
+        if (same_size && mip_levels == old_mip_levels && gl_target == GL_TEXTURE_2D) {
+          update_texture();
+        } else {
+          add_texture();
+        }
+      }
+    }
+
+    /// Wait for the mip chain to be built after load(), or the image to be decoded after start_load().
+    void wait_for_mipmaps() {
+      mip_jobs.wait();
+    }
+
     /// access attributes by name
     void visit(visitor &v) {
+      wait_for_mipmaps();
       v.visit(url, atom_url);
       v.visit(bytes, atom_bytes);
       v.visit(format, atom_format);
@@ -311,91 +501,77 @@ namespace octet { namespace scene {
       v.visit(cube_faces, atom_cube_faces);
     }
 
-    /// load the image from a url
+    /// Load the image from a url. The file is decoded now; the mip chain is built on the job pool
+    /// and anything that uses the pixels waits for it. Other work only overlaps with the mip chain
+    /// if it comes before the first use; to overlap the decoding too, use start_load().
     void load() {
-      string x;
-      if (cube_faces == 6) {
-        bytes.resize(0);
-        x.format(url, "left");
-        load_part(x.c_str());
-        x.format(url, "right");
-        load_part(x.c_str());
-        x.format(url, "top");
-        load_part(x.c_str());
-        x.format(url, "bottom");
-        load_part(x.c_str());
-        x.format(url, "front");
-        load_part(x.c_str());
-        x.format(url, "back");
-        load_part(x.c_str());
-      } else {
-        bytes.resize(0);
-        load_part(url.c_str());
+      wait_for_mipmaps();
+      read_files();
+      decode_files();
+
+      if (bytes.size() != 0) {
+        start_mipmaps();
       }
     }
 
+    /// Read the file now and decode it and build the mip chain on the job pool.
+    /// Start all the images of a scene like this before using any of them, so that they are
+    /// decoded in parallel. get_pixels(), get_gl_texture() and visit() wait for the image;
+    /// wait on the group that this returns before calling get_width() or get_height().
+    ///
+    ///     for (unsigned i = 0; i != images.size(); ++i) images[i]->start_load();
+    job_group &start_load() {
+      wait_for_mipmaps();
+      read_files();
+      job_pool::get().add(mip_jobs, [this]() {
+        decode_files();
+        if (bytes.size() != 0) make_mipmaps();
+      });
+      return mip_jobs;
+    }
+
+    /// decode one file and add it to the end of level 0.
     void load_part(const char *_url) {
       dynarray<uint8_t> buffer;
       app_utils::get_url(buffer, _url);
-      const unsigned char *src = &buffer[0];
-      const unsigned char *src_max = src + buffer.size();
-      if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF89a", 6)) {
-        gif_decoder dec;
-        dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
-        jpeg_decoder dec;
-        dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0 && buffer[1] == 0 && buffer[2] == 2) {
-        tga_decoder dec;
-        dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 4 && buffer[0] == 'D' && buffer[1] == 'D' && buffer[2] == 'S' && buffer[3] == ' ') {
-        dds_decoder dec;
-        dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 348 && (!memcmp(&buffer[344], "ni1", 4) || !memcmp(&buffer[344], "n+1", 4))) {
-        nifti_decoder dec;
-        gl_target = GL_TEXTURE_3D;
-        dec.get_image(bytes, format, width, height, depth, frames, src, src_max);
-      } else {
-        printf("warning: unknown texture format\n");
-        return;
-      }
-
-      make_mipmaps();
-      //dxt_encode();
+      decode_part(buffer);
     }
 
     /// get the OpenGL texture handle for this image.
     GLuint get_gl_texture() {
       if (!gl_texture) {
+        wait_for_mipmaps();
         if (bytes.size() == 0 || width == 0 || height == 0) {
           load();
+          wait_for_mipmaps();
         }
 
         // make a new texture handle
         glGenTextures(1, &gl_texture);
         glActiveTexture(GL_TEXTURE0);
 
-        // todo: handle compressed textures
+        if (bc_decoder::get_block_size(format) && !is_compression_supported(format)) {
+          decompress();
+        }
+
         if (format == GL_RGB || format == GL_RGBA) {
           add_texture();
-        } else if (format == COMPRESSED_RGB_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT3_EXT || format == COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+        } else if (bc_decoder::get_block_size(format)) {
           glBindTexture(gl_target, gl_texture);
           unsigned w = width;
           unsigned h = height;
           uint8_t *src = &bytes[0];
-          unsigned level = 0;
-          unsigned shift = ( format == COMPRESSED_RGB_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT1_EXT ) ? 1 : 0;
-          while (w != 0 && h != 0) {
-            unsigned wmin = w < 4 ? 4 : w;
-            unsigned hmin = h < 4 ? 4 : h;
-            unsigned size = ( wmin * hmin ) >> shift;
-            glCompressedTexImage2D(gl_target, level++, format, w, h, 0, size, (void*)src);
-            //printf("%d\n", glGetError());
+          for (unsigned level = 0; level != mip_levels; ++level) {
+            unsigned size = bc_decoder::get_level_size(format, w, h);
+            glCompressedTexImage2D(gl_target, level, format, w, h, 0, size, (void*)src);
             src += size;
-            w >>= 1;
-            h >>= 1;
+            w = w > 1 ? w / 2 : 1;
+            h = h > 1 ? h / 2 : 1;
           }
-          //printf("%d %d\n", src - image_, size);
+          #ifdef GL_TEXTURE_MAX_LEVEL
+            // files without a full mip chain
+            glTexParameteri(gl_target, GL_TEXTURE_MAX_LEVEL, mip_levels - 1);
+          #endif
         }
 
         glTexParameteri(gl_target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
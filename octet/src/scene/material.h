@@ -24,6 +24,77 @@ namespace octet { namespace scene {
     //dynarray<uint8_t> static_buffer;
     dynarray<uint8_t> buffer;
 
+    // drawn after the opaque materials, back to front.
+    bool transparent;
+
+    // the uniforms that change for each instance, found when params changes size.
+    enum { instance_modelToProjection, instance_modelToCamera, instance_decode, num_instance_params = instance_decode + mesh::num_decodes };
+    param_uniform *instance_params[num_instance_params];
+    unsigned num_params_found;
+
+    // locations of the uniforms in the shader's instanced variant, one for each param.
+    dynarray<GLint> instanced_locations;
+    GLint instanced_cameraToProjection;
+
+    // true between render_material(..., true) and the next render_material().
+    bool rendering_instanced;
+
+    void find_instance_params() {
+      if (num_params_found == params.size()) return;
+      static const atom_t names[num_instance_params] = {
+        atom_modelToProjection, atom_modelToCamera, atom_pos_scale, atom_pos_offset, atom_uv_decode, atom_normal_decode
+      };
+      for (unsigned i = 0; i != num_instance_params; ++i) {
+        instance_params[i] = get_param_uniform(names[i]);
+      }
+
+      shader *variant = custom_shader ? custom_shader->get_instanced() : NULL;
+      instanced_locations.resize(params.size());
+      for (unsigned i = 0; i != params.size(); ++i) {
+        param_uniform *pu = params[i]->get_param_uniform();
+        instanced_locations[i] = variant && pu ? variant->get_uniform_location(pu->get_atom_name()) : -1;
+      }
+      instanced_cameraToProjection = variant ? variant->get_uniform_location("cameraToProjection") : -1;
+      num_params_found = params.size();
+    }
+
+    bool is_instance_param(param_uniform *pu) const {
+      for (unsigned i = 0; i != num_instance_params; ++i) {
+        if (instance_params[i] == pu) return true;
+      }
+      return false;
+    }
+
+    // upload a uniform to the program in use.
+    void render_param(param_uniform *pu) {
+      if (!rendering_instanced) {
+        pu->render(buffer.data());
+        return;
+      }
+      for (unsigned i = 0; i != params.size(); ++i) {
+        if (params[i] == pu) {
+          pu->render_location(buffer.data(), instanced_locations[i]);
+          return;
+        }
+      }
+    }
+
+    // set and upload one of the instance uniforms.
+    void render_instance_param(unsigned index, const void *value, unsigned size) {
+      param_uniform *pu = instance_params[index];
+      if (pu) {
+        pu->set_value(buffer.data(), value, size);
+        render_param(pu);
+      }
+    }
+
+    void init_state() {
+      transparent = false;
+      num_params_found = ~0u;
+      instanced_cameraToProjection = -1;
+      rendering_instanced = false;
+    }
+
     // create the parameters that change frequently such as the matrices and lighting
     void create_dynamic_params() {
       buffer.reserve(0x200);
@@ -33,6 +104,12 @@ namespace octet { namespace scene {
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_modelToCamera, GL_FLOAT_MAT4, 1, param::stage_vertex));
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_lighting, GL_FLOAT_VEC4, ambient_size + max_lights * light_size, param::stage_fragment));
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_num_lights, GL_INT, 1, param::stage_fragment));
+
+      // decode for quantised vertex attributes, see mesh::quantize()
+      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_pos_scale, GL_FLOAT_VEC4, 1, param::stage_vertex));
+      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_pos_offset, GL_FLOAT_VEC4, 1, param::stage_vertex));
+      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_uv_decode, GL_FLOAT_VEC4, 1, param::stage_vertex));
+      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_normal_decode, GL_FLOAT_VEC4, 1, param::stage_vertex));
     }
 
     // create the attribute parameters
@@ -53,10 +130,14 @@ namespace octet { namespace scene {
 
     /// Default constructor makes a blank material.
     material() {
+      init_state();
     }
 
     /// Alternative constructor.
     material(const vec4 &color, param_shader *shader = NULL) {
+      init_state();
+      transparent = color.w() < 1;
+
       // materials are constructed from parameters which build the final shader.
       // this allows us to use OpenGLES2 (uniforms) and 3 (buffers) as well as new shader features.
       params.reserve(16);
@@ -76,6 +157,7 @@ namespace octet { namespace scene {
 
     /// create a material from an existing image
     material(image *img, sampler *smpl = NULL, param_shader *shader = NULL) {
+      init_state();
       if (!smpl) smpl = new sampler();
 
       params.reserve(16);
@@ -94,6 +176,7 @@ namespace octet { namespace scene {
     }
 
     material(param *diffuse, param *ambient, param *emission, param *specular, param *bump, param *shininess) {
+      init_state();
     }
 
     /// Serialize.
@@ -101,41 +184,95 @@ namespace octet { namespace scene {
     }
 
     /// Set the uniforms for this material.
-    void render(const mat4t &modelToProjection, const mat4t &modelToCamera, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+    /// msh, if given, supplies the decode for quantised vertex attributes.
+    void render(const mat4t &modelToProjection, const mat4t &modelToCamera, vec4 *light_uniforms, int num_light_uniforms, int num_lights, const mesh *msh = NULL) {
       /*char tmp[256];
       log("lu[0] = %s\n", light_uniforms[0].toString(tmp, sizeof(tmp)));
       log("lu[1] = %s\n", light_uniforms[1].toString(tmp, sizeof(tmp)));
       log("lu[2] = %s\n", light_uniforms[2].toString(tmp, sizeof(tmp)));
       log("lu[3] = %s\n", light_uniforms[3].toString(tmp, sizeof(tmp)));*/
-      {
-        // matrices and lighting go in the dynamic uniform buffer
-        param_uniform *modelToProjection_param = get_param_uniform(atom_modelToProjection);
-        if (modelToProjection_param) modelToProjection_param->set_value(buffer.data(), modelToProjection.get(), sizeof(modelToProjection));
+      render_material(light_uniforms, num_light_uniforms, num_lights);
+      render_decode(msh);
+      render_matrices(modelToProjection, modelToCamera);
+    }
 
-        param_uniform *modelToCamera_param = get_param_uniform(atom_modelToCamera);
-        if (modelToCamera_param) modelToCamera_param->set_value(buffer.data(), modelToCamera.get(), sizeof(modelToCamera));
+    /// Set the state shared by all the instances drawn with this material: the program,
+    /// lighting, colours and textures. Follow with render_decode() and render_matrices().
+    /// use_program = false skips glUseProgram() if the program is already in use.
+    /// instanced = true uses the shader's instanced variant (see has_instanced_program());
+    /// follow with render_decode() and render_instanced_matrices() instead.
+    void render_material(const vec4 *light_uniforms, int num_light_uniforms, int num_lights, bool use_program = true, bool instanced = false) {
+      find_instance_params();
+      rendering_instanced = instanced && has_instanced_program();
 
-        param_uniform *lighting_param = get_param_uniform(atom_lighting);
-        if (lighting_param) lighting_param->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
+      param_uniform *lighting_param = get_param_uniform(atom_lighting);
+      if (lighting_param) lighting_param->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
 
-        param_uniform *num_lights_param = get_param_uniform(atom_num_lights);
-        if (num_lights_param) num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
-      }
+      param_uniform *num_lights_param = get_param_uniform(atom_num_lights);
+      if (num_lights_param) num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
 
-      custom_shader->render();
+      if (use_program) glUseProgram(get_program(rendering_instanced));
 
-      {
-        // colours and textures go in the static uniform buffer
-        for (unsigned i = 0; i != params.size(); ++i) {
-          param_uniform *pu = params[i]->get_param_uniform();
-          if (pu) {
-            //printf("%s: %d off=%x\n", app_utils::get_atom_name(pu->get_name()), pu->get_uniform_buffer_index(), pu->get_offset());
+      // lighting, colours and textures; the instance uniforms come later.
+      for (unsigned i = 0; i != params.size(); ++i) {
+        param_uniform *pu = params[i]->get_param_uniform();
+        if (pu && !is_instance_param(pu)) {
+          //printf("%s: %d off=%x\n", app_utils::get_atom_name(pu->get_name()), pu->get_uniform_buffer_index(), pu->get_offset());
+          if (rendering_instanced) {
+            pu->render_location(buffer.data(), instanced_locations[i]);
+          } else {
             pu->render(buffer.data());
           }
         }
       }
     }
 
+    /// Set the decode for msh's quantised vertex attributes (see mesh::quantize()).
+    /// Only needed when the mesh changes.
+    void render_decode(const mesh *msh) {
+      find_instance_params();
+      const vec4 *decode = msh ? msh->get_attribute_decode() : mesh::get_default_attribute_decode();
+      for (unsigned i = 0; i != mesh::num_decodes; ++i) {
+        render_instance_param(instance_decode + i, &decode[i], sizeof(vec4));
+      }
+    }
+
+    /// Set the matrices for one instance.
+    void render_matrices(const mat4t &modelToProjection, const mat4t &modelToCamera) {
+      find_instance_params();
+      render_instance_param(instance_modelToProjection, modelToProjection.get(), sizeof(modelToProjection));
+      render_instance_param(instance_modelToCamera, modelToCamera.get(), sizeof(modelToCamera));
+    }
+
+    /// Set the camera for instanced drawing. The model to camera matrices come from an instance_buffer.
+    void render_instanced_matrices(const mat4t &cameraToProjection) {
+      find_instance_params();
+      glUniformMatrix4fv(instanced_cameraToProjection, 1, GL_FALSE, cameraToProjection.get());
+    }
+
+    /// The GL program used by render_material().
+    GLuint get_program(bool instanced = false) const {
+      if (instanced && has_instanced_program()) return custom_shader->get_instanced()->get_program();
+      return custom_shader ? custom_shader->get_program() : 0;
+    }
+
+    /// True if the shader has a variant that reads per-instance matrices,
+    /// so that many instances can share a draw call. See param_shader.
+    bool has_instanced_program() const {
+      return custom_shader && custom_shader->get_instanced();
+    }
+
+    /// Transparent materials are drawn after the opaque ones, furthest first.
+    /// Materials made from a color with alpha less than one start transparent.
+    bool is_transparent() const {
+      return transparent;
+    }
+
+    /// Draw this material with the transparent ones.
+    void set_transparent(bool value) {
+      transparent = value;
+    }
+
     /// Set the uniforms for this material on skinned meshes.
     void render_skinned(const mat4t &cameraToProjection, const mat4t *modelToCamera, int num_nodes, vec4 *light_uniforms, int num_light_uniforms, int num_lights) const {
       //shader.render_skinned(cameraToProjection, modelToCamera, num_nodes, light_uniforms, num_light_uniforms, num_lights);
@@ -162,6 +299,7 @@ namespace octet { namespace scene {
     void set_diffuse(const vec4 &color) {
       if (param *p = get_param_uniform(atom_diffuse)) {
         p->get_param_uniform()->set_value(buffer.data(), &color, sizeof(color));
+        transparent = color.w() < 1;
       }
     }
 
@@ -178,9 +316,10 @@ namespace octet { namespace scene {
       param_uniform *result = new param_uniform(pbi, data, name, _type, _repeat, _stage);
       params.push_back(result);
 
-      param_bind_info pbind;
-      pbind.program = custom_shader->get_program();
-      result->bind(pbind);
+      param_bind_info pbind;
+      pbind.program = custom_shader->get_program();
+      pbind.owner = custom_shader;
+      result->bind(pbind);
       return result;
     }
 
@@ -191,8 +330,9 @@ namespace octet { namespace scene {
       params.push_back(result);
 
       param_bind_info pbind;
-      pbind.program = custom_shader->get_program();
-      result->bind(pbind);
+      pbind.program = custom_shader->get_program();
+      pbind.owner = custom_shader;
+      result->bind(pbind);
       return result;
     }
   };
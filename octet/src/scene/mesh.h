@@ -25,6 +25,34 @@ namespace octet { namespace scene {
       }
     };
 
+    /// Vertex shader uniforms that decode quantised attributes. See quantize().
+    enum {
+      decode_pos_scale,   // pos.xyz = stored.xyz * pos_scale.xyz + pos_offset.xyz
+      decode_pos_offset,
+      decode_uv,          // uv = stored.xy * uv_decode.xy + uv_decode.zw
+      decode_normal,      // normal_decode.x != 0: normal.xy is octahedral
+      num_decodes
+    };
+
+    /// Compact encodings for quantize()
+    enum quantize_flags {
+      quantize_pos_unorm16 = 1 << 0,  // unorm16 positions within the AABB
+      quantize_pos_half = 1 << 1,     // half float positions relative to the AABB centre
+      quantize_normal_oct = 1 << 2,   // octahedral snorm16 normals
+      quantize_uv_unorm16 = 1 << 3,   // unorm16 uvs within their range
+      quantize_default = quantize_pos_unorm16 | quantize_normal_oct | quantize_uv_unorm16,
+    };
+
+    /// A group of nearby triangles that can be culled together. See mesh_clusters.
+    struct cluster {
+      vec3p center;           // bounding sphere in model space
+      float radius;
+      vec3p cone_axis;        // mean normal of the triangles
+      float cone_cutoff;      // all back facing if dot(center - eye, cone_axis) >= cone_cutoff * |center - eye| + radius
+      uint32_t first_index;   // triangles, after get_first_index()
+      uint32_t num_indices;
+    };
+
     // sortable edge
     struct edge {
       int32_t idx0;
@@ -57,6 +85,12 @@ namespace octet { namespace scene {
     // bounding box
     aabb mesh_aabb;
 
+    // decode uniforms for quantised attributes
+    vec4 attribute_decode[num_decodes];
+
+    // optional clusters for draw_clusters()
+    dynarray<cluster> clusters;
+
     struct general_vertex {
       const uint8_t *bytes;
       unsigned size;
@@ -106,9 +140,50 @@ namespace octet { namespace scene {
       return dot(normal, dir) <= 0;
     }
 
-    /// Get a vec4 value of an attribute.
+    // octahedral normal encoding: the unit sphere folded onto a square.
+    static vec2 oct_encode(vec3_in n) {
+      float len = fabsf(n.x()) + fabsf(n.y()) + fabsf(n.z());
+      if (len == 0) return vec2(0, 0);
+      vec2 e = n.xy() * (1.0f / len);
+      if (n.z() < 0) {
+        e = vec2(
+          (1 - fabsf(e.y())) * (e.x() >= 0 ? 1 : -1),
+          (1 - fabsf(e.x())) * (e.y() >= 0 ? 1 : -1)
+        );
+      }
+      return e;
+    }
+
+    // same as oct_decode() in the shaders.
+    static vec3 oct_decode(vec2_in e) {
+      vec3 n(e.x(), e.y(), 1 - fabsf(e.x()) - fabsf(e.y()));
+      float t = std::max(-n.z(), 0.0f);
+      n = vec3(n.x() + (n.x() >= 0 ? -t : t), n.y() + (n.y() >= 0 ? -t : t), n.z());
+      return n.normalize();
+    }
+
+    // apply the shader decode for an attribute.
+    vec4 decode_value(unsigned attr, vec4_in value) const {
+      switch (attr) {
+        case attribute_pos: {
+          vec3 pos = value.xyz() * attribute_decode[decode_pos_scale].xyz() + attribute_decode[decode_pos_offset].xyz();
+          return vec4(pos, value.w());
+        }
+        case attribute_normal: {
+          return attribute_decode[decode_normal].x() != 0 ? vec4(oct_decode(value.xy()), 0) : value;
+        }
+        case attribute_uv: {
+          const vec4 &uv = attribute_decode[decode_uv];
+          return vec4(value.xy() * uv.xy() + vec2(uv.z(), uv.w()), value.z(), value.w());
+        }
+      }
+      return value;
+    }
+
+    /// Get a vec4 value of an attribute, decoded as the shader would see it.
     vec4 get_value(const uint8_t *bytes, unsigned slot, unsigned index) const {
       unsigned size = get_size(slot);
+      bool norm = ((normalized >> slot) & 1) != 0;
       vec4 result = vec4(0, 0, 0, 0);
       bytes += stride * index + get_offset(slot);
     
@@ -117,8 +192,17 @@ namespace octet { namespace scene {
           const float *src = (const float*)(bytes);
           result = vec4(src[0], size > 1 ? src[1] : 0, size > 2 ? src[2] : 0, size > 3 ? src[3] : 1);
      	  } break;
+        case GL_HALF_FLOAT: {
+          const uint16_t *src = (const uint16_t*)(bytes);
+          result = vec4(half_to_float(src[0]), size > 1 ? half_to_float(src[1]) : 0, size > 2 ? half_to_float(src[2]) : 0, size > 3 ? half_to_float(src[3]) : 1);
+     	  } break;
         case GL_BYTE: {
           const int8_t *src = (const int8_t*)(bytes);
+          if (norm) {
+            // snorm: -128 and -127 are both -1
+            result = max(vec4((float)src[0], size > 1 ? (float)src[1] : 0, size > 2 ? (float)src[2] : 0, size > 3 ? (float)src[3] : 127) * (1.0f/127), vec4(-1));
+            break;
+          }
           result = vec4((float)src[0], size > 1 ? (float)src[1] : 0, size > 2 ? (float)src[2] : 0, size > 3 ? (float)src[3] : 255) * (1.0f/255);
      	  } break;
         case GL_UNSIGNED_BYTE: {
@@ -127,6 +211,10 @@ namespace octet { namespace scene {
      	  } break;
         case GL_SHORT: {
           const int16_t *src = (const int16_t*)(bytes);
+          if (norm) {
+            result = max(vec4((float)src[0], size > 1 ? (float)src[1] : 0, size > 2 ? (float)src[2] : 0, size > 3 ? (float)src[3] : 32767) * (1.0f/32767), vec4(-1));
+            break;
+          }
           result = vec4((float)src[0], size > 1 ? (float)src[1] : 0, size > 2 ? (float)src[2] : 0, size > 3 ? (float)src[3] : 0xffff) * (1.0f/0xffff);
      	  } break;
         case GL_UNSIGNED_SHORT: {
@@ -142,7 +230,7 @@ namespace octet { namespace scene {
           result = vec4((float)src[0], size > 1 ? (float)src[1] : 0, size > 2 ? (float)src[2] : 0, size > 3 ? (float)src[3] : 0xffff) * (1.0f/0xffff);
      	  } break;
       }
-      return result;
+      return decode_value(get_attr(slot), result);
     }
 
   public:
@@ -177,6 +265,10 @@ namespace octet { namespace scene {
       mode = rhs.mode;
 
       mesh_skin = rhs.mesh_skin;
+
+      std::copy(rhs.attribute_decode, rhs.attribute_decode + num_decodes, attribute_decode);
+
+      set_clusters(rhs.clusters);
     }
 
     /// Init function used for aggregated meshes.
@@ -200,6 +292,8 @@ namespace octet { namespace scene {
 
       mesh_skin = _skin;
 
+      std::copy(get_default_attribute_decode(), get_default_attribute_decode() + num_decodes, attribute_decode);
+
       if (max_vertices || max_indices) {
         set_default_attributes();
         allocate(max_vertices * sizeof(vertex), max_indices * sizeof(uint32_t));
@@ -221,6 +315,8 @@ namespace octet { namespace scene {
       v.visit(num_slots, atom_num_slots);
       v.visit(mesh_skin, atom_mesh_skin);
       v.visit(mesh_aabb, atom_aabb);
+      v.visit(attribute_decode, atom_attribute_decode);
+      v.visit(clusters, atom_clusters);
     }
 
     // Destructor
@@ -243,15 +339,17 @@ namespace octet { namespace scene {
     /// Add an extra attribute to the mesh. eg. add_attribute(attribute_pos, 3, GL_FLOAT, 0)
     unsigned add_attribute(unsigned attr, unsigned size, unsigned kind, unsigned offset, unsigned norm=0) {
       assert(num_slots < max_slots);
-      format[num_slots] = (offset << 9) + (attr << 5) + ((size-1) << 3) + (kind - GL_BYTE);
+      // kinds past GL_FLOAT (eg. GL_HALF_FLOAT) use bit 15 as a fourth kind bit.
+      unsigned k = kind - GL_BYTE;
+      format[num_slots] = ((k & 8) << 12) + (offset << 9) + (attr << 5) + ((size-1) << 3) + (k & 7);
       if (norm) normalized |= 1 << num_slots;
       return num_slots++;
     }
 
     /// helper function: how many bytes does this GL_? type use?
     static unsigned kind_size(unsigned kind) {
-      static const uint8_t bytes[] = { 1, 1, 2, 2, 4, 4, 4, 4 };
-      return kind < GL_BYTE || kind > GL_FLOAT ? 0 : bytes[kind - GL_BYTE];
+      static const uint8_t bytes[] = { 1, 1, 2, 2, 4, 4, 4, 2, 3, 4, 8, 2 };
+      return kind < GL_BYTE || kind > GL_HALF_FLOAT ? 0 : bytes[kind - GL_BYTE];
     }
 
     /// For a particular slot, get the offset in the vertex buffer of the first attribute.
@@ -271,7 +369,7 @@ namespace octet { namespace scene {
 
     /// For a particular slot, get the GL kind of the attribute (eg. GL_FLOAT)
     unsigned get_kind(unsigned slot) const {
-      return ( ( format[slot] >> 0 ) & 0x07 ) + GL_BYTE;
+      return ( ( format[slot] >> 0 ) & 0x07 ) + ( ( format[slot] >> 12 ) & 0x08 ) + GL_BYTE;
     }
 
     /// Get the stride of attributes in this mesh.
@@ -362,6 +460,32 @@ namespace octet { namespace scene {
       return mesh_aabb;
     }
 
+    /// set the clusters for draw_clusters(). Changing the indices removes them.
+    void set_clusters(const dynarray<cluster> &value) {
+      clusters.resize(value.size());
+      std::copy(value.data(), value.data() + value.size(), clusters.data());
+    }
+
+    /// get the number of clusters, zero if there are none.
+    unsigned get_num_clusters() const {
+      return clusters.size();
+    }
+
+    /// get one of the clusters
+    const cluster &get_cluster(unsigned index) const {
+      return clusters[index];
+    }
+
+    /// get the vertex shader uniforms that decode quantised attributes (num_decodes vec4s)
+    const vec4 *get_attribute_decode() const {
+      return attribute_decode;
+    }
+
+    /// decode uniforms for meshes with float attributes.
+    static const vec4 *get_default_attribute_decode() {
+      return shader::get_default_attribute_decode();
+    }
+
     /// return true if this mesh has a particular attribute. eg. attribute_pos
     bool has_attribute(unsigned attr) {
       for (unsigned i = 0; i != num_slots; ++i) {
@@ -500,6 +624,59 @@ namespace octet { namespace scene {
       }
     }
 
+    /// Like draw(), but draw num_instances copies in one call. The shader tells them apart
+    /// with per-instance attributes; see instance_buffer. Does nothing without OCTET_INSTANCING.
+    void draw_instanced(unsigned num_instances) {
+      #if OCTET_INSTANCING
+        if (get_index_type()) {
+          indices->bind();
+          glDrawElementsInstanced(get_mode(), get_num_indices(), get_index_type(), (GLvoid*)(get_index_size() * first_index), num_instances);
+        } else {
+          glDrawArraysInstanced(get_mode(), 0, get_num_vertices(), num_instances);
+        }
+      #endif
+    }
+
+    /// Like draw(), but only draw the clusters that may be visible, merging neighbouring clusters
+    /// into single draws. See mesh_clusters. Returns the number of indices drawn.
+    unsigned draw_clusters(const mat4t &modelToProjection, const mat4t &modelToCamera) {
+      vec4 planes[6];
+      modelToProjection.get_frustum_planes(planes);
+      vec3 eye = modelToCamera.inverse3x4().w().xyz();
+
+      indices->bind();
+      unsigned start = 0, count = 0, drawn = 0;
+      for (unsigned i = 0; i != clusters.size(); ++i) {
+        const cluster &c = clusters[i];
+        if (!cluster_is_visible(c, planes, eye)) continue;
+        if (count && start + count == c.first_index) {
+          count += c.num_indices;
+          continue;
+        }
+        if (count) {
+          glDrawElements(get_mode(), count, get_index_type(), (GLvoid*)(get_index_size() * (first_index + start)));
+          drawn += count;
+        }
+        start = c.first_index;
+        count = c.num_indices;
+      }
+      if (count) {
+        glDrawElements(get_mode(), count, get_index_type(), (GLvoid*)(get_index_size() * (first_index + start)));
+        drawn += count;
+      }
+      return drawn;
+    }
+
+    /// Is any of a cluster inside the frustum planes and facing eye? Both in model space.
+    static bool cluster_is_visible(const cluster &c, const vec4 *planes, vec3_in eye) {
+      vec3 center = c.center;
+      for (unsigned i = 0; i != 6; ++i) {
+        if (dot(planes[i].xyz(), center) + planes[i].w() < -c.radius) return false;
+      }
+      vec3 dir = center - eye;
+      return dot(dir, vec3(c.cone_axis)) < c.cone_cutoff * length(dir) + c.radius;
+    }
+
     /// When rendering a mesh, call this last to disable attributes.
     void disable_attributes() {
       for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
@@ -536,6 +713,135 @@ namespace octet { namespace scene {
       mesh_aabb = aabb((vmax + vmin) * 0.5f, (vmax - vmin) * 0.5f);
     }
 
+    /// Convert float positions, normals and uvs to compact encodings, typically halving the vertex size.
+    ///
+    /// The vertex shader decodes them with the uniforms from get_attribute_decode(), which
+    /// material::render() sets. get_value() decodes in the same way.
+    /// Do this last: code that reads float positions directly (eg. physics shapes, ray casts
+    /// and the mesh optimizer) skips or does not expect quantised meshes.
+    /// Returns false if there was nothing to convert.
+    bool quantize(unsigned flags = quantize_default) {
+      if (!num_vertices || !vertices) return false;
+
+      unsigned old_stride = stride;
+      unsigned new_kind[max_slots];
+      unsigned new_size[max_slots];
+      unsigned new_offset[max_slots];
+      unsigned new_stride = 0;
+      bool changed = false;
+      for (unsigned slot = 0; slot != num_slots; ++slot) {
+        unsigned attr = get_attr(slot), kind = get_kind(slot), size = get_size(slot);
+        new_kind[slot] = kind;
+        new_size[slot] = size;
+        if (kind == GL_FLOAT) {
+          if (attr == attribute_pos && size == 3 && (flags & (quantize_pos_unorm16|quantize_pos_half))) {
+            new_kind[slot] = flags & quantize_pos_half ? GL_HALF_FLOAT : GL_UNSIGNED_SHORT;
+          } else if (attr == attribute_normal && size == 3 && (flags & quantize_normal_oct)) {
+            new_kind[slot] = GL_SHORT;
+            new_size[slot] = 2;
+          } else if (attr == attribute_uv && size == 2 && (flags & quantize_uv_unorm16)) {
+            new_kind[slot] = GL_UNSIGNED_SHORT;
+          }
+        }
+        changed |= new_kind[slot] != kind;
+        new_offset[slot] = new_stride;
+        new_stride += (kind_size(new_kind[slot]) * new_size[slot] + 3) & ~3;
+      }
+      if (!changed) return false;
+
+      gl_resource *new_vertices = new gl_resource();
+      new_vertices->allocate(GL_ARRAY_BUFFER, new_stride * num_vertices);
+      {
+        gl_resource::rolock src_lock(vertices);
+        gl_resource::wolock dest_lock(new_vertices);
+        const uint8_t *src = src_lock.u8();
+        uint8_t *dest = dest_lock.u8();
+        memset(dest, 0, new_stride * num_vertices);
+
+        for (unsigned slot = 0; slot != num_slots; ++slot) {
+          unsigned kind = get_kind(slot), size = get_size(slot), attr = get_attr(slot);
+          const uint8_t *sp = src + get_offset(slot);
+          uint8_t *dp = dest + new_offset[slot];
+
+          if (new_kind[slot] == kind) {
+            unsigned bytes = kind_size(kind) * size;
+            for (unsigned i = 0; i != num_vertices; ++i) {
+              memcpy(dp + i * new_stride, sp + i * old_stride, bytes);
+            }
+            continue;
+          }
+
+          if (attr == attribute_normal) {
+            for (unsigned i = 0; i != num_vertices; ++i) {
+              vec2 e = oct_encode(*(const vec3p*)(sp + i * old_stride));
+              int16_t *d = (int16_t*)(dp + i * new_stride);
+              d[0] = (int16_t)floorf(e.x() * 32767 + 0.5f);
+              d[1] = (int16_t)floorf(e.y() * 32767 + 0.5f);
+            }
+            attribute_decode[decode_normal] = vec4(1, 0, 0, 0);
+            continue;
+          }
+
+          // positions and uvs are relative to their bounding box.
+          vec4 vmin(1e37f), vmax(-1e37f);
+          for (unsigned i = 0; i != num_vertices; ++i) {
+            const float *s = (const float*)(sp + i * old_stride);
+            vec4 v(s[0], s[1], size > 2 ? s[2] : 0, 0);
+            vmin = min(vmin, v);
+            vmax = max(vmax, v);
+          }
+
+          if (new_kind[slot] == GL_HALF_FLOAT) {
+            vec4 centre = (vmin + vmax) * 0.5f;
+            for (unsigned i = 0; i != num_vertices; ++i) {
+              const float *s = (const float*)(sp + i * old_stride);
+              uint16_t *d = (uint16_t*)(dp + i * new_stride);
+              for (unsigned j = 0; j != size; ++j) d[j] = float_to_half(s[j] - centre[j]);
+            }
+            attribute_decode[decode_pos_scale] = vec4(1, 1, 1, 0);
+            attribute_decode[decode_pos_offset] = vec4(centre.xyz(), 0);
+            continue;
+          }
+
+          // unorm16: GL scales to [0, 1]. avoid dividing by zero for flat boxes.
+          vec4 scale = max(vmax - vmin, vec4(1e-30f));
+          float rscale[4] = { 65535.0f / scale[0], 65535.0f / scale[1], 65535.0f / scale[2], 65535.0f / scale[3] };
+          for (unsigned i = 0; i != num_vertices; ++i) {
+            const float *s = (const float*)(sp + i * old_stride);
+            uint16_t *d = (uint16_t*)(dp + i * new_stride);
+            for (unsigned j = 0; j != size; ++j) {
+              float q = floorf((s[j] - vmin[j]) * rscale[j] + 0.5f);
+              d[j] = (uint16_t)std::min(std::max(q, 0.0f), 65535.0f);
+            }
+          }
+          if (attr == attribute_pos) {
+            attribute_decode[decode_pos_scale] = vec4(scale.xyz(), 0);
+            attribute_decode[decode_pos_offset] = vec4(vmin.xyz(), 0);
+          } else {
+            attribute_decode[decode_uv] = vec4(scale.x(), scale.y(), vmin.x(), vmin.y());
+          }
+        }
+      }
+
+      // rebuild the slots with the new kinds and offsets.
+      uint32_t old_format[max_slots];
+      memcpy(old_format, format, sizeof(format));
+      unsigned old_normalized = normalized;
+      unsigned old_num_slots = num_slots;
+      num_slots = 0;
+      normalized = 0;
+      for (unsigned slot = 0; slot != old_num_slots; ++slot) {
+        unsigned attr = (old_format[slot] >> 5) & 0x0f;
+        unsigned norm = (old_normalized >> slot) & 1;
+        // GL normalizes unorm16 and snorm16 to [0, 1] and [-1, 1]
+        if (new_kind[slot] == GL_SHORT || new_kind[slot] == GL_UNSIGNED_SHORT) norm = 1;
+        add_attribute(attr, new_size[slot], new_kind[slot], new_offset[slot], norm);
+      }
+      vertices = new_vertices;
+      stride = (uint16_t)new_stride;
+      return true;
+    }
+
     /// *very* slow ray cast.
     /// returns "barycentric" coordinates.
     /// eg. hit pos = bary[0] * pos0 + bary[1] * pos1 + bary[2] * pos2 (or ray.start + ray.distance * bary[3])
@@ -650,6 +956,7 @@ namespace octet { namespace scene {
     /// set a new IBO object
     void set_indices(gl_resource *value) {
       indices = value;
+      clusters.reset();
     }
 
     /// assign a vector to the index buffer and set params
@@ -662,6 +969,7 @@ namespace octet { namespace scene {
       set_index_type(sizeof(elem_t) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
       set_num_indices(rhs.size());
       set_first_index(0);
+      clusters.reset();
     }
 
     /// Get all the edges in a hash map to avoid duplicates.
@@ -0,0 +1,363 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Splitting meshes into clusters for culling.
+//
+
+namespace octet { namespace scene {
+  /// Split indexed triangle lists into small clusters of nearby triangles that face the same way,
+  /// each with a bounding sphere and a cone of normals.
+  ///
+  /// The triangles of each cluster are made contiguous in the index buffer, so visual_scene can
+  /// draw a mesh with clusters (see mesh::draw_clusters) by skipping the clusters that are off
+  /// screen or face away from the camera and merging the rest into a few glDrawElements calls.
+  /// This pays off on large meshes, where a view typically sees less than half of the triangles.
+  ///
+  /// Clusters are built greedily: each one grows by the triangle that adds the fewest new vertices,
+  /// then by the one closest to its normal and centre, up to max_vertices and max_triangles.
+  ///
+  /// Build clusters after mesh_optimizer and before mesh::quantize(), as changing the indices
+  /// removes them and this needs float positions.
+  ///
+  /// Example
+  ///
+  ///     mesh_clusters::build(msh);
+  ///     printf("%d clusters\n", msh->get_num_clusters());
+  class mesh_clusters {
+  public:
+    enum {
+      max_vertices = 64,
+      max_triangles = 124,
+    };
+
+    /// Indices and positions copied out of a mesh so that clusters can be built without GL.
+    struct mesh_data {
+      dynarray<uint32_t> indices;
+      dynarray<vec3p> positions;
+      dynarray<uint32_t> result;
+      dynarray<mesh::cluster> clusters;
+    };
+
+  private:
+    // set the bounds of a cluster from its triangles and their normals, indexed like the clusters.
+    static void calc_bounds(mesh::cluster &c, const uint32_t *indices, const vec3p *positions, const vec3p *normals, bool cone_culling) {
+      unsigned num_tris = c.num_indices / 3;
+      vec3 vmin(1e37f), vmax(-1e37f);
+      for (unsigned i = 0; i != c.num_indices; ++i) {
+        vec3 pos = positions[indices[i]];
+        vmin = min(vmin, pos);
+        vmax = max(vmax, pos);
+      }
+      vec3 center = (vmin + vmax) * 0.5f;
+      float radius = 0;
+      for (unsigned i = 0; i != c.num_indices; ++i) {
+        radius = std::max(radius, length(vec3(positions[indices[i]]) - center));
+      }
+      c.center = center;
+      c.radius = radius;
+
+      // the cone contains the normals of all the triangles.
+      // with a cutoff of one, the cluster is never back facing.
+      vec3 axis(0, 0, 0);
+      for (unsigned t = 0; t != num_tris; ++t) {
+        axis = axis + vec3(normals[c.first_index / 3 + t]);
+      }
+      c.cone_axis = vec3(0, 0, 0);
+      c.cone_cutoff = 1;
+      float len = length(axis);
+      if (!cone_culling || len == 0) return;
+      axis = axis * (1.0f / len);
+      float min_dot = 1;
+      for (unsigned t = 0; t != num_tris; ++t) {
+        min_dot = std::min(min_dot, dot(axis, vec3(normals[c.first_index / 3 + t])));
+      }
+      if (min_dot <= 0) return;
+      c.cone_axis = axis;
+      c.cone_cutoff = sqrtf(1 - min_dot * min_dot);
+    }
+
+  public:
+    /// Build clusters from an indexed triangle list. The triangles are written to dest in cluster
+    /// order; dest must not be indices. Positions are float x, y, z at pos_offset in each vertex.
+    /// Clusters have no cone if cone_culling is false, for meshes that are seen from both sides.
+    static void build(
+      dynarray<mesh::cluster> &clusters, uint32_t *dest, const uint32_t *indices, unsigned num_indices,
+      const uint8_t *vertices, unsigned num_vertices, unsigned stride, unsigned pos_offset,
+      bool cone_culling = true, unsigned max_cluster_vertices = max_vertices, unsigned max_cluster_triangles = max_triangles
+    ) {
+      clusters.resize(0);
+      unsigned num_tris = num_indices / 3;
+      if (!num_tris) return;
+
+      dynarray<vec3p> positions(num_vertices);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        positions[v] = *(const vec3p*)(vertices + v * stride + pos_offset);
+      }
+
+      // centre and unit normal of each triangle.
+      dynarray<vec3p> tri_centers(num_tris);
+      dynarray<vec3p> tri_normals(num_tris);
+      for (unsigned t = 0; t != num_tris; ++t) {
+        vec3 a = positions[indices[t*3+0]], b = positions[indices[t*3+1]], c = positions[indices[t*3+2]];
+        vec3 normal = cross(b - a, c - a);
+        float len = length(normal);
+        tri_centers[t] = (a + b + c) * (1.0f / 3);
+        tri_normals[t] = len == 0 ? vec3(0, 0, 0) : normal * (1.0f / len);
+      }
+
+      // triangles around each position: flat shaded meshes share positions but not vertices.
+      dynarray<uint32_t> remap_pos;
+      mesh_simplifier::weld(remap_pos, positions.data(), num_vertices);
+      dynarray<uint32_t> adj_offset(num_vertices + 1);
+      dynarray<uint32_t> adj(num_tris * 3);
+      memset(adj_offset.data(), 0, adj_offset.size() * sizeof(uint32_t));
+      for (unsigned i = 0; i != num_tris * 3; ++i) {
+        adj_offset[remap_pos[indices[i]] + 1]++;
+      }
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        adj_offset[v + 1] += adj_offset[v];
+      }
+      {
+        dynarray<uint32_t> fill(num_vertices);
+        memcpy(fill.data(), adj_offset.data(), num_vertices * sizeof(uint32_t));
+        for (unsigned i = 0; i != num_tris * 3; ++i) {
+          adj[fill[remap_pos[indices[i]]]++] = i / 3;
+        }
+      }
+
+      dynarray<uint8_t> emitted(num_tris);
+      memset(emitted.data(), 0, num_tris);
+      // the cluster each vertex was last added to.
+      dynarray<uint32_t> vertex_cluster(num_vertices);
+      memset(vertex_cluster.data(), 0xff, num_vertices * sizeof(uint32_t));
+      dynarray<uint32_t> cluster_vertices;
+      dynarray<vec3p> dest_normals(num_tris);
+
+      unsigned num_emitted = 0;
+      unsigned seed = 0;
+      while (num_emitted != num_tris) {
+        // start a new cluster next to the last one if we can.
+        uint32_t cluster_index = clusters.size();
+        unsigned best = ~0u;
+        for (unsigned i = 0; i != cluster_vertices.size() && best == ~0u; ++i) {
+          uint32_t v = remap_pos[cluster_vertices[i]];
+          for (unsigned j = adj_offset[v]; j != adj_offset[v+1]; ++j) {
+            if (!emitted[adj[j]]) { best = adj[j]; break; }
+          }
+        }
+        if (best == ~0u) {
+          while (emitted[seed]) ++seed;
+          best = seed;
+        }
+
+        mesh::cluster c;
+        c.first_index = num_emitted * 3;
+        c.num_indices = 0;
+        cluster_vertices.resize(0);
+        vec3 center_sum(0, 0, 0);
+        vec3 normal_sum(0, 0, 0);
+
+        while (best != ~0u) {
+          emitted[best] = 1;
+          for (unsigned k = 0; k != 3; ++k) {
+            uint32_t v = indices[best*3+k];
+            dest[num_emitted*3+k] = v;
+            if (vertex_cluster[v] != cluster_index) {
+              vertex_cluster[v] = cluster_index;
+              cluster_vertices.push_back(v);
+            }
+          }
+          dest_normals[num_emitted] = tri_normals[best];
+          center_sum = center_sum + vec3(tri_centers[best]);
+          normal_sum = normal_sum + vec3(tri_normals[best]);
+          num_emitted++;
+          c.num_indices += 3;
+          if (c.num_indices == max_cluster_triangles * 3) break;
+
+          // the next triangle shares the most vertices, then is closest in direction and position.
+          unsigned num_tris_in = c.num_indices / 3;
+          vec3 center = center_sum * (1.0f / num_tris_in);
+          vec3 normal = normal_sum;
+          float normal_len = length(normal);
+          normal = normal_len == 0 ? normal : normal * (1.0f / normal_len);
+          float radius2 = 0;
+          for (unsigned i = 0; i != cluster_vertices.size(); ++i) {
+            vec3 d = vec3(positions[cluster_vertices[i]]) - center;
+            radius2 = std::max(radius2, dot(d, d));
+          }
+          float rradius = radius2 == 0 ? 0 : 1.0f / sqrtf(radius2);
+
+          best = ~0u;
+          float best_score = 1e37f;
+          for (unsigned i = 0; i != cluster_vertices.size(); ++i) {
+            uint32_t v = remap_pos[cluster_vertices[i]];
+            if (v != cluster_vertices[i] && vertex_cluster[v] == cluster_index) continue;
+            for (unsigned j = adj_offset[v]; j != adj_offset[v+1]; ++j) {
+              unsigned t = adj[j];
+              if (emitted[t]) continue;
+              unsigned new_vertices = 0;
+              for (unsigned k = 0; k != 3; ++k) {
+                new_vertices += vertex_cluster[indices[t*3+k]] != cluster_index;
+              }
+              if (cluster_vertices.size() + new_vertices > max_cluster_vertices) continue;
+              float score =
+                new_vertices +
+                (1 - dot(normal, vec3(tri_normals[t]))) +
+                length(vec3(tri_centers[t]) - center) * rradius * 0.25f
+              ;
+              if (score < best_score) {
+                best_score = score;
+                best = t;
+              }
+            }
+          }
+        }
+        clusters.push_back(c);
+      }
+
+      for (unsigned i = 0; i != clusters.size(); ++i) {
+        calc_bounds(clusters[i], dest + clusters[i].first_index, positions.data(), dest_normals.data(), cone_culling);
+      }
+    }
+
+    /// Copy the indices and positions of a mesh for build(mesh_data &).
+    /// Returns false if the mesh is not a GL_TRIANGLES mesh with float positions.
+    /// This reads GL buffers, so call it on the GL thread.
+    static bool get_mesh_data(mesh_data &md, mesh *msh) {
+      unsigned index_type = msh->get_index_type();
+      if (msh->get_mode() != GL_TRIANGLES || (index_type != GL_UNSIGNED_INT && index_type != GL_UNSIGNED_SHORT)) {
+        return false;
+      }
+
+      unsigned num_indices = msh->get_num_indices() / 3 * 3;
+      unsigned num_vertices = msh->get_num_vertices();
+      unsigned stride = msh->get_stride();
+      unsigned pos_slot = msh->get_slot(attribute_pos);
+      if (num_indices < 3 || !num_vertices || pos_slot == ~0u) return false;
+      if (msh->get_kind(pos_slot) != GL_FLOAT || msh->get_size(pos_slot) < 3) return false;
+
+      md.indices.resize(num_indices);
+      md.positions.resize(num_vertices);
+      gl_resource::rolock idx_lock(msh->get_indices());
+      gl_resource::rolock vtx_lock(msh->get_vertices());
+      for (unsigned i = 0; i != num_indices; ++i) {
+        uint32_t idx = msh->get_index(idx_lock.u8(), i);
+        if (idx >= num_vertices) return false;
+        md.indices[i] = idx;
+      }
+      const uint8_t *src = vtx_lock.u8() + msh->get_offset(pos_slot);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        md.positions[v] = *(const vec3p*)(src + v * stride);
+      }
+      return true;
+    }
+
+    /// Build clusters for mesh data into md.result and md.clusters.
+    /// This does not touch GL, so it can run on any thread.
+    static void build(mesh_data &md, bool cone_culling = true) {
+      md.result.resize(md.indices.size());
+      build(
+        md.clusters, md.result.data(), md.indices.data(), md.indices.size(),
+        (const uint8_t*)md.positions.data(), md.positions.size(), sizeof(vec3p), 0, cone_culling
+      );
+    }
+
+    /// Set the reordered indices and clusters of a mesh from mesh data. Call it on the GL thread.
+    static void set_mesh_data(mesh *msh, const mesh_data &md) {
+      if (msh->get_index_type() == GL_UNSIGNED_SHORT) {
+        dynarray<uint16_t> short_indices(md.result.size());
+        for (unsigned i = 0; i != md.result.size(); ++i) {
+          short_indices[i] = (uint16_t)md.result[i];
+        }
+        msh->set_indices(short_indices);
+      } else {
+        msh->set_indices(md.result);
+      }
+      msh->set_clusters(md.clusters);
+    }
+
+    /// Build clusters for a mesh with float positions, reordering its indices.
+    /// Returns false if the mesh is not a GL_TRIANGLES mesh with float positions.
+    static bool build(mesh *msh, bool cone_culling = true) {
+      mesh_data md;
+      if (!get_mesh_data(md, msh)) return false;
+      build(md, cone_culling);
+      set_mesh_data(msh, md);
+      return true;
+    }
+
+    /// Build clusters for every mesh in a dictionary.
+    /// The clusters are built on the job pool; the buffers are read and written on the calling thread.
+    static void build_all(resource_dict &dict, bool cone_culling = true) {
+      dynarray<resource*> meshes;
+      dict.find_all(meshes, atom_mesh);
+
+      // gather the buffers serially: GL calls only work on the thread with the context.
+      dynarray<mesh_data> data(meshes.size());
+      dynarray<bool> ok(meshes.size());
+      for (unsigned i = 0; i != meshes.size(); ++i) {
+        ok[i] = get_mesh_data(data[i], meshes[i]->get_mesh());
+      }
+
+      job_pool::get().parallel_for(0, meshes.size(), 1, [&](unsigned m0, unsigned m1) {
+        for (unsigned i = m0; i != m1; ++i) {
+          if (ok[i]) build(data[i], cone_culling);
+        }
+      });
+
+      for (unsigned i = 0; i != meshes.size(); ++i) {
+        if (ok[i]) set_mesh_data(meshes[i]->get_mesh(), data[i]);
+      }
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class mesh_clusters_unit_test {
+    public:
+      mesh_clusters_unit_test() {
+        // a 16x16 grid of quads facing +z makes 512 triangles and 289 vertices.
+        enum { n = 16 };
+        dynarray<vec3p> positions;
+        dynarray<uint32_t> indices;
+        for (unsigned y = 0; y <= n; ++y) {
+          for (unsigned x = 0; x <= n; ++x) {
+            positions.push_back(vec3p((float)x, (float)y, 0));
+          }
+        }
+        for (unsigned y = 0; y != n; ++y) {
+          for (unsigned x = 0; x != n; ++x) {
+            uint32_t i = y * (n + 1) + x;
+            static const uint32_t quad[] = { 0, 1, n + 2, 0, n + 2, n + 1 };
+            for (unsigned k = 0; k != 6; ++k) indices.push_back(i + quad[k]);
+          }
+        }
+
+        dynarray<mesh::cluster> clusters;
+        dynarray<uint32_t> result(indices.size());
+        mesh_clusters::build(clusters, result.data(), indices.data(), indices.size(), (const uint8_t*)positions.data(), positions.size(), sizeof(vec3p), 0);
+
+        unsigned total = 0;
+        for (unsigned i = 0; i != clusters.size(); ++i) {
+          const mesh::cluster &c = clusters[i];
+          assert(c.first_index == total && c.num_indices <= mesh_clusters::max_triangles * 3);
+          total += c.num_indices;
+          // every triangle faces +z, so the cone is a line.
+          assert(c.cone_cutoff < 0.001f && vec3(c.cone_axis).z() > 0.999f);
+        }
+        assert(total == indices.size() && clusters.size() >= 5);
+
+        // with planes that contain everything, nothing is visible from behind and everything from in front.
+        vec4 planes[6];
+        for (unsigned i = 0; i != 6; ++i) planes[i] = vec4(0, 0, 0, 1);
+        for (unsigned i = 0; i != clusters.size(); ++i) {
+          assert(!mesh::cluster_is_visible(clusters[i], planes, vec3(8, 8, -10)));
+          assert(mesh::cluster_is_visible(clusters[i], planes, vec3(8, 8, 10)));
+        }
+      }
+    };
+    static mesh_clusters_unit_test mesh_clusters_unit_test;
+  #endif
+}}
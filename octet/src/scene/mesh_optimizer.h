@@ -0,0 +1,605 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Triangle and vertex reordering for faster drawing.
+//
+
+namespace octet { namespace scene {
+  /// Reorder indexed triangle lists so that they draw with fewer vertex shader runs and less memory traffic.
+  ///
+  /// There are three passes which are normally run in this order:
+  ///
+  ///   optimize_vertex_cache: Tom Forsyth's linear speed algorithm, which puts triangles that share
+  ///   vertices close together so that the post transform cache can reuse them.
+  ///
+  ///   optimize_overdraw: splits the result into clusters where this costs few cache misses and
+  ///   sorts the clusters so that outward facing ones come first. These tend to hide the others.
+  ///
+  ///   optimize_vertex_fetch: sorts the vertices into the order the indices first use them
+  ///   and drops unused ones.
+  ///
+  /// analyze() measures the result: ACMR is vertices transformed per triangle (0.5 at best, 3 at worst),
+  /// ATVR is vertices transformed per vertex used (1 at best) and the fetch ratio is bytes read
+  /// through a small cache per byte of vertices used (1 at best).
+  ///
+  /// Example
+  ///
+  ///     mesh_optimizer::statistics before = mesh_optimizer::analyze(msh);
+  ///     mesh_optimizer::optimize(msh);
+  ///     mesh_optimizer::statistics after = mesh_optimizer::analyze(msh);
+  class mesh_optimizer {
+  public:
+    enum {
+      forsyth_cache_size = 32,  // the cache Forsyth's scores are tuned for
+      fifo_cache_size = 16,     // a typical hardware post transform cache, for analysis and clustering
+      fetch_line_size = 64,     // bytes in a cache line
+      fetch_cache_lines = 64,   // lines in the direct mapped vertex fetch cache
+    };
+
+    /// Result of analyze()
+    struct statistics {
+      unsigned num_triangles;
+      unsigned num_vertices;    // vertices used by the indices
+      unsigned transformed;     // vertex shader runs with a fifo_cache_size post transform cache
+      unsigned bytes_fetched;   // vertex bytes read through the fetch cache
+      float acmr;               // transformed / num_triangles
+      float atvr;               // transformed / num_vertices
+      float fetch_ratio;        // bytes_fetched / (num_vertices * stride)
+    };
+
+    /// Buffers copied out of a mesh so that optimize() can run without GL.
+    struct mesh_data {
+      dynarray<uint32_t> indices;
+      dynarray<uint8_t> vertices;
+      unsigned num_vertices;
+      unsigned stride;
+      unsigned pos_offset;
+    };
+
+  private:
+    // a vertex for de-duplication
+    struct vertex_key {
+      const uint8_t *bytes;
+      unsigned size;
+
+      bool is_empty() const { return bytes == 0; }
+
+      bool operator ==(const vertex_key &rhs) const {
+        return size == rhs.size && memcmp(bytes, rhs.bytes, size) == 0;
+      }
+    };
+
+    class vertex_key_cmp : public hash_map_cmp {
+    public:
+      static unsigned get_hash(const vertex_key &key) {
+        unsigned hash = 2166136261u;
+        for (unsigned i = 0; i != key.size; ++i) {
+          hash = ( hash ^ key.bytes[i] ) * 16777619u;
+        }
+        return fuzz_hash(hash);
+      }
+      static bool is_empty(const vertex_key &key) { return key.is_empty(); }
+    };
+
+    // Forsyth's vertex score: recently used vertices and vertices with few triangles left score highly.
+    class forsyth_scores {
+      enum { max_valence = 32 };
+      float cache[forsyth_cache_size];
+      float valence[max_valence];
+
+    public:
+      forsyth_scores() {
+        for (unsigned i = 0; i != forsyth_cache_size; ++i) {
+          // the last triangle's vertices score a little less so that we don't make strips.
+          cache[i] = i < 3 ? 0.75f : powf(1.0f - (i - 3) * (1.0f / (forsyth_cache_size - 3)), 1.5f);
+        }
+        valence[0] = 0;
+        for (unsigned i = 1; i != max_valence; ++i) {
+          valence[i] = 2.0f / sqrtf((float)i);
+        }
+      }
+
+      float get(int cache_pos, unsigned live) const {
+        if (live == 0) return -1.0f;
+        float score = cache_pos < 0 ? 0.0f : cache[cache_pos];
+        return score + (live < max_valence ? valence[live] : 2.0f / sqrtf((float)live));
+      }
+    };
+
+    // A FIFO post transform cache. A vertex is in the cache if fewer than size vertices
+    // have been added since it was.
+    class fifo_cache {
+      dynarray<unsigned> added;
+      unsigned time;
+      unsigned size;
+
+    public:
+      fifo_cache(unsigned num_vertices, unsigned size_) : added(num_vertices), time(size_ + 1), size(size_) {
+        memset(added.data(), 0, num_vertices * sizeof(unsigned));
+      }
+
+      // returns true on a miss
+      bool access(uint32_t v) {
+        if (time - added[v] <= size) return false;
+        added[v] = ++time;
+        return true;
+      }
+
+      void flush() {
+        time += size + 1;
+      }
+    };
+
+    static const vec3p &get_pos(const uint8_t *vertices, unsigned stride, unsigned pos_offset, uint32_t v) {
+      return *(const vec3p*)(vertices + v * stride + pos_offset);
+    }
+
+  public:
+    /// Merge vertices with identical bytes, moving the unique ones to the front of vertices.
+    /// Returns the new number of vertices.
+    static unsigned remove_duplicate_vertices(uint32_t *indices, unsigned num_indices, uint8_t *vertices, unsigned num_vertices, unsigned stride) {
+      hash_map<vertex_key, unsigned, vertex_key_cmp> vertex_to_index;
+      dynarray<uint32_t> remap(num_vertices);
+      unsigned num_unique = 0;
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        vertex_key key = { vertices + v * stride, stride };
+        unsigned &e = vertex_to_index[key];
+        if (e == 0) { // hash_map inits to zero
+          e = ++num_unique;
+        }
+        remap[v] = e - 1;
+      }
+
+      // the keys point at the vertices, so only move them when we are done.
+      // the first use of each new index is the vertex to keep.
+      for (unsigned v = 0, next = 0; v != num_vertices; ++v) {
+        if (remap[v] == next) {
+          if (next != v) memmove(vertices + next * stride, vertices + v * stride, stride);
+          ++next;
+        }
+      }
+
+      for (unsigned i = 0; i != num_indices; ++i) {
+        indices[i] = indices[i] < num_vertices ? remap[indices[i]] : 0;
+      }
+      return num_unique;
+    }
+
+    /// Reorder triangles for the post transform vertex cache using Tom Forsyth's algorithm.
+    /// dest and indices must not overlap.
+    static void optimize_vertex_cache(uint32_t *dest, const uint32_t *indices, unsigned num_indices, unsigned num_vertices) {
+      static const forsyth_scores scores;
+      unsigned num_tris = num_indices / 3;
+      if (!num_tris) return;
+
+      // live triangles of each vertex in adj[offset[v] .. offset[v] + live[v]]
+      dynarray<unsigned> offset(num_vertices + 1);
+      dynarray<unsigned> live(num_vertices);
+      dynarray<unsigned> adj(num_tris * 3);
+      memset(live.data(), 0, num_vertices * sizeof(unsigned));
+      for (unsigned i = 0; i != num_tris * 3; ++i) {
+        live[indices[i]]++;
+      }
+      unsigned total = 0;
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        offset[v] = total;
+        total += live[v];
+        live[v] = 0;
+      }
+      offset[num_vertices] = total;
+      for (unsigned i = 0; i != num_tris * 3; ++i) {
+        uint32_t v = indices[i];
+        adj[offset[v] + live[v]++] = i / 3;
+      }
+
+      dynarray<float> vertex_score(num_vertices);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        vertex_score[v] = scores.get(-1, live[v]);
+      }
+
+      dynarray<float> tri_score(num_tris);
+      dynarray<uint8_t> emitted(num_tris);
+      unsigned best_tri = 0;
+      for (unsigned t = 0; t != num_tris; ++t) {
+        const uint32_t *tri = indices + t * 3;
+        tri_score[t] = vertex_score[tri[0]] + vertex_score[tri[1]] + vertex_score[tri[2]];
+        emitted[t] = 0;
+        if (tri_score[t] > tri_score[best_tri]) best_tri = t;
+      }
+
+      // the cache has three extra entries for the vertices pushed out by a triangle.
+      uint32_t cache[forsyth_cache_size + 3];
+      uint32_t new_cache[forsyth_cache_size + 3];
+      unsigned cache_count = 0;
+      unsigned next_unemitted = 0;
+
+      for (unsigned out = 0; out != num_tris; ++out) {
+        if (best_tri == ~0u) {
+          // dead end: carry on in the original order.
+          while (emitted[next_unemitted]) ++next_unemitted;
+          best_tri = next_unemitted;
+        }
+
+        const uint32_t *tri = indices + best_tri * 3;
+        dest[out * 3 + 0] = tri[0];
+        dest[out * 3 + 1] = tri[1];
+        dest[out * 3 + 2] = tri[2];
+        emitted[best_tri] = 1;
+
+        // remove the triangle from its vertices' lists
+        for (unsigned c = 0; c != 3; ++c) {
+          uint32_t v = tri[c];
+          unsigned *list = &adj[offset[v]];
+          unsigned n = live[v];
+          for (unsigned k = 0; k != n; ++k) {
+            if (list[k] == best_tri) {
+              list[k] = list[n - 1];
+              list[n - 1] = best_tri;
+              break;
+            }
+          }
+          live[v] = n - 1;
+        }
+
+        // move the triangle's vertices to the front of the cache
+        unsigned new_count = 0;
+        new_cache[new_count++] = tri[0];
+        if (tri[1] != tri[0]) new_cache[new_count++] = tri[1];
+        if (tri[2] != tri[0] && tri[2] != tri[1]) new_cache[new_count++] = tri[2];
+        for (unsigned i = 0; i != cache_count; ++i) {
+          uint32_t v = cache[i];
+          if (v != tri[0] && v != tri[1] && v != tri[2]) new_cache[new_count++] = v;
+        }
+
+        // rescore the vertices that moved or fell out and the triangles that use them.
+        for (unsigned i = 0; i != new_count; ++i) {
+          uint32_t v = new_cache[i];
+          int pos = i < forsyth_cache_size ? (int)i : -1;
+          float score = scores.get(pos, live[v]);
+          float delta = score - vertex_score[v];
+          vertex_score[v] = score;
+          const unsigned *list = &adj[offset[v]];
+          for (unsigned k = 0; k != live[v]; ++k) {
+            tri_score[list[k]] += delta;
+          }
+        }
+
+        // the next triangle is the best one using a vertex in the cache.
+        cache_count = std::min(new_count, (unsigned)forsyth_cache_size);
+        memcpy(cache, new_cache, cache_count * sizeof(uint32_t));
+        best_tri = ~0u;
+        float best_score = -1e37f;
+        for (unsigned i = 0; i != cache_count; ++i) {
+          uint32_t v = cache[i];
+          const unsigned *list = &adj[offset[v]];
+          for (unsigned k = 0; k != live[v]; ++k) {
+            unsigned t = list[k];
+            if (tri_score[t] > best_score) {
+              best_score = tri_score[t];
+              best_tri = t;
+            }
+          }
+        }
+      }
+    }
+
+    /// Reorder clusters of triangles, already ordered for the vertex cache, so that outward facing ones come first.
+    /// Clusters are split where the cache miss ratio grows by no more than threshold (eg. 1.05 for 5%).
+    /// pos_offset is the byte offset of a float vec3 position in each vertex.
+    /// dest and indices must not overlap.
+    static void optimize_overdraw(
+      uint32_t *dest, const uint32_t *indices, unsigned num_indices,
+      const uint8_t *vertices, unsigned num_vertices, unsigned stride, unsigned pos_offset,
+      float threshold = 1.05f
+    ) {
+      unsigned num_tris = num_indices / 3;
+      if (!num_tris) return;
+
+      // hard boundaries: triangles which miss the cache at all three vertices.
+      dynarray<unsigned> hard;
+      fifo_cache fifo(num_vertices, fifo_cache_size);
+      for (unsigned t = 0; t != num_tris; ++t) {
+        const uint32_t *tri = indices + t * 3;
+        unsigned misses = fifo.access(tri[0]) + fifo.access(tri[1]) + fifo.access(tri[2]);
+        if (t == 0 || misses == 3) hard.push_back(t);
+      }
+      hard.push_back(num_tris);
+
+      // soft boundaries: split a hard cluster where the cache miss ratio so far is within threshold of the whole.
+      dynarray<unsigned> clusters;
+      for (unsigned h = 0; h + 1 < hard.size(); ++h) {
+        unsigned begin = hard[h], end = hard[h + 1];
+        unsigned cluster_misses = 0;
+        fifo.flush();
+        for (unsigned t = begin; t != end; ++t) {
+          const uint32_t *tri = indices + t * 3;
+          cluster_misses += fifo.access(tri[0]) + fifo.access(tri[1]) + fifo.access(tri[2]);
+        }
+        float target = threshold * cluster_misses / (end - begin);
+
+        unsigned start = begin, misses = 0;
+        clusters.push_back(begin);
+        fifo.flush();
+        for (unsigned t = begin; t != end; ++t) {
+          const uint32_t *tri = indices + t * 3;
+          misses += fifo.access(tri[0]) + fifo.access(tri[1]) + fifo.access(tri[2]);
+          if (t + 1 != end && misses <= target * (t + 1 - start)) {
+            clusters.push_back(t + 1);
+            start = t + 1;
+            misses = 0;
+            fifo.flush();
+          }
+        }
+      }
+      unsigned num_clusters = clusters.size();
+      clusters.push_back(num_tris);
+
+      // the centre of the mesh
+      vec3 mesh_centre(0, 0, 0);
+      for (unsigned i = 0; i != num_tris * 3; ++i) {
+        mesh_centre += vec3(get_pos(vertices, stride, pos_offset, indices[i]));
+      }
+      mesh_centre = mesh_centre / (float)(num_tris * 3);
+
+      // sort on how far along its normal each cluster sits from the centre.
+      dynarray<std::pair<float, unsigned> > order(num_clusters);
+      for (unsigned c = 0; c != num_clusters; ++c) {
+        vec3 centroid(0, 0, 0);
+        vec3 normal(0, 0, 0);
+        float area = 0;
+        for (unsigned t = clusters[c]; t != clusters[c + 1]; ++t) {
+          const uint32_t *tri = indices + t * 3;
+          vec3 p0 = vec3(get_pos(vertices, stride, pos_offset, tri[0]));
+          vec3 p1 = vec3(get_pos(vertices, stride, pos_offset, tri[1]));
+          vec3 p2 = vec3(get_pos(vertices, stride, pos_offset, tri[2]));
+          vec3 n = cross(p1 - p0, p2 - p0);
+          float a = length(n);
+          centroid += (p0 + p1 + p2) * (a * (1.0f / 3));
+          normal += n;
+          area += a;
+        }
+        float normal_length = length(normal);
+        float key = 0;
+        if (area > 0 && normal_length > 0) {
+          key = dot(centroid / area - mesh_centre, normal / normal_length);
+        }
+        order[c] = std::make_pair(-key, c);
+      }
+      std::stable_sort(order.data(), order.data() + num_clusters);
+
+      uint32_t *d = dest;
+      for (unsigned i = 0; i != num_clusters; ++i) {
+        unsigned c = order[i].second;
+        unsigned size = (clusters[c + 1] - clusters[c]) * 3;
+        memcpy(d, indices + clusters[c] * 3, size * sizeof(uint32_t));
+        d += size;
+      }
+    }
+
+    /// Copy the vertices to dest in the order the indices first use them and renumber the indices.
+    /// Unused vertices are dropped. Returns the number of vertices in dest.
+    static unsigned optimize_vertex_fetch(uint8_t *dest, uint32_t *indices, unsigned num_indices, const uint8_t *vertices, unsigned num_vertices, unsigned stride) {
+      dynarray<uint32_t> remap(num_vertices);
+      memset(remap.data(), 0xff, num_vertices * sizeof(uint32_t));
+      unsigned next = 0;
+      for (unsigned i = 0; i != num_indices; ++i) {
+        uint32_t &r = remap[indices[i]];
+        if (r == ~0u) {
+          memcpy(dest + next * stride, vertices + indices[i] * stride, stride);
+          r = next++;
+        }
+        indices[i] = r;
+      }
+      return next;
+    }
+
+    /// Measure the vertex cache and vertex fetch efficiency of an indexed triangle list.
+    static statistics analyze(const uint32_t *indices, unsigned num_indices, unsigned num_vertices, unsigned stride) {
+      statistics result;
+      memset(&result, 0, sizeof(result));
+      result.num_triangles = num_indices / 3;
+
+      fifo_cache fifo(num_vertices, fifo_cache_size);
+      dynarray<uint8_t> used(num_vertices);
+      memset(used.data(), 0, num_vertices);
+      size_t tags[fetch_cache_lines];
+      memset(tags, 0xff, sizeof(tags));
+
+      for (unsigned i = 0; i != result.num_triangles * 3; ++i) {
+        uint32_t v = indices[i];
+        result.num_vertices += !used[v];
+        used[v] = 1;
+        if (fifo.access(v)) {
+          result.transformed++;
+          size_t first = (size_t)v * stride / fetch_line_size;
+          size_t last = ((size_t)v * stride + stride - 1) / fetch_line_size;
+          for (size_t line = first; line <= last; ++line) {
+            size_t &tag = tags[line % fetch_cache_lines];
+            if (tag != line) {
+              tag = line;
+              result.bytes_fetched += fetch_line_size;
+            }
+          }
+        }
+      }
+
+      result.acmr = result.num_triangles ? (float)result.transformed / result.num_triangles : 0;
+      result.atvr = result.num_vertices ? (float)result.transformed / result.num_vertices : 0;
+      result.fetch_ratio = result.num_vertices ? (float)result.bytes_fetched / ((float)result.num_vertices * stride) : 0;
+      return result;
+    }
+
+    /// Run all the passes over an indexed triangle list in place, merging duplicate vertices first.
+    /// pos_offset is the byte offset of a float vec3 position, or ~0 to skip the overdraw pass.
+    /// Returns the new number of vertices.
+    static unsigned optimize(
+      uint32_t *indices, unsigned num_indices, uint8_t *vertices, unsigned num_vertices,
+      unsigned stride, unsigned pos_offset, float overdraw_threshold = 1.05f
+    ) {
+      if (num_indices < 3 || !num_vertices) return num_vertices;
+
+      num_vertices = remove_duplicate_vertices(indices, num_indices, vertices, num_vertices, stride);
+
+      dynarray<uint32_t> tmp(num_indices);
+      optimize_vertex_cache(tmp.data(), indices, num_indices, num_vertices);
+      // any odd indices at the end are left alone.
+      unsigned tri_indices = num_indices - num_indices % 3;
+      if (pos_offset != ~0u) {
+        optimize_overdraw(indices, tmp.data(), tri_indices, vertices, num_vertices, stride, pos_offset, overdraw_threshold);
+      } else {
+        memcpy(indices, tmp.data(), tri_indices * sizeof(uint32_t));
+      }
+
+      dynarray<uint8_t> new_vertices(num_vertices * stride);
+      num_vertices = optimize_vertex_fetch(new_vertices.data(), indices, num_indices, vertices, num_vertices, stride);
+      memcpy(vertices, new_vertices.data(), num_vertices * stride);
+      return num_vertices;
+    }
+
+    /// Copy the buffers of a GL_TRIANGLES mesh for optimize(mesh_data &).
+    /// Returns false if the mesh can't be optimized. This reads GL buffers, so call it on the GL thread.
+    static bool get_mesh_data(mesh_data &md, mesh *msh) {
+      unsigned index_type = msh->get_index_type();
+      if (msh->get_mode() != GL_TRIANGLES || (index_type != GL_UNSIGNED_INT && index_type != GL_UNSIGNED_SHORT)) {
+        return false;
+      }
+
+      unsigned num_indices = msh->get_num_indices();
+      unsigned num_vertices = msh->get_num_vertices();
+      unsigned stride = msh->get_stride();
+      if (num_indices < 3 || !num_vertices || !stride) return false;
+
+      md.indices.resize(num_indices);
+      md.vertices.resize(num_vertices * stride);
+      md.num_vertices = num_vertices;
+      md.stride = stride;
+      {
+        gl_resource::rolock idx_lock(msh->get_indices());
+        gl_resource::rolock vtx_lock(msh->get_vertices());
+        for (unsigned i = 0; i != num_indices; ++i) {
+          uint32_t idx = msh->get_index(idx_lock.u8(), i);
+          // bad indices would take us out of the buffers.
+          if (idx >= num_vertices) return false;
+          md.indices[i] = idx;
+        }
+        memcpy(md.vertices.data(), vtx_lock.u8(), num_vertices * stride);
+      }
+
+      unsigned pos_slot = msh->get_slot(attribute_pos);
+      md.pos_offset = ~0u;
+      if (pos_slot != ~0u && msh->get_kind(pos_slot) == GL_FLOAT && msh->get_size(pos_slot) >= 3) {
+        md.pos_offset = msh->get_offset(pos_slot);
+      }
+      return true;
+    }
+
+    /// Optimize mesh data in place. This does not touch GL, so it can run on any thread.
+    static void optimize(mesh_data &md, float overdraw_threshold = 1.05f) {
+      md.num_vertices = optimize(
+        md.indices.data(), md.indices.size(), md.vertices.data(), md.num_vertices,
+        md.stride, md.pos_offset, overdraw_threshold
+      );
+    }
+
+    /// Replace the vertex and index buffers of a mesh with optimized mesh data. Call it on the GL thread.
+    static void set_mesh_data(mesh *msh, const mesh_data &md) {
+      unsigned vsize = md.num_vertices * md.stride;
+      gl_resource *new_vertices = new gl_resource(GL_ARRAY_BUFFER, vsize);
+      new_vertices->assign(md.vertices.data(), 0, vsize);
+      msh->set_vertices(new_vertices);
+      msh->set_num_vertices(md.num_vertices);
+
+      if (msh->get_index_type() == GL_UNSIGNED_SHORT) {
+        dynarray<uint16_t> short_indices(md.indices.size());
+        for (unsigned i = 0; i != md.indices.size(); ++i) {
+          short_indices[i] = (uint16_t)md.indices[i];
+        }
+        msh->set_indices(short_indices);
+      } else {
+        msh->set_indices(md.indices);
+      }
+    }
+
+    /// Optimize a GL_TRIANGLES mesh, replacing its vertex and index buffers.
+    /// Returns false if the mesh was left alone.
+    static bool optimize(mesh *msh, float overdraw_threshold = 1.05f) {
+      mesh_data md;
+      if (!get_mesh_data(md, msh)) return false;
+      optimize(md, overdraw_threshold);
+      set_mesh_data(msh, md);
+      return true;
+    }
+
+    /// Measure a mesh. See analyze() above.
+    static statistics analyze(mesh *msh) {
+      unsigned num_indices = msh->get_num_indices();
+      unsigned num_vertices = msh->get_num_vertices();
+      dynarray<uint32_t> indices(num_indices);
+      {
+        gl_resource::rolock idx_lock(msh->get_indices());
+        for (unsigned i = 0; i != num_indices; ++i) {
+          uint32_t idx = msh->get_index(idx_lock.u8(), i);
+          indices[i] = idx < num_vertices ? idx : 0;
+        }
+      }
+      return analyze(indices.data(), num_indices, num_vertices, msh->get_stride());
+    }
+
+    /// Optimize every mesh in a dictionary, for example before saving it with a binary_writer.
+    /// The meshes are optimized in parallel; their buffers are read and written on the calling thread.
+    static void optimize_all(resource_dict &dict, float overdraw_threshold = 1.05f) {
+      dynarray<resource*> meshes;
+      dict.find_all(meshes, atom_mesh);
+
+      // gather the buffers serially: GL calls only work on the thread with the context.
+      dynarray<mesh_data> data(meshes.size());
+      dynarray<bool> ok(meshes.size());
+      for (unsigned i = 0; i != meshes.size(); ++i) {
+        ok[i] = get_mesh_data(data[i], meshes[i]->get_mesh());
+      }
+
+      job_pool::get().parallel_for(0, meshes.size(), 1, [&](unsigned m0, unsigned m1) {
+        for (unsigned i = m0; i != m1; ++i) {
+          if (ok[i]) optimize(data[i], overdraw_threshold);
+        }
+      });
+
+      for (unsigned i = 0; i != meshes.size(); ++i) {
+        if (ok[i]) set_mesh_data(meshes[i]->get_mesh(), data[i]);
+      }
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class mesh_optimizer_unit_test {
+    public:
+      mesh_optimizer_unit_test() {
+        // a 16x16 grid of quads in row order with duplicated corners.
+        enum { n = 16 };
+        dynarray<vec3p> vertices;
+        dynarray<uint32_t> indices;
+        for (unsigned y = 0; y != n; ++y) {
+          for (unsigned x = 0; x != n; ++x) {
+            unsigned base = vertices.size();
+            vertices.push_back(vec3p((float)x, (float)y, 0));
+            vertices.push_back(vec3p((float)x + 1, (float)y, 0));
+            vertices.push_back(vec3p((float)x + 1, (float)y + 1, 0));
+            vertices.push_back(vec3p((float)x, (float)y + 1, 0));
+            static const uint32_t quad[] = { 0, 1, 2, 0, 2, 3 };
+            for (unsigned i = 0; i != 6; ++i) indices.push_back(base + quad[i]);
+          }
+        }
+        unsigned stride = sizeof(vec3p);
+        mesh_optimizer::statistics before = mesh_optimizer::analyze(indices.data(), indices.size(), vertices.size(), stride);
+        unsigned num_vertices = mesh_optimizer::optimize(indices.data(), indices.size(), (uint8_t*)vertices.data(), vertices.size(), stride, 0);
+        mesh_optimizer::statistics after = mesh_optimizer::analyze(indices.data(), indices.size(), num_vertices, stride);
+        assert(num_vertices == (n + 1) * (n + 1));
+        assert(after.num_triangles == before.num_triangles && after.acmr < before.acmr && after.bytes_fetched < before.bytes_fetched);
+      }
+    };
+    static mesh_optimizer_unit_test mesh_optimizer_unit_test;
+  #endif
+}}
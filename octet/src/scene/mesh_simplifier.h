@@ -0,0 +1,817 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Edge collapse simplification and levels of detail.
+//
+
+namespace octet { namespace scene {
+  /// Reduce the triangle count of meshes by collapsing edges, for levels of detail.
+  ///
+  /// Each collapse moves a vertex onto a neighbour, so a simplified index buffer uses the
+  /// original vertices and all the levels can share one vertex buffer.
+  /// The cost of a collapse is the quadric error metric of Garland and Heckbert, the
+  /// area weighted squared distance from the original planes, plus the change in normals and uvs.
+  ///
+  /// Vertices on open borders only move along the border. Where a position has several
+  /// vertices, such as a uv seam, it only moves if every one of them has a vertex to move to,
+  /// which keeps the seam.
+  ///
+  /// Errors are relative to the largest dimension of the mesh's bounding box.
+  ///
+  /// Example
+  ///
+  ///     float error = 0;
+  ///     mesh *quarter = mesh_simplifier::simplify(msh, msh->get_num_indices() / 12, 0.01f, &error);
+  ///
+  ///     // add levels of detail for every mesh in a scene.
+  ///     mesh_simplifier::add_lods(app_scene);
+  class mesh_simplifier {
+  public:
+    enum {
+      max_attributes = 5,
+    };
+
+    /// One level of detail from build_lods()
+    struct lod {
+      ref<mesh> msh;
+      float error;
+    };
+
+    /// Vertex data from a mesh for simplify()
+    struct mesh_data {
+      dynarray<uint32_t> indices;
+      dynarray<vec3p> positions;
+      dynarray<float> attributes;
+      float attribute_weights[max_attributes];
+      unsigned num_attributes;
+      float extent;
+    };
+
+  private:
+    // sum of weighted squared distances from planes as a symmetric 4x4 matrix.
+    struct quadric {
+      float a00, a01, a02, a11, a12, a22;
+      float b0, b1, b2;
+      float c;
+      float w;
+
+      void clear() {
+        memset(this, 0, sizeof(*this));
+      }
+
+      // add weight * (dot(n, p) + d)^2
+      void add_plane(vec3_in n, float d, float weight) {
+        float x = n.x(), y = n.y(), z = n.z();
+        a00 += weight * x * x; a01 += weight * x * y; a02 += weight * x * z;
+        a11 += weight * y * y; a12 += weight * y * z; a22 += weight * z * z;
+        b0 += weight * x * d; b1 += weight * y * d; b2 += weight * z * d;
+        c += weight * d * d;
+        w += weight;
+      }
+
+      void add(const quadric &r) {
+        a00 += r.a00; a01 += r.a01; a02 += r.a02;
+        a11 += r.a11; a12 += r.a12; a22 += r.a22;
+        b0 += r.b0; b1 += r.b1; b2 += r.b2;
+        c += r.c;
+        w += r.w;
+      }
+
+      // weighted mean squared distance of p from the planes.
+      float error(vec3_in p) const {
+        float x = p.x(), y = p.y(), z = p.z();
+        float e =
+          a00 * x * x + a11 * y * y + a22 * z * z +
+          2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+          2 * (b0 * x + b1 * y + b2 * z) + c
+        ;
+        return w > 0 ? fabsf(e) / w : 0;
+      }
+    };
+
+    // vertices with the same position and, optionally, attributes.
+    struct vertex_key {
+      const vec3p *pos;
+      const float *attr;
+      unsigned num_attributes;
+
+      bool is_empty() const { return pos == 0; }
+
+      bool operator ==(const vertex_key &rhs) const {
+        return
+          memcmp(pos, rhs.pos, sizeof(vec3p)) == 0 &&
+          (!num_attributes || memcmp(attr, rhs.attr, num_attributes * sizeof(float)) == 0)
+        ;
+      }
+    };
+
+    class vertex_key_cmp : public hash_map_cmp {
+    public:
+      static unsigned get_hash(const vertex_key &key) {
+        unsigned hash = 2166136261u;
+        const uint8_t *bytes = (const uint8_t*)key.pos;
+        for (unsigned i = 0; i != sizeof(vec3p); ++i) {
+          hash = ( hash ^ bytes[i] ) * 16777619u;
+        }
+        bytes = (const uint8_t*)key.attr;
+        for (unsigned i = 0; i != key.num_attributes * sizeof(float); ++i) {
+          hash = ( hash ^ bytes[i] ) * 16777619u;
+        }
+        return fuzz_hash(hash);
+      }
+      static bool is_empty(const vertex_key &key) { return key.is_empty(); }
+    };
+
+  public:
+    /// Map each vertex to the first one with the same position and num_attributes attributes.
+    static void weld(dynarray<uint32_t> &remap, const vec3p *positions, unsigned num_vertices, const float *attributes = NULL, unsigned num_attributes = 0) {
+      hash_map<vertex_key, unsigned, vertex_key_cmp> key_to_vertex;
+      remap.resize(num_vertices);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        vertex_key key = { &positions[v], attributes + v * num_attributes, num_attributes };
+        unsigned &e = key_to_vertex[key];
+        if (!e) e = v + 1;
+        remap[v] = e - 1;
+      }
+    }
+
+  private:
+    // a vertex of the position being collapsed and the vertex it moves to.
+    struct wedge {
+      uint32_t from;
+      uint32_t to;
+    };
+
+    struct collapse {
+      uint32_t from;
+      uint32_t to;
+      unsigned removed;
+      float cost;
+      float error;
+
+      bool operator <(const collapse &rhs) const { return cost < rhs.cost; }
+    };
+
+    enum {
+      flag_locked = 1,
+      flag_border = 2,
+    };
+
+    // the state of one simplification.
+    struct state {
+      const float *attributes;
+      unsigned num_attributes;
+      const float *attribute_weights;
+
+      dynarray<vec3p> pos;            // positions scaled to a unit box
+      dynarray<uint32_t> remap_pos;   // first vertex with the same position
+      dynarray<uint8_t> flags;        // by position
+      dynarray<quadric> quadrics;     // by position
+      dynarray<uint32_t> tris;        // live triangles
+      dynarray<uint64_t> edges;       // sorted directed edges between positions
+      dynarray<uint32_t> adj_offset;  // triangles around each position
+      dynarray<uint32_t> adj;
+    };
+
+    static uint64_t edge_key(uint32_t a, uint32_t b) {
+      return ((uint64_t)a << 32) | b;
+    }
+
+    static bool has_edge(const state &s, uint32_t a, uint32_t b) {
+      return std::binary_search(s.edges.data(), s.edges.data() + s.edges.size(), edge_key(a, b));
+    }
+
+    // an edge used in one direction only is on an open border.
+    static bool is_border_edge(const state &s, uint32_t a, uint32_t b) {
+      return has_edge(s, a, b) != has_edge(s, b, a);
+    }
+
+    static vec3 get_pos(const state &s, uint32_t v) {
+      return vec3(s.pos[v]);
+    }
+
+    // find the borders and the triangles around each position.
+    static void build_topology(state &s, bool first_pass, float border_weight) {
+      unsigned num_tris = s.tris.size() / 3;
+      unsigned num_vertices = s.pos.size();
+      s.edges.resize(num_tris * 3);
+      for (unsigned t = 0; t != num_tris; ++t) {
+        for (unsigned k = 0; k != 3; ++k) {
+          uint32_t a = s.remap_pos[s.tris[t*3+k]];
+          uint32_t b = s.remap_pos[s.tris[t*3+(k == 2 ? 0 : k+1)]];
+          s.edges[t*3+k] = edge_key(a, b);
+        }
+      }
+      std::sort(s.edges.data(), s.edges.data() + s.edges.size());
+
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        s.flags[v] &= ~flag_border;
+      }
+
+      // the same directed edge twice means a non-manifold mesh: leave it alone.
+      for (unsigned i = 1; i < s.edges.size(); ++i) {
+        if (s.edges[i] == s.edges[i-1]) {
+          s.flags[(uint32_t)(s.edges[i] >> 32)] |= flag_locked;
+          s.flags[(uint32_t)s.edges[i]] |= flag_locked;
+        }
+      }
+
+      for (unsigned t = 0; t != num_tris; ++t) {
+        for (unsigned k = 0; k != 3; ++k) {
+          uint32_t a = s.remap_pos[s.tris[t*3+k]];
+          uint32_t b = s.remap_pos[s.tris[t*3+(k == 2 ? 0 : k+1)]];
+          if (has_edge(s, b, a)) continue;
+          s.flags[a] |= flag_border;
+          s.flags[b] |= flag_border;
+          if (first_pass) {
+            // a plane through the border edge at right angles to the triangle keeps the border in place.
+            uint32_t c = s.remap_pos[s.tris[t*3+(k == 0 ? 2 : k-1)]];
+            vec3 pa = get_pos(s, a), edge = get_pos(s, b) - pa;
+            vec3 normal = cross(edge, get_pos(s, c) - pa);
+            vec3 side = cross(edge, normal);
+            float len = length(side);
+            if (len == 0) continue;
+            side = side * (1.0f / len);
+            float weight = dot(edge, edge) * border_weight;
+            s.quadrics[a].add_plane(side, -dot(side, pa), weight);
+            s.quadrics[b].add_plane(side, -dot(side, pa), weight);
+          }
+        }
+      }
+
+      s.adj_offset.resize(num_vertices + 1);
+      memset(s.adj_offset.data(), 0, s.adj_offset.size() * sizeof(uint32_t));
+      for (unsigned i = 0; i != num_tris * 3; ++i) {
+        s.adj_offset[s.remap_pos[s.tris[i]] + 1]++;
+      }
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        s.adj_offset[v + 1] += s.adj_offset[v];
+      }
+      s.adj.resize(num_tris * 3);
+      dynarray<uint32_t> fill(num_vertices);
+      memcpy(fill.data(), s.adj_offset.data(), num_vertices * sizeof(uint32_t));
+      for (unsigned i = 0; i != num_tris * 3; ++i) {
+        s.adj[fill[s.remap_pos[s.tris[i]]]++] = i / 3;
+      }
+    }
+
+    // which vertex of triangle t is at position p? ~0 if none.
+    static uint32_t corner_at(const state &s, unsigned t, uint32_t p) {
+      for (unsigned k = 0; k != 3; ++k) {
+        if (s.remap_pos[s.tris[t*3+k]] == p) return s.tris[t*3+k];
+      }
+      return ~0u;
+    }
+
+    // cost of moving position p onto position q, or a negative number if we can't.
+    // error is the squared distance part of the cost.
+    static float evaluate(const state &s, uint32_t p, uint32_t q, dynarray<wedge> &wedges, unsigned &removed, float &error) {
+      if ((s.flags[p] & flag_border) && !is_border_edge(s, p, q)) return -1;
+
+      vec3 pq = get_pos(s, q);
+      wedges.resize(0);
+      removed = 0;
+      for (unsigned i = s.adj_offset[p]; i != s.adj_offset[p+1]; ++i) {
+        unsigned t = s.adj[i];
+        uint32_t from = corner_at(s, t, p);
+        uint32_t to = corner_at(s, t, q);
+        if (to != ~0u) {
+          removed++;
+        } else {
+          // the triangles that stay must not turn over.
+          vec3 v[3], nv[3];
+          for (unsigned k = 0; k != 3; ++k) {
+            uint32_t pk = s.remap_pos[s.tris[t*3+k]];
+            v[k] = get_pos(s, pk);
+            nv[k] = pk == p ? pq : v[k];
+          }
+          vec3 n0 = cross(v[1] - v[0], v[2] - v[0]);
+          vec3 n1 = cross(nv[1] - nv[0], nv[2] - nv[0]);
+          float d = dot(n0, n1);
+          if (d <= 0 || d * d < 0.0625f * dot(n0, n0) * dot(n1, n1)) return -1;
+        }
+
+        unsigned j = 0;
+        while (j != wedges.size() && wedges[j].from != from) ++j;
+        if (j == wedges.size()) {
+          wedge w = { from, to };
+          wedges.push_back(w);
+        } else if (wedges[j].to == ~0u) {
+          wedges[j].to = to;
+        } else if (to != ~0u && to != wedges[j].to) {
+          // q is on a seam that p is not.
+          return -1;
+        }
+      }
+
+      float cost = 0;
+      for (unsigned j = 0; j != wedges.size(); ++j) {
+        // every vertex at p needs a vertex at q on the same side of any seam.
+        if (wedges[j].to == ~0u) return -1;
+        const float *a = s.attributes + wedges[j].from * s.num_attributes;
+        const float *b = s.attributes + wedges[j].to * s.num_attributes;
+        for (unsigned k = 0; k != s.num_attributes; ++k) {
+          cost += (a[k] - b[k]) * (a[k] - b[k]) * s.attribute_weights[k];
+        }
+      }
+
+      quadric qd = s.quadrics[p];
+      qd.add(s.quadrics[q]);
+      error = qd.error(pq);
+      return cost + error;
+    }
+
+    // the cheapest collapse of position p, or one to itself if there is none.
+    static collapse find_collapse(const state &s, uint32_t p, float max_error, dynarray<wedge> &wedges, dynarray<uint32_t> &tried) {
+      collapse best = { p, p, 0, 1e37f, 0 };
+      if (s.remap_pos[p] != p || (s.flags[p] & flag_locked)) return best;
+      tried.resize(0);
+      for (unsigned i = s.adj_offset[p]; i != s.adj_offset[p+1]; ++i) {
+        unsigned t = s.adj[i];
+        for (unsigned k = 0; k != 3; ++k) {
+          uint32_t q = s.remap_pos[s.tris[t*3+k]];
+          if (q == p || std::find(tried.data(), tried.data() + tried.size(), q) != tried.data() + tried.size()) continue;
+          tried.push_back(q);
+          unsigned removed = 0;
+          float error = 0;
+          float cost = evaluate(s, p, q, wedges, removed, error);
+          if (cost >= 0 && cost < best.cost && error <= max_error) {
+            best.to = q;
+            best.cost = cost;
+            best.error = error;
+            best.removed = removed;
+          }
+        }
+      }
+      return best;
+    }
+
+  public:
+    /// Simplify an indexed triangle list towards target_index_count indices, without letting the
+    /// error of a collapse exceed target_error. The result goes in dest, which may be indices.
+    ///
+    /// attributes has num_attributes floats per vertex, such as a normal and uv, and
+    /// attribute_weights scales the squared difference of each one.
+    /// Returns the number of indices in dest.
+    static unsigned simplify(
+      uint32_t *dest, const uint32_t *indices, unsigned num_indices,
+      const vec3p *positions, unsigned num_vertices,
+      const float *attributes, unsigned num_attributes, const float *attribute_weights,
+      unsigned target_index_count, float target_error, float *result_error = 0, float border_weight = 10.0f
+    ) {
+      if (result_error) *result_error = 0;
+
+      state s;
+      s.attributes = attributes;
+      s.num_attributes = attributes ? num_attributes : 0;
+      s.attribute_weights = attribute_weights;
+
+      unsigned num_tris = num_indices / 3;
+      if (num_tris * 3 <= target_index_count) {
+        memmove(dest, indices, num_tris * 3 * sizeof(uint32_t));
+        return num_tris * 3;
+      }
+
+      // unindexed meshes have many copies of each vertex.
+      {
+        dynarray<uint32_t> remap_vertex;
+        weld(remap_vertex, positions, num_vertices, s.attributes, s.num_attributes);
+        s.tris.resize(num_tris * 3);
+        for (unsigned i = 0; i != num_tris * 3; ++i) {
+          s.tris[i] = remap_vertex[indices[i]];
+        }
+      }
+
+      // errors are relative to the size of the mesh.
+      vec3 vmin(1e37f), vmax(-1e37f);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        vmin = min(vmin, vec3(positions[v]));
+        vmax = max(vmax, vec3(positions[v]));
+      }
+      vec3 size = vmax - vmin;
+      float extent = std::max(size.x(), std::max(size.y(), size.z()));
+      float scale = extent > 0 ? 1.0f / extent : 1.0f;
+      s.pos.resize(num_vertices);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        s.pos[v] = (vec3(positions[v]) - vmin) * scale;
+      }
+
+      weld(s.remap_pos, positions, num_vertices, NULL, 0);
+
+      s.flags.resize(num_vertices);
+      memset(s.flags.data(), 0, num_vertices);
+      s.quadrics.resize(num_vertices);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        s.quadrics[v].clear();
+      }
+      for (unsigned t = 0; t != num_tris; ++t) {
+        uint32_t p0 = s.remap_pos[s.tris[t*3+0]], p1 = s.remap_pos[s.tris[t*3+1]], p2 = s.remap_pos[s.tris[t*3+2]];
+        vec3 a = get_pos(s, p0);
+        vec3 normal = cross(get_pos(s, p1) - a, get_pos(s, p2) - a);
+        float len = length(normal);
+        if (len == 0) continue;
+        normal = normal * (1.0f / len);
+        float d = -dot(normal, a);
+        s.quadrics[p0].add_plane(normal, d, len * 0.5f);
+        s.quadrics[p1].add_plane(normal, d, len * 0.5f);
+        s.quadrics[p2].add_plane(normal, d, len * 0.5f);
+      }
+
+      float max_error = target_error * target_error;
+      float worst = 0;
+      unsigned target_tris = target_index_count / 3;
+      dynarray<collapse> collapses;
+      dynarray<collapse> best(num_vertices);
+      dynarray<uint8_t> dirty(num_vertices);
+      dynarray<wedge> wedges;
+      dynarray<uint32_t> vertex_remap(num_vertices);
+      dynarray<uint8_t> pass_lock(num_vertices);
+      memset(dirty.data(), 1, num_vertices);
+
+      for (bool first_pass = true; num_tris > target_tris; first_pass = false) {
+        build_topology(s, first_pass, border_weight);
+
+        // the cheapest collapse for each position that has changed.
+        job_pool::get().parallel_for(0, num_vertices, 1024, [&](unsigned v0, unsigned v1) {
+          dynarray<wedge> chunk_wedges;
+          dynarray<uint32_t> tried;
+          for (uint32_t p = v0; p != v1; ++p) {
+            if (dirty[p]) best[p] = find_collapse(s, p, max_error, chunk_wedges, tried);
+          }
+        });
+        memset(dirty.data(), 0, num_vertices);
+
+        collapses.resize(0);
+        for (uint32_t p = 0; p != num_vertices; ++p) {
+          if (best[p].to != p) collapses.push_back(best[p]);
+        }
+        if (collapses.size() == 0) break;
+        std::sort(collapses.data(), collapses.data() + collapses.size());
+
+        // apply the cheapest ones that don't touch each other.
+        // going half way to the target each pass lets the costs catch up,
+        // but passes that do little cost as much as the rest.
+        for (unsigned v = 0; v != num_vertices; ++v) vertex_remap[v] = v;
+        memset(pass_lock.data(), 0, num_vertices);
+        unsigned tris_left = num_tris;
+        unsigned pass_goal = std::max((num_tris - target_tris + 1) / 2, num_tris / 8);
+        unsigned pass_target = num_tris - std::min(num_tris - target_tris, pass_goal);
+        unsigned num_collapsed = 0;
+        for (unsigned i = 0; i != collapses.size() && tris_left > pass_target; ++i) {
+          const collapse &c = collapses[i];
+          if (pass_lock[c.from] || pass_lock[c.to]) continue;
+          unsigned removed = 0;
+          float error = 0;
+          evaluate(s, c.from, c.to, wedges, removed, error);
+          for (unsigned j = 0; j != wedges.size(); ++j) {
+            vertex_remap[wedges[j].from] = wedges[j].to;
+          }
+          s.quadrics[c.to].add(s.quadrics[c.from]);
+          for (unsigned j = s.adj_offset[c.from]; j != s.adj_offset[c.from+1]; ++j) {
+            unsigned t = s.adj[j];
+            for (unsigned k = 0; k != 3; ++k) pass_lock[s.remap_pos[s.tris[t*3+k]]] = 1;
+          }
+
+          // collapses onto q and near p need a new look.
+          uint32_t ends[2] = { c.from, c.to };
+          for (unsigned e = 0; e != 2; ++e) {
+            for (unsigned j = s.adj_offset[ends[e]]; j != s.adj_offset[ends[e]+1]; ++j) {
+              unsigned t = s.adj[j];
+              for (unsigned k = 0; k != 3; ++k) dirty[s.remap_pos[s.tris[t*3+k]]] = 1;
+            }
+          }
+          best[c.from].to = c.from;
+          tris_left -= std::min(tris_left, c.removed);
+          worst = std::max(worst, c.error);
+          num_collapsed++;
+        }
+        if (!num_collapsed) break;
+
+        // drop the triangles that have collapsed.
+        unsigned d = 0;
+        for (unsigned t = 0; t != num_tris; ++t) {
+          uint32_t i0 = vertex_remap[s.tris[t*3+0]], i1 = vertex_remap[s.tris[t*3+1]], i2 = vertex_remap[s.tris[t*3+2]];
+          uint32_t p0 = s.remap_pos[i0], p1 = s.remap_pos[i1], p2 = s.remap_pos[i2];
+          if (p0 == p1 || p1 == p2 || p2 == p0) continue;
+          s.tris[d++] = i0;
+          s.tris[d++] = i1;
+          s.tris[d++] = i2;
+        }
+        num_tris = d / 3;
+        s.tris.resize(d);
+      }
+
+      memcpy(dest, s.tris.data(), num_tris * 3 * sizeof(uint32_t));
+      if (result_error) *result_error = sqrtf(worst);
+      return num_tris * 3;
+    }
+
+  private:
+    // flat shaded meshes have a vertex for every face, which would make every edge a seam.
+    // use one vertex for faces that meet at less than the crease angle and have the same uvs.
+    static void weld_normals(mesh_data &md, float crease_angle) {
+      unsigned num_vertices = md.positions.size();
+      unsigned num_attributes = md.num_attributes;
+      float min_cos = cosf(crease_angle);
+      dynarray<uint32_t> remap_pos;
+      weld(remap_pos, md.positions.data(), num_vertices, NULL, 0);
+
+      // chains of distinct vertices at each position.
+      dynarray<uint32_t> next(num_vertices);
+      dynarray<uint32_t> remap(num_vertices);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        next[v] = ~0u;
+        uint32_t r = remap_pos[v];
+        remap[v] = v;
+        if (r == v) continue;
+        const float *a = md.attributes.data() + v * num_attributes;
+        uint32_t last = r;
+        for (uint32_t w = r; w != ~0u; w = next[w]) {
+          const float *b = md.attributes.data() + w * num_attributes;
+          if (
+            a[0] * b[0] + a[1] * b[1] + a[2] * b[2] >= min_cos &&
+            !memcmp(a + 3, b + 3, (num_attributes - 3) * sizeof(float))
+          ) {
+            remap[v] = w;
+            break;
+          }
+          last = w;
+        }
+        if (remap[v] == v) next[last] = v;
+      }
+
+      for (unsigned i = 0; i != md.indices.size(); ++i) {
+        md.indices[i] = remap[md.indices[i]];
+      }
+    }
+
+  public:
+    /// Get the indices, positions, normals and uvs of a GL_TRIANGLES mesh with float positions.
+    /// Faces with normals closer than crease_angle radians share vertices in the result.
+    /// Returns false if the mesh can't be simplified.
+    static bool get_mesh_data(mesh_data &md, mesh *msh, float crease_angle = 0.45f) {
+      unsigned index_type = msh->get_index_type();
+      if (msh->get_mode() != GL_TRIANGLES || (index_type != GL_UNSIGNED_INT && index_type != GL_UNSIGNED_SHORT)) {
+        return false;
+      }
+
+      unsigned num_indices = msh->get_num_indices();
+      unsigned num_vertices = msh->get_num_vertices();
+      unsigned stride = msh->get_stride();
+      unsigned pos_slot = msh->get_slot(attribute_pos);
+      if (num_indices < 3 || !num_vertices || pos_slot == ~0u) return false;
+      if (msh->get_kind(pos_slot) != GL_FLOAT || msh->get_size(pos_slot) < 3) return false;
+
+      // normals and uvs, if they are floats.
+      unsigned offsets[2], sizes[2], num_streams = 0;
+      bool has_normals = false;
+      static const unsigned attrs[2] = { attribute_normal, attribute_uv };
+      static const float weights[2] = { 0.0005f, 0.01f };
+      md.num_attributes = 0;
+      for (unsigned i = 0; i != 2; ++i) {
+        unsigned slot = msh->get_slot(attrs[i]);
+        if (slot == ~0u || msh->get_kind(slot) != GL_FLOAT) continue;
+        if (attrs[i] == attribute_normal) {
+          if (msh->get_size(slot) < 3) continue;
+          has_normals = true;
+        }
+        offsets[num_streams] = msh->get_offset(slot);
+        sizes[num_streams] = std::min(msh->get_size(slot), attrs[i] == attribute_uv ? 2u : 3u);
+        for (unsigned k = 0; k != sizes[num_streams]; ++k) md.attribute_weights[md.num_attributes++] = weights[i];
+        num_streams++;
+      }
+
+      md.indices.resize(num_indices);
+      md.positions.resize(num_vertices);
+      md.attributes.resize(num_vertices * md.num_attributes);
+      gl_resource::rolock idx_lock(msh->get_indices());
+      gl_resource::rolock vtx_lock(msh->get_vertices());
+      for (unsigned i = 0; i != num_indices; ++i) {
+        uint32_t idx = msh->get_index(idx_lock.u8(), i);
+        if (idx >= num_vertices) return false;
+        md.indices[i] = idx;
+      }
+
+      const uint8_t *src = vtx_lock.u8();
+      unsigned pos_offset = msh->get_offset(pos_slot);
+      vec3 vmin(1e37f), vmax(-1e37f);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        const uint8_t *vtx = src + v * stride;
+        md.positions[v] = *(const vec3p*)(vtx + pos_offset);
+        vmin = min(vmin, vec3(md.positions[v]));
+        vmax = max(vmax, vec3(md.positions[v]));
+        float *dest = md.attributes.data() + v * md.num_attributes;
+        for (unsigned i = 0; i != num_streams; ++i) {
+          const float *a = (const float*)(vtx + offsets[i]);
+          for (unsigned k = 0; k != sizes[i]; ++k) *dest++ = a[k];
+        }
+      }
+      vec3 size = vmax - vmin;
+      md.extent = std::max(size.x(), std::max(size.y(), size.z()));
+
+      if (has_normals) weld_normals(md, crease_angle);
+      return true;
+    }
+
+    /// Simplify mesh data. Returns the new indices reordered for the vertex cache.
+    static float simplify(dynarray<uint32_t> &result, const mesh_data &md, unsigned target_index_count, float target_error) {
+      dynarray<uint32_t> tmp(md.indices.size());
+      float error = 0;
+      unsigned num_indices = simplify(
+        tmp.data(), md.indices.data(), md.indices.size(), md.positions.data(), md.positions.size(),
+        md.attributes.data(), md.num_attributes, md.attribute_weights, target_index_count, target_error, &error
+      );
+      result.resize(num_indices);
+      if (num_indices) {
+        mesh_optimizer::optimize_vertex_cache(result.data(), tmp.data(), num_indices, md.positions.size());
+      }
+      return error;
+    }
+
+    /// Make a mesh that shares the vertices of msh with new indices.
+    static mesh *make_mesh(mesh *msh, const dynarray<uint32_t> &indices) {
+      mesh *result = new mesh(*msh);
+      result->set_aabb(msh->get_aabb());
+      // the copy shares the index buffer too.
+      result->set_indices((gl_resource*)NULL);
+      if (msh->get_index_type() == GL_UNSIGNED_SHORT) {
+        dynarray<uint16_t> short_indices(indices.size());
+        for (unsigned i = 0; i != indices.size(); ++i) {
+          short_indices[i] = (uint16_t)indices[i];
+        }
+        result->set_indices(short_indices);
+      } else {
+        result->set_indices(indices);
+      }
+      return result;
+    }
+
+    /// Simplify a mesh to about target_triangles triangles, sharing its vertex buffer.
+    /// Returns NULL if the mesh can't be simplified.
+    static mesh *simplify(mesh *msh, unsigned target_triangles, float target_error = 1.0f, float *result_error = 0) {
+      mesh_data md;
+      if (!get_mesh_data(md, msh)) return NULL;
+      dynarray<uint32_t> indices;
+      float error = simplify(indices, md, target_triangles * 3, target_error);
+      if (result_error) *result_error = error;
+      return make_mesh(msh, indices);
+    }
+
+    /// Simplify mesh data to a chain of levels, each with about reduction times the triangles of
+    /// the last. Each level is simplified from the original so that its error is accurate.
+    /// Stops early if a level would save little or exceed max_error.
+    static void build_lod_indices(dynarray<dynarray<uint32_t> > &levels, dynarray<float> &errors, const mesh_data &md, unsigned num_levels, float reduction, float max_error) {
+      levels.resize(0);
+      errors.resize(0);
+      unsigned last_count = md.indices.size();
+      unsigned target = last_count;
+      for (unsigned level = 0; level != num_levels; ++level) {
+        target = (unsigned)(target / 3 * reduction) * 3;
+        if (target < 3) break;
+        dynarray<uint32_t> indices;
+        float error = simplify(indices, md, target, max_error);
+        if (indices.size() == 0 || indices.size() > last_count * 9 / 10) break;
+        last_count = indices.size();
+        levels.resize(levels.size() + 1);
+        levels.back().resize(indices.size());
+        memcpy(levels.back().data(), indices.data(), indices.size() * sizeof(uint32_t));
+        errors.push_back(error);
+      }
+    }
+
+    /// Build a chain of simplified meshes for msh. See build_lod_indices.
+    static void build_lods(dynarray<lod> &lods, mesh *msh, unsigned num_levels = 3, float reduction = 0.5f, float max_error = 0.05f) {
+      lods.resize(0);
+      mesh_data md;
+      if (!get_mesh_data(md, msh)) return;
+      dynarray<dynarray<uint32_t> > levels;
+      dynarray<float> errors;
+      build_lod_indices(levels, errors, md, num_levels, reduction, max_error);
+      for (unsigned i = 0; i != levels.size(); ++i) {
+        lod l;
+        l.msh = make_mesh(msh, levels[i]);
+        l.error = errors[i] * md.extent;
+        lods.push_back(l);
+      }
+    }
+
+    /// Add levels of detail to every mesh instance in a scene that does not have them.
+    ///
+    /// Each level is drawn from the distance where its error, in world units, looks smaller
+    /// than max_angle radians; 0.001 is about a pixel on a typical screen.
+    /// The meshes are simplified in parallel.
+    static void add_lods(visual_scene *scene, unsigned num_levels = 3, float reduction = 0.5f, float max_angle = 0.001f, float max_error = 0.05f) {
+      // gather the meshes serially: reading buffers is not thread safe.
+      dynarray<mesh_instance *> instances;
+      dynarray<mesh *> meshes;
+      dynarray<unsigned> instance_mesh;
+      hash_map<mesh *, unsigned> mesh_index;
+      for (int i = 0; i != scene->get_num_mesh_instances(); ++i) {
+        mesh_instance *mi = scene->get_mesh_instance(i);
+        mesh *msh = mi->get_mesh();
+        if (!msh || (mi->get_flags() & mesh_instance::flag_lod)) continue;
+        unsigned &index = mesh_index[msh];
+        if (!index) {
+          meshes.push_back(msh);
+          index = meshes.size();
+        }
+        instances.push_back(mi);
+        instance_mesh.push_back(index - 1);
+      }
+
+      dynarray<mesh_data> data(meshes.size());
+      dynarray<bool> ok(meshes.size());
+      for (unsigned i = 0; i != meshes.size(); ++i) {
+        ok[i] = get_mesh_data(data[i], meshes[i]);
+      }
+
+      dynarray<dynarray<dynarray<uint32_t> > > levels(meshes.size());
+      dynarray<dynarray<float> > errors(meshes.size());
+      job_pool::get().parallel_for(0, meshes.size(), 1, [&](unsigned m0, unsigned m1) {
+        for (unsigned i = m0; i != m1; ++i) {
+          if (ok[i]) build_lod_indices(levels[i], errors[i], data[i], num_levels, reduction, max_error);
+        }
+      });
+
+      // make the meshes and instances serially.
+      dynarray<dynarray<lod> > lods(meshes.size());
+      for (unsigned i = 0; i != meshes.size(); ++i) {
+        for (unsigned j = 0; j != levels[i].size(); ++j) {
+          lod l;
+          l.msh = make_mesh(meshes[i], levels[i][j]);
+          l.error = errors[i][j] * data[i].extent;
+          lods[i].push_back(l);
+        }
+      }
+
+      for (unsigned i = 0; i != instances.size(); ++i) {
+        mesh_instance *mi = instances[i];
+        dynarray<lod> &chain = lods[instance_mesh[i]];
+        if (chain.size() == 0) continue;
+
+        // errors grow with the scale of the node.
+        float scale = mi->get_node() ? length(mi->get_node()->calcModelToWorld().x().xyz()) : 1.0f;
+        float max_distance = mi->get_max_draw_distance();
+        float distance = std::max(mi->get_min_draw_distance(), 0.0f);
+        mi->set_flags(mi->get_flags() | mesh_instance::flag_lod);
+        mesh_instance *prev = mi;
+        for (unsigned j = 0; j != chain.size(); ++j) {
+          // a coarser level that looks as good replaces this one.
+          if (j + 1 != chain.size() && chain[j+1].error <= chain[j].error) continue;
+          distance = std::max(distance, chain[j].error * scale / max_angle);
+          if (distance >= max_distance) break;
+          prev->set_max_draw_distance(distance);
+          mesh_instance *lod_mi = new mesh_instance(mi->get_node(), chain[j].msh, mi->get_material(), mi->get_skeleton());
+          lod_mi->set_flags(mi->get_flags());
+          lod_mi->set_min_draw_distance(distance);
+          lod_mi->set_max_draw_distance(max_distance);
+          scene->add_mesh_instance(lod_mi);
+          prev = lod_mi;
+        }
+      }
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class mesh_simplifier_unit_test {
+    public:
+      mesh_simplifier_unit_test() {
+        // a flat 16x16 grid of quads collapses to two triangles, but the corners stay put.
+        enum { n = 16 };
+        dynarray<vec3p> positions;
+        dynarray<uint32_t> indices;
+        for (unsigned y = 0; y <= n; ++y) {
+          for (unsigned x = 0; x <= n; ++x) {
+            positions.push_back(vec3p((float)x, (float)y, 0));
+          }
+        }
+        for (unsigned y = 0; y != n; ++y) {
+          for (unsigned x = 0; x != n; ++x) {
+            uint32_t i = y * (n + 1) + x;
+            static const uint32_t quad[] = { 0, 1, n + 2, 0, n + 2, n + 1 };
+            for (unsigned k = 0; k != 6; ++k) indices.push_back(i + quad[k]);
+          }
+        }
+        dynarray<uint32_t> result(indices.size());
+        float error = 1;
+        unsigned num_indices = mesh_simplifier::simplify(
+          result.data(), indices.data(), indices.size(), positions.data(), positions.size(),
+          NULL, 0, NULL, 0, 0.001f, &error
+        );
+        assert(num_indices == 6 && error < 0.001f);
+
+        // the area is unchanged and the triangles still face the same way.
+        float area = 0;
+        for (unsigned i = 0; i != num_indices; i += 3) {
+          vec3 a = positions[result[i]], b = positions[result[i+1]], c = positions[result[i+2]];
+          area += cross(b - a, c - a).z() * 0.5f;
+        }
+        assert(fabsf(area - n * n) < 0.01f);
+      }
+    };
+    static mesh_simplifier_unit_test mesh_simplifier_unit_test;
+  #endif
+}}
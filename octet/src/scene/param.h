@@ -86,6 +86,10 @@ namespace octet { namespace scene {
 
   struct param_bind_info {
     GLint program;
+    shader *owner;  // if not NULL, looks up uniform locations without calling GL
+
+    param_bind_info() : program(0), owner(NULL) {
+    }
   };
 
   struct param_buffer_info {
@@ -169,7 +173,7 @@ namespace octet { namespace scene {
 
     /// connect the parameter to the shader
     void bind(param_bind_info &pbi) {
-      uniform = glGetUniformLocation(pbi.program, get_atom_name());
+      uniform = pbi.owner ? pbi.owner->get_uniform_location(get_atom_name()) : glGetUniformLocation(pbi.program, get_atom_name());
       //log("bind %d %s\n", uniform, get_atom_name());
     }
 
@@ -200,8 +204,12 @@ namespace octet { namespace scene {
     /// for OpenGL ES2, call glUniform* to copy the uniform to the GPU command buffer.
     /// for OpenGL ES3, we can use the uniform buffer directly and so don't need this.
     void render(const uint8_t *buffer) {
-      GLint uni = get_uniform();
+      render_location(buffer, get_uniform());
+    }
 
+    /// Like render(), but for another program made from the same shader, such as
+    /// param_shader's instanced variant, where the uniform is at "uni".
+    virtual void render_location(const uint8_t *buffer, GLint uni) {
       if (uni == -1) return;
 
       switch (get_gl_type()) {
@@ -288,8 +296,8 @@ namespace octet { namespace scene {
     }
 
     /// Set the OpenGL state for this sampler.
-    void render(const uint8_t *buffer) {
-      param_uniform::render(buffer);
+    void render_location(const uint8_t *buffer, GLint uni) {
+      param_uniform::render_location(buffer, uni);
       glActiveTexture(GL_TEXTURE0 + texture_slot);
       glBindTexture(sampler_->get_gl_target(), sampler_->get_gl_texture(image_));
 
@@ -298,10 +306,19 @@ namespace octet { namespace scene {
   };
 
   /// Shader that uses parameters.
+  ///
+  /// If the vertex shader mentions OCTET_INSTANCED, a second program is made with it defined.
+  /// That variant should read the model to camera matrix from the per-instance attribute
+  /// "instance_modelToCamera" and use the uniform cameraToProjection (see shaders/default.vs),
+  /// so that visual_scene can draw many instances of a mesh in one call.
   class param_shader : public shader {
     std::string vertex_shader;
     std::string fragment_shader;
 
+    // variant reading the matrices from per-instance attributes, or NULL.
+    ref<shader> instanced;
+
+
   public:
     RESOURCE_META(param_shader)
 
@@ -321,13 +338,26 @@ namespace octet { namespace scene {
     void init(dynarray<ref<param> > &params) {
       shader::init(vertex_shader.data(), fragment_shader.data());
 
+      #if OCTET_INSTANCING
+        if (vertex_shader.find("OCTET_INSTANCED") != std::string::npos) {
+          instanced = new shader();
+          instanced->init(insert_after_version(vertex_shader.c_str(), "#define OCTET_INSTANCED 1\n").c_str(), fragment_shader.c_str());
+        }
+      #endif
+
       param_bind_info pbi;
       pbi.program = get_program();
+      pbi.owner = this;
 
       for (unsigned i = 0; i != params.size(); ++i) {
         params[i]->bind(pbi);
       }
     }
+
+    /// The instanced variant of this shader, or NULL if there is none.
+    shader *get_instanced() const {
+      return instanced;
+    }
   };
 }}
 
@@ -10,12 +10,14 @@
 #ifndef OCTET_SCENE_INCLUDED
 #define OCTET_SCENE_INCLUDED
 
+#include "../scene/transform_hierarchy.h"
 #include "../scene/scene_node.h"
 #include "../scene/skin.h"
 #include "../scene/skeleton.h"
 #include "../scene/animation.h"
 #include "../scene/mesh.h"
 #include "../scene/image.h"
+#include "../scene/animated_image.h"
 #include "../scene/sampler.h"
 #include "../scene/param.h"
 #include "../scene/material.h"
@@ -27,8 +29,12 @@
 #include "../scene/visual_scene.h"
 #include "../scene/displacement_map.h"
 #include "../scene/indexer.h"
+#include "../scene/mesh_optimizer.h"
+#include "../scene/mesh_simplifier.h"
+#include "../scene/mesh_clusters.h"
 #include "../scene/smooth.h"
 #include "../scene/mesh_text.h"
+#include "../scene/texture_atlas.h"
 #include "../scene/mesh_box.h"
 #include "../scene/mesh_cylinder.h"
 #include "../scene/mesh_sphere.h"
@@ -27,6 +27,67 @@ namespace octet { namespace scene {
     // is this node and all its children renderable?
     bool enabled;
 
+    // cached nodeToParent * parent's modelToWorld and enabled && parent's world_enabled.
+    mat4t modelToWorld;
+    bool world_enabled;
+
+    // modelToWorld is out of date. If a node is dirty, so are all its children.
+    bool dirty;
+
+    // some node below this one is dirty.
+    bool dirty_below;
+
+    // after flatten(), the transform lives in this slot of a transform_hierarchy
+    // and nodeToParent, modelToWorld and the dirty flags are not used.
+    ref<transform_hierarchy> hierarchy;
+    unsigned slot;
+
+    void init_cache() {
+      dirty = true;
+      dirty_below = false;
+      world_enabled = true;
+    }
+
+    // mark this node and its subtree as out of date, stopping at subtrees that already are.
+    void mark_subtree() {
+      dirty = true;
+      for (unsigned i = 0; i != children.size(); ++i) {
+        if (!children[i]->dirty) children[i]->mark_subtree();
+      }
+    }
+
+    // mark this node as moved and tell the ancestors.
+    void set_dirty() {
+      if (hierarchy) {
+        hierarchy->set_dirty(slot);
+        return;
+      }
+      if (!dirty) mark_subtree();
+      for (scene_node *p = parent; p != NULL && !p->dirty_below; p = p->parent) {
+        p->dirty_below = true;
+      }
+    }
+
+    // recompute this node from its parent, which must be up to date.
+    void update_cache() {
+      if (parent) {
+        modelToWorld = nodeToParent * parent->get_modelToWorld();
+        world_enabled = enabled && parent->calcEnabled();
+      } else {
+        modelToWorld = nodeToParent;
+        world_enabled = enabled;
+      }
+      dirty = false;
+    }
+
+    // bring this node up to date outside the update pass, parents first.
+    void clean() {
+      if (dirty) {
+        if (parent) parent->clean();
+        update_cache();
+      }
+    }
+
   public:
     RESOURCE_META(scene_node)
 
@@ -35,6 +96,8 @@ namespace octet { namespace scene {
       nodeToParent.loadIdentity();
       sid = atom_;
       enabled = true;
+      slot = 0;
+      init_cache();
       if (parent) {
         parent->add_child(this);
       }
@@ -45,6 +108,8 @@ namespace octet { namespace scene {
       this->nodeToParent = nodeToParent;
       this->sid = sid;
       enabled = true;
+      slot = 0;
+      init_cache();
     }
 
     /// the virtual add_ref on animation_target gets passed to here and we pass iton (delegate it) to the resource
@@ -60,7 +125,7 @@ namespace octet { namespace scene {
     /// animation input: for now, we only support skeleton animation
     void set_value(atom_t sid, atom_t sub_target, atom_t component, float *value) {
       if (sub_target == atom_transform) {
-        nodeToParent.init_transpose(value);
+        access_nodeToParent().init_transpose(value);
       }
     }
 
@@ -71,15 +136,92 @@ namespace octet { namespace scene {
       //log("visit scene_node children\n");
       v.visit(children, atom_children);
       //log("visit scene_node nodeToParent\n");
+      if (hierarchy) nodeToParent = hierarchy->get_local(slot);
       v.visit(nodeToParent, atom_nodeToParent);
       v.visit(sid, atom_sid);
+      if (v.is_reader()) {
+        init_cache();
+      }
     }
 
 
     /// add a child node to this node.
+    /// In a flattened tree, a node without children goes on the end of the transform_hierarchy
+    /// if this node is on one of its last two levels, which is the case when a tree is built
+    /// a level at a time. Anything else flattens the tree again, which touches every node,
+    /// so build trees in other orders before calling flatten().
     void add_child(scene_node *new_node) {
+      if (new_node->hierarchy && new_node->get_hierarchy() != get_hierarchy()) {
+        new_node->unflatten();
+      }
       new_node->parent = this;
       children.push_back(new_node);
+      if (hierarchy) {
+        if (new_node->children.size() == 0 && !new_node->hierarchy && hierarchy->can_add((int)slot)) {
+          new_node->slot = hierarchy->add((int)slot, new_node->nodeToParent, new_node->enabled);
+          new_node->hierarchy = hierarchy;
+        } else {
+          flatten();
+        }
+      } else {
+        new_node->mark_subtree();
+        new_node->set_dirty();
+      }
+    }
+
+    /// Move the transforms of the whole tree this node is in into a transform_hierarchy.
+    /// The nodes become handles to its slots and update_world() does a level at a time,
+    /// splitting big levels across the job pool. Best for big trees that do not change shape;
+    /// this is O(n), so call it once the tree is built rather than before adding each node.
+    void flatten() {
+      if (parent) {
+        parent->flatten();
+        return;
+      }
+
+      // breadth first, so that the nodes are sorted by depth.
+      dynarray<scene_node*> nodes;
+      dynarray<int> parents;
+      nodes.push_back(this);
+      parents.push_back(-1);
+      for (unsigned i = 0; i != nodes.size(); ++i) {
+        scene_node *node = nodes[i];
+        for (unsigned j = 0; j != node->children.size(); ++j) {
+          nodes.push_back(node->children[j]);
+          parents.push_back((int)i);
+        }
+      }
+
+      ref<transform_hierarchy> new_hierarchy = new transform_hierarchy();
+      for (unsigned i = 0; i != nodes.size(); ++i) {
+        new_hierarchy->add(parents[i], nodes[i]->get_nodeToParent(), nodes[i]->enabled);
+      }
+      for (unsigned i = 0; i != nodes.size(); ++i) {
+        nodes[i]->hierarchy = new_hierarchy;
+        nodes[i]->slot = i;
+      }
+      new_hierarchy->update();
+    }
+
+    /// Move the transforms of this node and the nodes below it back out of the transform_hierarchy.
+    void unflatten() {
+      if (!hierarchy) return;
+      nodeToParent = hierarchy->get_local(slot);
+      hierarchy = NULL;
+      init_cache();
+      for (unsigned i = 0; i != children.size(); ++i) {
+        children[i]->unflatten();
+      }
+    }
+
+    /// The flat arrays holding this node's transform, or NULL if the tree is not flattened.
+    transform_hierarchy *get_hierarchy() const {
+      return hierarchy;
+    }
+
+    /// This node's index in get_hierarchy().
+    unsigned get_slot() const {
+      return slot;
     }
 
     /// Get the parent node of this node.
@@ -97,21 +239,48 @@ namespace octet { namespace scene {
       return children[index];
     }
 
+    /// Recompute the world transforms of the nodes that have changed, top down.
+    /// Call this on the root once a frame; subtrees that have not changed are skipped.
+    void update_world() {
+      if (hierarchy) {
+        hierarchy->update();
+        return;
+      }
+      if (dirty) update_cache();
+      dirty_below = false;
+      for (unsigned i = 0; i != children.size(); ++i) {
+        scene_node *child = children[i];
+        if (child->dirty || child->dirty_below) {
+          child->update_world();
+        }
+      }
+    }
+
+    /// The scene_node to world matrix, from the cache if nothing has moved.
+    const mat4t &get_modelToWorld() {
+      if (hierarchy) return hierarchy->get_world(slot);
+      clean();
+      return modelToWorld;
+    }
+
     // compute the scene_node to world matrix for an individual scene_node;
     mat4t calcModelToWorld() {
-      mat4t result = nodeToParent;
-      for (scene_node *p = parent; p != NULL; p = p->parent) {
-        result = result * p->nodeToParent;
-      }
-      return result;
+      if (hierarchy) return hierarchy->get_world(slot);
+      clean();
+      return modelToWorld;
     }
 
     // calculate whether this node is enabled (recursively)
     bool calcEnabled() {
-      for (scene_node *p = this; p != NULL; p = p->parent) {
-        if (!p->enabled) return false;
-      }
-      return true;
+      if (hierarchy) return hierarchy->get_world_enabled(slot);
+      clean();
+      return world_enabled;
+    }
+
+    /// true if the node has moved since its world transform was last computed.
+    bool is_dirty() const {
+      if (hierarchy) return hierarchy->is_dirty(slot);
+      return dirty;
     }
 
     /// transform a point from model space to world space
@@ -130,11 +299,15 @@ namespace octet { namespace scene {
 
     /// read the node to parent transform matrix
     const mat4t &get_nodeToParent() const {
+      if (hierarchy) return hierarchy->get_local(slot);
       return nodeToParent;
     }
 
     /// access the node to parent transform matrix for writing.
+    /// Use get_nodeToParent() to read, this marks the node as moved.
     mat4t &access_nodeToParent() {
+      if (hierarchy) return hierarchy->access_local(slot);
+      set_dirty();
       return nodeToParent;
     }
 
@@ -165,27 +338,34 @@ namespace octet { namespace scene {
 
     /// set enabled state
     void set_enabled(bool value) {
-      enabled = value;
+      if (enabled != value) {
+        enabled = value;
+        if (hierarchy) {
+          hierarchy->set_enabled(slot, value);
+        } else {
+          set_dirty();
+        }
+      }
     }
 
     /// reset the matrix
     void loadIdentity() {
-      nodeToParent.loadIdentity();
+      access_nodeToParent().loadIdentity();
     }
 
     /// Translate the matrix
     void translate(vec3_in xyz) {
-      nodeToParent.translate(xyz[0], xyz[1], xyz[2]);
+      access_nodeToParent().translate(xyz[0], xyz[1], xyz[2]);
     }
 
     /// Rotate the matrix
     void rotate(float angle, vec3_in axis) {
-      nodeToParent.rotate(angle, axis[0], axis[1], axis[2]);
+      access_nodeToParent().rotate(angle, axis[0], axis[1], axis[2]);
     }
 
     /// Scale the matrix
     void scale(vec3_in xyz) {
-      nodeToParent.scale(xyz[0], xyz[1], xyz[2]);
+      access_nodeToParent().scale(xyz[0], xyz[1], xyz[2]);
     }
 
     /// Get the identifying sid
@@ -351,4 +531,83 @@ namespace octet { namespace scene {
       }
     #endif
   };
+
+  #if OCTET_UNIT_TEST
+    class scene_node_unit_test {
+      // the old way: multiply up the parent chain.
+      static mat4t brute_force(scene_node *node) {
+        mat4t result = node->get_nodeToParent();
+        for (scene_node *p = node->get_parent(); p != NULL; p = p->get_parent()) {
+          result = result * p->get_nodeToParent();
+        }
+        return result;
+      }
+
+      static bool same(const mat4t &a, const mat4t &b) {
+        for (int i = 0; i != 4; ++i) {
+          for (int j = 0; j != 4; ++j) {
+            if (fabsf(a[i][j] - b[i][j]) > 1e-4f) return false;
+          }
+        }
+        return true;
+      }
+
+    public:
+      scene_node_unit_test() {
+        ref<scene_node> root = new scene_node();
+        scene_node *a = new scene_node(root);
+        scene_node *b = new scene_node(a);
+        scene_node *c = new scene_node(root);
+        a->translate(vec3(1, 2, 3));
+        b->rotate(30, vec3(0, 1, 0));
+        b->translate(vec3(0, 0, 5));
+        c->scale(vec3(2, 2, 2));
+        root->update_world();
+        assert(!root->is_dirty() && !a->is_dirty() && !b->is_dirty() && !c->is_dirty());
+        assert(same(b->calcModelToWorld(), brute_force(b)) && same(c->calcModelToWorld(), brute_force(c)));
+
+        // moving a moves b but not c, and queries see the move before the next pass.
+        a->access_nodeToParent().translate(0, 10, 0);
+        assert(a->is_dirty() && b->is_dirty() && !c->is_dirty());
+        assert(same(b->calcModelToWorld(), brute_force(b)) && !a->is_dirty() && !b->is_dirty());
+        a->rotate(45, vec3(1, 0, 0));
+        root->update_world();
+        assert(!a->is_dirty() && !b->is_dirty() && same(b->calcModelToWorld(), brute_force(b)));
+
+        // disabling a disables b.
+        a->set_enabled(false);
+        assert(!b->calcEnabled() && c->calcEnabled());
+        a->set_enabled(true);
+        root->update_world();
+        assert(b->calcEnabled());
+
+        // the same, flattened into a transform_hierarchy.
+        c->flatten();
+        assert(root->get_hierarchy() && root->get_hierarchy() == b->get_hierarchy());
+        assert(b->get_slot() > a->get_slot() && same(b->calcModelToWorld(), brute_force(b)));
+        a->translate(vec3(0, 0, -4));
+        assert(a->is_dirty() && same(b->calcModelToWorld(), brute_force(b)));
+        root->update_world();
+        assert(!a->is_dirty() && same(b->get_modelToWorld(), brute_force(b)));
+        a->set_enabled(false);
+        assert(!b->calcEnabled() && c->calcEnabled());
+
+        // adding a leaf below the deepest level appends it without flattening again.
+        transform_hierarchy *th = root->get_hierarchy();
+        scene_node *d = new scene_node(b);
+        d->translate(vec3(1, 0, 0));
+        assert(d->get_hierarchy() == th && d->get_slot() == th->size() - 1 && same(d->calcModelToWorld(), brute_force(d)));
+        assert(!d->calcEnabled());
+
+        // adding below the root does not fit the level order, so the tree is flattened again.
+        scene_node *e = new scene_node(root);
+        assert(e->get_hierarchy() == root->get_hierarchy() && root->get_hierarchy() != th);
+        assert(e->get_slot() < d->get_slot() && same(d->calcModelToWorld(), brute_force(d)));
+
+        root->unflatten();
+        assert(!d->get_hierarchy() && same(d->calcModelToWorld(), brute_force(d)) && !d->calcEnabled());
+      }
+    };
+    static scene_node_unit_test scene_node_unit_test;
+  #endif
 }}
@@ -0,0 +1,572 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Texture atlas: many small images packed into a few large ones.
+//
+
+namespace octet { namespace scene {
+  /// One sprite or glyph in a texture_atlas: the page it is on and where it is.
+  class atlas_region : public resource {
+    // the atlas page that contains the pixels
+    ref<image> page;
+    uint32_t page_index;
+
+    // u0, v0 (bottom left), u1, v1 (top right) on the page
+    vec4 uv_rect;
+
+    // pixels on the page, bottom row first like image.
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+
+  public:
+    RESOURCE_META(atlas_region)
+
+    /// Make an empty region. These are usually made by texture_atlas.
+    atlas_region() {
+      set(0, 0, 0, 0, 0, 0);
+    }
+
+    /// Place the region on a page.
+    void set(image *page, unsigned page_index, unsigned x, unsigned y, unsigned width, unsigned height) {
+      this->page = page;
+      this->page_index = page_index;
+      this->x = (uint16_t)x;
+      this->y = (uint16_t)y;
+      this->width = (uint16_t)width;
+      this->height = (uint16_t)height;
+      if (page && page->get_width() && page->get_height()) {
+        float uscale = 1.0f / page->get_width();
+        float vscale = 1.0f / page->get_height();
+        uv_rect = vec4(x * uscale, y * vscale, (x + width) * uscale, (y + height) * vscale);
+      } else {
+        uv_rect = vec4(0, 0, 1, 1);
+      }
+    }
+
+    /// The atlas page image. Use this texture to draw the region.
+    image *get_page() const {
+      return page;
+    }
+
+    /// Which page of the atlas this region is on.
+    unsigned get_page_index() const {
+      return page_index;
+    }
+
+    /// Texture coordinates of the region as (u0, v0, u1, v1).
+    vec4 get_uv_rect() const {
+      return uv_rect;
+    }
+
+    /// Convert a texture coordinate in the original image (0..1) to one on the atlas page.
+    vec2 get_uv(float u, float v) const {
+      return vec2(
+        uv_rect.x() + (uv_rect.z() - uv_rect.x()) * u,
+        uv_rect.y() + (uv_rect.w() - uv_rect.y()) * v
+      );
+    }
+
+    /// left edge on the page in pixels
+    unsigned get_x() const { return x; }
+
+    /// bottom edge on the page in pixels
+    unsigned get_y() const { return y; }
+
+    /// width in pixels
+    unsigned get_width() const { return width; }
+
+    /// height in pixels
+    unsigned get_height() const { return height; }
+
+    /// GL texture of the page, or 0 if the region did not fit in the atlas.
+    GLuint get_gl_texture() {
+      return page ? page->get_gl_texture() : 0;
+    }
+
+    /// Serialize.
+    void visit(visitor &v) {
+      v.visit(page, atom_page);
+      v.visit(page_index, atom_page_index);
+      v.visit(uv_rect, atom_uv_rect);
+      v.visit(x, atom_x);
+      v.visit(y, atom_y);
+      v.visit(width, atom_width);
+      v.visit(height, atom_height);
+    }
+  };
+
+  /// Packs many small images, such as sprites or font glyphs, into a few large pages
+  /// so that they can be drawn with one texture binding.
+  ///
+  /// The pages are packed with a skyline bottom-left packer, tallest images first.
+  /// Each image sits in a slot that starts on a multiple of "alignment" pixels
+  /// and is filled out with copies of the image's edge pixels, so the first
+  /// log2(alignment) mip levels and bilinear filtering do not mix in the neighbours.
+  ///
+  /// Example
+  ///
+  ///     ref<texture_atlas> atlas = new texture_atlas(512, 512);
+  ///     atlas->add("ship", new image("assets/invaderers/ship.gif"));
+  ///     atlas->add("invaderer", new image("assets/invaderers/invaderer.gif"));
+  ///     atlas->pack();
+  ///     atlas->add_to_dict(dict);
+  ///     ...
+  ///     atlas_region *ship = dict.get_atlas_region("ship");
+  ///     glBindTexture(GL_TEXTURE_2D, ship->get_gl_texture());
+  ///     vec4 uvs = ship->get_uv_rect();
+  class texture_atlas : public resource {
+    // an image waiting to be packed
+    struct entry {
+      ref<atlas_region> region;
+
+      // RGBA pixels in the "pixels" array
+      unsigned offset;
+      uint16_t width;
+      uint16_t height;
+
+      // aligned slot on the page, including the gutter
+      uint16_t slot_x;
+      uint16_t slot_y;
+      uint16_t slot_w;
+      uint16_t slot_h;
+      uint16_t page;
+
+      // character code for font glyphs
+      unsigned chr;
+
+      // pixels are waiting to be made into a distance field
+      bool distance_field;
+    };
+
+    // fonts whose glyphs are in the atlas
+    struct font_glyphs {
+      ref<bitmap_font> font;
+      unsigned first_entry;
+      unsigned end_entry;
+    };
+
+    // a horizontal segment of the top of the packed area
+    struct skyline_node {
+      unsigned x;
+      unsigned y;
+      unsigned width;
+    };
+
+    // results (to save)
+    dynarray<ref<image> > pages;
+    dictionary<ref<atlas_region> > regions;
+
+    // packer settings
+    unsigned page_width;
+    unsigned page_height;
+    unsigned padding;
+    unsigned alignment;
+
+    // border of distance fields, 0 for plain images
+    unsigned spread;
+
+    // packer sources (not saved)
+    dynarray<entry> entries;
+    dynarray<font_glyphs> fonts;
+    dynarray<uint8_t> pixels;
+
+    unsigned align(unsigned value) const {
+      return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // copy a rectangle of pixels in any of the uncompressed GL formats as RGBA.
+    static void copy_rgba(uint8_t *dest, const uint8_t *src, unsigned format, unsigned num_pixels) {
+      for (unsigned i = 0; i != num_pixels; ++i, dest += 4) {
+        switch (format) {
+          case GL_RGBA: dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = src[3]; src += 4; break;
+          case GL_RGB: dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = 0xff; src += 3; break;
+          case GL_LUMINANCE_ALPHA: dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[1]; src += 2; break;
+          case GL_LUMINANCE: dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 0xff; src += 1; break;
+          default: dest[0] = dest[1] = dest[2] = 0xff; dest[3] = src[0]; src += 1; break;
+        }
+      }
+    }
+
+    static unsigned get_num_comps(unsigned format) {
+      return format == GL_RGBA ? 4 : format == GL_RGB ? 3 : format == GL_LUMINANCE_ALPHA ? 2 : 1;
+    }
+
+    // add an entry with space for its pixels
+    entry &add_entry(const char *name, unsigned width, unsigned height) {
+      ref<atlas_region> &region = regions[name];
+      if (!region) {
+        region = new atlas_region();
+      } else {
+        // forget the old pixels for this name
+        for (unsigned i = 0; i != entries.size(); ++i) {
+          if ((atlas_region*)entries[i].region == (atlas_region*)region) entries[i].region = 0;
+        }
+      }
+
+      entry e;
+      e.region = region;
+      e.offset = pixels.size();
+      e.width = (uint16_t)width;
+      e.height = (uint16_t)height;
+      e.slot_x = e.slot_y = e.page = 0;
+      e.slot_w = (uint16_t)align(width + padding * 2);
+      e.slot_h = (uint16_t)align(height + padding * 2);
+      e.chr = 0;
+      e.distance_field = false;
+      entries.push_back(e);
+      pixels.resize(pixels.size() + width * height * 4);
+      return entries.back();
+    }
+
+    // the y at which a w x h slot fits on node i of the skyline, or ~0 if it does not fit.
+    unsigned fit(const dynarray<skyline_node> &skyline, unsigned i, unsigned w, unsigned h) const {
+      if (skyline[i].x + w > page_width) return ~0u;
+      unsigned y = 0;
+      for (unsigned j = i, left = w; left; ++j) {
+        y = std::max(y, skyline[j].y);
+        if (y + h > page_height) return ~0u;
+        left -= std::min(left, skyline[j].width);
+      }
+      return y;
+    }
+
+    // raise the skyline over a newly placed slot.
+    static void place(dynarray<skyline_node> &skyline, unsigned i, unsigned w, unsigned top) {
+      skyline_node node = { skyline[i].x, top, w };
+      skyline.push_back(node);
+      for (unsigned j = skyline.size() - 1; j != i; --j) {
+        skyline[j] = skyline[j-1];
+      }
+      skyline[i] = node;
+
+      // trim the nodes that are now underneath
+      unsigned right = node.x + w;
+      for (unsigned j = i + 1; j < skyline.size() && skyline[j].x < right; ) {
+        unsigned end = skyline[j].x + skyline[j].width;
+        if (end <= right) {
+          skyline.erase(j);
+        } else {
+          skyline[j].width = end - right;
+          skyline[j].x = right;
+          break;
+        }
+      }
+
+      // merge neighbours of the same height
+      for (unsigned j = 0; j + 1 < skyline.size(); ) {
+        if (skyline[j].y == skyline[j+1].y) {
+          skyline[j].width += skyline[j+1].width;
+          skyline.erase(j + 1);
+        } else {
+          ++j;
+        }
+      }
+    }
+
+    // find the lowest, then leftmost, place for the slot on a page.
+    bool find_place(const dynarray<skyline_node> &skyline, unsigned w, unsigned h, unsigned &best_node, unsigned &best_y) const {
+      unsigned best_top = ~0u;
+      for (unsigned i = 0; i != skyline.size(); ++i) {
+        unsigned y = fit(skyline, i, w, h);
+        if (y != ~0u && y + h < best_top) {
+          best_top = y + h;
+          best_node = i;
+          best_y = y;
+        }
+      }
+      return best_top != ~0u;
+    }
+
+    // copy the entry to its slot and fill the rest of the slot with its edge pixels.
+    void blit(uint8_t *page_bytes, unsigned page_w, const entry &e) const {
+      const uint8_t *src = &pixels[e.offset];
+      for (unsigned sy = 0; sy != e.slot_h; ++sy) {
+        int iy = std::min(std::max((int)sy - (int)padding, 0), (int)e.height - 1);
+        uint8_t *dest = page_bytes + ((e.slot_y + sy) * page_w + e.slot_x) * 4;
+        const uint8_t *src_row = src + iy * e.width * 4;
+        for (unsigned sx = 0; sx != e.slot_w; ++sx, dest += 4) {
+          int ix = std::min(std::max((int)sx - (int)padding, 0), (int)e.width - 1);
+          memcpy(dest, src_row + ix * 4, 4);
+        }
+      }
+    }
+
+  public:
+    RESOURCE_META(texture_atlas)
+
+    /// Make an atlas with pages of a certain size. Use powers of two for mip mapping.
+    /// padding is the border in pixels around each image; slots start on multiples of alignment pixels.
+    texture_atlas(unsigned page_width = 1024, unsigned page_height = 1024, unsigned padding = 2, unsigned alignment = 4) {
+      this->page_width = page_width;
+      this->page_height = page_height;
+      this->padding = padding;
+      this->alignment = alignment ? alignment : 1;
+      spread = 0;
+    }
+
+    /// Store images added from now on as signed distance fields (see sdf_builder) for drawing
+    /// with shaders/text_sdf.fs. The alpha channel gives the shape and the colour becomes white.
+    /// Each image gains a border of "spread" pixels, the furthest distance that is stored.
+    void set_distance_field(unsigned spread) {
+      this->spread = spread;
+    }
+
+    /// Add 8-bit pixels (GL_RGBA, GL_RGB, GL_LUMINANCE_ALPHA, GL_LUMINANCE or GL_ALPHA) by name.
+    /// Rows are bottom first, like image. Adding a name again replaces the old region on the next pack().
+    atlas_region *add(const char *name, unsigned format, unsigned width, unsigned height, const uint8_t *src) {
+      entry &e = add_entry(name, width + spread * 2, height + spread * 2);
+      uint8_t *dest = &pixels[e.offset];
+      if (spread) {
+        memset(dest, 0, e.width * e.height * 4);
+        e.distance_field = true;
+      }
+      unsigned src_stride = width * get_num_comps(format);
+      for (unsigned y = 0; y != height; ++y) {
+        copy_rgba(dest + ((y + spread) * e.width + spread) * 4, src + y * src_stride, format, width);
+      }
+      return e.region;
+    }
+
+    /// Add an image by name. The image is loaded if necessary.
+    atlas_region *add(const char *name, image *img) {
+      const uint8_t *src = img->get_pixels();
+      if (!src) {
+        log("texture_atlas: no pixels for %s\n", name);
+        return 0;
+      }
+      return add(name, img->get_format(), img->get_width(), img->get_height(), src);
+    }
+
+    /// Add the glyphs of a bitmap font, named "<name>/<character code>".
+    /// After pack(), the font draws from the atlas page.
+    /// Keep fonts smaller than a page so that all their glyphs land on the same page.
+    void add_font(const char *name, bitmap_font *font, image **font_pages, unsigned num_pages = 1) {
+      dynarray<unsigned> chars;
+      font->get_chars(chars);
+
+      font_glyphs fg;
+      fg.font = font;
+      fg.first_entry = entries.size();
+
+      dynarray<uint8_t> glyph;
+      string glyph_name;
+      for (unsigned i = 0; i != chars.size(); ++i) {
+        unsigned page, x, y, w, h;
+        if (!font->get_char_rect(chars[i], page, x, y, w, h) || !w || !h || page >= num_pages) continue;
+
+        image *img = font_pages[page];
+        const uint8_t *src = img->get_pixels();
+        unsigned iw = img->get_width(), ih = img->get_height();
+        if (!src || x + w > iw || y + h > ih) continue;
+
+        // .fnt rectangles are top row first, images are bottom row first.
+        unsigned comps = get_num_comps(img->get_format());
+        glyph.resize(w * h * comps);
+        for (unsigned j = 0; j != h; ++j) {
+          memcpy(&glyph[j * w * comps], src + ((ih - y - h + j) * iw + x) * comps, w * comps);
+        }
+
+        glyph_name.format("%s/%d", name, chars[i]);
+        add(glyph_name.c_str(), img->get_format(), w, h, &glyph[0]);
+        entries.back().chr = chars[i];
+        if (spread) {
+          font->grow_char(chars[i], spread);
+        }
+      }
+
+      fg.end_entry = entries.size();
+      fonts.push_back(fg);
+    }
+
+    /// Pack everything added so far into pages, replacing any earlier packing.
+    /// Returns the number of pages.
+    unsigned pack() {
+      // distance fields are slow to build, so share them out on the job pool.
+      job_pool::get().parallel_for(0, entries.size(), 16, [this](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i != end; ++i) {
+          entry &e = entries[i];
+          if (!e.distance_field) continue;
+          uint8_t *p = &pixels[e.offset];
+          sdf_builder::build(p + 3, p + 3, e.width, e.height, 4, spread);
+          for (unsigned j = 0; j != e.width * e.height; ++j) {
+            p[j*4+0] = p[j*4+1] = p[j*4+2] = 0xff;
+          }
+          e.distance_field = false;
+        }
+      });
+
+      // tallest, then widest, first
+      dynarray<unsigned> order(entries.size());
+      for (unsigned i = 0; i != entries.size(); ++i) order[i] = i;
+      std::sort(order.data(), order.data() + order.size(), [this](unsigned a, unsigned b) {
+        const entry &ea = entries[a], &eb = entries[b];
+        return ea.slot_h != eb.slot_h ? ea.slot_h > eb.slot_h : ea.slot_w != eb.slot_w ? ea.slot_w > eb.slot_w : a < b;
+      });
+
+      dynarray<dynarray<skyline_node> > skylines;
+      unsigned used_height = 0;
+      for (unsigned i = 0; i != order.size(); ++i) {
+        entry &e = entries[order[i]];
+        if (!e.region) {
+          e.page = 0xffff;
+          continue;
+        }
+        if (e.slot_w > page_width || e.slot_h > page_height) {
+          log("texture_atlas: %dx%d image is too big for the page\n", e.width, e.height);
+          e.page = 0xffff;
+          continue;
+        }
+
+        // first page with room, or a new page
+        unsigned page = 0, node = 0, y = 0;
+        while (page != skylines.size() && !find_place(skylines[page], e.slot_w, e.slot_h, node, y)) {
+          ++page;
+        }
+        if (page == skylines.size()) {
+          skylines.resize(page + 1);
+          skyline_node empty = { 0, 0, page_width };
+          skylines[page].push_back(empty);
+          find_place(skylines[page], e.slot_w, e.slot_h, node, y);
+        }
+
+        e.page = (uint16_t)page;
+        e.slot_x = (uint16_t)skylines[page][node].x;
+        e.slot_y = (uint16_t)y;
+        used_height = std::max(used_height, y + e.slot_h);
+        place(skylines[page], node, e.slot_w, y + e.slot_h);
+      }
+
+      // a single page only needs to be tall enough for its contents.
+      unsigned num_pages = skylines.size();
+      unsigned height = page_height;
+      if (num_pages == 1) {
+        height = alignment;
+        while (height < used_height) height *= 2;
+      }
+
+      // draw the pages
+      pages.resize(num_pages);
+      dynarray<uint8_t> page_bytes(page_width * height * 4);
+      for (unsigned page = 0; page != num_pages; ++page) {
+        memset(page_bytes.data(), 0, page_bytes.size());
+        for (unsigned i = 0; i != entries.size(); ++i) {
+          if (entries[i].page == page) blit(page_bytes.data(), page_width, entries[i]);
+        }
+        if (!pages[page]) pages[page] = new image();
+        pages[page]->set_pixels(GL_RGBA, (uint16_t)page_width, (uint16_t)height, page_bytes.data());
+      }
+
+      for (unsigned i = 0; i != entries.size(); ++i) {
+        entry &e = entries[i];
+        if (!e.region) {
+          continue;
+        } else if (e.page < num_pages) {
+          e.region->set(pages[e.page], e.page, e.slot_x + padding, e.slot_y + padding, e.width, e.height);
+        } else {
+          e.region->set(0, 0, 0, 0, e.width, e.height);
+        }
+      }
+
+      // point the fonts at their new glyphs.
+      for (unsigned i = 0; i != fonts.size(); ++i) {
+        font_glyphs &fg = fonts[i];
+        fg.font->set_page_size(page_width, height);
+        for (unsigned j = fg.first_entry; j != fg.end_entry; ++j) {
+          const entry &e = entries[j];
+          if (e.page < num_pages) {
+            fg.font->set_char_rect(e.chr, e.page, e.slot_x + padding, height - (e.slot_y + padding + e.height));
+          }
+        }
+      }
+
+      return num_pages;
+    }
+
+    /// Number of pages made by pack()
+    unsigned get_num_pages() const {
+      return pages.size();
+    }
+
+    /// Get a page image to use as a texture.
+    image *get_page(unsigned index) const {
+      return pages[index];
+    }
+
+    /// Find a region by name.
+    atlas_region *get_region(const char *name) {
+      int index = regions.get_index(name);
+      return index >= 0 ? (atlas_region*)regions.get_value(index) : 0;
+    }
+
+    /// Make every sprite and glyph available by name, for example dict.get_atlas_region("ship").
+    void add_to_dict(resource_dict &dict) {
+      for (unsigned i = 0; i != regions.get_num_indices(); ++i) {
+        const char *key = regions.get_key(i);
+        if (key) {
+          dict.set_resource(key, regions.get_value(i));
+        }
+      }
+    }
+
+    /// Serialize the packed pages and regions.
+    void visit(visitor &v) {
+      v.visit(pages, atom_pages);
+      v.visit(regions, atom_regions);
+      v.visit(page_width, atom_width);
+      v.visit(page_height, atom_height);
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class texture_atlas_unit_test {
+    public:
+      texture_atlas_unit_test() {
+        // solid squares of different sizes and colours
+        ref<texture_atlas> atlas = new texture_atlas(64, 64, 2, 4);
+        dynarray<uint8_t> src(30 * 30 * 3);
+        for (unsigned i = 0; i != 8; ++i) {
+          unsigned size = 5 + i * 3;
+          for (unsigned j = 0; j != size * size * 3; ++j) src[j] = (uint8_t)(i * 30 + j % 3);
+          char name[8];
+          sprintf(name, "s%d", i);
+          atlas->add(name, GL_RGB, size, size, &src[0]);
+        }
+        unsigned num_pages = atlas->pack();
+        assert(num_pages == 2);
+
+        for (unsigned i = 0; i != 8; ++i) {
+          char name[8];
+          sprintf(name, "s%d", i);
+          atlas_region *r = atlas->get_region(name);
+          image *page = r->get_page();
+          assert(page && r->get_x() % 4 == 2 && r->get_y() % 4 == 2);
+
+          // the middle and the gutter are both the image colour
+          const uint8_t *p = page->get_pixels();
+          unsigned mid = (r->get_y() + r->get_height() / 2) * page->get_width() + r->get_x() + r->get_width() / 2;
+          unsigned gutter = (r->get_y() - 2) * page->get_width() + r->get_x() - 2;
+          assert(p[mid*4] == i * 30 && p[mid*4+2] == i * 30 + 2 && p[mid*4+3] == 0xff);
+          assert(!memcmp(p + mid*4, p + gutter*4, 4));
+
+          // no overlaps
+          for (unsigned j = 0; j != i; ++j) {
+            sprintf(name, "s%d", j);
+            atlas_region *q = atlas->get_region(name);
+            assert(
+              q->get_page() != page ||
+              q->get_x() + q->get_width() + 4 <= r->get_x() || r->get_x() + r->get_width() + 4 <= q->get_x() ||
+              q->get_y() + q->get_height() + 4 <= r->get_y() || r->get_y() + r->get_height() + 4 <= q->get_y()
+            );
+          }
+        }
+      }
+    };
+
+    static texture_atlas_unit_test texture_atlas_unit_test;
+  #endif
+} }
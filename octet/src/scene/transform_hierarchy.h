@@ -0,0 +1,417 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Flat transform hierarchy
+//
+
+namespace octet { namespace scene {
+  /// Node transforms kept in flat arrays, sorted by depth.
+  ///
+  /// Parent indices, local matrices and world matrices each have their own contiguous array.
+  /// The slots of one depth sit together and every parent comes before its children,
+  /// so update() can walk the levels in order and split each level across the job pool.
+  ///
+  /// scene_node::flatten() moves a tree into one of these. The nodes then read and write
+  /// their slots, so normal scene_node code keeps working.
+  ///
+  /// Example
+  ///
+  ///     root->flatten();
+  ///     node->rotate(10, vec3(0, 1, 0));  // writes the node's local matrix slot
+  ///     root->update_world();             // calls transform_hierarchy::update()
+  class transform_hierarchy : public resource {
+    enum {
+      flag_dirty = 1,         // world matrix is out of date; set on the children during update()
+      flag_enabled = 2,       // node's own enabled flag
+      flag_world_enabled = 4, // enabled and all the parents are enabled
+
+      // levels smaller than this are not worth sending to the job pool.
+      parallel_grain = 2048,
+    };
+
+    dynarray<int> parents_;
+    dynarray<mat4t> local_;
+    dynarray<mat4t> world_;
+    dynarray<uint8_t> flags_;
+
+    // first slot of each level. levels_[d+1] - levels_[d] slots have depth d.
+    dynarray<unsigned> levels_;
+
+    // slots [first, end) of the next level hold all the children of a slot; they may hold
+    // other slots too. A leaf has first = ~0 and end = 0 so that it does not widen a range.
+    struct child_range {
+      unsigned first;
+      unsigned end;
+    };
+    dynarray<child_range> children_;
+
+    // slots [dirty_begin_[d], dirty_end_[d]) of level d hold all the slots marked by set_dirty().
+    dynarray<unsigned> dirty_begin_;
+    dynarray<unsigned> dirty_end_;
+
+    bool any_dirty_;
+    unsigned num_updated_;
+
+    // dest = local * parent, the same as mat4t::operator* but with SSE even when OCTET_SSE is off.
+    static void multiply(mat4t &dest, const mat4t &local, const mat4t &parent) {
+      #if OCTET_SSE2
+        const float *l = local.get();
+        const float *p = parent.get();
+        __m128 p0 = _mm_loadu_ps(p + 0);
+        __m128 p1 = _mm_loadu_ps(p + 4);
+        __m128 p2 = _mm_loadu_ps(p + 8);
+        __m128 p3 = _mm_loadu_ps(p + 12);
+        float *d = dest.get();
+        for (int i = 0; i != 16; i += 4) {
+          __m128 row = _mm_mul_ps(_mm_set1_ps(l[i+0]), p0);
+          row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(l[i+1]), p1));
+          row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(l[i+2]), p2));
+          row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(l[i+3]), p3));
+          _mm_storeu_ps(d + i, row);
+        }
+      #else
+        dest = local * parent;
+      #endif
+    }
+
+    // recompute one slot from its parent, which must be up to date.
+    void update_slot(unsigned slot) {
+      int parent = parents_[slot];
+      bool world_enabled = (flags_[slot] & flag_enabled) != 0;
+      if (parent < 0) {
+        world_[slot] = local_[slot];
+      } else {
+        multiply(world_[slot], local_[slot], world_[parent]);
+        world_enabled = world_enabled && (flags_[parent] & flag_world_enabled);
+      }
+      if (world_enabled) flags_[slot] |= flag_world_enabled; else flags_[slot] &= ~flag_world_enabled;
+    }
+
+    // update the slots of one level in [begin, end). A slot is done if it or its parent is dirty,
+    // in which case it becomes dirty so that its children are done on the next level.
+    // [child_begin, child_end) grows to cover the children of the slots done,
+    // until it covers all of [next_begin, next_end), the next level.
+    unsigned update_range(unsigned begin, unsigned end, unsigned &child_begin, unsigned &child_end, unsigned next_begin, unsigned next_end) {
+      unsigned num_updated = 0;
+      const int *parents = parents_.data();
+      uint8_t *flags = flags_.data();
+      bool track = child_begin > next_begin || child_end < next_end;
+      for (unsigned slot = begin; slot != end; ++slot) {
+        int parent = parents[slot];
+        if (parent >= 0 && (flags[parent] & flag_dirty)) {
+          flags[slot] |= flag_dirty;
+        }
+        if (flags[slot] & flag_dirty) {
+          update_slot(slot);
+          num_updated++;
+          if (track) {
+            const child_range &children = children_[slot];
+            child_begin = children.first < child_begin ? children.first : child_begin;
+            child_end = children.end > child_end ? children.end : child_end;
+            track = child_begin > next_begin || child_end < next_end;
+          }
+        }
+      }
+      return num_updated;
+    }
+
+    // update_range() split across the job pool if the range is big enough.
+    unsigned update_level(job_pool &pool, unsigned begin, unsigned end, unsigned &child_begin, unsigned &child_end, unsigned next_begin, unsigned next_end) {
+      #if OCTET_THREADS
+        if (end - begin >= parallel_grain && pool.get_num_threads() > 1) {
+          std::atomic<unsigned> num_updated(0);
+          std::atomic<unsigned> atomic_begin(child_begin), atomic_end(child_end);
+          pool.parallel_for(begin, end, parallel_grain, [&](unsigned b, unsigned e) {
+            unsigned cb = ~0u, ce = 0;
+            num_updated += update_range(b, e, cb, ce, next_begin, next_end);
+            unsigned cur = atomic_begin;
+            while (cb < cur && !atomic_begin.compare_exchange_weak(cur, cb)) {}
+            cur = atomic_end;
+            while (ce > cur && !atomic_end.compare_exchange_weak(cur, ce)) {}
+          });
+          child_begin = atomic_begin;
+          child_end = atomic_end;
+          return num_updated;
+        }
+      #endif
+      return update_range(begin, end, child_begin, child_end, next_begin, next_end);
+    }
+
+    unsigned get_level(unsigned slot) const {
+      return (unsigned)(std::upper_bound(levels_.data(), levels_.data() + levels_.size(), slot) - levels_.data()) - 1;
+    }
+
+    void clear_dirty_ranges() {
+      for (unsigned level = 0; level != dirty_begin_.size(); ++level) {
+        dirty_begin_[level] = ~0u;
+        dirty_end_[level] = 0;
+      }
+    }
+
+    // bring a slot up to date outside of update() by walking up to the first moved parent.
+    // Returns true if the slot was out of date. The dirty flags stay for the next update().
+    bool refresh(unsigned slot) {
+      int parent = parents_[slot];
+      bool stale = (flags_[slot] & flag_dirty) != 0;
+      if (parent >= 0 && refresh((unsigned)parent)) stale = true;
+      if (stale) update_slot(slot);
+      return stale;
+    }
+
+  public:
+    transform_hierarchy() {
+      any_dirty_ = false;
+      num_updated_ = 0;
+    }
+
+    /// Remove all the slots.
+    void reset() {
+      parents_.resize(0);
+      local_.resize(0);
+      world_.resize(0);
+      flags_.resize(0);
+      levels_.resize(0);
+      children_.resize(0);
+      dirty_begin_.resize(0);
+      dirty_end_.resize(0);
+      any_dirty_ = false;
+    }
+
+    /// True if add() can take a slot with this parent without sorting the slots again:
+    /// a root while there are only roots, or a child of a slot on the last two levels.
+    bool can_add(int parent) const {
+      unsigned num_levels = levels_.size();
+      if (parent < 0) return num_levels <= 1;
+      if ((unsigned)parent >= size()) return false;
+      return num_levels == 1 || (unsigned)parent >= levels_[num_levels - 2];
+    }
+
+    /// Add a slot and return its index.
+    /// Slots must be added a level at a time: the roots, then their children, then theirs...
+    /// "parent" is -1 for a root. See can_add().
+    unsigned add(int parent, mat4t_in local, bool enabled) {
+      unsigned slot = parents_.size();
+      if (parent < 0) {
+        assert(levels_.size() <= 1 && "roots must come first");
+        if (levels_.empty()) {
+          levels_.push_back(0);
+          dirty_begin_.push_back(~0u);
+          dirty_end_.push_back(0);
+        }
+      } else {
+        assert((unsigned)parent < slot);
+        unsigned last_level = levels_.size() - 1;
+        if ((unsigned)parent >= levels_[last_level]) {
+          // first child of a slot on the deepest level starts a new level.
+          levels_.push_back(slot);
+          dirty_begin_.push_back(~0u);
+          dirty_end_.push_back(0);
+        } else {
+          assert(last_level >= 1 && (unsigned)parent >= levels_[last_level-1] && "slots not sorted by depth");
+        }
+        if (slot < children_[parent].first) children_[parent].first = slot;
+        children_[parent].end = slot + 1;
+      }
+      parents_.push_back(parent);
+      local_.push_back(local);
+      world_.push_back(local);
+      flags_.push_back((uint8_t)(enabled ? flag_enabled : 0));
+      child_range leaf = { ~0u, 0 };
+      children_.push_back(leaf);
+      set_dirty(slot);
+      return slot;
+    }
+
+    /// Number of slots.
+    unsigned size() const {
+      return parents_.size();
+    }
+
+    /// Number of levels; the depth of the deepest slot plus one.
+    unsigned get_num_levels() const {
+      return levels_.size();
+    }
+
+    /// Parent slot of a slot, or -1 for a root.
+    int get_parent(unsigned slot) const {
+      return parents_[slot];
+    }
+
+    /// Read the local (node to parent) matrix of a slot.
+    const mat4t &get_local(unsigned slot) const {
+      return local_[slot];
+    }
+
+    /// Access the local matrix for writing. This marks the slot as moved.
+    mat4t &access_local(unsigned slot) {
+      set_dirty(slot);
+      return local_[slot];
+    }
+
+    /// Mark a slot and so all the slots below it as moved.
+    void set_dirty(unsigned slot) {
+      if (flags_[slot] & flag_dirty) return;
+      flags_[slot] |= flag_dirty;
+      any_dirty_ = true;
+      unsigned level = get_level(slot);
+      if (slot < dirty_begin_[level]) dirty_begin_[level] = slot;
+      if (slot + 1 > dirty_end_[level]) dirty_end_[level] = slot + 1;
+    }
+
+    /// True if this slot has moved since the last update(). Does not look at the parents.
+    bool is_dirty(unsigned slot) const {
+      return (flags_[slot] & flag_dirty) != 0;
+    }
+
+    /// Set the enabled flag of a slot. A disabled slot disables the ones below it.
+    void set_enabled(unsigned slot, bool value) {
+      if (value) flags_[slot] |= flag_enabled; else flags_[slot] &= ~flag_enabled;
+      set_dirty(slot);
+    }
+
+    /// The world (model to world) matrix of a slot, brought up to date if it or a parent has moved.
+    const mat4t &get_world(unsigned slot) {
+      if (any_dirty_) refresh(slot);
+      return world_[slot];
+    }
+
+    /// True if a slot and all its parents are enabled.
+    bool get_world_enabled(unsigned slot) {
+      if (any_dirty_) refresh(slot);
+      return (flags_[slot] & flag_world_enabled) != 0;
+    }
+
+    /// The world matrices as computed by the last update(), in slot order.
+    const mat4t *get_world_matrices() const {
+      return world_.data();
+    }
+
+    /// Recompute the world matrices of the slots that have moved and the slots below them.
+    /// Each level is done after the one above; big levels are split across the job pool.
+    /// Only the part of each level between the first and last slot that can have moved is visited.
+    void update(job_pool &pool = job_pool::get()) {
+      num_updated_ = 0;
+      if (!any_dirty_) return;
+
+      unsigned num_levels = levels_.size();
+      uint8_t *flags = flags_.data();
+
+      // children of the slots done on the level above.
+      unsigned child_begin = ~0u, child_end = 0;
+
+      // slots done on the level above, whose dirty flags are cleared once this level is done.
+      unsigned prev_begin = 0, prev_end = 0;
+
+      for (unsigned level = 0; level != num_levels; ++level) {
+        unsigned begin = dirty_begin_[level] < child_begin ? dirty_begin_[level] : child_begin;
+        unsigned end = dirty_end_[level] > child_end ? dirty_end_[level] : child_end;
+        unsigned next_begin = level + 1 < num_levels ? levels_[level + 1] : size();
+        unsigned next_end = level + 2 < num_levels ? levels_[level + 2] : size();
+        child_begin = ~0u;
+        child_end = 0;
+
+        if (begin < end) {
+          num_updated_ += update_level(pool, begin, end, child_begin, child_end, next_begin, next_end);
+        }
+
+        for (unsigned slot = prev_begin; slot < prev_end; ++slot) {
+          flags[slot] &= ~flag_dirty;
+        }
+        prev_begin = begin;
+        prev_end = end;
+      }
+
+      for (unsigned slot = prev_begin; slot < prev_end; ++slot) {
+        flags[slot] &= ~flag_dirty;
+      }
+      clear_dirty_ranges();
+      any_dirty_ = false;
+    }
+
+    /// Number of world matrices recomputed by the last update().
+    unsigned get_num_updated() const {
+      return num_updated_;
+    }
+  };
+
+  #if OCTET_UNIT_TEST
+    class transform_hierarchy_unit_test {
+      static mat4t brute_force(transform_hierarchy &h, unsigned slot) {
+        mat4t result = h.get_local(slot);
+        for (int p = h.get_parent(slot); p >= 0; p = h.get_parent(p)) {
+          result = result * h.get_local(p);
+        }
+        return result;
+      }
+
+      static bool check(transform_hierarchy &h) {
+        for (unsigned slot = 0; slot != h.size(); ++slot) {
+          mat4t expected = brute_force(h, slot);
+          const mat4t &world = h.get_world(slot);
+          for (int i = 0; i != 16; ++i) {
+            if (fabsf(world.get()[i] - expected.get()[i]) > 1e-3f) return false;
+          }
+        }
+        return true;
+      }
+
+    public:
+      transform_hierarchy_unit_test() {
+        // a few roots with wide levels, so that update() uses the job pool.
+        // the pool has workers even on one core so that the parallel path is tested.
+        job_pool pool(3);
+        transform_hierarchy h;
+        random rand(0x1234);
+        unsigned level_begin = 0, level_end = 0;
+        for (unsigned level = 0; level != 5; ++level) {
+          unsigned count = level == 0 ? 4 : 6000;
+          for (unsigned i = 0; i != count; ++i) {
+            mat4t local;
+            local.loadIdentity();
+            local.rotate(rand.get(-30.0f, 30.0f), 0, 0, 1);
+            local.translate(rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f), 0);
+            int parent = level == 0 ? -1 : (int)(level_begin + (i % (level_end - level_begin)));
+            h.add(parent, local, true);
+          }
+          level_begin = level_end;
+          level_end = h.size();
+        }
+        assert(h.get_num_levels() == 5);
+        h.update(pool);
+        assert(h.get_num_updated() == h.size() && check(h));
+
+        // nothing moved: nothing to do.
+        h.update(pool);
+        assert(h.get_num_updated() == 0);
+
+        // moving a root moves its subtree only.
+        h.access_local(1).translate(0, 5, 0);
+        assert(check(h));
+        h.update(pool);
+        assert(h.get_num_updated() > 1 && h.get_num_updated() < h.size() / 2 && check(h));
+
+        // slots in the middle of the tree, updated without the lazy refresh in check().
+        h.access_local(10000).translate(1, 0, 0);
+        h.access_local(17000).rotate(5, 0, 0, 1);
+        h.update(pool);
+        assert(h.get_num_updated() >= 2 && check(h));
+
+        // a child of the deepest level starts a new level; the first level is closed.
+        assert(h.can_add((int)h.size() - 1) && !h.can_add(0) && !h.can_add(-1));
+        unsigned leaf = h.add((int)h.size() - 1, h.get_local(0), true);
+        assert(h.get_num_levels() == 6 && check(h));
+
+        // disabling a slot disables the slots below it.
+        unsigned child = leaf;
+        unsigned parent = (unsigned)h.get_parent(child);
+        h.set_enabled(parent, false);
+        h.update(pool);
+        assert(!h.get_world_enabled(child) && h.get_world_enabled(0));
+      }
+    };
+    static transform_hierarchy_unit_test transform_hierarchy_unit_test;
+  #endif
+}}
@@ -43,6 +43,37 @@ namespace octet { namespace scene {
 
     int frame_number;
 
+    /// world boxes of the mesh instances, to skip the ones off screen.
+    bool frustum_culling;
+    aabb_tree instance_tree;
+    dynarray<int> instance_proxies;
+    dynarray<unsigned> visible_instances;
+    unsigned num_culled;
+
+    /// visible instances sorted by state; see get_render_key().
+    struct render_item {
+      uint64_t key;
+      unsigned instance;  // index in mesh_instances
+      unsigned matrices;  // index of modelToProjection in render_matrices; modelToCamera follows
+      unsigned num_instances;   // > 1 to draw this and the items after it with one instanced draw
+      unsigned first_instance;  // their modelToCamera matrices in instances
+
+      bool operator<(const render_item &rhs) const {
+        return key != rhs.key ? key < rhs.key : instance < rhs.instance;
+      }
+    };
+    dynarray<render_item> render_queue;
+    dynarray<mat4t> render_matrices;
+    unsigned num_program_changes;
+    unsigned num_material_changes;
+    unsigned num_mesh_changes;
+    unsigned num_draws;
+
+    /// runs of at least min_instances items with the same mesh and material share a draw.
+    enum { min_instances = 4 };
+    bool instancing;
+    instance_buffer instances;
+
     /// shaders to draw triangles
     ref<bump_shader> object_shader;
     ref<bump_shader> skin_shader;
@@ -181,20 +212,87 @@ namespace octet { namespace scene {
       }
     }
 
-    void render_impl(bump_shader &object_shader, bump_shader &skin_shader, camera_instance &cam, float aspect_ratio) {
-      mat4t cameraToWorld = cam.get_node()->calcModelToWorld();
+    // fill visible_instances with the indices of the mesh instances that may be in the frustum, in order.
+    // Skinned instances are always drawn as the bind pose box does not cover the animation.
+    void cull_mesh_instances(camera_instance &cam) {
+      unsigned num_instances = mesh_instances.size();
+      visible_instances.resize(0);
+      num_culled = 0;
+      if (!frustum_culling) {
+        for (unsigned i = 0; i != num_instances; ++i) {
+          visible_instances.push_back(i);
+        }
+        return;
+      }
 
-      mat4t worldToCamera;
-      cameraToWorld.invertQuick(worldToCamera);
+      if (instance_proxies.size() > num_instances) {
+        instance_tree.reset();
+        instance_proxies.resize(0);
+      }
+      while (instance_proxies.size() < num_instances) {
+        instance_proxies.push_back(-1);
+      }
 
-      calc_lighting(worldToCamera);
+      // move the boxes that have changed. Most do nothing as the tree's boxes have a margin.
+      for (unsigned i = 0; i != num_instances; ++i) {
+        mesh_instance *mi = mesh_instances[i];
+        mesh *msh = mi->get_mesh();
+        int &proxy = instance_proxies[i];
+        if (mi->get_skeleton() || !msh) {
+          if (proxy >= 0) {
+            instance_tree.remove(proxy);
+            proxy = -1;
+          }
+          visible_instances.push_back(i);
+          continue;
+        }
 
-      cam.set_cameraToWorld(cameraToWorld, aspect_ratio);
-      mat4t cameraToProjection = cam.get_cameraToProjection();
+        aabb bb = msh->get_aabb().get_transform(mi->get_node()->get_modelToWorld());
+        if (proxy < 0) {
+          proxy = instance_tree.add(bb, i);
+        } else {
+          instance_tree.move(proxy, bb);
+        }
+      }
 
-      draw_debug_data(cam);
+      instance_tree.cull(aabb_tree::frustum(cam.get_frustum_planes()), visible_instances);
+      num_culled = num_instances - visible_instances.size();
 
-      for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
+      // keep the draw order of mesh_instances.
+      std::sort(visible_instances.data(), visible_instances.data() + visible_instances.size());
+    }
+
+    // sort key for the render queue.
+    // Opaque items come first, front to back in coarse bands so that they still sort by state.
+    // Transparent items come last, back to front. Then by program, material and mesh; the low
+    // bits of the material and mesh addresses are used, so a collision only costs a state change.
+    static uint64_t get_render_key(material *mat, mesh *msh, float depth, float near_plane) {
+      union { float f; uint32_t u; } d;
+      uint64_t key;
+      if (mat->is_transparent()) {
+        // top 23 bits of the positive float, inverted.
+        d.f = depth > 0 ? depth : 0;
+        key = (1ull << 63) | ((uint64_t)((~d.u >> 8) & 0x7fffff) << 40);
+      } else {
+        // powers of two of the near plane distance.
+        d.f = depth > near_plane ? depth / near_plane : 1;
+        int band = (int)(d.u >> 23) - 127;
+        key = (uint64_t)(band < 15 ? band : 15) << 40;
+      }
+      key |= (uint64_t)(mat->get_program() & 0xfff) << 28;
+      key |= (uint64_t)(((size_t)mat >> 4) & 0x3fff) << 14;
+      key |= (uint64_t)(((size_t)msh >> 4) & 0x3fff);
+      return key;
+    }
+
+    // compute the matrices of the visible instances and sort them by get_render_key().
+    void build_render_queue(camera_instance &cam) {
+      render_queue.resize(0);
+      render_matrices.resize(visible_instances.size() * 2);
+      float near_plane = cam.get_near_plane() > 0 ? cam.get_near_plane() : 1e-3f;
+
+      for (unsigned visible_index = 0; visible_index != visible_instances.size(); ++visible_index) {
+        unsigned mesh_index = visible_instances[visible_index];
         mesh_instance *mi = mesh_instances[mesh_index];
 
         scene_node *node = mi->get_node();
@@ -205,20 +303,16 @@ namespace octet { namespace scene {
           !node->calcEnabled()
         ) continue;
 
-        mesh *msh = mi->get_mesh();
-        skin *skn = msh->get_skin();
-        skeleton *skel = mi->get_skeleton();
-        material *mat = mi->get_material();
-
-        mat4t modelToWorld = node->calcModelToWorld();
-        mat4t modelToCamera;
-        mat4t modelToProjection;
+        const mat4t &modelToWorld = node->get_modelToWorld();
+        unsigned matrices = render_queue.size() * 2;
+        mat4t &modelToProjection = render_matrices[matrices];
+        mat4t &modelToCamera = render_matrices[matrices + 1];
         cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
         //printf("%d %f\n", mesh_index, modelToWorld.w().y());
 
         // selecting LOD meshes by distance
+        float distance = -modelToCamera.w().z();
         if (flags & mesh_instance::flag_lod) {
-          float distance = -modelToCamera.w().z();
           //printf("%f %f %f\n", distance, mi->get_min_draw_distance(), mi->get_max_draw_distance());
           if (
             distance < mi->get_min_draw_distance() ||
@@ -228,11 +322,95 @@ namespace octet { namespace scene {
           }
         }
 
+        render_item item = { get_render_key(mi->get_material(), mi->get_mesh(), distance, near_plane), mesh_index, matrices, 1, 0 };
+        render_queue.push_back(item);
+      }
+
+      std::sort(render_queue.data(), render_queue.data() + render_queue.size());
+
+      #if OCTET_INSTANCING
+        // find the runs of the same mesh and material and send their matrices to GL in one go.
+        instances.clear();
+        for (unsigned i = 0; i != render_queue.size(); ) {
+          mesh_instance *mi = mesh_instances[render_queue[i].instance];
+          unsigned end = i + 1;
+          if (instancing && can_instance(mi)) {
+            while (end != render_queue.size()) {
+              mesh_instance *next = mesh_instances[render_queue[end].instance];
+              if (next->get_mesh() != mi->get_mesh() || next->get_material() != mi->get_material() || !can_instance(next)) break;
+              ++end;
+            }
+          }
+          if (end - i >= min_instances) {
+            render_queue[i].num_instances = end - i;
+            render_queue[i].first_instance = instances.size();
+            for (unsigned j = i; j != end; ++j) {
+              instances.add(render_matrices[render_queue[j].matrices + 1]);
+            }
+          }
+          i = end;
+        }
+        instances.upload();
+      #endif
+    }
+
+    // can this instance share a draw with others of the same mesh and material?
+    // Skinned meshes have their own matrices and clustered meshes cull each instance's clusters.
+    static bool can_instance(mesh_instance *mi) {
+      mesh *msh = mi->get_mesh();
+      return
+        !(mi->get_skeleton() && msh->get_skin()) &&
+        !msh->get_num_clusters() &&
+        !(mi->get_flags() & mesh_instance::flag_selected) &&
+        mi->get_material()->has_instanced_program()
+      ;
+    }
+
+    // draw the queue, only changing the program, material uniforms and vertex attributes
+    // when they differ from the item before. Runs found by build_render_queue() are
+    // drawn with the material's instanced program and one call.
+    void draw_render_queue(camera_instance &cam) {
+      const mat4t &cameraToProjection = cam.get_cameraToProjection();
+      GLuint cur_program = 0;
+      material *cur_material = NULL;
+      bool cur_instanced = false; // cur_material set up for instanced drawing
+      mesh *cur_mesh = NULL;      // attributes enabled
+      mesh *decoded_mesh = NULL;  // attribute decode set in cur_material
+      num_program_changes = num_material_changes = num_mesh_changes = num_draws = 0;
+
+      for (unsigned i = 0; i != render_queue.size(); i += render_queue[i].num_instances) {
+        const render_item &item = render_queue[i];
+        bool instanced = item.num_instances > 1;
+        mesh_instance *mi = mesh_instances[item.instance];
+        mesh *msh = mi->get_mesh();
+        skin *skn = msh->get_skin();
+        skeleton *skel = mi->get_skeleton();
+        material *mat = mi->get_material();
+        const mat4t &modelToProjection = render_matrices[item.matrices];
+        const mat4t &modelToCamera = render_matrices[item.matrices + 1];
+
         if (!skel || !skn) {
           /// normal rendering for single matrix objects
           /// build a projection matrix: model -> world -> camera_instance -> projection
           /// the projection space is the cube -1 <= x/w, y/w, z/w <= 1
-          mat->render(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+          if (mat != cur_material || instanced != cur_instanced) {
+            GLuint program = mat->get_program(instanced);
+            mat->render_material(light_uniforms, num_light_uniforms, num_lights, program != cur_program, instanced);
+            if (instanced) mat->render_instanced_matrices(cameraToProjection);
+            if (program != cur_program) {
+              cur_program = program;
+              num_program_changes++;
+            }
+            cur_material = mat;
+            cur_instanced = instanced;
+            decoded_mesh = NULL;
+            num_material_changes++;
+          }
+          if (msh != decoded_mesh) {
+            mat->render_decode(msh);
+            decoded_mesh = msh;
+          }
+          if (!instanced) mat->render_matrices(modelToProjection, modelToCamera);
         } else {
           /// multi-matrix rendering
           mat4t *transforms = skel->calc_transforms(modelToCamera, skn);
@@ -250,16 +428,56 @@ namespace octet { namespace scene {
           static bool dumped;
           if (!dumped) { msh->dump_transformed(modelToProjection); dumped = true; }
         }*/
-        msh->enable_attributes();
-        msh->draw();
-        msh->disable_attributes();
+        if (msh != cur_mesh) {
+          if (cur_mesh) cur_mesh->disable_attributes();
+          msh->enable_attributes();
+          cur_mesh = msh;
+          num_mesh_changes++;
+        }
+        if (instanced) {
+          instances.enable_attributes(item.first_instance);
+          msh->draw_instanced(item.num_instances);
+          instance_buffer::disable_attributes();
+        } else if (msh->get_num_clusters() && (!skel || !skn)) {
+          // skip the clusters that are off screen or facing away.
+          msh->draw_clusters(modelToProjection, modelToCamera);
+        } else {
+          msh->draw();
+        }
+        num_draws++;
 
         if (mi->get_flags() & mesh_instance::flag_selected) {
-          aabb bb = mi->get_mesh()->get_aabb();
-          bb = bb.get_transform(mi->get_node()->calcModelToWorld());
+          // draw_aabb() uses its own vertices.
+          cur_mesh->disable_attributes();
+          cur_mesh = NULL;
+          aabb bb = msh->get_aabb();
+          bb = bb.get_transform(mi->get_node()->get_modelToWorld());
           draw_aabb(bb);
         }
       }
+
+      if (cur_mesh) cur_mesh->disable_attributes();
+    }
+
+    void render_impl(bump_shader &object_shader, bump_shader &skin_shader, camera_instance &cam, float aspect_ratio) {
+      // catch nodes moved since update()
+      update_world();
+
+      mat4t cameraToWorld = cam.get_node()->calcModelToWorld();
+
+      mat4t worldToCamera;
+      cameraToWorld.invertQuick(worldToCamera);
+
+      calc_lighting(worldToCamera);
+
+      cam.set_cameraToWorld(cameraToWorld, aspect_ratio);
+
+      draw_debug_data(cam);
+
+      cull_mesh_instances(cam);
+      build_render_queue(cam);
+      draw_render_queue(cam);
+
       frame_number++;
     }
   public:
@@ -268,6 +486,13 @@ namespace octet { namespace scene {
     /// Create an empty visual_scene; Use add_* functions to add components to the scene.
     visual_scene() {
       frame_number = 0;
+      frustum_culling = true;
+      num_culled = 0;
+      num_program_changes = 0;
+      num_material_changes = 0;
+      num_mesh_changes = 0;
+      num_draws = 0;
+      instancing = true;
       num_light_uniforms = 0;
       num_lights = 0;
       render_aabbs = false;
@@ -341,6 +566,10 @@ namespace octet { namespace scene {
       v.visit(animation_instances, atom_animation_instances);
       v.visit(camera_instances, atom_camera_instances);
       v.visit(light_instances, atom_light_instances);
+      if (v.is_reader()) {
+        instance_tree.reset();
+        instance_proxies.reset();
+      }
     }
 
     /// reset the scene.
@@ -349,6 +578,8 @@ namespace octet { namespace scene {
       animation_instances.reset();
       camera_instances.reset();
       light_instances.reset();
+      instance_tree.reset();
+      instance_proxies.reset();
     }
 
     /// set up OpenGL state
@@ -501,6 +732,53 @@ namespace octet { namespace scene {
       render_aabbs = value;
     }
 
+    /// skip mesh instances outside the camera's view (on by default).
+    void set_frustum_culling(bool value) {
+      frustum_culling = value;
+    }
+
+    /// mesh instances drawn, or at least tested further, by the last render().
+    unsigned get_num_visible_instances() const {
+      return visible_instances.size();
+    }
+
+    /// mesh instances skipped by the frustum test in the last render().
+    unsigned get_num_culled_instances() const {
+      return num_culled;
+    }
+
+    /// mesh instances drawn by the last render(), after frustum and distance tests.
+    unsigned get_num_drawn_instances() const {
+      return render_queue.size();
+    }
+
+    /// glUseProgram() calls made by the last render() for the mesh instances.
+    unsigned get_num_program_changes() const {
+      return num_program_changes;
+    }
+
+    /// material uniform uploads made by the last render(); instance matrices are not counted.
+    unsigned get_num_material_changes() const {
+      return num_material_changes;
+    }
+
+    /// vertex buffer and attribute setups made by the last render().
+    unsigned get_num_mesh_changes() const {
+      return num_mesh_changes;
+    }
+
+    /// mesh draws made by the last render(); an instanced draw of many mesh instances counts once.
+    unsigned get_num_draws() const {
+      return num_draws;
+    }
+
+    /// Draw runs of mesh instances with the same mesh and material with one instanced draw call.
+    /// On by default; has no effect without OCTET_INSTANCING (eg. on GLES2) or for materials
+    /// whose shader has no instanced variant (see param_shader).
+    void set_instancing(bool value) {
+      instancing = value;
+    }
+
     /// debugging aid to draw debug lines
     void set_render_debug_lines(bool value) {
       render_debug_lines = value;
@@ -536,8 +814,12 @@ namespace octet { namespace scene {
           btCollisionObject *co = array[i];
           scene_node *node = (scene_node *)co->getUserPointer();
           if (node) {
-            mat4t &mat = node->access_nodeToParent();
+            // only mark the node as moved if the body has moved.
+            mat4t mat;
             co->getWorldTransform().getOpenGLMatrix(mat.get());
+            if (memcmp(&mat, &node->get_nodeToParent(), sizeof(mat))) {
+              node->access_nodeToParent() = mat;
+            }
             //printf("%d %f\n", i, mat.w().y());
           }
         }
@@ -552,6 +834,9 @@ namespace octet { namespace scene {
         mesh_instance *inst = mesh_instances[idx];
         inst->update(delta_time);
       }
+
+      // one pass over the nodes that physics and animation have moved.
+      update_world();
     }
 
     /// render using specific shaders.
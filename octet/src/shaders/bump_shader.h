@@ -16,6 +16,7 @@ namespace octet { namespace shaders {
     GLuint light_uniforms_index;    // lighting parameters for fragment shader
     GLuint num_lights_index;        // how many lights?
     GLuint samplers_index;          // index for texture samplers
+    GLuint decode_index[4];         // pos_scale, pos_offset, uv_decode and normal_decode
 
     void init_uniforms(const char *vertex_shader, const char *fragment_shader) {
       // use the common shader code to compile and link the shaders
@@ -23,16 +24,31 @@ namespace octet { namespace shaders {
       shader::init(vertex_shader, fragment_shader);
 
       // extract the indices of the uniforms to use later
-      modelToProjection_index = glGetUniformLocation(program(), "modelToProjection");
-      cameraToProjection_index = glGetUniformLocation(program(), "cameraToProjection");
-      modelToCamera_index = glGetUniformLocation(program(), "modelToCamera");
-      light_uniforms_index = glGetUniformLocation(program(), "light_uniforms");
-      num_lights_index = glGetUniformLocation(program(), "num_lights");
-      samplers_index = glGetUniformLocation(program(), "samplers");
+      modelToProjection_index = get_uniform_location("modelToProjection");
+      cameraToProjection_index = get_uniform_location("cameraToProjection");
+      modelToCamera_index = get_uniform_location("modelToCamera");
+      light_uniforms_index = get_uniform_location("light_uniforms");
+      num_lights_index = get_uniform_location("num_lights");
+      samplers_index = get_uniform_location("samplers");
+      static const char *decode_names[] = { "pos_scale", "pos_offset", "uv_decode", "normal_decode" };
+      for (unsigned i = 0; i != 4; ++i) {
+        decode_index[i] = get_uniform_location(decode_names[i]);
+      }
+    }
+
+    // attribute_decode is four vec4s from mesh::get_attribute_decode() or NULL for float attributes.
+    void set_decode_uniforms(const vec4 *attribute_decode) {
+      const vec4 *decode = attribute_decode ? attribute_decode : get_default_attribute_decode();
+      for (unsigned i = 0; i != 4; ++i) {
+        glUniform4fv(decode_index[i], 1, decode[i].get());
+      }
     }
 
   public:
-    void init(bool is_skinned=false) {
+    /// num_lights >= 0 builds a fragment shader for exactly that many lights, with the light loop unrolled.
+    /// is_instanced builds a vertex shader that takes modelToCamera from a per-instance attribute;
+    /// draw with render_instanced() and an instance_buffer. Needs OCTET_INSTANCING.
+    void init(bool is_skinned=false, int num_lights=-1, bool is_instanced=false) {
       // this is the vertex shader for regular geometry
       // it is called for each corner of each triangle
       // it inputs pos and uv from each corner
@@ -52,13 +68,51 @@ namespace octet { namespace shaders {
       
         uniform mat4 modelToProjection;
         uniform mat4 modelToCamera;
+        uniform vec4 pos_scale;
+        uniform vec4 pos_offset;
+        uniform vec4 uv_decode;
+        uniform vec4 normal_decode;
       
         void main() {
-          uv_ = uv;
-          normal_ = (modelToCamera * vec4(normal,0)).xyz;
+          vec4 mpos = vec4(pos.xyz * pos_scale.xyz + pos_offset.xyz, pos.w);
+          vec3 mnormal = normal_decode.x != 0.0 ? oct_decode(normal.xy) : normal;
+          uv_ = uv * uv_decode.xy + uv_decode.zw;
+          normal_ = (modelToCamera * vec4(mnormal,0)).xyz;
           tangent_ = (modelToCamera * vec4(tangent,0)).xyz;
           bitangent_ = (modelToCamera * vec4(bitangent,0)).xyz;
-          gl_Position = modelToProjection * pos;
+          gl_Position = modelToProjection * mpos;
+        }
+      );
+
+      // this is the vertex shader for instanced geometry
+      // it is the same as the regular one, but each instance has its own model to camera matrix
+      const char instanced_vertex_shader[] = SHADER_STR(
+        varying vec2 uv_;
+        varying vec3 normal_;
+        varying vec3 tangent_;
+        varying vec3 bitangent_;
+      
+        attribute vec4 pos;
+        attribute vec3 normal;
+        attribute vec3 tangent;
+        attribute vec3 bitangent;
+        attribute vec2 uv;
+        attribute mat4 instance_modelToCamera;
+      
+        uniform mat4 cameraToProjection;
+        uniform vec4 pos_scale;
+        uniform vec4 pos_offset;
+        uniform vec4 uv_decode;
+        uniform vec4 normal_decode;
+      
+        void main() {
+          vec4 mpos = vec4(pos.xyz * pos_scale.xyz + pos_offset.xyz, pos.w);
+          vec3 mnormal = normal_decode.x != 0.0 ? oct_decode(normal.xy) : normal;
+          uv_ = uv * uv_decode.xy + uv_decode.zw;
+          normal_ = (instance_modelToCamera * vec4(mnormal,0)).xyz;
+          tangent_ = (instance_modelToCamera * vec4(tangent,0)).xyz;
+          bitangent_ = (instance_modelToCamera * vec4(bitangent,0)).xyz;
+          gl_Position = cameraToProjection * (instance_modelToCamera * mpos);
         }
       );
 
@@ -83,9 +137,15 @@ namespace octet { namespace shaders {
       
         uniform mat4 cameraToProjection;
         uniform mat4 modelToCamera[192];
+        uniform vec4 pos_scale;
+        uniform vec4 pos_offset;
+        uniform vec4 uv_decode;
+        uniform vec4 normal_decode;
       
         void main() {
-          uv_ = uv;
+          vec4 mpos = vec4(pos.xyz * pos_scale.xyz + pos_offset.xyz, pos.w);
+          vec3 mnormal = normal_decode.x != 0.0 ? oct_decode(normal.xy) : normal;
+          uv_ = uv * uv_decode.xy + uv_decode.zw;
           ivec4 index = ivec4(blendindices);
           mat4 m2c0 = modelToCamera[index.x];
           mat4 m2c1 = modelToCamera[index.y];
@@ -93,10 +153,10 @@ namespace octet { namespace shaders {
           mat4 m2c3 = modelToCamera[index.w];
           float blend0 = 1.0 - blendweight.x - blendweight.y - blendweight.z;
           mat4 blendedModelToCamera = m2c0 * blend0 + m2c1 * blendweight.x + m2c2 * blendweight.y + m2c3 * blendweight.z;
-          normal_ = normalize((blendedModelToCamera * vec4(normal,0)).xyz);
+          normal_ = normalize((blendedModelToCamera * vec4(mnormal,0)).xyz);
           tangent_ = normalize((blendedModelToCamera * vec4(tangent,0)).xyz);
           bitangent_ = normalize((blendedModelToCamera * vec4(bitangent,0)).xyz);
-          gl_Position = cameraToProjection * (blendedModelToCamera * pos);
+          gl_Position = cameraToProjection * (blendedModelToCamera * mpos);
         }
       );
 
@@ -159,16 +219,44 @@ namespace octet { namespace shaders {
     
       // use the common shader code to compile and link the shaders
       // the result is a shader program
-      init_uniforms(is_skinned ? skinned_vertex_shader : vertex_shader, fragment_shader);
+      const char *vs = is_skinned ? skinned_vertex_shader : is_instanced ? instanced_vertex_shader : vertex_shader;
+      if (num_lights >= 0) {
+        char num[16];
+        sprintf(num, "%d", num_lights);
+        const char *values[] = { "num_lights", num };
+        string variant;
+        specialise(variant, fragment_shader, values, 1);
+        init_uniforms(vs, variant.c_str());
+      } else {
+        init_uniforms(vs, fragment_shader);
+      }
     }
 
-    void render(const mat4t &modelToProjection, const mat4t &modelToCamera, const vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+    void render(const mat4t &modelToProjection, const mat4t &modelToCamera, const vec4 *light_uniforms, int num_light_uniforms, int num_lights, const vec4 *attribute_decode = NULL) {
       // tell openGL to use the program
       shader::render();
 
       // customize the program with uniforms
       glUniformMatrix4fv(modelToProjection_index, 1, GL_FALSE, modelToProjection.get());
       glUniformMatrix4fv(modelToCamera_index, 1, GL_FALSE, modelToCamera.get());
+      set_decode_uniforms(attribute_decode);
+
+      glUniform4fv(light_uniforms_index, num_light_uniforms, (float*)light_uniforms);
+      glUniform1i(num_lights_index, num_lights);
+
+      // we use textures 0-3 for material properties.
+      static const GLint samplers[] = { 0, 1, 2, 3, 4, 5 };
+      glUniform1iv(samplers_index, 6, samplers);
+    }
+
+    /// For shaders made with is_instanced: the model to camera matrices come from an instance_buffer.
+    void render_instanced(const mat4t &cameraToProjection, const vec4 *light_uniforms, int num_light_uniforms, int num_lights, const vec4 *attribute_decode = NULL) {
+      // tell openGL to use the program
+      shader::render();
+
+      // customize the program with uniforms
+      glUniformMatrix4fv(cameraToProjection_index, 1, GL_FALSE, cameraToProjection.get());
+      set_decode_uniforms(attribute_decode);
 
       glUniform4fv(light_uniforms_index, num_light_uniforms, (float*)light_uniforms);
       glUniform1i(num_lights_index, num_lights);
@@ -178,13 +266,14 @@ namespace octet { namespace shaders {
       glUniform1iv(samplers_index, 6, samplers);
     }
 
-    void render_skinned(const mat4t &cameraToProjection, const mat4t *modelToCamera, int num_matrices, const vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+    void render_skinned(const mat4t &cameraToProjection, const mat4t *modelToCamera, int num_matrices, const vec4 *light_uniforms, int num_light_uniforms, int num_lights, const vec4 *attribute_decode = NULL) {
       // tell openGL to use the program
       shader::render();
 
       // customize the program with uniforms
       glUniformMatrix4fv(cameraToProjection_index, 1, GL_FALSE, cameraToProjection.get());
       glUniformMatrix4fv(modelToCamera_index, num_matrices, GL_FALSE, (float*)modelToCamera);
+      set_decode_uniforms(attribute_decode);
 
       glUniform4fv(light_uniforms_index, num_light_uniforms, (float*)light_uniforms);
       glUniform1i(num_lights_index, num_lights);
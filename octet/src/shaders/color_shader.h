@@ -43,8 +43,8 @@ namespace octet { namespace shaders {
       #endif
 
       // set up handles to access the uniforms.
-      modelToProjectionIndex_ = glGetUniformLocation(program(), "modelToProjection");
-      emissive_colorIndex_ = glGetUniformLocation(program(), "emissive_color");
+      modelToProjectionIndex_ = get_uniform_location("modelToProjection");
+      emissive_colorIndex_ = get_uniform_location("emissive_color");
     }
 
     // start drawing with this shader
@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Compute shaders run on the CPU for machines without GL compute.
+
+namespace octet { namespace shaders {
+  /// Compile a GLSL compute shader to cpp_vm bytecode and run it on the job pool.
+  ///
+  /// Buffers are plain memory, so the results can be uploaded with glBufferData
+  /// or used directly in unit tests. See compiler/cpp_vm.h for the supported GLSL.
+  ///
+  /// Example
+  ///
+  ///     ref<cpu_compute_shader> helix = new cpu_compute_shader("shaders/helix.cs");
+  ///     helix->set_uniform("num_steps", 320);
+  ///     helix->bind_buffer(0, vertices.data(), vertices.size() * sizeof(vertices[0]));
+  ///     helix->dispatch((320 + 64) / 64);
+  class cpu_compute_shader : public resource {
+    compiler::cpp_vm_program program_;
+    compiler::cpp_vm *vm_;
+
+    // not copyable
+    cpu_compute_shader(const cpu_compute_shader &);
+    cpu_compute_shader &operator=(const cpu_compute_shader &);
+  public:
+    cpu_compute_shader() {
+      vm_ = 0;
+    }
+
+    cpu_compute_shader(const char *url) {
+      vm_ = 0;
+      dynarray<uint8_t> cs;
+      app_utils::get_url(cs, url);
+      cs.push_back(0);
+      init((const char *)cs.data());
+    }
+
+    ~cpu_compute_shader() {
+      delete vm_;
+    }
+
+    /// Compile from source; returns false and logs the errors if it failed.
+    bool init(const char *source) {
+      delete vm_;
+      vm_ = 0;
+
+      compiler::cpp_parser *parser = new compiler::cpp_parser();
+      bool ok = parser->parse(source) && compiler::cpp_vm_compiler(*parser, program_).compile("main");
+      delete parser;
+
+      if (!ok) {
+        log("%s\nCPU compute shader error:\n%s\n\n", source, compiler::cpp_log(""));
+        return false;
+      }
+      vm_ = new compiler::cpp_vm(program_);
+      return true;
+    }
+
+    bool is_valid() const {
+      return vm_ != 0;
+    }
+
+    /// Set a uniform; returns false if the shader does not have it.
+    bool set_uniform(const char *name, float value) {
+      return vm_ && vm_->set_uniform(name, value);
+    }
+
+    bool set_uniform(const char *name, int value) {
+      return vm_ && vm_->set_uniform(name, value);
+    }
+
+    bool set_uniform(const char *name, const float *values, unsigned n) {
+      return vm_ && vm_->set_uniform(name, values, n);
+    }
+
+    /// Attach memory to a layout(binding = n) buffer, like glBindBufferBase.
+    void bind_buffer(unsigned binding, void *data, size_t size) {
+      if (vm_) vm_->bind_buffer(binding, data, size);
+    }
+
+    /// Run x * y * z work groups; returns when they have all finished.
+    void dispatch(size_t x, size_t y = 1, size_t z = 1) {
+      if (vm_) vm_->dispatch((unsigned)x, (unsigned)y, (unsigned)z);
+    }
+
+    /// The compiled bytecode.
+    const compiler::cpp_vm_program &get_program() const {
+      return program_;
+    }
+  };
+}}
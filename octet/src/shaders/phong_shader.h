@@ -86,15 +86,15 @@ namespace octet { namespace shaders {
       shader::init(vertex_shader, fragment_shader);
 
       // extract the indices of the uniforms to use later
-      modelToProjection_index = glGetUniformLocation(program(), "modelToProjection");
-      cameraToProjection_index = glGetUniformLocation(program(), "cameraToProjection");
-      modelToCamera_index = glGetUniformLocation(program(), "modelToCamera");
-      light_direction_index = glGetUniformLocation(program(), "light_direction");
-      samplers_index = glGetUniformLocation(program(), "samplers");
-      shininess_index = glGetUniformLocation(program(), "shininess");
-      light_ambient_index = glGetUniformLocation(program(), "light_ambient");
-      light_diffuse_index = glGetUniformLocation(program(), "light_diffuse");
-      light_specular_index = glGetUniformLocation(program(), "light_specular");
+      modelToProjection_index = get_uniform_location("modelToProjection");
+      cameraToProjection_index = get_uniform_location("cameraToProjection");
+      modelToCamera_index = get_uniform_location("modelToCamera");
+      light_direction_index = get_uniform_location("light_direction");
+      samplers_index = get_uniform_location("samplers");
+      shininess_index = get_uniform_location("shininess");
+      light_ambient_index = get_uniform_location("light_ambient");
+      light_diffuse_index = get_uniform_location("light_diffuse");
+      light_specular_index = get_uniform_location("light_specular");
     }
 
     void render(const mat4t &modelToProjection, const mat4t &modelToCamera, const vec4 &light_direction, float shininess, vec4 &light_ambient, vec4 &light_diffuse, vec4 &light_specular, int num_samplers=4) {
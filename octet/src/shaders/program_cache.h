@@ -0,0 +1,263 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Linked shader programs saved between runs
+
+namespace octet { namespace shaders {
+  /// Keep linked programs on disk so that later runs can skip the driver's compiler.
+  ///
+  /// Entries are keyed by a hash of the vertex and fragment source and the GL vendor,
+  /// renderer and version strings, so a new driver just misses.
+  /// Each entry has the glGetProgramBinary() output and the locations of the active uniforms,
+  /// so binding parameters does not need glGetUniformLocation() either.
+  ///
+  /// shader::init() tries the cache first. If the driver rejects a binary,
+  /// the program is compiled from source and its entry replaced.
+  /// The cache is off if the driver has no binary formats or the path is NULL.
+  ///
+  /// Example
+  ///
+  ///     program_cache::get().set_path("my_game_programs.bin");
+  ///     my_shader.init(vs, fs);
+  ///     printf("%d programs loaded\n", program_cache::get().get_num_hits());
+  class program_cache {
+    // file layout: magic, then entry_header, binary, uniform table for each entry.
+    // the uniform table is an int32 location, then the name and a zero, for each uniform.
+    enum { magic = 0x3143504f }; // "OPC1"
+
+    struct entry_header {
+      uint64_t key;
+      uint32_t format;
+      uint32_t binary_size;
+      uint32_t table_size;
+      uint32_t pad;
+    };
+
+    string path_;
+    bool enabled_;
+    bool loaded_;
+    int supported_;
+    dynarray<uint8_t> file_;
+    hash_map<uint64_t, unsigned> offsets_;
+    unsigned num_hits_;
+    unsigned num_misses_;
+
+    // FNV-1a including the terminator, so that "ab", "c" differs from "a", "bc".
+    static uint64_t add_hash(uint64_t hash, const char *str) {
+      if (!str) str = "";
+      do {
+        hash = (hash ^ (uint8_t)*str) * 0x100000001b3ull;
+      } while (*str++);
+      return hash;
+    }
+
+    static void append(dynarray<uint8_t> &dest, const void *src, unsigned size) {
+      unsigned offset = dest.size();
+      dest.resize(offset + size);
+      if (size) memcpy(&dest[offset], src, size);
+    }
+
+    // find the entries, dropping a truncated one at the end.
+    void index() {
+      offsets_.clear();
+      unsigned offset = sizeof(uint32_t);
+      while (offset + sizeof(entry_header) <= file_.size()) {
+        entry_header header;
+        memcpy(&header, &file_[offset], sizeof(header));
+        uint64_t size = (uint64_t)sizeof(header) + header.binary_size + header.table_size;
+        if (offset + size > file_.size()) break;
+        offsets_[header.key] = offset;
+        offset += (unsigned)size;
+      }
+      file_.resize(offset);
+    }
+
+    void load_file() {
+      if (loaded_) return;
+      loaded_ = true;
+      file_.resize(0);
+      FILE *file = fopen(path_.c_str(), "rb");
+      if (file) {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (size > 0) {
+          file_.resize((unsigned)size);
+          if (fread(file_.data(), 1, file_.size(), file) != file_.size()) file_.resize(0);
+        }
+        fclose(file);
+      }
+
+      uint32_t file_magic = 0;
+      if (file_.size() >= sizeof(file_magic)) memcpy(&file_magic, file_.data(), sizeof(file_magic));
+      if (file_magic != magic) {
+        file_.resize(0);
+        file_magic = magic;
+        append(file_, &file_magic, sizeof(file_magic));
+      }
+      index();
+    }
+
+  public:
+    program_cache() {
+      path_ = "octet_programs.bin";
+      enabled_ = true;
+      loaded_ = false;
+      supported_ = -1;
+      num_hits_ = 0;
+      num_misses_ = 0;
+    }
+
+    /// The cache used by shader::init()
+    static program_cache &get() {
+      static program_cache instance;
+      return instance;
+    }
+
+    /// Where to keep the programs; NULL turns the cache off.
+    /// The default is octet_programs.bin in the working directory.
+    void set_path(const char *path) {
+      enabled_ = path != NULL;
+      if (path) path_ = path;
+      loaded_ = false;
+    }
+
+    /// True if the driver can save programs and the cache has a path.
+    /// Needs a GL context.
+    bool is_enabled() {
+      #ifdef __APPLE__
+        return false;
+      #else
+        if (supported_ < 0) {
+          GLint num_formats = 0;
+          glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+          supported_ = num_formats > 0;
+        }
+        return enabled_ && supported_;
+      #endif
+    }
+
+    /// Key for a pair of shaders on the current driver. Never zero.
+    static uint64_t get_key(const char *vs, const char *fs) {
+      uint64_t hash = 0xcbf29ce484222325ull;
+      hash = add_hash(hash, vs);
+      hash = add_hash(hash, fs);
+      hash = add_hash(hash, (const char*)glGetString(GL_VENDOR));
+      hash = add_hash(hash, (const char*)glGetString(GL_RENDERER));
+      hash = add_hash(hash, (const char*)glGetString(GL_VERSION));
+      return hash ? hash : 1;
+    }
+
+    /// Ask the driver to keep the binary of a program that is about to be linked.
+    void prepare(GLuint program) {
+      #ifndef __APPLE__
+        if (is_enabled()) {
+          glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+      #endif
+    }
+
+    /// Link "program" from a saved binary and add its uniform locations to "uniforms".
+    /// Returns false if there is no entry or the driver will not take it.
+    bool load(GLuint program, uint64_t key, dictionary<GLint> &uniforms) {
+      #ifndef __APPLE__
+        load_file();
+        if (offsets_.contains(key)) {
+          entry_header header;
+          unsigned offset = offsets_[key];
+          memcpy(&header, &file_[offset], sizeof(header));
+          const uint8_t *binary = &file_[offset] + sizeof(header);
+          glProgramBinary(program, header.format, binary, header.binary_size);
+
+          GLint linked = GL_FALSE;
+          glGetProgramiv(program, GL_LINK_STATUS, &linked);
+          if (linked) {
+            const uint8_t *src = binary + header.binary_size;
+            const uint8_t *end = src + header.table_size;
+            while (src + sizeof(int32_t) < end) {
+              int32_t location;
+              memcpy(&location, src, sizeof(location));
+              const char *name = (const char*)src + sizeof(location);
+              const char *name_end = (const char*)memchr(name, 0, end - (const uint8_t*)name);
+              if (!name_end) break;
+              uniforms[name] = location;
+              src = (const uint8_t*)name_end + 1;
+            }
+            num_hits_++;
+            return true;
+          }
+        }
+      #endif
+      num_misses_++;
+      return false;
+    }
+
+    /// Save the binary of a linked program with its uniform locations, replacing any old entry.
+    /// Returns false if the program did not link or the file could not be written.
+    bool save(GLuint program, uint64_t key, dictionary<GLint> &uniforms) {
+      #ifndef __APPLE__
+        GLint linked = GL_FALSE;
+        GLint size = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+        if (!linked || size <= 0) return false;
+
+        dynarray<uint8_t> binary(size);
+        GLsizei length = 0;
+        GLenum format = 0;
+        glGetProgramBinary(program, size, &length, &format, binary.data());
+        if (length <= 0) return false;
+
+        dynarray<uint8_t> table;
+        for (unsigned i = 0; i != uniforms.get_num_indices(); ++i) {
+          if (const char *name = uniforms.get_key(i)) {
+            int32_t location = uniforms.get_value(i);
+            append(table, &location, sizeof(location));
+            append(table, name, (unsigned)strlen(name) + 1);
+          }
+        }
+
+        // copy the other entries and add this one at the end.
+        load_file();
+        dynarray<uint8_t> file;
+        append(file, file_.data(), sizeof(uint32_t));
+        for (unsigned offset = sizeof(uint32_t); offset != file_.size(); ) {
+          entry_header header;
+          memcpy(&header, &file_[offset], sizeof(header));
+          unsigned entry_size = sizeof(header) + header.binary_size + header.table_size;
+          if (header.key != key) append(file, &file_[offset], entry_size);
+          offset += entry_size;
+        }
+        entry_header header = { key, format, (uint32_t)length, table.size(), 0 };
+        append(file, &header, sizeof(header));
+        append(file, binary.data(), length);
+        append(file, table.data(), table.size());
+
+        file_.resize(0);
+        append(file_, file.data(), file.size());
+        index();
+
+        FILE *out = fopen(path_.c_str(), "wb");
+        if (!out) return false;
+        bool ok = fwrite(file_.data(), 1, file_.size(), out) == file_.size();
+        fclose(out);
+        return ok;
+      #else
+        return false;
+      #endif
+    }
+
+    /// Programs loaded from the cache.
+    unsigned get_num_hits() const {
+      return num_hits_;
+    }
+
+    /// Programs that had to be compiled.
+    unsigned get_num_misses() const {
+      return num_misses_;
+    }
+  };
+}}
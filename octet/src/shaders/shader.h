@@ -14,9 +14,13 @@ namespace octet { namespace shaders {
   class shader : public resource {
     GLuint program_;
 
+    // locations of the active uniforms, from the linked program or the program cache.
+    dictionary<GLint> uniforms_;
+
     void link(GLuint vertex_shader, GLuint fragment_shader) {
           // assemble the program for use by glUseProgram
       GLuint program = glCreateProgram();
+      program_cache::get().prepare(program);
       glAttachShader(program, vertex_shader);
       glAttachShader(program, fragment_shader);
 
@@ -29,6 +33,7 @@ namespace octet { namespace shaders {
       glBindAttribLocation(program, attribute_blendindices, "blendindices");
       glBindAttribLocation(program, attribute_color, "color");
       glBindAttribLocation(program, attribute_uv, "uv");
+      glBindAttribLocation(program, attribute_instance, "instance_modelToCamera");
       glLinkProgram(program);
 
       program_ = program;
@@ -42,14 +47,90 @@ namespace octet { namespace shaders {
         printf("linked ok\n");
       }
     }
+
+    void get_active_uniforms() {
+      GLint num_uniforms = 0;
+      glGetProgramiv(program_, GL_ACTIVE_UNIFORMS, &num_uniforms);
+      for (GLint i = 0; i != num_uniforms; ++i) {
+        char name[256];
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(program_, i, sizeof(name), &length, &size, &type, name);
+        if (length <= 0) continue;
+        GLint location = glGetUniformLocation(program_, name);
+        uniforms_[name] = location;
+
+        // arrays are reported as light_uniforms[0] but looked up as light_uniforms
+        char *bracket = strstr(name, "[0]");
+        if (bracket && bracket[3] == 0) {
+          *bracket = 0;
+          uniforms_[name] = location;
+        }
+      }
+    }
   public:
     shader() {
     }
 
+    /// Decode uniforms (pos_scale, pos_offset, uv_decode, normal_decode) for float vertex attributes.
+    /// Quantised meshes supply their own; see mesh::quantize().
+    static const vec4 *get_default_attribute_decode() {
+      static const vec4 identity[4] = {
+        vec4(1, 1, 1, 0), vec4(0, 0, 0, 0), vec4(1, 1, 0, 0), vec4(0, 0, 0, 0)
+      };
+      return identity;
+    }
+
+    /// GLSL to unpack octahedral normals: the unit sphere folded onto a square.
+    /// init() adds this to vertex shaders that call oct_decode() without defining it.
+    static const char *get_decode_glsl() {
+      return SHADER_STR(
+        vec3 oct_decode(vec2 e) {
+          vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+          float t = max(-n.z, 0.0);
+          n.x += n.x >= 0.0 ? -t : t;
+          n.y += n.y >= 0.0 ? -t : t;
+          return normalize(n);
+        }
+      ) "\n";
+    }
+
+    /// Insert text into shader source after the #version line, if there is one.
+    static std::string insert_after_version(const char *source, const char *text) {
+      std::string result = source;
+      size_t pos = 0;
+      if (result.compare(0, 8, "#version") == 0) {
+        pos = result.find('\n');
+        pos = pos == std::string::npos ? result.size() : pos + 1;
+      }
+      result.insert(pos, text);
+      return result;
+    }
+
     GLuint program() { return program_; }
   
     void init(const char *vs, const char *fs) {
       //printf("creating shader program\n");
+      uniforms_.reset();
+
+      std::string vs_with_decode;
+      if (strstr(vs, "oct_decode(") && !strstr(vs, "vec3 oct_decode(")) {
+        vs_with_decode = insert_after_version(vs, get_decode_glsl());
+        vs = vs_with_decode.c_str();
+      }
+
+      // try for a program linked on an earlier run.
+      program_cache &cache = program_cache::get();
+      uint64_t key = cache.is_enabled() ? program_cache::get_key(vs, fs) : 0;
+      if (key) {
+        program_ = glCreateProgram();
+        if (cache.load(program_, key, uniforms_)) {
+          return;
+        }
+        glDeleteProgram(program_);
+        uniforms_.reset();
+      }
 
       GLsizei length;
       char buf[0x10000];
@@ -72,6 +153,49 @@ namespace octet { namespace shaders {
       }
 
       link(vertex_shader, fragment_shader);
+      get_active_uniforms();
+
+      if (key) {
+        cache.save(program_, key, uniforms_);
+      }
+    }
+
+    /// Make a variant of a shader with some names fixed, eg. { "num_lights", "2" }.
+    /// values holds num_values name, value pairs.
+    /// Uniforms and consts are folded into the code, which unrolls the loops they bound;
+    /// any other name is #defined. result is GLSL to pass to init().
+    /// On failure result is the original source.
+    static bool specialise(string &result, const char *source, const char *const *values, unsigned num_values) {
+      // parse once to find the uniforms, then again with the #defines.
+      compiler::cpp_parser parser;
+      bool ok = parser.parse(source);
+      bool reparse = false;
+      compiler::cpp_symbols &symbols = parser.getSymbols();
+      for (unsigned i = 0; i != num_values; ++i) {
+        if (!ok || !parser.getGlobalScope()->lookup(symbols.intern(values[i*2]))) {
+          parser.predefine(values[i*2], values[i*2+1]);
+          reparse = true;
+        }
+      }
+      if (reparse) {
+        parser.reset();
+        ok = parser.parse(source);
+      }
+
+      if (ok) {
+        compiler::cpp_optimizer optimizer(parser);
+        for (unsigned i = 0; i != num_values; ++i) {
+          optimizer.specialise(values[i*2], atof(values[i*2+1]));
+        }
+        optimizer.optimise();
+        ok = compiler::cpp_glsl_writer(parser).write(result);
+      }
+
+      if (!ok) {
+        log("Shader specialisation error:\n%s\n%s\n\n\n\n", compiler::cpp_log(""), source);
+        result = source;
+      }
+      return ok;
     }
 
     /// create a program from pre-compiled binary code. (ie. PS Vita)  
@@ -98,6 +222,12 @@ namespace octet { namespace shaders {
     GLuint get_program() const {
       return program_;
     }
+
+    /// Location of a uniform, eg. "light_uniforms", without asking the driver if we can.
+    GLint get_uniform_location(const char *name) {
+      int index = uniforms_.get_index(name);
+      return index != -1 ? uniforms_.get_value(index) : glGetUniformLocation(program_, name);
+    }
   };
 
 }}
@@ -56,9 +56,9 @@ namespace octet { namespace shaders {
       shader::init(vertex_shader, fragment_shader);
 
       // extract the indices of the uniforms to use later
-      modelToProjectionIndex_ = glGetUniformLocation(program(), "modelToProjection");
-      samplerIndex_ = glGetUniformLocation(program(), "sampler");
-	  color_index = glGetUniformLocation(program(), "color");
+      modelToProjectionIndex_ = get_uniform_location("modelToProjection");
+      samplerIndex_ = get_uniform_location("sampler");
+	  color_index = get_uniform_location("color");
     }
 	//, float color[4]
     void render(const mat4t &modelToProjection, int sampler, vec4 _color) {
@@ -36,7 +36,7 @@ const TiXmlString::size_type TiXmlString::npos = static_cast< TiXmlString::size_
 
 
 // Null rep.
-TiXmlString::Rep TiXmlString::nullrep_ = { 0, 0, { '\0' } };
+TiXmlString::Rep TiXmlString::nullrep_ = { 0, 0, TiXmlString::nullrep_.str, { '\0' } };
 
 
 void TiXmlString::reserve (size_type cap)
@@ -139,10 +139,10 @@ class TiXmlString
 
 
 	// Convert a TiXmlString into a null-terminated char *
-	const char * c_str () const { return rep_->str; }
+	const char * c_str () const { return rep_->ptr; }
 
 	// Convert a TiXmlString into a char * (need not be null terminated).
-	const char * data () const { return rep_->str; }
+	const char * data () const { return rep_->ptr; }
 
 	// Return the length of a TiXmlString
 	size_type length () const { return rep_->size; }
@@ -161,14 +161,14 @@ class TiXmlString
 	const char& at (size_type index) const
 	{
 		assert( index < length() );
-		return rep_->str[ index ];
+		return rep_->ptr[ index ];
 	}
 
 	// [] operator
 	char& operator [] (size_type index) const
 	{
 		assert( index < length() );
-		return rep_->str[ index ];
+		return rep_->ptr[ index ];
 	}
 
 	// find a char in a string. Return TiXmlString::npos if not found
@@ -215,16 +215,34 @@ class TiXmlString
 		other.rep_ = r;
 	}
 
+	/*	Make the string a view of len characters at str, which are not copied or freed.
+		Used by TiXmlDocument's in-situ mode. The characters must be zero terminated before
+		c_str() is used and header, of view_header_size() bytes, must outlive the string.
+		Assigning to a view copies it first.
+	*/
+	void assign_view (void* header, char* str, size_type len)
+	{
+		quit();
+		rep_ = static_cast<Rep*>(header);
+		rep_->size = len;
+		rep_->capacity = 0;
+		rep_->ptr = str;
+	}
+
+	static size_type view_header_size () { return sizeof(Rep); }
+
   private:
 
 	void init(size_type sz) { init(sz, sz); }
-	void set_size(size_type sz) { rep_->str[ rep_->size = sz ] = '\0'; }
-	char* start() const { return rep_->str; }
-	char* finish() const { return rep_->str + rep_->size; }
+	void set_size(size_type sz) { rep_->ptr[ rep_->size = sz ] = '\0'; }
+	char* start() const { return rep_->ptr; }
+	char* finish() const { return rep_->ptr + rep_->size; }
 
+	// ptr is str, except for views (capacity 0) where it points to someone else's characters.
 	struct Rep
 	{
 		size_type size, capacity;
+		char* ptr;
 		char str[1];
 	};
 
@@ -241,7 +259,8 @@ class TiXmlString
 			const size_type intsNeeded = ( bytesNeeded + sizeof(int) - 1 ) / sizeof( int ); 
 			rep_ = reinterpret_cast<Rep*>( new int[ intsNeeded ] );
 
-			rep_->str[ rep_->size = sz ] = '\0';
+			rep_->ptr = rep_->str;
+			rep_->ptr[ rep_->size = sz ] = '\0';
 			rep_->capacity = cap;
 		}
 		else
@@ -252,7 +271,7 @@ class TiXmlString
 
 	void quit()
 	{
-		if (rep_ != &nullrep_)
+		if (rep_ != &nullrep_ && rep_->capacity)
 		{
 			// The rep_ is really an array of ints. (see the allocator, above).
 			// Cast it back before delete, so the compiler won't incorrectly call destructors.
@@ -35,6 +35,49 @@ FILE* TiXmlFOpen( const char* filename, const char* mode );
 
 bool TiXmlBase::condenseWhiteSpace = true;
 
+void TiXmlArena::Grow( size_t size )
+{
+	blockSize = blockSize ? blockSize * 2 : MIN_BLOCK;
+	if ( blockSize > MAX_BLOCK )
+		blockSize = MAX_BLOCK;
+
+	size_t bytes = size + BLOCK_HEADER > blockSize ? size + BLOCK_HEADER : blockSize;
+	char* block = (char*)malloc( bytes );
+	*(char**)block = blocks;
+	blocks = block;
+	next = block + BLOCK_HEADER;
+	end = block + bytes;
+}
+
+void TiXmlArena::Clear()
+{
+	while ( blocks )
+	{
+		char* prev = *(char**)blocks;
+		free( blocks );
+		blocks = prev;
+	}
+	next = end = 0;
+	blockSize = 0;
+}
+
+// 16 bytes keeps the object aligned.
+void* TiXmlBase::Allocate( size_t size, TiXmlArena* arena )
+{
+	char* mem = arena ? (char*)arena->Alloc( size + 16 ) : (char*)::operator new( size + 16 );
+	*(size_t*)mem = arena ? 1 : 0;
+	return mem + 16;
+}
+
+void TiXmlBase::operator delete( void* ptr )
+{
+	if ( !ptr )
+		return;
+	char* mem = (char*)ptr - 16;
+	if ( !*(size_t*)mem )
+		::operator delete( mem );
+}
+
 // Microsoft compiler security
 FILE* TiXmlFOpen( const char* filename, const char* mode )
 {
@@ -870,6 +913,7 @@ TiXmlDocument::TiXmlDocument() : TiXmlNode( TiXmlNode::TINYXML_DOCUMENT )
 {
 	tabsize = 4;
 	useMicrosoftBOM = false;
+	InitInSitu();
 	ClearError();
 }
 
@@ -878,6 +922,7 @@ TiXmlDocument::TiXmlDocument( const char * documentName ) : TiXmlNode( TiXmlNode
 	tabsize = 4;
 	useMicrosoftBOM = false;
 	value = documentName;
+	InitInSitu();
 	ClearError();
 }
 
@@ -888,6 +933,7 @@ TiXmlDocument::TiXmlDocument( const std::string& documentName ) : TiXmlNode( TiX
 	tabsize = 4;
 	useMicrosoftBOM = false;
     value = documentName;
+	InitInSitu();
 	ClearError();
 }
 #endif
@@ -895,6 +941,7 @@ TiXmlDocument::TiXmlDocument( const std::string& documentName ) : TiXmlNode( TiX
 
 TiXmlDocument::TiXmlDocument( const TiXmlDocument& copy ) : TiXmlNode( TiXmlNode::TINYXML_DOCUMENT )
 {
+	InitInSitu();
 	copy.CopyTo( this );
 }
 
@@ -902,10 +949,76 @@ TiXmlDocument::TiXmlDocument( const TiXmlDocument& copy ) : TiXmlNode( TiXmlNode
 void TiXmlDocument::operator=( const TiXmlDocument& copy )
 {
 	Clear();
+	ClearInSitu();
 	copy.CopyTo( this );
 }
 
 
+TiXmlDocument::~TiXmlDocument()
+{
+	// the children may live in the arena, so they go first.
+	Clear();
+	ClearInSitu();
+	free( terminators );
+}
+
+
+void TiXmlDocument::InitInSitu()
+{
+	inSitu = false;
+	parsingInSitu = false;
+	terminators = 0;
+	numTerminators = maxTerminators = 0;
+}
+
+
+void TiXmlDocument::ClearInSitu()
+{
+	arena.Clear();
+	numTerminators = 0;
+}
+
+
+void TiXmlDocument::SetInSituString( TIXML_STRING* str, const char* begin, const char* end, const char* p )
+{
+	#ifdef TIXML_USE_STL
+		str->assign( begin, end - begin );
+		(void)p;
+	#else
+		str->assign_view( arena.Alloc( TiXmlString::view_header_size() ), const_cast< char* >( begin ), end - begin );
+		char* terminator = const_cast< char* >( end );
+		if ( end < p )
+		{
+			*terminator = 0;
+			return;
+		}
+		if ( numTerminators == maxTerminators )
+		{
+			maxTerminators = maxTerminators ? maxTerminators * 2 : 256;
+			terminators = (char**)realloc( terminators, maxTerminators * sizeof( char* ) );
+		}
+		terminators[ numTerminators++ ] = terminator;
+	#endif
+}
+
+
+const char* TiXmlDocument::ParseInSitu( char* buf, TiXmlEncoding encoding )
+{
+	// row and column tracking would have to read the text as it changes.
+	int savedTabsize = tabsize;
+	tabsize = 0;
+	parsingInSitu = true;
+	const char* result = Parse( buf, 0, encoding );
+	parsingInSitu = false;
+	tabsize = savedTabsize;
+
+	for ( int i = 0; i != numTerminators; ++i )
+		*terminators[ i ] = 0;
+	numTerminators = 0;
+	return result;
+}
+
+
 bool TiXmlDocument::LoadFile( TiXmlEncoding encoding )
 {
 	return LoadFile( Value(), encoding );
@@ -948,6 +1061,7 @@ bool TiXmlDocument::LoadFile( FILE* file, TiXmlEncoding encoding )
 
 	// Delete the existing data:
 	Clear();
+	ClearInSitu();
 	location.Clear();
 
 	// Get the file size, so we can pre-allocate the string. HUGE speed impact.
@@ -984,11 +1098,13 @@ bool TiXmlDocument::LoadFile( FILE* file, TiXmlEncoding encoding )
 	}
 	*/
 
-	char* buf = new char[ length+1 ];
+	// in-situ documents keep the text.
+	char* buf = inSitu ? (char*)arena.Alloc( length+1 ) : new char[ length+1 ];
 	buf[0] = 0;
 
 	if ( fread( buf, length, 1, file ) != 1 ) {
-		delete [] buf;
+		if ( !inSitu )
+			delete [] buf;
 		SetError( TIXML_ERROR_OPENING_FILE, 0, 0, TIXML_ENCODING_UNKNOWN );
 		return false;
 	}
@@ -1029,6 +1145,11 @@ bool TiXmlDocument::LoadFile( FILE* file, TiXmlEncoding encoding )
 	assert( q <= (buf+length) );
 	*q = 0;
 
+	if ( inSitu ) {
+		ParseInSitu( buf, encoding );
+		return !Error();
+	}
+
 	Parse( buf, 0, encoding );
 
 	delete [] buf;
@@ -106,6 +106,45 @@ struct TiXmlCursor
 };
 
 
+/**
+	A bump allocator for the nodes of a document parsed in-situ.
+	Everything allocated is freed at once by Clear() or the destructor.
+*/
+class TiXmlArena
+{
+public:
+	TiXmlArena() : blocks( 0 ), next( 0 ), end( 0 ), blockSize( 0 ) {}
+	~TiXmlArena()	{ Clear(); }
+
+	/// Allocate size bytes, 16 byte aligned.
+	void* Alloc( size_t size )
+	{
+		size = ( size + 15 ) & ~(size_t)15;
+		if ( (size_t)( end - next ) < size )
+			Grow( size );
+		void* result = next;
+		next += size;
+		return result;
+	}
+
+	/// Free every allocation.
+	void Clear();
+
+private:
+	TiXmlArena( const TiXmlArena& );		// not implemented.
+	void operator=( const TiXmlArena& );	// not allowed.
+
+	void Grow( size_t size );
+
+	// each block starts with a pointer to the previous one, padded to 16 bytes.
+	enum { BLOCK_HEADER = 16, MIN_BLOCK = 64*1024, MAX_BLOCK = 4*1024*1024 };
+	char* blocks;
+	char* next;
+	char* end;
+	size_t blockSize;
+};
+
+
 /**
 	Implements the interface to the "Visitor pattern" (see the Accept() method.)
 	If you call the Accept() method, it requires being passed a TiXmlVisitor
@@ -252,6 +291,15 @@ public:
 	// in the UTF-8 sequence.
 	static const int utf8ByteTable[256];
 
+	/*	Nodes and attributes may come from a document's arena (see TiXmlDocument::SetInSitu).
+		A header before each object records where it came from, so that delete leaves
+		arena objects for the arena to free.
+	*/
+	static void* operator new( size_t size )						{ return Allocate( size, 0 ); }
+	static void* operator new( size_t size, TiXmlArena* arena )		{ return Allocate( size, arena ); }
+	static void operator delete( void* ptr );
+	static void operator delete( void* ptr, TiXmlArena* )			{ operator delete( ptr ); }
+
 	virtual const char* Parse(	const char* p, 
 								TiXmlParsingData* data, 
 								TiXmlEncoding encoding /*= TIXML_ENCODING_UNKNOWN */ ) = 0;
@@ -319,6 +367,17 @@ protected:
 									bool ignoreCase,			// whether to ignore case in the end tag
 									TiXmlEncoding encoding );	// the current encoding
 
+	/*	ReadText for in-situ parsing: the text is decoded over itself, which only ever
+		shrinks it, and returned as [*textBegin, *textEnd). Returns a pointer past the end tag.
+	*/
+	static const char* ReadTextInSitu(	const char* in,
+										char** textBegin,
+										char** textEnd,
+										bool ignoreWhiteSpace,
+										const char* endTag,
+										bool ignoreCase,
+										TiXmlEncoding encoding );
+
 	// If an entity has been found, transform it into a character.
 	static const char* GetEntity( const char* in, char* value, int* length, TiXmlEncoding encoding );
 
@@ -397,6 +456,8 @@ private:
 	TiXmlBase( const TiXmlBase& );				// not implemented.
 	void operator=( const TiXmlBase& base );	// not allowed.
 
+	static void* Allocate( size_t size, TiXmlArena* arena );
+
 	struct Entity
 	{
 		const char*     str;
@@ -1399,7 +1460,23 @@ public:
 	TiXmlDocument( const TiXmlDocument& copy );
 	void operator=( const TiXmlDocument& copy );
 
-	virtual ~TiXmlDocument() {}
+	virtual ~TiXmlDocument();
+
+	/** In-situ mode makes loading much faster for large files. The text is kept by the
+		document and parsed in place: element names, attribute values and text point into
+		it, with entities decoded over the original characters. The nodes come from an
+		arena owned by the document, which is freed in one go when the document is
+		cleared, reloaded or destroyed. Row and column tracking is not available.
+
+		Nodes and strings added or changed after loading are allocated as usual.
+		@verbatim
+		TiXmlDocument doc;
+		doc.SetInSitu( true );
+		doc.LoadFile( "scene.dae" );
+		@endverbatim
+	*/
+	void SetInSitu( bool _inSitu )		{ inSitu = _inSitu; }
+	bool InSitu() const					{ return inSitu; }
 
 	/** Load a file using the current document value.
 		Returns true if successful. Will delete any existing
@@ -1522,6 +1599,13 @@ public:
 	// [internal use]
 	void SetError( int err, const char* errorLocation, TiXmlParsingData* prevData, TiXmlEncoding encoding );
 
+	// [internal use] the arena for new nodes while parsing in-situ, otherwise null.
+	TiXmlArena* ParseArena()	{ return parsingInSitu ? &arena : 0; }
+
+	// [internal use] point str at [begin, end) of the in-situ text. The terminating zero
+	// is written now if the parser is past end, otherwise when the parse is done.
+	void SetInSituString( TIXML_STRING* str, const char* begin, const char* end, const char* p );
+
 	virtual const TiXmlDocument*    ToDocument()    const { return this; } ///< Cast to a more defined type. Will return null not of the requested type.
 	virtual TiXmlDocument*          ToDocument()          { return this; } ///< Cast to a more defined type. Will return null not of the requested type.
 
@@ -1538,6 +1622,9 @@ protected :
 
 private:
 	void CopyTo( TiXmlDocument* target ) const;
+	void InitInSitu();
+	void ClearInSitu();
+	const char* ParseInSitu( char* buf, TiXmlEncoding encoding );
 
 	bool error;
 	int  errorId;
@@ -1545,6 +1632,13 @@ private:
 	int tabsize;
 	TiXmlCursor errorLocation;
 	bool useMicrosoftBOM;		// the UTF-8 BOM were found when read. Note this, and try to write.
+
+	bool inSitu;
+	bool parsingInSitu;
+	TiXmlArena arena;				// in-situ text and nodes
+	char** terminators;				// zeros to write when the in-situ parse is done
+	int numTerminators;
+	int maxTerminators;
 };
 
 
@@ -403,7 +403,8 @@ const char* TiXmlBase::ReadName( const char* p, TIXML_STRING * name, TiXmlEncodi
 	// Oddly, not supported on some comilers,
 	//name->clear();
 	// So use this:
-	*name = "";
+	if ( name )
+		*name = "";
 	assert( p );
 
 	// Names start with letters or underscores.
@@ -427,7 +428,7 @@ const char* TiXmlBase::ReadName( const char* p, TIXML_STRING * name, TiXmlEncodi
 			//(*name) += *p; // expensive
 			++p;
 		}
-		if ( p-start > 0 ) {
+		if ( name && p-start > 0 ) {
 			name->assign( start, p-start );
 		}
 		return p;
@@ -636,6 +637,51 @@ const char* TiXmlBase::ReadText(	const char* p,
 	return p;
 }
 
+const char* TiXmlBase::ReadTextInSitu(	const char* p,
+										char** textBegin,
+										char** textEnd,
+										bool trimWhiteSpace,
+										const char* endTag,
+										bool caseInsensitive,
+										TiXmlEncoding encoding )
+{
+	bool condense = trimWhiteSpace && condenseWhiteSpace;
+	if ( condense )
+		p = SkipWhiteSpace( p, encoding );
+
+	// the write head never passes the read head.
+	char* q = const_cast< char* >( p );
+	*textBegin = q;
+	bool whitespace = false;
+	while (	   p && *p
+			&& !StringEqual( p, endTag, caseInsensitive, encoding ) )
+	{
+		if ( condense && IsWhiteSpace( *p ) )
+		{
+			whitespace = true;
+			++p;
+			continue;
+		}
+
+		// Any run of whitespace becomes a space.
+		if ( whitespace )
+		{
+			*q++ = ' ';
+			whitespace = false;
+		}
+
+		int len;
+		char cArr[4] = { 0, 0, 0, 0 };
+		p = GetChar( p, cArr, &len, encoding );
+		for ( int i = 0; i < len; ++i )
+			*q++ = cArr[i];
+	}
+	*textEnd = q;
+	if ( p && *p ) 
+		p += strlen( endTag );
+	return p;
+}
+
 #ifdef TIXML_USE_STL
 
 void TiXmlDocument::StreamIn( std::istream * in, TIXML_STRING * tag )
@@ -703,6 +749,15 @@ void TiXmlDocument::StreamIn( std::istream * in, TIXML_STRING * tag )
 
 const char* TiXmlDocument::Parse( const char* p, TiXmlParsingData* prevData, TiXmlEncoding encoding )
 {
+	if ( inSitu && !parsingInSitu && p )
+	{
+		// parse a copy that the document keeps.
+		size_t length = strlen( p );
+		char* buf = (char*)arena.Alloc( length + 1 );
+		memcpy( buf, p, length + 1 );
+		return ParseInSitu( buf, encoding );
+	}
+
 	ClearError();
 
 	// Parse away, at the document level. Since a document
@@ -839,6 +894,9 @@ TiXmlNode* TiXmlNode::Identify( const char* p, TiXmlEncoding encoding )
 	// - Everthing else is unknown to tinyxml.
 	//
 
+	TiXmlDocument* document = GetDocument();
+	TiXmlArena* arena = document ? document->ParseArena() : 0;
+
 	const char* xmlHeader = { "<?xml" };
 	const char* commentHeader = { "<!--" };
 	const char* dtdHeader = { "<!" };
@@ -849,21 +907,21 @@ TiXmlNode* TiXmlNode::Identify( const char* p, TiXmlEncoding encoding )
 		#ifdef DEBUG_PARSER
 			TIXML_LOG( "XML parsing Declaration\n" );
 		#endif
-		returnNode = new TiXmlDeclaration();
+		returnNode = new (arena) TiXmlDeclaration();
 	}
 	else if ( StringEqual( p, commentHeader, false, encoding ) )
 	{
 		#ifdef DEBUG_PARSER
 			TIXML_LOG( "XML parsing Comment\n" );
 		#endif
-		returnNode = new TiXmlComment();
+		returnNode = new (arena) TiXmlComment();
 	}
 	else if ( StringEqual( p, cdataHeader, false, encoding ) )
 	{
 		#ifdef DEBUG_PARSER
 			TIXML_LOG( "XML parsing CDATA\n" );
 		#endif
-		TiXmlText* text = new TiXmlText( "" );
+		TiXmlText* text = new (arena) TiXmlText( "" );
 		text->SetCDATA( true );
 		returnNode = text;
 	}
@@ -872,7 +930,7 @@ TiXmlNode* TiXmlNode::Identify( const char* p, TiXmlEncoding encoding )
 		#ifdef DEBUG_PARSER
 			TIXML_LOG( "XML parsing Unknown(1)\n" );
 		#endif
-		returnNode = new TiXmlUnknown();
+		returnNode = new (arena) TiXmlUnknown();
 	}
 	else if (    IsAlpha( *(p+1), encoding )
 			  || *(p+1) == '_' )
@@ -880,14 +938,14 @@ TiXmlNode* TiXmlNode::Identify( const char* p, TiXmlEncoding encoding )
 		#ifdef DEBUG_PARSER
 			TIXML_LOG( "XML parsing Element\n" );
 		#endif
-		returnNode = new TiXmlElement( "" );
+		returnNode = new (arena) TiXmlElement( "" );
 	}
 	else
 	{
 		#ifdef DEBUG_PARSER
 			TIXML_LOG( "XML parsing Unknown(2)\n" );
 		#endif
-		returnNode = new TiXmlUnknown();
+		returnNode = new (arena) TiXmlUnknown();
 	}
 
 	if ( returnNode )
@@ -1067,16 +1125,16 @@ const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 
 	// Read the name.
 	const char* pErr = p;
+	TiXmlArena* arena = document ? document->ParseArena() : 0;
 
-    p = ReadName( p, &value, encoding );
+	p = ReadName( p, arena ? 0 : &value, encoding );
 	if ( !p || !*p )
 	{
 		if ( document )	document->SetError( TIXML_ERROR_FAILED_TO_READ_ELEMENT_NAME, pErr, data, encoding );
 		return 0;
 	}
-
-    TIXML_STRING endTag ("</");
-	endTag += value;
+	if ( arena )
+		document->SetInSituString( &value, pErr, p, p );
 
 	// Check for and read attributes. Also look for an empty
 	// tag or an end tag.
@@ -1119,9 +1177,9 @@ const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 			// </foo > and
 			// </foo> 
 			// are both valid end tags.
-			if ( StringEqual( p, endTag.c_str(), false, encoding ) )
+			if ( p[0] == '<' && p[1] == '/' && strncmp( p + 2, value.c_str(), value.length() ) == 0 )
 			{
-				p += endTag.length();
+				p += 2 + value.length();
 				p = SkipWhiteSpace( p, encoding );
 				if ( p && *p && *p == '>' ) {
 					++p;
@@ -1139,7 +1197,7 @@ const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 		else
 		{
 			// Try to read an attribute:
-			TiXmlAttribute* attrib = new TiXmlAttribute();
+			TiXmlAttribute* attrib = new (arena) TiXmlAttribute();
 			if ( !attrib )
 			{
 				return 0;
@@ -1189,7 +1247,7 @@ const char* TiXmlElement::ReadValue( const char* p, TiXmlParsingData* data, TiXm
 		if ( *p != '<' )
 		{
 			// Take what we have, make a text element.
-			TiXmlText* textNode = new TiXmlText( "" );
+			TiXmlText* textNode = new ( document ? document->ParseArena() : 0 ) TiXmlText( "" );
 
 			if ( !textNode )
 			{
@@ -1288,6 +1346,18 @@ const char* TiXmlUnknown::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 		return 0;
 	}
 	++p;
+	if ( document && document->ParseArena() )
+	{
+		const char* start = p;
+		while ( *p && *p != '>' )
+			++p;
+		const char* end = p;
+		if ( *p )
+			++p;
+		document->SetInSituString( &value, start, end, p );
+		return p;
+	}
+
     value = "";
 
 	while ( p && *p && *p != '>' )
@@ -1373,6 +1443,18 @@ const char* TiXmlComment::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 				  <!-- declarations for <head> & <body> -->
 	*/
 
+	if ( document && document->ParseArena() )
+	{
+		const char* start = p;
+		while (	*p && !StringEqual( p, endTag, false, encoding ) )
+			++p;
+		const char* end = p;
+		if ( *p )
+			p += strlen( endTag );
+		document->SetInSituString( &value, start, end, p );
+		return p;
+	}
+
     value = "";
 	// Keep all the white space.
 	while (	p && *p && !StringEqual( p, endTag, false, encoding ) )
@@ -1399,7 +1481,9 @@ const char* TiXmlAttribute::Parse( const char* p, TiXmlParsingData* data, TiXmlE
 	}
 	// Read the name, the '=' and the value.
 	const char* pErr = p;
-	p = ReadName( p, &name, encoding );
+	TiXmlArena* arena = document ? document->ParseArena() : 0;
+	p = ReadName( p, arena ? 0 : &name, encoding );
+	const char* nameEnd = p;
 	if ( !p || !*p )
 	{
 		if ( document ) document->SetError( TIXML_ERROR_READING_ATTRIBUTES, pErr, data, encoding );
@@ -1413,6 +1497,8 @@ const char* TiXmlAttribute::Parse( const char* p, TiXmlParsingData* data, TiXmlE
 	}
 
 	++p;	// skip '='
+	if ( arena )
+		document->SetInSituString( &name, pErr, nameEnd, p );
 	p = SkipWhiteSpace( p, encoding );
 	if ( !p || !*p )
 	{
@@ -1424,7 +1510,15 @@ const char* TiXmlAttribute::Parse( const char* p, TiXmlParsingData* data, TiXmlE
 	const char SINGLE_QUOTE = '\'';
 	const char DOUBLE_QUOTE = '\"';
 
-	if ( *p == SINGLE_QUOTE )
+	if ( arena && ( *p == SINGLE_QUOTE || *p == DOUBLE_QUOTE ) )
+	{
+		end = *p == SINGLE_QUOTE ? "\'" : "\"";
+		char* textBegin;
+		char* textEnd;
+		p = ReadTextInSitu( p + 1, &textBegin, &textEnd, false, end, false, encoding );
+		document->SetInSituString( &value, textBegin, textEnd, p );
+	}
+	else if ( *p == SINGLE_QUOTE )
 	{
 		++p;
 		end = "\'";		// single quote in string
@@ -1441,6 +1535,7 @@ const char* TiXmlAttribute::Parse( const char* p, TiXmlParsingData* data, TiXmlE
 		// All attribute values should be in single or double quotes.
 		// But this is such a common error that the parser will try
 		// its best, even without them.
+		const char* start = p;
 		value = "";
 		while (    p && *p											// existence
 				&& !IsWhiteSpace( *p )								// whitespace
@@ -1453,9 +1548,12 @@ const char* TiXmlAttribute::Parse( const char* p, TiXmlParsingData* data, TiXmlE
 				if ( document ) document->SetError( TIXML_ERROR_READING_ATTRIBUTES, p, data, encoding );
 				return 0;
 			}
-			value += *p;
+			if ( !arena )
+				value += *p;
 			++p;
 		}
+		if ( arena )
+			document->SetInSituString( &value, start, p, p );
 	}
 	return p;
 }
@@ -1517,6 +1615,18 @@ const char* TiXmlText::Parse( const char* p, TiXmlParsingData* data, TiXmlEncodi
 		}
 		p += strlen( startTag );
 
+		if ( document && document->ParseArena() )
+		{
+			const char* start = p;
+			while ( *p && !StringEqual( p, endTag, false, encoding ) )
+				++p;
+			const char* end = p;
+			if ( *p )
+				p += strlen( endTag );
+			document->SetInSituString( &value, start, end, p );
+			return p;
+		}
+
 		// Keep all the white space, ignore the encoding, etc.
 		while (	   p && *p
 				&& !StringEqual( p, endTag, false, encoding )
@@ -1535,7 +1645,16 @@ const char* TiXmlText::Parse( const char* p, TiXmlParsingData* data, TiXmlEncodi
 		bool ignoreWhite = true;
 
 		const char* end = "<";
-		p = ReadText( p, &value, ignoreWhite, end, false, encoding );
+		if ( document && document->ParseArena() )
+		{
+			char* textBegin;
+			char* textEnd;
+			p = ReadTextInSitu( p, &textBegin, &textEnd, ignoreWhite, end, false, encoding );
+			if ( p )
+				document->SetInSituString( &value, textBegin, textEnd, p - 1 );
+		}
+		else
+			p = ReadText( p, &value, ignoreWhite, end, false, encoding );
 		if ( p )
 			return p-1;	// don't truncate the '<'
 		return 0;